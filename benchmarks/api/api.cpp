@@ -0,0 +1,308 @@
+//
+//  api.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// Latency of the public document API, to compare versions: every operation runs a number of times for each
+// combination of database size (documents already in the database), document size and number of keys per document.
+// Operations: open (timed along with the close before it), save (create and update), getDocumentById, SGDocument construction, SGMutableDocument setBody
+// and set, getBody, getAllDocumentsKey and deleteDocument.
+// Results go to stdout as JSON, one entry per operation and combination, progress goes to stderr.
+//
+// usage: sgcbl_bench [document_sizes] [key_counts] [database_sizes] [iterations]
+// Sizes and counts are comma separated lists, i.e sgcbl_bench 256,4096 4,32 100,10000 1000
+// getAllDocumentsKey and open run at most kMaxSlowIterations times, they cost as much as the database size.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "SGCouchBaseLite.h"
+
+using namespace std;
+using namespace Strata;
+
+typedef chrono::steady_clock Clock;
+
+static const size_t kMaxSlowIterations = 20;
+
+struct Configuration {
+    size_t database_size;
+    size_t document_size;
+    size_t key_count;
+};
+
+struct OperationResult {
+    string operation;
+    Configuration configuration;
+    SGHistogramSnapshot latency_ns;
+};
+
+vector<size_t> parseList(const char *argument, const vector<size_t> &default_values) {
+    if (argument == nullptr) {
+        return default_values;
+    }
+    vector<size_t> values;
+    stringstream stream(argument);
+    string value;
+    while (getline(stream, value, ',')) {
+        if (!value.empty()) {
+            values.push_back(strtoul(value.c_str(), nullptr, 10));
+        }
+    }
+    return values;
+}
+
+// JSON object with key_count string fields, about document_size bytes in total
+string makeBody(size_t document_size, size_t key_count, size_t seed) {
+    key_count = key_count > 0 ? key_count : 1;
+    size_t value_size = document_size / key_count > 16 ? document_size / key_count - 16 : 1;
+    string body = "{";
+    for (size_t key = 0; key < key_count; ++key) {
+        if (key > 0) {
+            body += ",";
+        }
+        body += "\"key_" + to_string(key) + "\":\"";
+        body.append(value_size, (char) ('a' + (seed + key) % 26));
+        body += "\"";
+    }
+    body += "}";
+    return body;
+}
+
+// Runs operation(index) count times, recording the latency of each call. Stops at the first failure.
+template<typename Operation>
+bool measure(SGHistogram &latency_ns, size_t count, Operation operation) {
+    for (size_t index = 0; index < count; ++index) {
+        Clock::time_point started_at = Clock::now();
+        bool succeeded = operation(index);
+        latency_ns.record((uint64_t) chrono::duration_cast<chrono::nanoseconds>(Clock::now() - started_at).count());
+        if (!succeeded) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool seedDatabase(SGDatabase &database, const Configuration &configuration) {
+    for (size_t index = 0; index < configuration.database_size; ++index) {
+        SGMutableDocument document(&database, "seed_" + to_string(index));
+        if (!document.setBody(makeBody(configuration.document_size, configuration.key_count, index)) ||
+            database.save(&document) != SGDatabaseReturnStatus::kNoError) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool runConfiguration(const Configuration &configuration, size_t iterations, const string &suffix,
+                      vector<OperationResult> &results) {
+    string db_name = "sgcbl_bench_" + to_string(configuration.database_size) + "_" +
+                     to_string(configuration.document_size) + "_" + to_string(configuration.key_count) + "_" + suffix;
+    SGDatabase database(db_name);
+    if (database.open() != SGDatabaseReturnStatus::kNoError || !seedDatabase(database, configuration)) {
+        fprintf(stderr, "Can't seed database %s\n", db_name.c_str());
+        return false;
+    }
+
+    size_t slow_iterations = iterations < kMaxSlowIterations ? iterations : kMaxSlowIterations;
+    string body = makeBody(configuration.document_size, configuration.key_count, 0);
+    string value(configuration.document_size / (configuration.key_count > 0 ? configuration.key_count : 1), 'v');
+    // Spread the reads over the seeded documents
+    auto seed_id = [&configuration](size_t index) {
+        size_t database_size = configuration.database_size > 0 ? configuration.database_size : 1;
+        return "seed_" + to_string((index * 7919) % database_size);
+    };
+
+    bool succeeded = true;
+    auto run = [&](const char *operation, const function<bool(SGHistogram &)> &body_function) {
+        if (!succeeded) {
+            return;
+        }
+        fprintf(stderr, "%-20s database %zu, document %zu bytes, %zu keys\n", operation, configuration.database_size,
+                configuration.document_size, configuration.key_count);
+        SGHistogram latency_ns;
+        if (!body_function(latency_ns)) {
+            fprintf(stderr, "%s failed\n", operation);
+            succeeded = false;
+            return;
+        }
+        OperationResult result;
+        result.operation = operation;
+        result.configuration = configuration;
+        result.latency_ns = latency_ns.snapshot();
+        results.push_back(result);
+    };
+
+    run("open", [&](SGHistogram &latency_ns) {
+        return measure(latency_ns, slow_iterations, [&](size_t) {
+            return database.close() == SGDatabaseReturnStatus::kNoError &&
+                   database.open() == SGDatabaseReturnStatus::kNoError;
+        });
+    });
+
+    vector<unique_ptr<SGMutableDocument>> documents;
+    run("save_create", [&](SGHistogram &latency_ns) {
+        for (size_t index = 0; index < iterations; ++index) {
+            documents.emplace_back(new SGMutableDocument(&database, "bench_" + to_string(index)));
+            if (!documents.back()->setBody(body)) {
+                return false;
+            }
+        }
+        return measure(latency_ns, iterations, [&](size_t index) {
+            return database.save(documents[index].get()) == SGDatabaseReturnStatus::kNoError;
+        });
+    });
+
+    run("save_update", [&](SGHistogram &latency_ns) {
+        for (size_t index = 0; index < iterations; ++index) {
+            documents[index]->set("key_0", fleece::slice(value));
+        }
+        return measure(latency_ns, iterations, [&](size_t index) {
+            return database.save(documents[index].get()) == SGDatabaseReturnStatus::kNoError;
+        });
+    });
+
+    run("getDocumentById", [&](SGHistogram &latency_ns) {
+        return measure(latency_ns, iterations, [&](size_t index) {
+            C4Document *c4doc = database.getDocumentById(seed_id(index));
+            bool found = c4doc != nullptr || configuration.database_size == 0;
+            c4doc_free(c4doc);
+            return found;
+        });
+    });
+
+    vector<unique_ptr<SGDocument>> loaded_documents;
+    run("SGDocument", [&](SGHistogram &latency_ns) {
+        return measure(latency_ns, iterations, [&](size_t index) {
+            loaded_documents.emplace_back(new SGDocument(&database, "bench_" + to_string(index)));
+            return loaded_documents.back()->exist();
+        });
+    });
+
+    vector<unique_ptr<SGMutableDocument>> unsaved_documents;
+    run("setBody", [&](SGHistogram &latency_ns) {
+        for (size_t index = 0; index < iterations; ++index) {
+            unsaved_documents.emplace_back(new SGMutableDocument(&database, "unsaved_" + to_string(index)));
+        }
+        return measure(latency_ns, iterations, [&](size_t index) {
+            return unsaved_documents[index]->setBody(body);
+        });
+    });
+
+    run("set", [&](SGHistogram &latency_ns) {
+        return measure(latency_ns, iterations, [&](size_t index) {
+            size_t key_count = configuration.key_count > 0 ? configuration.key_count : 1;
+            unsaved_documents[index]->set("key_" + to_string(index % key_count), fleece::slice(value));
+            return true;
+        });
+    });
+
+    run("getBody", [&](SGHistogram &latency_ns) {
+        size_t body_bytes = 0;
+        bool measured = measure(latency_ns, iterations, [&](size_t index) {
+            body_bytes += loaded_documents[index]->getBody().size();
+            return true;
+        });
+        return measured && body_bytes > 0;
+    });
+
+    run("getAllDocumentsKey", [&](SGHistogram &latency_ns) {
+        return measure(latency_ns, slow_iterations, [&](size_t) {
+            vector<string> document_keys;
+            return database.getAllDocumentsKey(document_keys) &&
+                   document_keys.size() == configuration.database_size + iterations;
+        });
+    });
+
+    run("deleteDocument", [&](SGHistogram &latency_ns) {
+        loaded_documents.clear();
+        return measure(latency_ns, iterations, [&](size_t index) {
+            return database.deleteDocument(documents[index].get()) == SGDatabaseReturnStatus::kNoError;
+        });
+    });
+
+    documents.clear();
+    unsaved_documents.clear();
+    database.close();
+    return succeeded;
+}
+
+void printResults(const vector<OperationResult> &results, size_t iterations) {
+#ifdef SG_LOG_DISABLE_DEBUG
+    const char *debug_logging = "compiled out";
+#else
+    const char *debug_logging = "compiled in";
+#endif
+    printf("{\n  \"benchmark\": \"sgcbl_bench\",\n  \"timestamp\": %lld,\n  \"iterations\": %zu,\n"
+           "  \"debug_logging\": \"%s\",\n  \"results\": [", (long long) time(nullptr), iterations, debug_logging);
+    for (size_t index = 0; index < results.size(); ++index) {
+        const OperationResult &result = results[index];
+        const SGHistogramSnapshot &latency = result.latency_ns;
+        double mean_ns = latency.mean();
+        printf("%s\n    {\"operation\": \"%s\", \"database_size\": %zu, \"document_size\": %zu, \"key_count\": %zu, "
+               "\"count\": %llu, \"mean_ns\": %.0f, \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+               "\"max_ns\": %llu, \"ops_per_second\": %.1f}",
+               index == 0 ? "" : ",", result.operation.c_str(), result.configuration.database_size,
+               result.configuration.document_size, result.configuration.key_count,
+               (unsigned long long) latency.count, mean_ns, (unsigned long long) latency.percentile(50),
+               (unsigned long long) latency.percentile(90), (unsigned long long) latency.percentile(99),
+               (unsigned long long) latency.max, mean_ns > 0 ? 1e9 / mean_ns : 0.0);
+    }
+    printf("\n  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    vector<size_t> document_sizes = parseList(argc > 1 ? argv[1] : nullptr, {256, 4096});
+    vector<size_t> key_counts = parseList(argc > 2 ? argv[2] : nullptr, {4, 32});
+    vector<size_t> database_sizes = parseList(argc > 3 ? argv[3] : nullptr, {100, 10000});
+    size_t iterations = argc > 4 ? strtoul(argv[4], nullptr, 10) : 1000;
+    if (iterations == 0) {
+        fprintf(stderr, "usage: sgcbl_bench [document_sizes] [key_counts] [database_sizes] [iterations]\n");
+        return 1;
+    }
+
+    // Keep the info lines, i.e every deleted document, off the measurements
+    setLogLevel(kC4LogWarning);
+
+    // A unique suffix makes sure every run starts from empty databases
+    string suffix = to_string(chrono::system_clock::now().time_since_epoch().count());
+
+    vector<OperationResult> results;
+    bool succeeded = true;
+    for (size_t database_size : database_sizes) {
+        for (size_t document_size : document_sizes) {
+            for (size_t key_count : key_counts) {
+                Configuration configuration = {database_size, document_size, key_count};
+                succeeded = runConfiguration(configuration, iterations, suffix, results) && succeeded;
+            }
+        }
+    }
+
+    printResults(results, iterations);
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+//
+//  initialsync.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Measures the time a brand new node takes to get a full copy of a remote database.
+// Each run pulls into a fresh local database with a one-shot replicator, first with the default profile and then
+// with the kInitialSync profile, and waits on the completion future.
+//
+// usage: initialsync-benchmark [url] [username password]
+// The url defaults to a local Sync Gateway (or any stand-in for it) at ws://localhost:4984/staging
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SGCouchBaseLite.h"
+
+using namespace std;
+using namespace Strata;
+
+struct RunResult {
+    bool success;
+    double seconds;
+    size_t document_count;
+};
+
+RunResult runInitialSync(const string &url, const string &username, const string &password,
+                         SGReplicatorConfiguration::SyncProfile profile, const string &db_name) {
+    RunResult result = {false, 0.0, 0};
+
+    SGDatabase database(db_name);
+    if (database.open() != SGDatabaseReturnStatus::kNoError) {
+        fprintf(stderr, "Can't open database %s\n", db_name.c_str());
+        return result;
+    }
+
+    SGURLEndpoint url_endpoint(url);
+    if (!url_endpoint.init()) {
+        fprintf(stderr, "Invalid url %s\n", url.c_str());
+        return result;
+    }
+
+    SGReplicatorConfiguration replicator_configuration(&database, &url_endpoint);
+    replicator_configuration.setReplicatorType(SGReplicatorConfiguration::ReplicatorType::kPull);
+    replicator_configuration.setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode::kOneShot);
+    replicator_configuration.setSyncProfile(profile);
+
+    SGBasicAuthenticator basic_authenticator(username, password);
+    if (!username.empty()) {
+        replicator_configuration.setAuthenticator(&basic_authenticator);
+    }
+
+    SGReplicator replicator(&replicator_configuration);
+    shared_future<SGReplicatorCompletion> completion = replicator.getCompletion();
+
+    chrono::steady_clock::time_point started_at = chrono::steady_clock::now();
+    if (replicator.start() != SGReplicatorReturnStatus::kNoError) {
+        fprintf(stderr, "Could not start the replicator\n");
+        return result;
+    }
+
+    SGReplicatorCompletion completed = completion.get();
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - started_at).count();
+    result.success = !completed.is_error;
+    if (completed.is_error) {
+        fprintf(stderr, "Replication failed: %s\n", completed.error_message.c_str());
+    }
+
+    vector<string> document_keys;
+    database.getAllDocumentsKey(document_keys);
+    result.document_count = document_keys.size();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    string url = argc > 1 ? argv[1] : "ws://localhost:4984/staging";
+    string username = argc > 3 ? argv[2] : "";
+    string password = argc > 3 ? argv[3] : "";
+
+    // A unique suffix makes sure every run starts from an empty database
+    string suffix = to_string(chrono::system_clock::now().time_since_epoch().count());
+
+    struct {
+        const char *name;
+        SGReplicatorConfiguration::SyncProfile profile;
+    } profiles[] = {
+        {"default", SGReplicatorConfiguration::SyncProfile::kDefaultProfile},
+        {"initial_sync", SGReplicatorConfiguration::SyncProfile::kInitialSync},
+    };
+
+    printf("%-14s %10s %12s %12s\n", "profile", "docs", "seconds", "docs/s");
+    bool all_succeeded = true;
+    for (const auto &entry : profiles) {
+        RunResult result = runInitialSync(url, username, password, entry.profile,
+                                          string("initialsync_") + entry.name + "_" + suffix);
+        all_succeeded = all_succeeded && result.success;
+        printf("%-14s %10zu %12.3f %12.1f\n", entry.name, result.document_count, result.seconds,
+               result.seconds > 0 ? result.document_count / result.seconds : 0.0);
+    }
+
+    return all_succeeded ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+//
+//  logging.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Cost of the logging on the document load path: every SGDocument load logs its body at debug level.
+// Loads the same documents with the library's log domains at info level, where the debug lines are skipped before
+// their arguments are evaluated, then at debug level, where the body is serialized and formatted for every load.
+// Log messages go to a callback that drops them, so the console doesn't skew the numbers.
+// A last debug run installs SGAsyncLogSink, so the loads only format the lines into its ring buffer and its thread
+// writes them to logging_benchmark.log.
+// Building with -DSG_LOG_DEBUG=OFF compiles the debug lines out, all runs then cost the same.
+//
+// usage: logging-benchmark [document_count] [document_size] [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "SGCouchBaseLite.h"
+
+using namespace std;
+using namespace Strata;
+
+typedef chrono::steady_clock Clock;
+
+static void discardLog(C4LogDomain domain, C4LogLevel level, const char *message, va_list args) {}
+
+bool seedDocuments(SGDatabase &database, size_t document_count, size_t document_size, vector<string> &doc_ids) {
+    for (size_t index = 0; index < document_count; ++index) {
+        string body = "{\"index\":" + to_string(index) + ",\"payload\":\"";
+        if (document_size > body.size() + 2) {
+            body.append(document_size - body.size() - 2, 'x');
+        }
+        body += "\"}";
+
+        SGMutableDocument document(&database, "logging_" + to_string(index));
+        if (!document.setBody(body) || database.save(&document) != SGDatabaseReturnStatus::kNoError) {
+            return false;
+        }
+        doc_ids.push_back(document.getId());
+    }
+    return true;
+}
+
+// Returns the average time of a document load, in nanoseconds
+double measureLoads(SGDatabase &database, const vector<string> &doc_ids, size_t iterations) {
+    size_t found = 0;
+    Clock::time_point started_at = Clock::now();
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        for (const string &doc_id : doc_ids) {
+            SGDocument document(&database, doc_id);
+            found += document.exist() ? 1 : 0;
+        }
+    }
+    chrono::nanoseconds elapsed = Clock::now() - started_at;
+    if (found != iterations * doc_ids.size()) {
+        fprintf(stderr, "Only %zu of %zu loads found their document\n", found, iterations * doc_ids.size());
+    }
+    return (double) elapsed.count() / (iterations * doc_ids.size());
+}
+
+int main(int argc, char **argv) {
+    size_t document_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+    size_t document_size = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4096;
+    size_t iterations = argc > 3 ? strtoul(argv[3], nullptr, 10) : 10;
+
+    SGDatabase database("logging_benchmark");
+    if (database.open() != SGDatabaseReturnStatus::kNoError) {
+        fprintf(stderr, "Can't open the database\n");
+        return 1;
+    }
+    vector<string> doc_ids;
+    if (!seedDocuments(database, document_count, document_size, doc_ids)) {
+        fprintf(stderr, "Can't save the documents\n");
+        return 1;
+    }
+
+    // Preformatted, so the debug run pays for the formatting like a real log callback would
+    c4log_writeToCallback(kC4LogDebug, discardLog, true);
+
+    setLogLevel(kC4LogInfo);
+    measureLoads(database, doc_ids, 1);// Warm up the caches
+    double info_ns = measureLoads(database, doc_ids, iterations);
+
+    setLogLevel(kC4LogDebug);
+    double debug_ns = measureLoads(database, doc_ids, iterations);
+
+    SGAsyncLogSink log_sink("logging_benchmark.log");
+    if (!log_sink.start(kC4LogDebug)) {
+        fprintf(stderr, "Can't start the log sink\n");
+        return 1;
+    }
+    double sink_ns = measureLoads(database, doc_ids, iterations);
+    log_sink.stop();
+    SGAsyncLogSinkStats sink_stats = log_sink.getStats();
+    setLogLevel(kSGDefaultLogLevel);
+
+#ifdef SG_LOG_DISABLE_DEBUG
+    const char *debug_logging = "compiled out";
+#else
+    const char *debug_logging = "compiled in";
+#endif
+    printf("%zu documents of %zu bytes, %zu loads each, debug logging %s\n", document_count, document_size, iterations,
+           debug_logging);
+    printf("%-12s %12s\n", "level", "ns/load");
+    printf("%-12s %12.0f\n", "info", info_ns);
+    printf("%-12s %12.0f\n", "debug", debug_ns);
+    printf("%-12s %12.0f   (%llu lines written, %llu dropped)\n", "debug, sink", sink_ns,
+           (unsigned long long) sink_stats.logged_count, (unsigned long long) sink_stats.dropped_count);
+    printf("Skipping the debug lines saves %.0f ns per load (%.1f%%)\n", debug_ns - info_ns,
+           debug_ns > 0 ? 100.0 * (debug_ns - info_ns) / debug_ns : 0.0);
+
+    database.close();
+    return 0;
+}
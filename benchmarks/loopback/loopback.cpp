@@ -0,0 +1,336 @@
+//
+//  loopback.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Replicates between two local databases in the same process, through SGLoopbackSocketFactory. No network and no
+// Sync Gateway needed, so it can run in CI.
+// For every direction, document size and conflict rate it measures:
+//   - throughput: one-shot replication of the whole data set, in docs/s and wire bytes/s
+//   - compression: WebSocket frame bytes actually sent and the CPU time spent in permessage-deflate
+//   - latency: with a continuous replicator, time from saving a document to the end of its replication
+//
+// usage: loopback-benchmark [document_count] [min_docs_per_second] [compression_level]
+// compression_level is a zlib level from 1 to 9, 0 (the default) disables compression.
+// Exits with 1 if a replication fails, doesn't converge, or is slower than min_docs_per_second.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "SGCouchBaseLite.h"
+#include "SGHistogram.h"
+#include "SGLoopbackSocketFactory.h"
+
+using namespace std;
+using namespace Strata;
+
+typedef chrono::steady_clock Clock;
+
+// Documents saved one by one for the latency measurement, and how long to wait for them.
+static const size_t kLatencyDocumentCount = 200;
+static const chrono::milliseconds kLatencyWriteInterval(5);
+static const chrono::seconds kLatencyTimeout(30);
+
+struct Scenario {
+    const char *direction_name;
+    SGReplicatorConfiguration::ReplicatorType replicator_type;
+    size_t document_size;
+    double conflict_rate;
+};
+
+struct ScenarioResult {
+    bool success;
+    size_t document_count;
+    double seconds;
+    uint64_t wire_bytes;
+    uint64_t frame_bytes;
+    uint64_t compression_time_us;
+    uint64_t error_count;
+    SGHistogramSnapshot latency_us;
+};
+
+string makeBody(size_t document_size, size_t index, const string &origin) {
+    string body = "{\"index\":" + to_string(index) + ",\"origin\":\"" + origin + "\",\"payload\":\"";
+    if (document_size > body.size() + 2) {
+        body.append(document_size - body.size() - 2, 'x');
+    }
+    body += "\"}";
+    return body;
+}
+
+bool saveDocument(SGDatabase &database, const string &doc_id, const string &body) {
+    SGMutableDocument document(&database, doc_id);
+    if (!document.setBody(body)) {
+        return false;
+    }
+    return database.save(&document) == SGDatabaseReturnStatus::kNoError;
+}
+
+bool seedDocuments(SGDatabase &database, const string &prefix, size_t first, size_t count, size_t document_size,
+                   const string &origin) {
+    for (size_t index = first; index < first + count; ++index) {
+        if (!saveDocument(database, prefix + to_string(index), makeBody(document_size, index, origin))) {
+            fprintf(stderr, "Can't save document %s%zu\n", prefix.c_str(), index);
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t countDocuments(SGDatabase &database) {
+    vector<string> document_keys;
+    database.getAllDocumentsKey(document_keys);
+    return document_keys.size();
+}
+
+// Waits for the replicator to stop while draining its document events.
+SGReplicatorCompletion waitForCompletion(SGReplicator &replicator, SGDocumentEventQueue &document_event_queue,
+                                         uint64_t &error_count) {
+    shared_future<SGReplicatorCompletion> completion = replicator.getCompletion();
+    vector<SGDocumentEndedEvent> events;
+    while (completion.wait_for(chrono::milliseconds(0)) != future_status::ready) {
+        document_event_queue.waitForEvents(chrono::milliseconds(5));
+        events.clear();
+        document_event_queue.drain(events);
+        for (const SGDocumentEndedEvent &event : events) {
+            if (event.isError()) {
+                error_count++;
+            }
+        }
+    }
+    return completion.get();
+}
+
+// Saves documents one at a time on the source side(s) and records how long each takes to replicate.
+bool measureLatency(SGDatabase &local_database, SGDatabase &remote_database, SGReplicatorConfiguration &configuration,
+                    SGDocumentEventQueue &document_event_queue, const Scenario &scenario, SGHistogram &latency_us) {
+    configuration.setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode::kContinuous);
+    SGReplicator replicator(&configuration);
+    replicator.setDocumentEventQueue(&document_event_queue);
+    if (replicator.start() != SGReplicatorReturnStatus::kNoError) {
+        fprintf(stderr, "Could not start the continuous replicator\n");
+        return false;
+    }
+
+    bool push = scenario.replicator_type != SGReplicatorConfiguration::ReplicatorType::kPull;
+    bool pull = scenario.replicator_type != SGReplicatorConfiguration::ReplicatorType::kPush;
+
+    map<string, Clock::time_point> saved_at;
+    size_t replicated_count = 0;
+    vector<SGDocumentEndedEvent> events;
+    auto collect = [&]() {
+        events.clear();
+        document_event_queue.drain(events);
+        Clock::time_point now = Clock::now();
+        for (const SGDocumentEndedEvent &event : events) {
+            auto iter = saved_at.find(event.getDocId());
+            if (iter == saved_at.end() || event.isError()) {
+                continue;
+            }
+            latency_us.record(chrono::duration_cast<chrono::microseconds>(now - iter->second).count());
+            saved_at.erase(iter);
+            replicated_count++;
+        }
+    };
+
+    for (size_t index = 0; index < kLatencyDocumentCount; ++index) {
+        // Alternate sides when replicating both ways
+        bool save_locally = push && (!pull || index % 2 == 0);
+        string doc_id = string(save_locally ? "latency_local_" : "latency_remote_") + to_string(index);
+        saved_at[doc_id] = Clock::now();
+        if (!saveDocument(save_locally ? local_database : remote_database, doc_id,
+                          makeBody(scenario.document_size, index, "latency"))) {
+            fprintf(stderr, "Can't save document %s\n", doc_id.c_str());
+            break;
+        }
+        document_event_queue.waitForEvents(kLatencyWriteInterval);
+        collect();
+    }
+
+    Clock::time_point deadline = Clock::now() + kLatencyTimeout;
+    while (replicated_count < kLatencyDocumentCount && Clock::now() < deadline) {
+        document_event_queue.waitForEvents(chrono::milliseconds(10));
+        collect();
+    }
+
+    replicator.stop();
+    replicator.join();
+
+    if (replicated_count < kLatencyDocumentCount) {
+        fprintf(stderr, "Only %zu of %zu documents replicated in time\n", replicated_count, kLatencyDocumentCount);
+        return false;
+    }
+    return true;
+}
+
+ScenarioResult runScenario(const Scenario &scenario, size_t document_count, int compression_level,
+                           const string &suffix) {
+    ScenarioResult result = {false, 0, 0.0, 0, 0, 0, 0, SGHistogramSnapshot()};
+
+    SGDatabase local_database("loopback_local_" + suffix);
+    SGDatabase remote_database("loopback_remote_" + suffix);
+    if (local_database.open() != SGDatabaseReturnStatus::kNoError ||
+        remote_database.open() != SGDatabaseReturnStatus::kNoError) {
+        fprintf(stderr, "Can't open the databases\n");
+        return result;
+    }
+
+    // Sources get the data set, destinations get a conflicting copy of the first conflict_rate * document_count docs.
+    size_t conflict_count = (size_t) (document_count * scenario.conflict_rate);
+    bool seeded = true;
+    switch (scenario.replicator_type) {
+        case SGReplicatorConfiguration::ReplicatorType::kPush:
+            seeded = seedDocuments(local_database, "doc_", 0, document_count, scenario.document_size, "local") &&
+                     seedDocuments(remote_database, "doc_", 0, conflict_count, scenario.document_size, "remote");
+            break;
+        case SGReplicatorConfiguration::ReplicatorType::kPull:
+            seeded = seedDocuments(remote_database, "doc_", 0, document_count, scenario.document_size, "remote") &&
+                     seedDocuments(local_database, "doc_", 0, conflict_count, scenario.document_size, "local");
+            break;
+        case SGReplicatorConfiguration::ReplicatorType::kPushAndPull:
+            seeded = seedDocuments(local_database, "doc_", 0, document_count / 2, scenario.document_size, "local") &&
+                     seedDocuments(remote_database, "doc_", document_count / 2, document_count - document_count / 2,
+                                   scenario.document_size, "remote") &&
+                     seedDocuments(remote_database, "doc_", 0, conflict_count / 2, scenario.document_size, "remote") &&
+                     seedDocuments(local_database, "doc_", document_count / 2, conflict_count - conflict_count / 2,
+                                   scenario.document_size, "local");
+            break;
+    }
+    if (!seeded) {
+        return result;
+    }
+
+    SGLoopbackSocketFactory socket_factory(&remote_database);
+    socket_factory.setCompressionLevel(compression_level);
+    SGURLEndpoint url_endpoint("ws://loopback:4984/remote");
+    url_endpoint.init();
+
+    SGReplicatorConfiguration configuration(&local_database, &url_endpoint);
+    configuration.setReplicatorType(scenario.replicator_type);
+    configuration.setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode::kOneShot);
+    configuration.setConflictResolutionPolicy(SGReplicatorConfiguration::ConflictResolutionPolicy::kResolveToRemoteRevision);
+    configuration.setSocketFactory(&socket_factory);
+
+    SGDocumentEventQueue document_event_queue;
+
+    {
+        SGReplicator replicator(&configuration);
+        replicator.setDocumentEventQueue(&document_event_queue);
+
+        Clock::time_point started_at = Clock::now();
+        if (replicator.start() != SGReplicatorReturnStatus::kNoError) {
+            fprintf(stderr, "Could not start the replicator\n");
+            return result;
+        }
+        SGReplicatorCompletion completion = waitForCompletion(replicator, document_event_queue, result.error_count);
+        result.seconds = chrono::duration<double>(Clock::now() - started_at).count();
+        if (completion.is_error) {
+            fprintf(stderr, "Replication failed: %s\n", completion.error_message.c_str());
+            return result;
+        }
+    }
+    SGSocketFactoryStats socket_stats = socket_factory.getStats();
+    result.wire_bytes = socket_stats.bytes_written;
+    result.frame_bytes = socket_stats.wire_bytes_written;
+    result.compression_time_us = socket_stats.compression_time_us;
+    result.document_count = document_count;
+
+    bool converged = true;
+    if (scenario.replicator_type != SGReplicatorConfiguration::ReplicatorType::kPull) {
+        converged = converged && countDocuments(remote_database) == document_count;
+    }
+    if (scenario.replicator_type != SGReplicatorConfiguration::ReplicatorType::kPush) {
+        converged = converged && countDocuments(local_database) == document_count;
+    }
+    if (!converged) {
+        fprintf(stderr, "Databases didn't converge: local %zu, remote %zu documents\n",
+                countDocuments(local_database), countDocuments(remote_database));
+        return result;
+    }
+
+    SGHistogram latency_us;
+    if (!measureLatency(local_database, remote_database, configuration, document_event_queue, scenario, latency_us)) {
+        return result;
+    }
+    result.latency_us = latency_us.snapshot();
+    result.success = true;
+    return result;
+}
+
+int main(int argc, char **argv) {
+    size_t document_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+    double min_docs_per_second = argc > 2 ? strtod(argv[2], nullptr) : 0.0;
+    int compression_level = argc > 3 ? atoi(argv[3]) : SGWebSocketCodec::kCompressionDisabled;
+
+    // A unique suffix makes sure every run starts from empty databases
+    string suffix = to_string(chrono::system_clock::now().time_since_epoch().count());
+
+    const struct {
+        const char *name;
+        SGReplicatorConfiguration::ReplicatorType replicator_type;
+    } directions[] = {
+        {"push", SGReplicatorConfiguration::ReplicatorType::kPush},
+        {"pull", SGReplicatorConfiguration::ReplicatorType::kPull},
+        {"push_and_pull", SGReplicatorConfiguration::ReplicatorType::kPushAndPull},
+    };
+    const size_t document_sizes[] = {256, 4096, 65536};
+    const double conflict_rates[] = {0.0, 0.1};
+
+    printf("compression level: %d\n", compression_level);
+    printf("%-14s %8s %9s %8s %9s %10s %9s %9s %7s %11s %7s %9s %9s %9s\n", "direction", "doc_size", "conflicts", "docs",
+           "seconds", "docs/s", "MB/s", "wire_MB", "ratio", "compress_ms", "errors", "p50_us", "p90_us", "p99_us");
+
+    bool all_succeeded = true;
+    unsigned run = 0;
+    for (const auto &direction : directions) {
+        for (size_t document_size : document_sizes) {
+            for (double conflict_rate : conflict_rates) {
+                Scenario scenario = {direction.name, direction.replicator_type, document_size, conflict_rate};
+                ScenarioResult result = runScenario(scenario, document_count, compression_level,
+                                                    suffix + "_" + to_string(run++));
+
+                double docs_per_second = result.seconds > 0 ? result.document_count / result.seconds : 0.0;
+                double megabytes_per_second = result.seconds > 0 ? result.wire_bytes / result.seconds / 1e6 : 0.0;
+                double compression_ratio = result.frame_bytes > 0 ? (double) result.wire_bytes / result.frame_bytes : 0.0;
+                printf("%-14s %8zu %8.0f%% %8zu %9.3f %10.1f %9.2f %9.2f %7.2f %11.1f %7llu %9llu %9llu %9llu%s\n",
+                       scenario.direction_name, scenario.document_size, scenario.conflict_rate * 100,
+                       result.document_count, result.seconds, docs_per_second, megabytes_per_second,
+                       result.frame_bytes / 1e6, compression_ratio, result.compression_time_us / 1e3,
+                       (unsigned long long) result.error_count,
+                       (unsigned long long) result.latency_us.percentile(50),
+                       (unsigned long long) result.latency_us.percentile(90),
+                       (unsigned long long) result.latency_us.percentile(99),
+                       result.success ? "" : "  FAILED");
+
+                if (!result.success || docs_per_second < min_docs_per_second) {
+                    all_succeeded = false;
+                }
+            }
+        }
+    }
+
+    return all_succeeded ? 0 : 1;
+}
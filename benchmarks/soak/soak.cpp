@@ -0,0 +1,357 @@
+//
+//  soak.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// Scalability and soak test of the thread safe SGDatabase functions. For each thread count, the threads run a mix of
+// operations on one database for a fixed duration, while a continuous replicator syncs it with a second database
+// through SGLoopbackSocketFactory:
+//   - readers load a random document (SGDocument)
+//   - writers update or recreate a random document (save)
+//   - deleters delete a random document (deleteDocument)
+//   - enumerators list the document ids (getAllDocumentsKey)
+// Each thread picks its next operation at random, weighted by the mix.
+// Prints per thread count the throughput, its scaling against one thread, the latency percentiles of each operation,
+// the database lock contention and the resident memory sampled every second (Linux only). Live LiteCore objects,
+// i.e C4Documents never freed, and open file descriptors are compared before and after each run and at the end.
+//
+// usage: soak-benchmark [seconds_per_run] [thread_counts] [mix] [document_count] [document_size]
+// thread_counts is comma separated, mix is readers:writers:deleters:enumerators weights,
+// i.e soak-benchmark 30 1,2,4,8,16 70:20:5:5 1000 1024
+// Exits with 1 if an operation failed or the replicator stopped with an error.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+#include "SGCouchBaseLite.h"
+
+using namespace std;
+using namespace Strata;
+
+typedef chrono::steady_clock Clock;
+
+static const chrono::seconds kMemorySampleInterval(1);
+
+enum Operation {
+    kRead,
+    kWrite,
+    kDelete,
+    kEnumerate,
+    kOperationCount
+};
+
+const char *operation_names[kOperationCount] = {"read", "write", "delete", "enumerate"};
+
+struct ProcessUsage {
+    uint64_t resident_kb;
+    uint64_t open_file_count;
+};
+
+ProcessUsage readProcessUsage() {
+    ProcessUsage usage = {0, 0};
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            usage.resident_kb = strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    DIR *fd_directory = opendir("/proc/self/fd");
+    if (fd_directory != nullptr) {
+        while (readdir(fd_directory) != nullptr) {
+            usage.open_file_count++;
+        }
+        closedir(fd_directory);
+        // ".", ".." and the directory itself
+        usage.open_file_count = usage.open_file_count > 3 ? usage.open_file_count - 3 : 0;
+    }
+#endif
+    return usage;
+}
+
+struct RunResult {
+    unsigned thread_count;
+    double seconds;
+    uint64_t operation_count[kOperationCount];
+    uint64_t error_count;
+    SGHistogramSnapshot latency_us[kOperationCount];
+    uint64_t lock_acquisitions;
+    uint64_t lock_contentions;
+    vector<uint64_t> resident_kb;// Sampled every kMemorySampleInterval
+    int object_count_delta;
+    int64_t open_file_delta;
+};
+
+vector<unsigned> parseList(const char *argument, char separator, const vector<unsigned> &default_values) {
+    if (argument == nullptr) {
+        return default_values;
+    }
+    vector<unsigned> values;
+    stringstream stream(argument);
+    string value;
+    while (getline(stream, value, separator)) {
+        values.push_back((unsigned) strtoul(value.c_str(), nullptr, 10));
+    }
+    return values;
+}
+
+string makeBody(size_t document_size, uint64_t revision) {
+    string body = "{\"revision\":" + to_string(revision) + ",\"payload\":\"";
+    if (document_size > body.size() + 2) {
+        body.append(document_size - body.size() - 2, 'x');
+    }
+    body += "\"}";
+    return body;
+}
+
+bool runOperation(Operation operation, SGDatabase &database, const string &doc_id, size_t document_size,
+                  uint64_t revision) {
+    switch (operation) {
+        case kRead: {
+            // getDocumentById() doesn't tell errors from deleted documents, every read counts as a success
+            SGDocument document(&database, doc_id);
+            return true;
+        }
+        case kWrite: {
+            SGMutableDocument document(&database, doc_id);
+            return document.setBody(makeBody(document_size, revision)) &&
+                   database.save(&document) == SGDatabaseReturnStatus::kNoError;
+        }
+        case kDelete: {
+            SGMutableDocument document(&database, doc_id);
+            return !document.exist() || database.deleteDocument(&document) == SGDatabaseReturnStatus::kNoError;
+        }
+        case kEnumerate: {
+            vector<string> document_keys;
+            return database.getAllDocumentsKey(document_keys);
+        }
+        default:
+            return false;
+    }
+}
+
+RunResult runThreads(SGDatabase &database, unsigned thread_count, chrono::seconds duration,
+                     const vector<unsigned> &mix, size_t document_count, size_t document_size) {
+    RunResult result = {};
+    result.thread_count = thread_count;
+
+    SGHistogram latency_us[kOperationCount];
+    atomic<uint64_t> operation_count[kOperationCount];
+    for (atomic<uint64_t> &count : operation_count) {
+        count = 0;
+    }
+    atomic<uint64_t> error_count {0};
+    atomic<bool> stop {false};
+
+    unsigned total_weight = 0;
+    for (unsigned weight : mix) {
+        total_weight += weight;
+    }
+
+    int object_count_before = c4_getObjectCount();
+    ProcessUsage usage_before = readProcessUsage();
+    SGLockStats lock_stats_before = database.getLockStats();
+
+    Clock::time_point started_at = Clock::now();
+    vector<thread> threads;
+    for (unsigned thread_index = 0; thread_index < thread_count; ++thread_index) {
+        threads.emplace_back([&, thread_index]() {
+            mt19937 random(thread_index + 1);
+            uniform_int_distribution<unsigned> pick_weight(0, total_weight > 0 ? total_weight - 1 : 0);
+            uniform_int_distribution<size_t> pick_document(0, document_count > 0 ? document_count - 1 : 0);
+            uint64_t revision = 0;
+            while (!stop) {
+                unsigned weight = pick_weight(random);
+                size_t operation = 0;
+                while (operation + 1 < kOperationCount && weight >= mix[operation]) {
+                    weight -= mix[operation];
+                    operation++;
+                }
+                string doc_id = "soak_" + to_string(pick_document(random));
+
+                Clock::time_point operation_started_at = Clock::now();
+                bool succeeded = runOperation((Operation) operation, database, doc_id, document_size, ++revision);
+                latency_us[operation].record(
+                        chrono::duration_cast<chrono::microseconds>(Clock::now() - operation_started_at).count());
+                operation_count[operation]++;
+                if (!succeeded) {
+                    error_count++;
+                }
+            }
+        });
+    }
+
+    while (Clock::now() - started_at < duration) {
+        this_thread::sleep_for(kMemorySampleInterval);
+        result.resident_kb.push_back(readProcessUsage().resident_kb);
+    }
+    stop = true;
+    for (thread &worker : threads) {
+        worker.join();
+    }
+    result.seconds = chrono::duration<double>(Clock::now() - started_at).count();
+
+    for (size_t operation = 0; operation < kOperationCount; ++operation) {
+        result.operation_count[operation] = operation_count[operation];
+        result.latency_us[operation] = latency_us[operation].snapshot();
+    }
+    result.error_count = error_count;
+
+    SGLockStats lock_stats = database.getLockStats();
+    result.lock_acquisitions = lock_stats.acquisition_count - lock_stats_before.acquisition_count;
+    result.lock_contentions = lock_stats.contended_count - lock_stats_before.contended_count;
+    result.object_count_delta = c4_getObjectCount() - object_count_before;
+    result.open_file_delta = (int64_t) readProcessUsage().open_file_count - (int64_t) usage_before.open_file_count;
+    return result;
+}
+
+void printRun(const RunResult &result, double single_thread_throughput) {
+    uint64_t total_count = 0;
+    for (uint64_t count : result.operation_count) {
+        total_count += count;
+    }
+    double throughput = total_count / result.seconds;
+    double scaling = single_thread_throughput > 0 ? throughput / (single_thread_throughput * result.thread_count) : 1.0;
+
+    printf("\n%u threads: %.0f ops/s, scaling efficiency %.0f%%, %llu errors, db lock contended %.1f%%\n",
+           result.thread_count, throughput, 100.0 * scaling, (unsigned long long) result.error_count,
+           result.lock_acquisitions > 0 ? 100.0 * result.lock_contentions / result.lock_acquisitions : 0.0);
+    printf("  %-10s %10s %10s %10s %10s %10s %10s\n", "operation", "count", "ops/s", "p50 us", "p99 us", "p99.9 us",
+           "max us");
+    for (size_t operation = 0; operation < kOperationCount; ++operation) {
+        const SGHistogramSnapshot &latency = result.latency_us[operation];
+        printf("  %-10s %10llu %10.0f %10llu %10llu %10llu %10llu\n", operation_names[operation],
+               (unsigned long long) result.operation_count[operation], result.operation_count[operation] / result.seconds,
+               (unsigned long long) latency.percentile(50), (unsigned long long) latency.percentile(99),
+               (unsigned long long) latency.percentile(99.9), (unsigned long long) latency.max);
+    }
+    printf("  RSS MB:");
+    for (uint64_t resident_kb : result.resident_kb) {
+        printf(" %.1f", resident_kb / 1024.0);
+    }
+    printf("\n  Live LiteCore objects %+d, open files %+lld\n", result.object_count_delta,
+           (long long) result.open_file_delta);
+}
+
+int main(int argc, char **argv) {
+    chrono::seconds duration(argc > 1 ? strtoul(argv[1], nullptr, 10) : 10);
+    vector<unsigned> thread_counts = parseList(argc > 2 ? argv[2] : nullptr, ',', {1, 2, 4, 8});
+    vector<unsigned> mix = parseList(argc > 3 ? argv[3] : nullptr, ':', {70, 20, 5, 5});
+    size_t document_count = argc > 4 ? strtoul(argv[4], nullptr, 10) : 1000;
+    size_t document_size = argc > 5 ? strtoul(argv[5], nullptr, 10) : 1024;
+    if (mix.size() != kOperationCount || duration.count() == 0) {
+        fprintf(stderr, "usage: soak-benchmark [seconds_per_run] [thread_counts] [readers:writers:deleters:enumerators]"
+                        " [document_count] [document_size]\n");
+        return 1;
+    }
+
+    // Keep the info lines, i.e every deleted document, off the measurements
+    setLogLevel(kC4LogWarning);
+
+    int object_count_at_start = c4_getObjectCount();
+    ProcessUsage usage_at_start = readProcessUsage();
+    bool succeeded = true;
+    {
+        // A unique suffix makes sure every run starts from empty databases
+        string suffix = to_string(chrono::system_clock::now().time_since_epoch().count());
+        SGDatabase local_database("soak_local_" + suffix);
+        SGDatabase remote_database("soak_remote_" + suffix);
+        if (local_database.open() != SGDatabaseReturnStatus::kNoError ||
+            remote_database.open() != SGDatabaseReturnStatus::kNoError) {
+            fprintf(stderr, "Can't open the databases\n");
+            return 1;
+        }
+        local_database.setLockProfilingEnabled(true);
+        for (size_t index = 0; index < document_count; ++index) {
+            if (!runOperation(kWrite, local_database, "soak_" + to_string(index), document_size, 0)) {
+                fprintf(stderr, "Can't seed the database\n");
+                return 1;
+            }
+        }
+
+        SGLoopbackSocketFactory socket_factory(&remote_database);
+        SGURLEndpoint url_endpoint("ws://loopback:4984/remote");
+        url_endpoint.init();
+        SGReplicatorConfiguration configuration(&local_database, &url_endpoint);
+        configuration.setReplicatorType(SGReplicatorConfiguration::ReplicatorType::kPushAndPull);
+        configuration.setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode::kContinuous);
+        configuration.setConflictResolutionPolicy(SGReplicatorConfiguration::ConflictResolutionPolicy::kResolveToRemoteRevision);
+        configuration.setSocketFactory(&socket_factory);
+
+        // One replicator for all the runs, it can only be created once
+        SGReplicator replicator(&configuration);
+        shared_future<SGReplicatorCompletion> completion = replicator.getCompletion();
+        if (replicator.start() != SGReplicatorReturnStatus::kNoError) {
+            fprintf(stderr, "Could not start the replicator\n");
+            return 1;
+        }
+
+        printf("%lld s per run, mix %u:%u:%u:%u (read:write:delete:enumerate), %zu documents of %zu bytes\n",
+               (long long) duration.count(), mix[kRead], mix[kWrite], mix[kDelete], mix[kEnumerate], document_count,
+               document_size);
+        double single_thread_throughput = 0.0;
+        for (unsigned thread_count : thread_counts) {
+            RunResult result = runThreads(local_database, thread_count, duration, mix, document_count, document_size);
+            if (thread_count == 1 || single_thread_throughput == 0.0) {
+                uint64_t total_count = 0;
+                for (uint64_t count : result.operation_count) {
+                    total_count += count;
+                }
+                single_thread_throughput = total_count / result.seconds / thread_count;
+            }
+            printRun(result, single_thread_throughput);
+            succeeded = succeeded && result.error_count == 0;
+            fflush(stdout);
+        }
+
+        SGReplicatorStats replicator_stats = replicator.getStats();
+        printf("\nReplicator: %llu documents pushed, %llu pulled, %llu reconnects\n",
+               (unsigned long long) replicator_stats.push.document_count,
+               (unsigned long long) replicator_stats.pull.document_count,
+               (unsigned long long) replicator_stats.reconnect_count);
+
+        replicator.stop();
+        replicator.join();
+        if (completion.wait_for(chrono::seconds(0)) == future_status::ready && completion.get().is_error) {
+            fprintf(stderr, "Replication failed: %s\n", completion.get().error_message.c_str());
+            succeeded = false;
+        }
+    }
+
+    ProcessUsage usage_at_end = readProcessUsage();
+    printf("After closing everything: live LiteCore objects %+d, open files %+lld\n",
+           c4_getObjectCount() - object_count_at_start,
+           (long long) usage_at_end.open_file_count - (long long) usage_at_start.open_file_count);
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+//
+//  transport.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Compares the replicator transports when many replications run at once: LiteCore's built-in civetweb sockets,
+// SGCivetWebSocketFactory and SGEventLoopSocketFactory. Every replicator pushes its own local database to one
+// in-process SGReplicatorListener, so no Sync Gateway is needed.
+// For 1, 10 and 100 concurrent one-shot replications it prints the throughput, the threads the transport added
+// and the peak resident memory growth.
+//
+// usage: transport-benchmark [documents_per_replicator] [document_size]
+// Exits with 1 if a replication fails or doesn't push every document. Linux only, reads /proc/self/status.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SGCouchBaseLite.h"
+
+using namespace std;
+using namespace Strata;
+
+typedef chrono::steady_clock Clock;
+
+static const uint16_t kListenerPort = 4995;
+static const unsigned kReplicatorCounts[] = {1, 10, 100};
+static const chrono::milliseconds kSampleInterval(10);
+
+enum class Transport {
+    kBuiltIn,
+    kCivetWeb,
+    kEventLoop
+};
+
+const char *transport_names[] = {"builtin", "civetweb", "eventloop"};
+
+struct ProcessUsage {
+    uint64_t thread_count;
+    uint64_t resident_kb;
+};
+
+ProcessUsage readProcessUsage() {
+    ProcessUsage usage = {0, 0};
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            usage.thread_count = strtoull(line.c_str() + 8, nullptr, 10);
+        } else if (line.compare(0, 6, "VmRSS:") == 0) {
+            usage.resident_kb = strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return usage;
+}
+
+// Samples thread count and resident memory until stopped, keeping the peaks.
+class UsageMonitor {
+public:
+    UsageMonitor() {
+        thread_ = thread([this]() {
+            while (!stop_) {
+                ProcessUsage usage = readProcessUsage();
+                peak_threads_ = max(peak_threads_.load(), usage.thread_count);
+                peak_resident_kb_ = max(peak_resident_kb_.load(), usage.resident_kb);
+                this_thread::sleep_for(kSampleInterval);
+            }
+        });
+    }
+
+    ProcessUsage stop() {
+        stop_ = true;
+        thread_.join();
+        return {peak_threads_.load(), peak_resident_kb_.load()};
+    }
+
+private:
+    atomic<bool> stop_ {false};
+    atomic<uint64_t> peak_threads_ {0};
+    atomic<uint64_t> peak_resident_kb_ {0};
+    thread thread_;
+};
+
+struct RunResult {
+    bool success;
+    double seconds;
+    uint64_t thread_count;
+    uint64_t resident_kb;
+};
+
+string makeBody(size_t document_size, size_t index) {
+    string body = "{\"index\":" + to_string(index) + ",\"payload\":\"";
+    if (document_size > body.size() + 2) {
+        body.append(document_size - body.size() - 2, 'x');
+    }
+    body += "\"}";
+    return body;
+}
+
+RunResult runReplications(Transport transport, unsigned replicator_count, size_t document_count, size_t document_size,
+                          const string &remote_url, const string &suffix) {
+    RunResult result = {false, 0.0, 0, 0};
+
+    vector<unique_ptr<SGDatabase>> databases;
+    for (unsigned index = 0; index < replicator_count; ++index) {
+        databases.emplace_back(new SGDatabase("transport_local_" + suffix + "_" + to_string(index)));
+        SGDatabase &database = *databases.back();
+        if (database.open() != SGDatabaseReturnStatus::kNoError) {
+            fprintf(stderr, "Can't open the local database\n");
+            return result;
+        }
+        for (size_t doc_index = 0; doc_index < document_count; ++doc_index) {
+            SGMutableDocument document(&database, suffix + "_" + to_string(index) + "_" + to_string(doc_index));
+            if (!document.setBody(makeBody(document_size, doc_index)) ||
+                database.save(&document) != SGDatabaseReturnStatus::kNoError) {
+                fprintf(stderr, "Can't save a document\n");
+                return result;
+            }
+        }
+    }
+
+    ProcessUsage baseline = readProcessUsage();
+    UsageMonitor monitor;
+
+    {
+        unique_ptr<SGSocketFactory> socket_factory;
+        if (transport == Transport::kCivetWeb) {
+            SGCivetWebSocketFactory *civetweb_factory = new SGCivetWebSocketFactory();
+            civetweb_factory->setCompressionLevel(SGWebSocketCodec::kCompressionDisabled);
+            socket_factory.reset(civetweb_factory);
+        } else if (transport == Transport::kEventLoop) {
+            SGEventLoopSocketFactory *event_loop_factory = new SGEventLoopSocketFactory();
+            event_loop_factory->setCompressionLevel(SGWebSocketCodec::kCompressionDisabled);
+            socket_factory.reset(event_loop_factory);
+        }
+
+        SGURLEndpoint url_endpoint(remote_url);
+        url_endpoint.init();
+
+        vector<unique_ptr<SGReplicatorConfiguration>> configurations;
+        vector<unique_ptr<SGReplicator>> replicators;
+        Clock::time_point started_at = Clock::now();
+        for (unique_ptr<SGDatabase> &database : databases) {
+            configurations.emplace_back(new SGReplicatorConfiguration(database.get(), &url_endpoint));
+            configurations.back()->setReplicatorType(SGReplicatorConfiguration::ReplicatorType::kPush);
+            configurations.back()->setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode::kOneShot);
+            configurations.back()->setSocketFactory(socket_factory.get());
+            replicators.emplace_back(new SGReplicator(configurations.back().get()));
+            if (replicators.back()->start() != SGReplicatorReturnStatus::kNoError) {
+                fprintf(stderr, "Could not start a replicator\n");
+                monitor.stop();
+                return result;
+            }
+        }
+
+        bool all_succeeded = true;
+        for (unique_ptr<SGReplicator> &replicator : replicators) {
+            SGReplicatorCompletion completion = replicator->getCompletion().get();
+            if (completion.is_error || completion.progress.document_count < document_count) {
+                fprintf(stderr, "Replication failed: %s\n", completion.error_message.c_str());
+                all_succeeded = false;
+            }
+        }
+        result.seconds = chrono::duration<double>(Clock::now() - started_at).count();
+        result.success = all_succeeded;
+    }
+
+    ProcessUsage peak = monitor.stop();
+    result.thread_count = peak.thread_count > baseline.thread_count ? peak.thread_count - baseline.thread_count : 0;
+    result.resident_kb = peak.resident_kb > baseline.resident_kb ? peak.resident_kb - baseline.resident_kb : 0;
+    return result;
+}
+
+int main(int argc, char **argv) {
+    size_t document_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100;
+    size_t document_size = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1024;
+
+    // A unique suffix makes sure every run starts from empty databases
+    string suffix = to_string(chrono::system_clock::now().time_since_epoch().count());
+
+    SGDatabase remote_database("transport_remote_" + suffix);
+    if (remote_database.open() != SGDatabaseReturnStatus::kNoError) {
+        fprintf(stderr, "Can't open the remote database\n");
+        return 1;
+    }
+    SGReplicatorListener listener(&remote_database, kListenerPort);
+    listener.setMaxConnections(kReplicatorCounts[sizeof(kReplicatorCounts) / sizeof(kReplicatorCounts[0]) - 1]);
+    if (listener.start() != SGReplicatorListenerReturnStatus::kNoError) {
+        fprintf(stderr, "Can't start the listener on port %u\n", kListenerPort);
+        return 1;
+    }
+    string remote_url = "ws://127.0.0.1:" + to_string(kListenerPort) + "/transport_remote_" + suffix;
+
+    printf("%-10s %11s %9s %10s %9s %12s\n", "transport", "replicators", "seconds", "docs/s", "+threads", "+peak_rss_MB");
+
+    bool all_succeeded = true;
+    unsigned run = 0;
+    for (unsigned replicator_count : kReplicatorCounts) {
+        for (Transport transport : {Transport::kBuiltIn, Transport::kCivetWeb, Transport::kEventLoop}) {
+            RunResult result = runReplications(transport, replicator_count, document_count, document_size, remote_url,
+                                               suffix + "_" + to_string(run++));
+            double docs_per_second = result.seconds > 0 ? replicator_count * document_count / result.seconds : 0.0;
+            printf("%-10s %11u %9.3f %10.1f %9llu %12.1f%s\n", transport_names[(int) transport], replicator_count,
+                   result.seconds, docs_per_second, (unsigned long long) result.thread_count,
+                   result.resident_kb / 1024.0, result.success ? "" : "  FAILED");
+            all_succeeded = all_succeeded && result.success;
+        }
+    }
+
+    listener.stop();
+    return all_succeeded ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+//
+//  p2p.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Direct replication between two devices on the same network, without a Sync Gateway.
+//
+// On the first device:   ./p2p-playground listen 4984 username password
+// On the second device:  ./p2p-playground connect ws://<first device ip>:4984/p2p_listener username password
+// Without credentials the listener is only reachable from the same device.
+//
+// Each side saves a document named after its role, then both databases converge.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "SGCouchBaseLite.h"
+
+using namespace std;
+using namespace Strata;
+
+int listen(uint16_t port, const string &username, const string &password) {
+    SGDatabase database("p2p_listener");
+    if (database.open() != SGDatabaseReturnStatus::kNoError) {
+        cout << "Can't open DB!" << endl;
+        return 1;
+    }
+
+    SGMutableDocument document(&database, "from_listener");
+    document.set("message", fleece::slice("hello from the listener"));
+    database.save(&document);
+
+    SGReplicatorListener listener(&database, port);
+    listener.setMaxConnections(4);
+    if (!username.empty()) {
+        // Every interface, peers must authenticate
+        listener.setNetworkInterface("");
+        listener.setCredentials(username, password);
+    }
+    if (listener.start() != SGReplicatorListenerReturnStatus::kNoError) {
+        cout << "Could not start the listener" << endl;
+        return 1;
+    }
+    cout << "Listening on port " << listener.getPort() << ", path " << listener.getPath() << endl;
+
+    while (true) {
+        this_thread::sleep_for(chrono::seconds(5));
+        SGReplicatorListenerStats stats = listener.getStats();
+        cout << "accepted: " << stats.accepted_count << " rejected: " << stats.rejected_count
+             << " unauthorized: " << stats.unauthorized_count
+             << " bytes in: " << stats.bytes_received << " bytes out: " << stats.bytes_sent << endl;
+        for (const SGReplicatorPeerStats &peer : stats.peers) {
+            cout << "  peer " << peer.remote_address << ":" << peer.remote_port
+                 << " docs in: " << peer.documents_received << " docs out: " << peer.documents_sent
+                 << " connected for " << peer.connected_ms / 1000 << "s" << endl;
+        }
+    }
+}
+
+int connect(const string &url, const string &username, const string &password) {
+    SGDatabase database("p2p_peer");
+    if (database.open() != SGDatabaseReturnStatus::kNoError) {
+        cout << "Can't open DB!" << endl;
+        return 1;
+    }
+
+    SGMutableDocument document(&database, "from_peer");
+    document.set("message", fleece::slice("hello from the peer"));
+    database.save(&document);
+
+    SGURLEndpoint url_endpoint(url);
+    if (!url_endpoint.init()) {
+        cout << "Invalid url " << url << endl;
+        return 1;
+    }
+
+    SGReplicatorConfiguration replicator_configuration(&database, &url_endpoint);
+    replicator_configuration.setReplicatorType(SGReplicatorConfiguration::ReplicatorType::kPushAndPull);
+    replicator_configuration.setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode::kOneShot);
+    SGBasicAuthenticator authenticator(username, password);
+    if (!username.empty()) {
+        replicator_configuration.setAuthenticator(&authenticator);
+    }
+
+    SGReplicator replicator(&replicator_configuration);
+    if (replicator.start() != SGReplicatorReturnStatus::kNoError) {
+        cout << "Could not start the replicator" << endl;
+        return 1;
+    }
+
+    SGReplicatorCompletion completion = replicator.getCompletion().get();
+    if (completion.is_error) {
+        cout << "Replication failed: " << completion.error_message << endl;
+        return 1;
+    }
+
+    SGDocument listener_document(&database, "from_listener");
+    cout << "Replicated, listener's document: " << listener_document.getBody() << endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "listen") {
+        return listen(argc > 2 ? (uint16_t) atoi(argv[2]) : SGReplicatorListener::kDefaultPort,
+                      argc > 4 ? argv[3] : "", argc > 4 ? argv[4] : "");
+    }
+    if (mode == "connect" && argc > 2) {
+        return connect(argv[2], argc > 4 ? argv[3] : "", argc > 4 ? argv[4] : "");
+    }
+    cout << "usage: " << argv[0] << " listen [port] [username password] | connect ws://host:port/p2p_listener [username password]" << endl;
+    return 1;
+}
@@ -24,6 +24,7 @@
 
 
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 #include "SGFleece.h"
@@ -44,6 +45,12 @@ void onStatusChanged(SGReplicator::ActivityLevel level, SGReplicatorProgress pro
     }
     qC4Debug(logDomainSGExample, "Replicator Activity Level: %s %f (%llu/%llu)", activity_level_string[(unsigned int)level], progress_percentage, progress.completed, progress.total);
 }
+void onStats(const SGReplicatorStats &stats){
+    qC4Debug(logDomainSGExample, "Replicator stats: push %.1f docs/s %.1f B/s, pull %.1f docs/s %.1f B/s, pending push: %llu, push latency p99: %llu us",
+             stats.push.documents_per_second, stats.push.bytes_per_second,
+             stats.pull.documents_per_second, stats.pull.bytes_per_second,
+             stats.pending_push_count, stats.push_latency_us.percentile(99));
+}
 void onDocumentEnded(bool pushing, std::string doc_id, std::string error_message, bool is_error,bool transient){
     qC4Debug(logDomainSGExample, "onDocumentError: pushing: %d, Doc Id: %s, is error: %d, error message: %s, transient:%d", pushing, doc_id.c_str(), is_error, error_message.c_str(), transient);
 }
@@ -58,7 +65,7 @@ public:
     void onValidate(const std::string& doc_id, const std::string& json_body) {
         qC4Debug(logDomainSGExample, "MiniHCS: New incoming revision: Doc Id: %s, Doc body: %s", doc_id.c_str(), json_body.c_str() );
         SGDocument document(db_, doc_id);
-        qC4Debug(logDomainSGExample, "MiniHCS: existing revision: Doc Id: %s, Doc body: %s", doc_id.c_str(), document.getBody().c_str() );
+        qC4Debug(logDomainSGExample, "MiniHCS: saved revision: Doc Id: %s, Doc body: %s", doc_id.c_str(), document.getBody().c_str() );
     }
 
 private:
@@ -67,8 +74,19 @@ private:
 
 int main()
 {
+    // Log domains default to info. Debug logs every document body, only turn it on while investigating.
+    setLogLevel(kC4LogDebug);
+    setLogLevel("SG.example", kC4LogDebug);
+
+    // Open example_trace.json with chrome://tracing or https://ui.perfetto.dev to see where each operation spent its time
+    SGTrace::setEnabled(true);
+
+    // Declared first, the database records into it until it's destroyed
+    SGMetrics metrics;
+
     // Default db location will be current location
     SGDatabase sgDatabase("db2");
+    sgDatabase.setMetrics(&metrics);
 
     qC4Info(logDomainSGExample, "Database will be stored in: '%s'", sgDatabase.getDBPath().c_str());
 
@@ -100,6 +118,17 @@ int main()
         qC4Info(logDomainSGExample, "Document Key: %s", (*iter).c_str());
     }
 
+    // Queries over 50ms are logged with their plan, see getSlowQueries()
+    sgDatabase.setSlowQueryThreshold(std::chrono::milliseconds(50));
+    {
+        SGQuery query(&sgDatabase, "[\"SELECT\", {\"WHAT\": [[\"._id\"]], \"WHERE\": [\"=\", [\".name\"], [\"$name\"]]}]");
+        qC4Info(logDomainSGExample, "Query plan:\n%s", query.explain().c_str());
+        vector<string> rows;
+        if(query.run(rows, "{\"name\": \"custom_doc\"}")){
+            qC4Info(logDomainSGExample, "%zu documents named custom_doc", rows.size());
+        }
+    }
+
     SGMutableDocument newdoc(&sgDatabase, "custom_doc");
 
     // This is not a valid json.
@@ -172,6 +201,15 @@ int main()
 
     qC4Info(logDomainSGExample, "Document Body after save: %s", usbPDDocument.getBody().c_str());
 
+    // Binary content goes to the blob store, streamed, instead of a base64 string in the body
+    istringstream firmware_image(string(256 * 1024, '\x5a'));
+    SGBlob firmware_blob;
+    if(sgDatabase.saveBlob(firmware_image, "application/octet-stream", firmware_blob) == SGBlobReturnStatus::kNoError){
+        usbPDDocument.setBlob("firmware", firmware_blob);
+        sgDatabase.save(&usbPDDocument);
+        qC4Info(logDomainSGExample, "Firmware blob %s, %llu bytes", firmware_blob.getDigest().c_str(), (unsigned long long) firmware_blob.getLength());
+    }
+
 
     // Bellow Replicator API
     string my_url = "ws://localhost:4984/staging";
@@ -191,22 +229,48 @@ int main()
     SGReplicatorConfiguration replicator_configuration(&sgDatabase, &url_endpoint);
 
     SGBasicAuthenticator basic_authenticator("username","password");
+    // To reconnect with a session cookie rather than the password every time:
+    // SGSessionAuthenticator session_authenticator(&url_endpoint, "username", "password");
+    // Over wss, also give it the CA certificates to verify the gateway with:
+    // session_authenticator.setCACertificateFile("ca.pem");
 
     replicator_configuration.setAuthenticator(&basic_authenticator);
 
     replicator_configuration.setReplicatorType(SGReplicatorConfiguration::ReplicatorType::kPushAndPull);
 
+    // Notice a dead connection within seconds: ping every 30s and give up on connection attempts after 10s
+    replicator_configuration.setHeartbeatInterval(30);
+    replicator_configuration.setConnectTimeout(10);
+
+    // Push alarms ahead of everything else, and sensor readings at most once per second
+    replicator_configuration.setPriorityDocIdPrefixes({"alarm::"});
+    replicator_configuration.setPushDebounce(chrono::milliseconds(1000), {"sensor::"});
+
     vector<string> channels = {"channel1", "random_channel_name"};
     replicator_configuration.setChannels(channels);
 
+    // MiniHCS reads the database for every revision, keep that off the puller thread. Must outlive the replicator.
+    SGRevisionPipeline revision_pipeline;
+
     SGReplicator replicator(&replicator_configuration);
 
 
     replicator.addChangeListener(onStatusChanged);
     replicator.addDocumentEndedListener(onDocumentEnded);
+    replicator.addStatsListener(onStats, chrono::milliseconds(500));
+
+    // Document events can also be drained in batches from the application thread
+    SGDocumentEventQueue document_event_queue(1024, SGDocumentEventQueue::OverflowPolicy::kCoalesce);
+    replicator.setDocumentEventQueue(&document_event_queue);
 
     MiniHCS miniHCS(&sgDatabase);
     replicator.addValidationListener( bind(&MiniHCS::onValidate, &miniHCS, _1, _2) );
+    replicator.setRevisionPipeline(&revision_pipeline);
+
+    replicator.addBlobProgressListener([](const SGBlobProgress &progress){
+        qC4Debug(logDomainSGExample, "Blob %s of %s: %llu/%llu bytes", progress.pushing ? "upload" : "download", progress.doc_id.c_str(),
+                 (unsigned long long) progress.bytes_completed, (unsigned long long) progress.bytes_total);
+    });
 
 
     if(replicator.start() != SGReplicatorReturnStatus::kNoError){
@@ -215,6 +279,17 @@ int main()
     }
     qC4Info(logDomainSGExample, "Started replicator");
 
+    // Wait for a local change to reach the server instead of polling the progress
+    SGPushCompletion push_completion = replicator.waitForPush(usbPDDocument.getId(), chrono::seconds(5)).get();
+    qC4Info(logDomainSGExample, "Document pushed: %d, timed out: %d, pending documents: %zu", push_completion.pushed,
+            push_completion.timed_out, replicator.getPendingDocumentIds().size());
+
+    // Adding a channel doesn't need a restart, only the new channel is fetched, in the background
+    channels.push_back("channel2");
+    replicator.updateChannels(channels, [](const SGChannelUpdate &update){
+        qC4Info(logDomainSGExample, "Channel update done in %llu ms, %llu documents pulled, error: %d", update.duration_ms, update.document_count, update.is_error);
+    });
+
     this_thread::sleep_for(chrono::milliseconds(1000));
 
     channels = {"channel2"};
@@ -230,10 +305,30 @@ int main()
     replicator.stop();
     replicator.join();
 
+    // Runs what is still queued while miniHCS is alive
+    revision_pipeline.stop();
+    SGRevisionPipelineStats pipeline_stats = revision_pipeline.getStats();
+    qC4Info(logDomainSGExample, "Revision pipeline: %llu handled, %llu refused, max queued %llu, handler p99: %llu us", (unsigned long long) pipeline_stats.processed_count,
+            (unsigned long long) pipeline_stats.refused_count, (unsigned long long) pipeline_stats.max_queued_count, (unsigned long long) pipeline_stats.handler_latency_us.percentile(99));
+
+    vector<SGDocumentEndedEvent> document_events;
+    document_event_queue.drain(document_events);
+    for(const SGDocumentEndedEvent &event : document_events){
+        qC4Debug(logDomainSGExample, "Queued document event: pushing: %d, Doc Id: %s, error message: %s", event.isPushing(), event.getDocId().c_str(), event.getErrorMessage().c_str());
+    }
+    SGDocumentEventQueueStats queue_stats = document_event_queue.getStats();
+    qC4Debug(logDomainSGExample, "Document event queue: delivered: %llu, dropped: %llu, coalesced: %llu", queue_stats.delivered_count, queue_stats.dropped_count, queue_stats.coalesced_count);
+
     channels = {"random_channel_name"};
     replicator_configuration.setChannels(channels);
     this_thread::sleep_for(chrono::milliseconds(1000));
 
+    qC4Info(logDomainSGExample, "Database metrics:\n%s", metrics.snapshot().toText().c_str());
+
+    if(!SGTrace::dump("example_trace.json")){
+        qC4Warning(logDomainSGExample, "Could not write example_trace.json");
+    }
+
     qC4Info(logDomainSGExample, "End of demo.");
 
     return 0;
@@ -0,0 +1,182 @@
+//
+//  SGAsyncLogSink.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGASYNCLOGSINK_H
+#define SGASYNCLOGSINK_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <litecore/c4.h>
+
+#include "SGRingBuffer.h"
+
+namespace Strata {
+    typedef struct {
+        uint64_t logged_count;// Messages written to the file.
+        uint64_t dropped_count;// Messages dropped because the ring buffer was full.
+        uint64_t truncated_count;// Messages cut to kMaxMessageLength.
+        uint64_t written_bytes;// Bytes written to the files, across rotations.
+        uint64_t rotation_count;// Number of times the file was rotated.
+    } SGAsyncLogSinkStats;
+
+    /*
+     * Takes over LiteCore's log callback, so the logging thread only formats the message into a ring buffer slot.
+     * A background thread adds the timestamp, domain and level and writes the lines to a size capped file, rotated as
+     * "<path>.1", "<path>.2", ... When the buffer is full messages are dropped and counted rather than waiting, so
+     * logging never stalls a hot path. The file gets a line telling how many messages were dropped.
+     *
+     * Only one sink can be started at a time, it replaces the console output of LiteCore's callback until stop()
+     * puts the previous callback and level back.
+     * Logging is thread safe and never blocks, start() and stop() must not be called concurrently.
+     */
+    class SGAsyncLogSink {
+    public:
+        static constexpr size_t kDefaultCapacity = 4096;
+        static constexpr uint64_t kDefaultMaxFileSize = 10 * 1024 * 1024;
+        static constexpr unsigned kDefaultMaxRotateCount = 5;
+
+        // Longer messages are truncated
+        static constexpr size_t kMaxMessageLength = 480;
+
+        /** SGAsyncLogSink.
+        * @brief Creates the sink, start() installs it.
+        * @param file_path The log file.
+        * @param max_file_size Size above which the file is rotated, in bytes.
+        * @param max_rotate_count Number of rotated files kept, older ones are deleted.
+        * @param capacity Number of messages the ring buffer holds, rounded up to a power of two.
+        */
+        explicit SGAsyncLogSink(const std::string &file_path, uint64_t max_file_size = kDefaultMaxFileSize,
+                                unsigned max_rotate_count = kDefaultMaxRotateCount, size_t capacity = kDefaultCapacity);
+
+        virtual ~SGAsyncLogSink();
+
+        /** SGAsyncLogSink start.
+        * @brief Opens the file and installs the sink as LiteCore's log callback. Returns false if the file can't be
+        * opened or another sink is started.
+        * @param level The lowest level written, see also setLogLevel() for the domains' own levels.
+        */
+        bool start(C4LogLevel level = kC4LogInfo);
+
+        /** SGAsyncLogSink stop.
+        * @brief Restores the log callback and level start() replaced, writes out what is still buffered and closes
+        * the file.
+        */
+        void stop();
+
+        /** SGAsyncLogSink flush.
+        * @brief Blocks until every message buffered so far is written to the file.
+        */
+        void flush();
+
+        SGAsyncLogSinkStats getStats() const;
+
+        /** SGAsyncLogSink enableBinaryLogFiles.
+        * @brief Turns on LiteCore's binary log files, which store messages without formatting them. Read them with
+        * LiteCore's log decoder. Independent of the sink.
+        * @param directory Where the files go.
+        * @param level The lowest level written.
+        * @param max_file_size Size above which a file is rotated, in bytes.
+        * @param max_rotate_count Number of rotated files kept per level.
+        */
+        static bool enableBinaryLogFiles(const std::string &directory, C4LogLevel level,
+                                         uint64_t max_file_size = kDefaultMaxFileSize,
+                                         unsigned max_rotate_count = kDefaultMaxRotateCount);
+
+    private:
+        struct LogRecord {
+            std::chrono::system_clock::time_point time;
+            C4LogDomain domain {nullptr};
+            C4LogLevel level {kC4LogNone};
+            uint16_t length {0};
+            char message[kMaxMessageLength];
+        };
+
+        const std::string file_path_;
+        const uint64_t max_file_size_;
+        const unsigned max_rotate_count_;
+        SGRingBuffer<LogRecord> ring_buffer_;
+
+        // Drain thread. The file is only used by it, or once it's stopped.
+        std::thread thread_;
+        std::mutex drain_lock_;
+        std::condition_variable drain_wakeup_;
+        std::condition_variable drained_;
+        bool stopping_ {false};
+        uint64_t flush_requests_ {0};
+        uint64_t flushed_requests_ {0};
+        std::FILE *file_ {nullptr};
+        uint64_t file_size_ {0};
+        uint64_t reported_dropped_count_ {0};
+
+        // LiteCore's callback before start(), e.g. its console output
+        C4LogCallback previous_callback_ {nullptr};
+        C4LogLevel previous_level_ {kC4LogNone};
+
+        std::atomic<uint64_t> logged_count_ {0};
+        std::atomic<uint64_t> dropped_count_ {0};
+        std::atomic<uint64_t> truncated_count_ {0};
+        std::atomic<uint64_t> written_bytes_ {0};
+        std::atomic<uint64_t> rotation_count_ {0};
+
+        // The started sink and the callbacks still using it, see stop()
+        static std::atomic<SGAsyncLogSink *> active_sink_;
+        static std::atomic<int> active_callbacks_;
+
+        static void logCallback(C4LogDomain domain, C4LogLevel level, const char *fmt, va_list args);
+
+        void push(C4LogDomain domain, C4LogLevel level, const char *fmt, va_list args);
+
+        /** SGAsyncLogSink run.
+        * @brief Drain thread: writes the buffered messages until the sink stops.
+        */
+        void run();
+
+        /** SGAsyncLogSink drain.
+        * @brief Writes every buffered message to the file. Drain thread only.
+        */
+        void drain();
+
+        void write(const LogRecord &record);
+
+        void writeLine(const std::string &line);
+
+        /** SGAsyncLogSink rotate.
+        * @brief Shifts the rotated files by one, deleting the oldest, and starts a new file.
+        */
+        void rotate();
+
+        SGAsyncLogSink(const SGAsyncLogSink &) = delete;
+        SGAsyncLogSink &operator=(const SGAsyncLogSink &) = delete;
+    };
+}
+
+#endif //SGASYNCLOGSINK_H
@@ -25,11 +25,16 @@
 #ifndef SGAUTHENTICATOR_H
 #define SGAUTHENTICATOR_H
 
+#include <chrono>
+#include <mutex>
 #include <string>
 #include <fleece/FleeceImpl.hh>
 #include <fleece/MutableArray.hh>
 #include <fleece/MutableDict.hh>
 
+#include "SGScheduler.h"
+#include "SGURLEndpoint.h"
+
 namespace Strata {
     class SGAuthenticator {
     public:
@@ -38,6 +43,11 @@ namespace Strata {
         virtual ~SGAuthenticator() {}
 
         virtual void authenticate(fleece::Retained<fleece::impl::MutableDict> options) = 0;
+
+        /** SGAuthenticator authenticationFailed.
+        * @brief Called by the SGReplicator when the server rejected the credentials set by authenticate().
+        */
+        virtual void authenticationFailed() {}
     };
 
     class SGBasicAuthenticator : public SGAuthenticator {
@@ -67,6 +77,129 @@ namespace Strata {
         std::string password_;
 
     };
+
+    /*
+     * Authenticates with a Sync Gateway session cookie instead of sending the credentials on every connection, which
+     * spares the gateway a password hash check per reconnection.
+     * Either uses a session created elsewhere (i.e by the application's backend), or creates one with the credentials
+     * through the gateway's _session endpoint and renews it when it gets close to expiring. The session is kept
+     * across restarts and reconnections, and several replicators to the same gateway can share the authenticator.
+     * Sessions are created on the authenticator's own thread, ahead of expiry, so an unreachable gateway never blocks
+     * the replicator. Falls back to basic authentication while there is no session.
+     *
+     * All functions are thread safe.
+     */
+    class SGSessionAuthenticator : public SGAuthenticator {
+    public:
+        /** SGSessionAuthenticator.
+        * @brief Uses an existing session, it can't be renewed.
+        * @param session_id The session ID.
+        * @param expires When the session expires.
+        * @param cookie_name The session cookie name.
+        */
+        SGSessionAuthenticator(const std::string &session_id, const std::chrono::system_clock::time_point &expires,
+                               const std::string &cookie_name = kDefaultCookieName);
+
+        /** SGSessionAuthenticator.
+        * @brief Creates sessions with the credentials when needed.
+        * @param url_endpoint The Sync Gateway database the sessions are for, i.e "ws://localhost:4984/staging".
+        * @param username The user name.
+        * @param password The password.
+        */
+        SGSessionAuthenticator(const SGURLEndpoint *url_endpoint, const std::string &username, const std::string &password);
+
+        virtual ~SGSessionAuthenticator();
+
+        /** SGSessionAuthenticator authenticate.
+        * @brief Sets the session cookie, or the basic authentication credentials if there is no valid session yet.
+        * Doesn't block: a missing or expiring session is requested in the background for the next connection.
+        * @param options The reference to the mutable fleece dicationary.
+        */
+        void authenticate(fleece::Retained<fleece::impl::MutableDict> options) override;
+
+        /** SGSessionAuthenticator authenticationFailed.
+        * @brief Drops the session and requests a new one in the background.
+        */
+        void authenticationFailed() override;
+
+        /** SGSessionAuthenticator renewSession.
+        * @brief Creates a new session now. Returns false if it failed or there are no credentials.
+        * Blocks for up to the gateway's connect and response timeouts.
+        */
+        bool renewSession();
+
+        /** SGSessionAuthenticator setRenewalMargin.
+        * @brief Sessions expiring within this margin are renewed before connecting. Defaults to an hour.
+        * @param renewal_margin The renewal margin.
+        */
+        void setRenewalMargin(const std::chrono::seconds &renewal_margin);
+
+        /** SGSessionAuthenticator setCACertificateFile.
+        * @brief PEM file with the certificates of the authorities trusted to sign the gateway's certificate. Sessions
+        * are only requested over https once it is set, the credentials are never sent to an unverified server.
+        * @param ca_file The CA certificates file path.
+        */
+        void setCACertificateFile(const std::string &ca_file);
+
+        std::string getSessionId() const;
+
+        std::chrono::system_clock::time_point getSessionExpiry() const;
+
+        static constexpr const char *kDefaultCookieName = "SyncGatewaySession";
+
+        // Sync Gateway's default session lifetime, assumed when a response has no expiry.
+        static const unsigned kDefaultSessionTtlSec = 24 * 60 * 60;
+
+        static const unsigned kDefaultRenewalMarginSec = 60 * 60;
+
+        // How long to wait for the gateway's response. Connecting times out after 10 seconds in civetweb.
+        static const int kResponseTimeoutMs = 10 * 1000;
+
+        // Delay before trying again after a failed session request.
+        static const unsigned kRetryIntervalSec = 60;
+
+    private:
+        mutable std::mutex session_lock_;
+        // Serializes the session requests, held without session_lock_ during the request
+        std::mutex request_lock_;
+
+        std::string session_id_;
+        std::string cookie_name_;
+        std::chrono::system_clock::time_point expires_;
+        std::chrono::seconds renewal_margin_ {kDefaultRenewalMarginSec};
+
+        // Only set when the authenticator creates its own sessions
+        std::string scheme_;
+        std::string host_;
+        uint16_t port_ {0};
+        std::string database_;
+        std::string username_;
+        std::string password_;
+        std::string ca_file_;
+
+        // Runs the session requests, see _scheduleRequest(). Guarded by session_lock_.
+        SGScheduler::TaskId request_task_ {0};
+        std::chrono::steady_clock::time_point request_due_;
+
+        /** SGSessionAuthenticator requestSession.
+        * @brief POSTs to the _session endpoint and stores the new session. Must be called without session_lock_.
+        */
+        bool requestSession();
+
+        /** SGSessionAuthenticator runScheduledRequest.
+        * @brief Scheduler task: requests a session, then schedules its renewal, or a retry if it failed.
+        */
+        void runScheduledRequest();
+
+        /** SGSessionAuthenticator scheduleRequest.
+        * @brief Replaces the pending session request. Called internally inside locked functions.
+        * @param delay Time to wait before the request.
+        */
+        void _scheduleRequest(const std::chrono::milliseconds &delay);
+
+        // Declared last: stopped, and its tasks done, before the members they use are destroyed
+        SGScheduler scheduler_;
+    };
 }
 
 
@@ -0,0 +1,121 @@
+//
+//  SGBandwidthLimiter.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGBANDWIDTHLIMITER_H
+#define SGBANDWIDTHLIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace Strata {
+    /*
+     * Upload and download rate limits, as token buckets, for the SG socket factories.
+     * A replicator gets its own limiter from SGReplicatorConfiguration::setBandwidthLimit(), and every connection is
+     * also subject to the process wide limiter, see process(). Limits can be changed while connections are open.
+     * Bytes are counted on the wire, after compression.
+     *
+     * All functions are thread safe.
+     */
+    class SGBandwidthLimiter {
+    public:
+        enum class Direction {
+            kUpload = 0,
+            kDownload
+        };
+
+        /** SGBandwidthLimiter create.
+        * @brief Returns a new, unlimited, limiter that find() can look up.
+        */
+        static std::shared_ptr<SGBandwidthLimiter> create();
+
+        /** SGBandwidthLimiter find.
+        * @brief Returns the limiter with this ID, nullptr if it doesn't exist anymore.
+        * @param id The limiter ID, see getId().
+        */
+        static std::shared_ptr<SGBandwidthLimiter> find(uint64_t id);
+
+        /** SGBandwidthLimiter process.
+        * @brief The limiter shared by every connection of the process. Unlimited until setLimits() is called.
+        */
+        static SGBandwidthLimiter &process();
+
+        virtual ~SGBandwidthLimiter();
+
+        uint64_t getId() const;
+
+        /** SGBandwidthLimiter setLimits.
+        * @brief Sets the rates, 0 means unlimited. Takes effect right away.
+        * @param upload_bytes_per_second The upload rate limit.
+        * @param download_bytes_per_second The download rate limit.
+        * @param burst_bytes How many bytes can go at once after an idle period. 0 uses one second worth of traffic.
+        */
+        void setLimits(uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second, uint64_t burst_bytes = 0);
+
+        uint64_t getLimit(Direction direction) const;
+
+        /** SGBandwidthLimiter reserve.
+        * @brief Takes byte_count bytes from the bucket and returns how long to wait before moving more data in this
+        * direction. Zero when there is no limit or enough tokens were left.
+        * @param direction Upload or download.
+        * @param byte_count Number of bytes moved.
+        */
+        std::chrono::nanoseconds reserve(Direction direction, size_t byte_count);
+
+        /** SGBandwidthLimiter addThrottleTime.
+        * @brief Called by the socket factories with the time a connection was held back.
+        */
+        void addThrottleTime(Direction direction, const std::chrono::nanoseconds &throttle_time);
+
+        /** SGBandwidthLimiter getThrottleTimeMs.
+        * @brief Total time connections were held back by the limits in this direction, in milliseconds.
+        */
+        uint64_t getThrottleTimeMs(Direction direction) const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Bucket {
+            uint64_t rate {0};// Bytes per second, 0 for unlimited
+            double capacity {0};
+            double tokens {0};// Negative while in debt
+            Clock::time_point refilled_at;
+            std::atomic<uint64_t> throttle_time_ns {0};
+        };
+
+        explicit SGBandwidthLimiter(uint64_t id);
+
+        uint64_t id_;
+
+        mutable std::mutex limiter_lock_;
+        Bucket buckets_[2];
+
+        SGBandwidthLimiter(const SGBandwidthLimiter &) = delete;
+        SGBandwidthLimiter &operator=(const SGBandwidthLimiter &) = delete;
+    };
+}
+
+#endif //SGBANDWIDTHLIMITER_H
@@ -0,0 +1,187 @@
+//
+//  SGBlob.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGBLOB_H
+#define SGBLOB_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include <litecore/c4.h>
+#include <litecore/c4BlobStore.h>
+#include <fleece/FleeceImpl.hh>
+#include <fleece/MutableDict.hh>
+
+namespace Strata {
+    class SGDatabase;
+
+    enum class SGBlobReturnStatus {
+        kNoError,
+        kOpenDBError,
+        kOpenStreamError,
+        kWriteError,
+        kReadError,
+        kInstallError,
+        kNotFoundError, // The content isn't in the local blob store, i.e not pulled yet.
+        kInvalidArgumentError
+    };
+
+    std::ostream& operator << (std::ostream& os, const SGBlobReturnStatus& return_status);
+
+    /*
+     * Binary content kept in the database's blob store instead of the document body. The document only holds a small
+     * dictionary with the digest, length and content type, see SGMutableDocument::setBlob(). The replicator transfers
+     * the content on its own and only when the digest changed, editing the rest of the document doesn't send it again.
+     * The store is content addressed: the same content saved twice is stored once.
+     */
+    class SGBlob {
+    public:
+        SGBlob();
+
+        SGBlob(const std::string &digest, uint64_t length, const std::string &content_type);
+
+        virtual ~SGBlob();
+
+        /** SGBlob fromDict.
+        * @brief Reads a blob dictionary of a document. Returns false if the dictionary isn't a blob.
+        * @param dict The dictionary to read.
+        * @param blob The blob to set.
+        */
+        static bool fromDict(const fleece::impl::Dict *dict, SGBlob &blob);
+
+        /** SGBlob containsBlobs.
+        * @brief Returns true if the value, or any value nested in it, is a blob dictionary.
+        * @param value The value to look into.
+        */
+        static bool containsBlobs(const fleece::impl::Value *value);
+
+        /** SGBlob toDict.
+        * @brief Returns the dictionary to store in a document.
+        */
+        fleece::Retained<fleece::impl::MutableDict> toDict() const;
+
+        // Content digest, i.e "sha1-VVVVoqTjDMTrNoaBLkFAyOsdsIs="
+        const std::string &getDigest() const;
+
+        uint64_t getLength() const;
+
+        const std::string &getContentType() const;
+
+        bool isValid() const;
+
+        // Blob dictionary properties, the same Couchbase Lite uses
+        static constexpr const char *kTypeProperty = "@type";
+        static constexpr const char *kBlobType = "blob";
+        static constexpr const char *kDigestProperty = "digest";
+        static constexpr const char *kLengthProperty = "length";
+        static constexpr const char *kContentTypeProperty = "content_type";
+
+    private:
+        std::string digest_;
+        uint64_t length_ {0};
+        std::string content_type_;
+    };
+
+    /*
+     * Streams content into the blob store, in chunks, so the content is never entirely in memory.
+     * Content written but not installed is discarded. SGDatabase::close() waits for the writer to be destroyed.
+     * Not thread safe.
+     */
+    class SGBlobWriter {
+    public:
+        SGBlobWriter(SGDatabase *database);
+
+        virtual ~SGBlobWriter();
+
+        /** SGBlobWriter write.
+        * @brief Appends a chunk of content.
+        * @param data The chunk.
+        * @param size The chunk size in bytes.
+        */
+        SGBlobReturnStatus write(const void *data, size_t size);
+
+        /** SGBlobWriter install.
+        * @brief Adds the content written to the blob store, unless it's already there, and returns its blob.
+        * Nothing can be written afterwards.
+        * @param content_type The MIME type of the content, i.e "application/octet-stream".
+        * @param blob The blob to set.
+        */
+        SGBlobReturnStatus install(const std::string &content_type, SGBlob &blob);
+
+        uint64_t getBytesWritten() const;
+
+        /** SGBlobWriter wasDeduplicated.
+        * @brief True if install() found the same content already in the store.
+        */
+        bool wasDeduplicated() const;
+
+    private:
+        // Kept open until the writer is destroyed, nullptr if it wasn't open
+        SGDatabase *database_ {nullptr};
+        C4BlobStore *blob_store_ {nullptr};
+        C4WriteStream *write_stream_ {nullptr};
+        C4Error c4error_ {};
+        uint64_t bytes_written_ {0};
+        bool deduplicated_ {false};
+
+        SGBlobWriter(const SGBlobWriter &) = delete;
+        SGBlobWriter &operator=(const SGBlobWriter &) = delete;
+    };
+
+    /*
+     * Streams content out of the blob store, in chunks. SGDatabase::close() waits for the reader to be destroyed.
+     * Not thread safe.
+     */
+    class SGBlobReader {
+    public:
+        SGBlobReader(SGDatabase *database, const SGBlob &blob);
+
+        virtual ~SGBlobReader();
+
+        /** SGBlobReader getStatus.
+        * @brief kNoError once the content is open, kNotFoundError if it isn't in the store.
+        */
+        SGBlobReturnStatus getStatus() const;
+
+        /** SGBlobReader read.
+        * @brief Reads the next chunk of content. Returns the number of bytes read, 0 at the end or on error.
+        * @param buffer Where to copy the chunk.
+        * @param size The buffer size in bytes.
+        */
+        size_t read(void *buffer, size_t size);
+
+    private:
+        // Kept open until the reader is destroyed, nullptr if it wasn't open
+        SGDatabase *database_ {nullptr};
+        C4ReadStream *read_stream_ {nullptr};
+        C4Error c4error_ {};
+        SGBlobReturnStatus status_ {SGBlobReturnStatus::kNoError};
+
+        SGBlobReader(const SGBlobReader &) = delete;
+        SGBlobReader &operator=(const SGBlobReader &) = delete;
+    };
+}
+
+#endif //SGBLOB_H
@@ -0,0 +1,175 @@
+//
+//  SGCivetWebSocketFactory.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGCIVETWEBSOCKETFACTORY_H
+#define SGCIVETWEBSOCKETFACTORY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <fleece/FleeceImpl.hh>
+
+#include "SGScheduler.h"
+#include "SGSocketFactory.h"
+#include "SGWebSocketCodec.h"
+
+struct mg_connection;
+
+namespace Strata {
+    /*
+     * Replicator transport over civetweb client connections, with our own WebSocket framing so it can negotiate
+     * permessage-deflate. Worth it on metered links with JSON heavy documents: BLIP only compresses some message
+     * bodies, this compresses every frame with a shared window.
+     * Falls back to uncompressed frames when the server doesn't accept the extension.
+     *
+     * Each connection uses one reader thread. Stop every replicator using the factory before destroying it.
+     * When the idle timeout closes a dead connection, LiteCore is told right away but the reader thread only exits
+     * once the OS gives up on the connection.
+     */
+    class SGCivetWebSocketFactory : public SGSocketFactory {
+    public:
+        SGCivetWebSocketFactory();
+
+        virtual ~SGCivetWebSocketFactory();
+
+        /** SGCivetWebSocketFactory setCompressionLevel.
+        * @brief zlib level used when the server accepts permessage-deflate, from 1 (fastest) to 9 (smallest).
+        * SGWebSocketCodec::kCompressionDisabled doesn't offer compression. Applies to new connections.
+        * @param compression_level The compression level.
+        */
+        void setCompressionLevel(int compression_level);
+
+        int getCompressionLevel() const;
+
+    protected:
+        void open(C4Socket *socket, const C4Address *address, C4Slice options) override;
+
+        void write(C4Socket *socket, C4SliceResult data) override;
+
+        void completedReceive(C4Socket *socket, size_t byte_count) override;
+
+        void requestClose(C4Socket *socket, int status, C4String message) override;
+
+    private:
+        struct Connection {
+            C4Socket *socket {nullptr};
+            std::string scheme;
+            std::string host;
+            uint16_t port {0};
+            std::string path;
+            fleece::alloc_slice options;
+            int compression_level {SGWebSocketCodec::kCompressionDisabled};
+
+            // Bandwidth limits, see SGBandwidthLimiter
+            std::shared_ptr<SGBandwidthLimiter> bandwidth_limiter;
+            std::chrono::steady_clock::time_point receive_throttled_until;// Connection thread only
+
+            // Guards the civetweb connection and the encoding side of the codec
+            std::mutex write_lock;
+            mg_connection *connection {nullptr};
+            bool close_sent {false};
+            SGWebSocketCodec codec {SGWebSocketCodec::Role::kClient};
+            std::chrono::steady_clock::time_point send_throttled_until;
+
+            std::mutex lock;
+            std::condition_variable receive_window;
+            size_t unread_bytes {0};
+            bool socket_closed {false};
+
+            // Dead connection detection, see SGReplicatorConfiguration. Guarded by lock.
+            std::chrono::seconds heartbeat_interval {0};
+            std::chrono::seconds idle_timeout {0};
+            std::chrono::steady_clock::time_point last_received;
+            std::chrono::steady_clock::time_point next_heartbeat;
+        };
+
+        struct ConnectionHandle : public SGSocketHandle {
+            ConnectionHandle(SGSocketFactory *socket_factory, const std::shared_ptr<Connection> &socket_connection)
+                    : SGSocketHandle(socket_factory), connection(socket_connection) {}
+
+            std::shared_ptr<Connection> connection;
+        };
+
+        // Unread bytes handed to LiteCore above which we stop reading from the server.
+        static const size_t kMaxUnreadBytes = 1024 * 1024;
+
+        static const size_t kReadBufferSize = 64 * 1024;
+
+        // Largest HTTP response header accepted during the handshake.
+        static const size_t kMaxResponseHeaderSize = 16 * 1024;
+
+        // How long the destructor waits for the connection threads.
+        static const unsigned kStopTimeoutMs = 5000;
+
+        // How often heartbeats and idle timeouts are checked.
+        static const unsigned kTimerResolutionMs = 250;
+
+        std::atomic<int> compression_level_ {SGWebSocketCodec::kDefaultCompressionLevel};
+
+        std::mutex connections_lock_;
+        std::condition_variable connections_finished_;
+        unsigned running_connections_ {0};
+
+        // Sends the heartbeats, enforces the idle timeouts and reports throttled writes, the connection threads are
+        // blocked reading.
+        SGScheduler scheduler_;
+
+        /** SGCivetWebSocketFactory run.
+        * @brief Connection thread: connects, runs the handshake, then reads until the connection closes.
+        */
+        void run(std::shared_ptr<Connection> connection);
+
+        /** SGCivetWebSocketFactory handshake.
+        * @brief Sends the upgrade request and reads the response. Bytes received after the response headers are
+        * returned in leftover.
+        */
+        bool handshake(const std::shared_ptr<Connection> &connection, std::string &leftover);
+
+        /** SGCivetWebSocketFactory onMessage.
+        * @brief Handles a decoded message or control frame. Returns false once the close handshake is over.
+        */
+        bool onMessage(const std::shared_ptr<Connection> &connection, int opcode, const std::string &payload);
+
+        /** SGCivetWebSocketFactory sendFrame.
+        * @brief Encodes and sends a frame. Returns false if it couldn't be sent.
+        * @param throttle_delay If not nullptr, set to how long the upload limits want the connection to wait.
+        */
+        bool sendFrame(const std::shared_ptr<Connection> &connection, int opcode, const void *data, size_t size,
+                       std::chrono::nanoseconds *throttle_delay = nullptr);
+
+        void closeSocket(const std::shared_ptr<Connection> &connection, const C4Error &error);
+
+        /** SGCivetWebSocketFactory checkTimers.
+        * @brief Sends a due heartbeat, or closes the socket if nothing was received for the idle timeout.
+        */
+        void checkTimers(const std::shared_ptr<Connection> &connection);
+    };
+}
+
+#endif //SGCIVETWEBSOCKETFACTORY_H
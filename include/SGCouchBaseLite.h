@@ -28,9 +28,23 @@
 #include "SGDatabase.h"
 #include "SGDocument.h"
 #include "SGMutableDocument.h"
+#include "SGBlob.h"
 #include "SGReplicator.h"
 #include "SGReplicatorConfiguration.h"
 #include "SGURLEndpoint.h"
 #include "SGAuthenticator.h"
+#include "SGLogging.h"
+#include "SGAsyncLogSink.h"
+#include "SGTrace.h"
+#include "SGMetrics.h"
+#include "SGProfiledMutex.h"
+#include "SGMemoryTracker.h"
+#include "SGQuery.h"
+#include "SGLoopbackSocketFactory.h"
+#include "SGReplicatorListener.h"
+#include "SGCivetWebSocketFactory.h"
+#ifdef __linux__
+#include "SGEventLoopSocketFactory.h"
+#endif
 
 #endif //SGCOUCHBASELITE_H
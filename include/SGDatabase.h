@@ -25,16 +25,31 @@
 #ifndef SGDATABASE_H
 #define SGDATABASE_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
 #include <string>
 #include <thread>
+#include <vector>
 #include <mutex>
 #include <litecore/c4.h>
 #include <fleece/FleeceImpl.hh>
+#include "SGBlob.h"
 #include "SGDocument.h"
+#include "SGMemoryTracker.h"
+#include "SGMetrics.h"
+#include "SGProfiledMutex.h"
+#include "SGQuery.h"
 
 namespace Strata {
     // Forward declaration is required due to the circular include for SGDatabase<->SGDocument.
     class SGDocument;
+    class SGQuery;
 
     enum class SGDatabaseReturnStatus {
         kNoError,
@@ -54,9 +69,17 @@ namespace Strata {
 
     std::ostream& operator << (std::ostream& os, const SGDatabaseReturnStatus& return_status);
 
+    struct SGMemoryLimitStats {
+        uint64_t pressure_count {0};            // Times the usage went over the limit
+        uint64_t throttled_save_count {0};      // save() calls that waited for the usage to drop
+        uint64_t throttle_time_us {0};          // Time save() calls spent waiting
+        uint64_t throttle_timeout_count {0};    // Waits that ended before the usage dropped
+    };
+
     /*
      * Thread safe is guaranteed on these functions:
-     * getC4db(), open(), isOpen(), close(), save(), getDocumentById(), deleteDocument(), getAllDocumentsKey()
+     * getC4db(), open(), isOpen(), close(), save(), getDocumentById(), deleteDocument(), getAllDocumentsKey(),
+     * saveBlob(), readBlob(), hasBlob()
      */
     class SGDatabase {
 
@@ -82,6 +105,66 @@ namespace Strata {
         //  Thread Safe.
         C4Database *getC4db();
 
+        /** SGDatabase setMetrics.
+        * @brief Records into the registry, labeled with the database name: the latency of open(), close(), save(),
+        * getDocumentById(), deleteDocument() and getAllDocumentsKey() per returned status, the document body sizes,
+        * the transaction commit time and how long callers wait for the database lock.
+        * Call after setDBName(). Thread Safe.
+        * @param metrics The registry, must outlive the database. nullptr stops recording.
+        */
+        void setMetrics(SGMetrics *metrics);
+
+        /** SGDatabase setLockProfilingEnabled.
+        * @brief Profiles the database lock every public function serializes on, see getLockStats(). Thread Safe.
+        * @param enabled Whether acquisitions are profiled.
+        */
+        void setLockProfilingEnabled(bool enabled);
+
+        /** SGDatabase getLockStats.
+        * @brief Acquisitions, contention, wait and hold times of the database lock, and the function that held it the
+        * longest, since profiling was enabled. Thread Safe.
+        */
+        SGLockStats getLockStats() const;
+
+        /** SGDatabase getMemoryUsage.
+        * @brief Live count and bytes, per SGMemoryCategory, of the documents constructed with this database and what
+        * they hold. Thread Safe.
+        */
+        SGMemoryUsage getMemoryUsage() const;
+
+        /** SGDatabase setMemoryLimit.
+        * @brief Soft limit on getMemoryUsage(). When the usage goes over it, the memory pressure listener is called so
+        * the application can drop documents it keeps around, and save() waits up to max_save_delay for the usage to
+        * drop back, slowing writers down rather than failing them. Thread Safe.
+        * @param soft_limit_bytes The limit, 0 disables it.
+        * @param max_save_delay How long a save() waits at most.
+        */
+        void setMemoryLimit(uint64_t soft_limit_bytes,
+                            std::chrono::milliseconds max_save_delay = std::chrono::milliseconds(kDefaultMaxSaveDelayMs));
+
+        /** SGDatabase setMemoryPressureListener.
+        * @brief Called once each time the usage goes over the memory limit, from the thread calling save() or
+        * getDocumentById(), without the database lock. Thread Safe.
+        * @param callback Receives the usage, nullptr removes the listener.
+        */
+        void setMemoryPressureListener(const std::function<void(const SGMemoryUsage &usage)> &callback);
+
+        SGMemoryLimitStats getMemoryLimitStats() const;
+
+        /** SGDatabase setSlowQueryThreshold.
+        * @brief Logs the queries, SGQuery runs and getAllDocumentsKey(), running longer than the threshold, with their
+        * plan, see getSlowQueries(). Thread Safe.
+        * @param threshold The run time from which a query is slow, 0 disables the log.
+        */
+        void setSlowQueryThreshold(std::chrono::milliseconds threshold);
+
+        /** SGDatabase getSlowQueries.
+        * @brief The last slow queries, oldest first. Thread Safe.
+        */
+        std::vector<SGSlowQuery> getSlowQueries() const;
+
+        void clearSlowQueries();
+
         /** SGDatabase Open.
         * @brief Open or create a local embedded database if name does not exist. Thread Safe.
         * @param db_name The couchebase lite embeeded database name.
@@ -94,7 +177,8 @@ namespace Strata {
         bool isOpen();
 
         /** SGDatabase Close.
-        * @brief Close the local database if it's open. Thread Safe.
+        * @brief Close the local database if it's open. Waits for the SGBlobWriter and SGBlobReader using it, and so
+        * for saveBlob() and readBlob(), to be done. Thread Safe.
         */
         SGDatabaseReturnStatus close();
 
@@ -116,10 +200,54 @@ namespace Strata {
         */
         SGDatabaseReturnStatus deleteDocument(SGDocument *doc);
 
+        /** SGDatabase getDocumentCount.
+        * @brief Number of documents, deleted ones excluded. Thread Safe.
+        */
+        uint64_t getDocumentCount();
+
         /** SGDatabase getAllDocumentsKey.
         * @brief Runs local database query to get list of document keys. True on success, False otherwise. Thread Safe.
         */
         bool getAllDocumentsKey(std::vector<std::string>& document_keys);
+
+        /** SGDatabase saveBlob.
+        * @brief Streams the input into the blob store, a chunk at a time, and returns its blob to set in a document
+        * with SGMutableDocument::setBlob(). Content already stored isn't stored again. Thread Safe.
+        * @param input The content, read until the end.
+        * @param content_type The MIME type of the content, i.e "application/octet-stream".
+        * @param blob The blob to set.
+        */
+        SGBlobReturnStatus saveBlob(std::istream &input, const std::string &content_type, SGBlob &blob);
+
+        /** SGDatabase readBlob.
+        * @brief Streams the content of a blob to the output, a chunk at a time. Thread Safe.
+        * @param blob The blob, see SGDocument::getBlob().
+        * @param output Where to write the content.
+        */
+        SGBlobReturnStatus readBlob(const SGBlob &blob, std::ostream &output);
+
+        /** SGDatabase hasBlob.
+        * @brief Check if the content of the blob is in the local blob store, e.g to skip importing content with a
+        * known digest again, or to know if a pulled blob was downloaded. Thread Safe.
+        * @param blob The blob.
+        */
+        bool hasBlob(const SGBlob &blob);
+
+        /** SGDatabase saveLocalDocument.
+        * @brief Stores data in the database file apart from the documents: it's never replicated nor listed by
+        * getAllDocumentsKey(). Thread Safe.
+        * @param key The name of the data.
+        * @param data The data, empty removes it.
+        */
+        bool saveLocalDocument(const std::string &key, const fleece::alloc_slice &data);
+
+        /** SGDatabase getLocalDocument.
+        * @brief Reads data stored with saveLocalDocument(). Returns false if there is none. Thread Safe.
+        * @param key The name of the data.
+        * @param data The data to set.
+        */
+        bool getLocalDocument(const std::string &key, fleece::alloc_slice &data);
+
     private:
 
         C4Database *c4db_{nullptr};
@@ -127,29 +255,147 @@ namespace Strata {
         C4Error c4error_ {};
         std::string db_name_;
         std::string db_path_;
-        std::mutex db_lock_;
+        SGProfiledMutex db_lock_;
+
+        // SGBlobWriter and SGBlobReader streaming from c4db_, close() waits for them. Guarded by db_lock_.
+        size_t open_blob_streams_ {0};
+        std::condition_variable_any blob_streams_closed_;
+
+        // Metrics registered for this database, defined in SGDatabase.cpp. Guarded by db_lock_.
+        struct Metrics;
+        std::unique_ptr<Metrics> metrics_;
+
+        // Shared with the documents, which may outlive the database
+        std::shared_ptr<SGMemoryTracker> memory_tracker_ {std::make_shared<SGMemoryTracker>()};
+        std::atomic<uint64_t> memory_limit_bytes_ {0};
+        std::atomic<int64_t> max_save_delay_ms_ {kDefaultMaxSaveDelayMs};
+        std::atomic<bool> over_memory_limit_ {false};
+        std::mutex memory_listener_lock_;
+        std::function<void(const SGMemoryUsage &usage)> on_memory_pressure_callback_;
+        std::atomic<uint64_t> memory_pressure_count_ {0};
+        std::atomic<uint64_t> throttled_save_count_ {0};
+        std::atomic<uint64_t> throttle_time_us_ {0};
+        std::atomic<uint64_t> throttle_timeout_count_ {0};
+
+        static const int64_t kDefaultMaxSaveDelayMs = 100;
+
+        std::atomic<int64_t> slow_query_threshold_us_ {0};
+        mutable std::mutex slow_queries_lock_;
+        std::deque<SGSlowQuery> slow_queries_;
+
+        // Slow queries kept by getSlowQueries().
+        static const size_t kSlowQueryLogCapacity = 100;
 
         static constexpr const char *kSGDatabasesDirectory_ = "db";
 
+        // LiteCore raw document store of the local documents.
+        static constexpr const char *kLocalDocumentStore = "SGLocalDocuments";
+
+        // Chunk size used to stream blobs in and out.
+        static const size_t kBlobChunkSize = 64 * 1024;
+
         /** SGDatabase createNewDocument.
         * @brief Create new couchebase document.
         * @param doc The SGDocument reference.
         * @param body The fleece slice data which will be stored in the body of the document.
+        * @param revision_flags Flags of the new revision, i.e kRevHasAttachments.
         */
-        SGDatabaseReturnStatus _createNewDocument(SGDocument *doc, fleece::alloc_slice body);
+        SGDatabaseReturnStatus _createNewDocument(SGDocument *doc, fleece::alloc_slice body, C4RevisionFlags revision_flags);
 
         /** SGDatabase updateDocument.
         * @brief Update existing couchebase document.
         * @param doc The SGDocument reference.
         * @param body The fleece slice data which will update the body.
+        * @param revision_flags Flags of the new revision, i.e kRevHasAttachments.
         */
-        SGDatabaseReturnStatus _updateDocument(SGDocument *doc, fleece::alloc_slice new_body);
+        SGDatabaseReturnStatus _updateDocument(SGDocument *doc, fleece::alloc_slice new_body, C4RevisionFlags revision_flags);
 
         /** SGDatabase isOpen.
         * @brief Check if database is open. Called internally inside locked functions.
         */
         bool _isOpen() const;
 
+        /** SGDatabase endTransaction.
+        * @brief Commits the transaction. Called internally inside locked functions.
+        * @param commit_us Where to record the commit time, nullptr when metrics are off.
+        */
+        bool _endTransaction(SGHistogram *commit_us);
+
+        /** SGDatabase lockDatabase.
+        * @brief Acquires db_lock_, recording the wait when metrics are on.
+        * @param operation The public function acquiring it, reported by getLockStats().
+        */
+        std::unique_lock<SGProfiledMutex> lockDatabase(const char *operation);
+
+        // Implementations of the public functions, which take db_lock_ and add the metrics. Called internally inside
+        // locked functions.
+        SGDatabaseReturnStatus _openDatabase();
+
+        /** SGDatabase closeDatabase.
+        * @brief Closes c4db_ once the blob streams are done, releasing lock while waiting for them.
+        * @param lock The held db_lock_.
+        */
+        SGDatabaseReturnStatus _closeDatabase(std::unique_lock<SGProfiledMutex> &lock);
+
+        SGDatabaseReturnStatus _saveDocument(SGDocument *doc);
+
+        C4Document *_loadDocument(const std::string &doc_id, SGDatabaseReturnStatus &status);
+
+        SGDatabaseReturnStatus _purgeDocument(SGDocument *doc);
+
+        bool _queryAllDocumentsKey(std::vector<std::string> &document_keys);
+
+        // Used by SGQuery, these take the database lock
+        C4Query *compileQuery(const std::string &json_query);
+
+        void freeQuery(C4Query *query);
+
+        bool runQuery(C4Query *query, const std::string &json_query, const std::string &parameters,
+                      const char *operation, std::string &plan,
+                      const std::function<void(FLArrayIterator *columns)> &on_row);
+
+        std::string explainQuery(C4Query *query, std::string &plan);
+
+        /** SGDatabase runQuery.
+        * @brief Runs the query and calls on_row for each row, logging it if it's slow. Called internally inside locked
+        * functions.
+        * @param query The compiled query.
+        * @param json_query Its text, for the slow query log.
+        * @param parameters The JSON parameters, empty if none.
+        * @param plan The query's cached plan, see _explainQuery().
+        * @param on_row Receives the columns of each row.
+        */
+        bool _runQuery(C4Query *query, const std::string &json_query, const std::string &parameters,
+                       std::string &plan, const std::function<void(FLArrayIterator *columns)> &on_row);
+
+        /** SGDatabase explainQuery.
+        * @brief Returns the translated SQL and query plan. Called internally inside locked functions.
+        * @param query The compiled query.
+        * @param plan Its cached plan, explained and set if empty.
+        */
+        const std::string &_explainQuery(C4Query *query, std::string &plan);
+
+        /** SGDatabase acquireBlobStream.
+        * @brief Returns c4db_, kept open until releaseBlobStream(), or nullptr if the database isn't open.
+        */
+        C4Database *acquireBlobStream();
+
+        /** SGDatabase releaseBlobStream.
+        * @brief Lets close() go ahead once the stream acquired with acquireBlobStream() is closed.
+        */
+        void releaseBlobStream();
+
+        /** SGDatabase checkMemoryLimit.
+        * @brief Calls the memory pressure listener when the usage went over the limit. Called without the lock.
+        * @param throttle_save Whether to wait for the usage to drop below the limit.
+        */
+        void checkMemoryLimit(bool throttle_save);
+
+        friend SGDocument;
+        friend SGQuery;
+        friend SGBlobWriter;
+        friend SGBlobReader;
+
     };
 }
 
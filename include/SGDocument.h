@@ -25,8 +25,10 @@
 #ifndef SGDOCUMENT_H
 #define SGDOCUMENT_H
 
+#include <memory>
 #include <string>
 #include "SGDatabase.h"
+#include "SGMemoryTracker.h"
 #include <litecore/c4Document+Fleece.h>
 #include <fleece/FleeceImpl.hh>
 #include <fleece/MutableArray.hh>
@@ -44,6 +46,11 @@ namespace Strata {
 
         SGDocument(SGDatabase *database, const std::string &docId);
 
+        // Both copies would free the same C4Document and untrack the same memory
+        SGDocument(const SGDocument &) = delete;
+
+        SGDocument &operator=(const SGDocument &) = delete;
+
         C4Document *getC4document() const;
 
         const std::string &getId() const;
@@ -71,6 +78,14 @@ namespace Strata {
         */
         const fleece::impl::Value *get(const std::string &keyToFind);
 
+        /** SGDocument getBlob.
+        * @brief Reads the blob stored under the key, see SGDatabase::readBlob() for its content. Returns false if
+        * there is no blob under the key.
+        * @param key The reference to the key.
+        * @param blob The blob to set.
+        */
+        bool getBlob(const std::string &key, SGBlob &blob);
+
         /** SGDocument exist.
         * @brief Check if the document exist in the DB.
         */
@@ -84,6 +99,10 @@ namespace Strata {
         // Document ID
         std::string id_;
 
+        // Tracker of the database the document was loaded from, besides SGMemoryTracker::process()
+        std::shared_ptr<SGMemoryTracker> database_memory_;
+
+        // Frees the C4Document it replaces
         void setC4document(C4Document *);
 
         friend SGDatabase;
@@ -95,6 +114,15 @@ namespace Strata {
         void initMutableDict();
 
         fleece::Retained<fleece::impl::MutableDict> mutable_dict_;
+
+        /** SGDocument accountMemory.
+        * @brief Reports a change of a memory category held by the document to the process and database trackers.
+        * @param was_live If the document held an object of the category.
+        * @param old_bytes The bytes it was counted with.
+        * @param is_live If the document holds one now.
+        * @param new_bytes The bytes to count it with.
+        */
+        void accountMemory(SGMemoryCategory category, bool was_live, uint64_t old_bytes, bool is_live, uint64_t new_bytes);
     };
 }
 
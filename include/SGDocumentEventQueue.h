@@ -0,0 +1,203 @@
+//
+//  SGDocumentEventQueue.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGDOCUMENTEVENTQUEUE_H
+#define SGDOCUMENTEVENTQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <litecore/c4.h>
+
+#include "SGRingBuffer.h"
+
+namespace Strata {
+    /*
+     * One replicator onDocumentEnded event.
+     * Doc ids up to kInlineDocIdLength bytes are stored inline and the error is kept as a C4Error, so queuing an
+     * event doesn't allocate. The error message is only formatted when errorMessage() is called.
+     */
+    class SGDocumentEndedEvent {
+    public:
+        static constexpr size_t kInlineDocIdLength = 64;
+
+        SGDocumentEndedEvent();
+
+        SGDocumentEndedEvent(bool pushing, C4String doc_id, C4Error error, bool error_is_transient);
+
+        bool isPushing() const;
+
+        std::string getDocId() const;
+
+        bool isError() const;
+
+        bool isErrorTransient() const;
+
+        C4Error getError() const;
+
+        /** SGDocumentEndedEvent getErrorMessage.
+        * @brief Formats the error message. Empty if the event isn't an error.
+        */
+        std::string getErrorMessage() const;
+
+        /** SGDocumentEndedEvent getCoalescedCount.
+        * @brief Number of older events for the same document and direction merged into this one (kCoalesce policy).
+        */
+        uint32_t getCoalescedCount() const;
+
+    private:
+        friend class SGDocumentEventQueue;
+
+        bool pushing_ {false};
+        bool error_is_transient_ {false};
+        C4Error error_ {};
+        uint32_t coalesced_count_ {0};
+        uint32_t doc_id_length_ {0};
+        char inline_doc_id_[kInlineDocIdLength];
+        std::string long_doc_id_;// Only used for doc ids longer than kInlineDocIdLength.
+    };
+
+    typedef struct {
+        uint64_t enqueued_count;// Events accepted by the queue.
+        uint64_t delivered_count;// Events handed out by drain().
+        uint64_t dropped_count;// Events discarded by kDropOldest, or after close().
+        uint64_t coalesced_count;// Events merged into a newer event for the same document by kCoalesce.
+        uint64_t blocked_count;// Pushes that had to wait for room with kBlock.
+    } SGDocumentEventQueueStats;
+
+    /*
+     * Bounded queue between the replicator thread and the application for document ended events.
+     * The replicator pushes into a lock-free ring buffer, the application drains batches on its own thread.
+     *
+     * Thread safe is guaranteed on all functions. drain() and waitForEvents() should be called from a single
+     * consumer thread.
+     */
+    class SGDocumentEventQueue {
+    public:
+        enum class OverflowPolicy {
+            // Wait for the application to drain. A slow consumer throttles the replicator, no event is lost.
+            kBlock = 0,
+            // Discard the oldest queued event to make room for the new one.
+            kDropOldest,
+            // Keep only the latest event per document and direction while the ring buffer is full.
+            kCoalesce
+        };
+
+        static constexpr size_t kDefaultCapacity = 4096;
+
+        /** SGDocumentEventQueue.
+        * @brief Creates the queue.
+        * @param capacity Number of events the ring buffer can hold, rounded up to a power of two.
+        * @param overflow_policy What to do with new events when the ring buffer is full.
+        */
+        explicit SGDocumentEventQueue(size_t capacity = kDefaultCapacity,
+                                      OverflowPolicy overflow_policy = OverflowPolicy::kBlock);
+
+        virtual ~SGDocumentEventQueue();
+
+        /** SGDocumentEventQueue push.
+        * @brief Queues an event. Called by SGReplicator on the replicator thread.
+        * @param pushing True for a pushed document, false for a pulled document.
+        * @param doc_id The document id.
+        * @param error The replication error, code 0 if there wasn't one.
+        * @param error_is_transient True if the error is transient.
+        */
+        void push(bool pushing, C4String doc_id, C4Error error, bool error_is_transient);
+
+        /** SGDocumentEventQueue drain.
+        * @brief Moves up to max_events queued events to the end of events. Returns the number of events moved.
+        * @param events The vector to append to.
+        * @param max_events Maximum number of events to move.
+        */
+        size_t drain(std::vector<SGDocumentEndedEvent> &events, size_t max_events = kDefaultCapacity);
+
+        /** SGDocumentEventQueue waitForEvents.
+        * @brief Blocks until at least one event is queued or timeout expires. Returns true if events are available.
+        * @param timeout Maximum time to wait.
+        */
+        bool waitForEvents(const std::chrono::milliseconds &timeout);
+
+        /** SGDocumentEventQueue close.
+        * @brief Stop accepting events and release producers blocked by kBlock. Events pushed afterwards are dropped.
+        */
+        void close();
+
+        bool isClosed() const;
+
+        OverflowPolicy getOverflowPolicy() const;
+
+        size_t getCapacity() const;
+
+        SGDocumentEventQueueStats getStats() const;
+
+    private:
+        SGRingBuffer<SGDocumentEndedEvent> ring_buffer_;
+        const OverflowPolicy overflow_policy_;
+        std::atomic<bool> closed_ {false};
+
+        std::atomic<uint64_t> enqueued_count_ {0};
+        std::atomic<uint64_t> delivered_count_ {0};
+        std::atomic<uint64_t> dropped_count_ {0};
+        std::atomic<uint64_t> coalesced_count_ {0};
+        std::atomic<uint64_t> blocked_count_ {0};
+
+        // Wake ups. Producers only take the lock when somebody is actually waiting.
+        std::mutex wait_lock_;
+        std::condition_variable events_available_;
+        std::condition_variable space_available_;
+        std::atomic<int> waiting_consumers_ {0};
+        std::atomic<int> waiting_producers_ {0};
+
+        // kCoalesce overflow in arrival order, indexed by direction and doc id. Drained after the ring buffer.
+        // While it isn't empty, new events go here too so a document's events are never delivered out of order.
+        std::mutex overflow_lock_;
+        std::vector<SGDocumentEndedEvent> overflow_events_;
+        std::unordered_map<std::string, size_t> overflow_index_;
+        std::atomic<bool> has_overflow_events_ {false};
+
+        void pushBlocking(SGDocumentEndedEvent &&event);
+
+        void pushDroppingOldest(SGDocumentEndedEvent &&event);
+
+        void pushCoalescing(SGDocumentEndedEvent &&event);
+
+        void notifyConsumer();
+
+        void notifyProducers();
+
+        SGDocumentEventQueue(const SGDocumentEventQueue &) = delete;
+        SGDocumentEventQueue &operator=(const SGDocumentEventQueue &) = delete;
+    };
+
+    std::ostream& operator << (std::ostream& os, const SGDocumentEventQueue::OverflowPolicy& overflow_policy);
+}
+
+#endif //SGDOCUMENTEVENTQUEUE_H
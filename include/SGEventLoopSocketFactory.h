@@ -0,0 +1,266 @@
+//
+//  SGEventLoopSocketFactory.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGEVENTLOOPSOCKETFACTORY_H
+#define SGEVENTLOOPSOCKETFACTORY_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SGSocketFactory.h"
+#include "SGWebSocketCodec.h"
+
+namespace Strata {
+    /*
+     * Replicator transport multiplexing every connection on a few epoll event loops, instead of a thread (or two)
+     * per connection. Meant for processes running many replicators at once, most of them idle.
+     * Does its own WebSocket framing, permessage-deflate included, like SGCivetWebSocketFactory.
+     *
+     * Linux only, ws:// only (no TLS). Connections are spread round robin on the I/O threads. Host names are resolved
+     * on the replicator's thread when the connection opens. Stop every replicator using the factory before
+     * destroying it.
+     */
+    class SGEventLoopSocketFactory : public SGSocketFactory {
+    public:
+        /** SGEventLoopSocketFactory.
+        * @brief Starts the I/O threads.
+        * @param io_thread_count Number of event loops, each one on its own thread.
+        */
+        explicit SGEventLoopSocketFactory(unsigned io_thread_count = kDefaultIOThreadCount);
+
+        virtual ~SGEventLoopSocketFactory();
+
+        /** SGEventLoopSocketFactory setCompressionLevel.
+        * @brief zlib level used when the server accepts permessage-deflate, from 1 (fastest) to 9 (smallest).
+        * SGWebSocketCodec::kCompressionDisabled doesn't offer compression. Applies to new connections.
+        * @param compression_level The compression level.
+        */
+        void setCompressionLevel(int compression_level);
+
+        int getCompressionLevel() const;
+
+        unsigned getIOThreadCount() const;
+
+        static const unsigned kDefaultIOThreadCount = 2;
+
+    protected:
+        void open(C4Socket *socket, const C4Address *address, C4Slice options) override;
+
+        void write(C4Socket *socket, C4SliceResult data) override;
+
+        void completedReceive(C4Socket *socket, size_t byte_count) override;
+
+        void requestClose(C4Socket *socket, int status, C4String message) override;
+
+    private:
+        enum class ConnectionState {
+            kConnecting,
+            kHandshake,
+            kOpen,
+            kClosed
+        };
+
+        struct EventLoop;
+
+        struct PendingWrite {
+            uint64_t end_offset;// Position of the end of the frame in the outgoing byte stream
+            size_t byte_count;// Payload size to report with c4socket_completedWrite(), 0 for control frames
+        };
+
+        struct Address {
+            int family;
+            std::string socket_address;// The raw sockaddr returned by getaddrinfo()
+        };
+
+        struct Connection {
+            EventLoop *loop {nullptr};
+            C4Socket *socket {nullptr};
+            int fd {-1};
+            C4Error open_error {};// Set when open() failed, the loop closes the socket right away
+            std::string host;
+            uint16_t port {0};
+            int compression_level {SGWebSocketCodec::kCompressionDisabled};
+
+            // Event loop thread only, once open() posted the connection
+            std::deque<Address> addresses;// Resolved addresses not tried yet, tried in order when a connect fails
+            ConnectionState state {ConnectionState::kConnecting};
+            std::string websocket_key;
+            std::string response;
+            uint32_t registered_events {0};
+
+            // Dead connection detection, see SGReplicatorConfiguration. Event loop thread only.
+            std::chrono::seconds heartbeat_interval {0};
+            std::chrono::seconds idle_timeout {0};
+            std::chrono::seconds connect_timeout {0};
+            std::chrono::steady_clock::time_point opened_at;
+            std::chrono::steady_clock::time_point last_received;
+            std::chrono::steady_clock::time_point next_heartbeat;
+            bool timed {false};// Counted in EventLoop::timed_connection_count
+
+            // Bandwidth limits, see SGBandwidthLimiter. Event loop thread only.
+            std::shared_ptr<SGBandwidthLimiter> bandwidth_limiter;
+            std::chrono::steady_clock::time_point send_throttled_until;
+            std::chrono::steady_clock::time_point receive_throttled_until;
+            bool throttled {false};// In EventLoop::throttled
+
+            // Guards the outgoing side, shared with LiteCore's threads
+            std::mutex lock;
+            SGWebSocketCodec codec {SGWebSocketCodec::Role::kClient};
+            std::string outbox;
+            size_t outbox_offset {0};
+            uint64_t queued_bytes {0};
+            uint64_t sent_bytes {0};
+            std::deque<PendingWrite> pending_writes;
+            size_t unread_bytes {0};
+            bool close_sent {false};
+            bool close_requested {false};
+            C4Error close_error {};// What to report if the close is requested before the connection is open
+            bool socket_closed {false};
+        };
+
+        struct ConnectionHandle : public SGSocketHandle {
+            ConnectionHandle(SGSocketFactory *socket_factory, const std::shared_ptr<Connection> &socket_connection)
+                    : SGSocketHandle(socket_factory), connection(socket_connection) {}
+
+            std::shared_ptr<Connection> connection;
+        };
+
+        struct EventLoop {
+            int epoll_fd {-1};
+            int wakeup_fd {-1};// eventfd, wakes epoll_wait() up when other threads post work
+            std::thread thread;
+
+            std::mutex lock;
+            std::vector<std::shared_ptr<Connection>> posted;// New connections and connections needing attention
+            bool stopping {false};
+
+            // Event loop thread only
+            std::map<int, std::shared_ptr<Connection>> connections;
+            std::vector<char> read_buffer;
+            size_t timed_connection_count {0};
+            std::chrono::steady_clock::time_point last_timer_check;
+            std::vector<std::shared_ptr<Connection>> throttled;// Connections held back by the bandwidth limits
+        };
+
+        // Unread bytes handed to LiteCore above which a connection stops reading.
+        static const size_t kMaxUnreadBytes = 1024 * 1024;
+
+        static const size_t kReadBufferSize = 64 * 1024;
+
+        // Largest HTTP response header accepted during the handshake.
+        static const size_t kMaxResponseHeaderSize = 16 * 1024;
+
+        static const int kMaxEventsPerWait = 64;
+
+        // How often heartbeats and timeouts are checked, when a connection uses them.
+        static const int kTimerResolutionMs = 250;
+
+        std::atomic<int> compression_level_ {SGWebSocketCodec::kDefaultCompressionLevel};
+
+        std::vector<std::unique_ptr<EventLoop>> loops_;
+        std::atomic<unsigned> next_loop_ {0};
+
+        /** SGEventLoopSocketFactory run.
+        * @brief Event loop thread.
+        */
+        void run(EventLoop *loop);
+
+        /** SGEventLoopSocketFactory post.
+        * @brief Schedules the connection for the event loop: registers it when new, updates its events otherwise.
+        * Thread safe.
+        */
+        void post(const std::shared_ptr<Connection> &connection);
+
+        void onEvents(const std::shared_ptr<Connection> &connection, uint32_t events);
+
+        /** SGEventLoopSocketFactory connectNext.
+        * @brief Starts a non blocking connect to the next address of the connection that accepts one and sets its fd.
+        * Returns false once every address was tried, connect_error holds the last error then.
+        */
+        bool connectNext(Connection &connection, int &connect_error);
+
+        /** SGEventLoopSocketFactory onConnected.
+        * @brief Completes the connect. If it failed, moves on to the next address, closes the connection once none
+        * is left.
+        */
+        void onConnected(const std::shared_ptr<Connection> &connection);
+
+        /** SGEventLoopSocketFactory onReadable.
+        * @brief Reads until the socket is drained or the receive window is full. Returns false once closed.
+        */
+        bool onReadable(const std::shared_ptr<Connection> &connection);
+
+        /** SGEventLoopSocketFactory onHandshakeData.
+        * @brief Buffers the upgrade response. Returns false if the handshake failed.
+        */
+        bool onHandshakeData(const std::shared_ptr<Connection> &connection, const char *data, size_t size);
+
+        bool onFrameData(const std::shared_ptr<Connection> &connection, const char *data, size_t size);
+
+        /** SGEventLoopSocketFactory flush.
+        * @brief Sends as much of the outbox as the socket takes and reports completed writes. Returns false if the
+        * connection broke.
+        */
+        bool flush(const std::shared_ptr<Connection> &connection);
+
+        /** SGEventLoopSocketFactory queueFrame.
+        * @brief Encodes a frame into the outbox. Must hold connection->lock.
+        */
+        bool queueFrame(Connection &connection, int opcode, const void *data, size_t size, size_t byte_count);
+
+        void updateEvents(const std::shared_ptr<Connection> &connection);
+
+        /** SGEventLoopSocketFactory checkTimers.
+        * @brief Sends due heartbeats and closes connections past their connect or idle timeout.
+        */
+        void checkTimers(EventLoop *loop);
+
+        void wakeUp(EventLoop *loop);
+
+        /** SGEventLoopSocketFactory markThrottled.
+        * @brief Keeps track of a connection held back by the bandwidth limits, so the loop wakes up when it can resume.
+        */
+        void markThrottled(const std::shared_ptr<Connection> &connection);
+
+        /** SGEventLoopSocketFactory resumeThrottled.
+        * @brief Resumes the connections whose bandwidth wait is over. Returns the epoll_wait() timeout until the next
+        * one, -1 if none is left.
+        */
+        int resumeThrottled(EventLoop *loop);
+
+        /** SGEventLoopSocketFactory closeConnection.
+        * @brief Closes the file descriptor and tells LiteCore, once. Event loop thread only.
+        */
+        void closeConnection(const std::shared_ptr<Connection> &connection, const C4Error &error);
+    };
+}
+
+#endif //SGEVENTLOOPSOCKETFACTORY_H
@@ -0,0 +1,99 @@
+//
+//  SGHistogram.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGHISTOGRAM_H
+#define SGHISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Strata {
+    /*
+     * Point-in-time copy of an SGHistogram. Safe to keep and inspect after the histogram moves on.
+     */
+    struct SGHistogramSnapshot {
+        uint64_t count {0};
+        uint64_t min {0};
+        uint64_t max {0};
+        uint64_t sum {0};
+
+        // Raw bucket counts, indexed the same way as SGHistogram buckets.
+        std::vector<uint64_t> bucket_counts;
+
+        double mean() const;
+
+        /** SGHistogramSnapshot percentile.
+        * @brief Returns the value at the given percentile (0-100). The result is the upper bound of the matching bucket.
+        * @param percentile The percentile to look up, i.e 50, 99, 99.9
+        */
+        uint64_t percentile(double percentile) const;
+    };
+
+    /*
+     * Log-linear (HDR style) histogram of unsigned 64 bit values.
+     * Values below 16 get exact buckets, larger values are grouped in 16 sub buckets per power of two,
+     * which keeps the relative error under 6.25% over the whole range.
+     *
+     * record() is lock-free and can be called from any thread.
+     */
+    class SGHistogram {
+    public:
+        SGHistogram();
+
+        virtual ~SGHistogram() {}
+
+        void record(uint64_t value);
+
+        SGHistogramSnapshot snapshot() const;
+
+        void reset();
+
+        /** SGHistogram bucketUpperBound.
+        * @brief Returns the largest value that falls in the given bucket.
+        * @param index The bucket index.
+        */
+        static uint64_t bucketUpperBound(size_t index);
+
+        static constexpr unsigned kSubBucketBits = 4;
+        static constexpr unsigned kSubBucketCount = 1u << kSubBucketBits;
+        static constexpr size_t kBucketCount = kSubBucketCount + (64 - kSubBucketBits) * kSubBucketCount;
+
+    private:
+        std::atomic<uint64_t> counts_[kBucketCount];
+        std::atomic<uint64_t> count_ {0};
+        std::atomic<uint64_t> sum_ {0};
+        std::atomic<uint64_t> min_;
+        std::atomic<uint64_t> max_ {0};
+
+        static size_t bucketIndex(uint64_t value);
+
+        // Non copyable, the counters are atomics.
+        SGHistogram(const SGHistogram &) = delete;
+        SGHistogram &operator=(const SGHistogram &) = delete;
+    };
+}
+
+#endif //SGHISTOGRAM_H
@@ -24,26 +24,61 @@
 
 #ifndef SGLOGGING_H
 #define SGLOGGING_H
+#include <string>
 #include <litecore/c4.h>
-#include <litecore/Logging.hh>
 
+/*
+ * Log domains start at kSGDefaultLogLevel and can be changed at runtime with Strata::setLogLevel().
+ * The qC4 macros check that a message would be logged before evaluating their arguments, so a disabled debug line
+ * costs a level check, not a body serialization.
+ * Building with SG_LOG_DISABLE_DEBUG (the SG_LOG_DEBUG CMake option) compiles the qC4Debug lines out completely.
+ */
 #define Q_DECLARE_C4_LOGGING_CATEGORY(name) \
     extern C4LogDomain &name();
 
 #define Q_C4_LOGGING_CATEGORY(name, logName) \
     C4LogDomain &name() \
     { \
-        static C4LogDomain c4logdomain = [](){ \
-            static litecore::LogDomain logdomain(logName, litecore::LogLevel::Debug); \
-            logdomain.setCallbackLogLevel(litecore::LogLevel::Debug); \
-            return (C4LogDomain)&logdomain; \
-        } (); \
+        static C4LogDomain c4logdomain = Strata::getLogDomain(logName); \
         return c4logdomain; \
     }
 
-#  define qC4Debug(category, FMT, ...) C4LogToAt(category(), kC4LogDebug,   FMT, ## __VA_ARGS__)
-#  define qC4Info(category, FMT, ...) C4LogToAt(category(), kC4LogInfo,   FMT, ## __VA_ARGS__)
-#  define qC4Warning(category, FMT, ...) C4LogToAt(category(), kC4LogWarning,   FMT, ## __VA_ARGS__)
-#  define qC4Critical(category, FMT, ...) C4LogToAt(category(), kC4LogError,   FMT, ## __VA_ARGS__)
+#define SG_C4_LOG_AT(category, level, FMT, ...) \
+    do { if (c4log_willLog(category(), level)) c4log(category(), level, FMT, ## __VA_ARGS__); } while (0)
+
+#ifdef SG_LOG_DISABLE_DEBUG
+// Still type checked, but never evaluated
+#  define qC4Debug(category, FMT, ...) do { if (false) c4log(category(), kC4LogDebug, FMT, ## __VA_ARGS__); } while (0)
+#else
+#  define qC4Debug(category, FMT, ...) SG_C4_LOG_AT(category, kC4LogDebug,   FMT, ## __VA_ARGS__)
+#endif
+#  define qC4Info(category, FMT, ...) SG_C4_LOG_AT(category, kC4LogInfo,   FMT, ## __VA_ARGS__)
+#  define qC4Warning(category, FMT, ...) SG_C4_LOG_AT(category, kC4LogWarning,   FMT, ## __VA_ARGS__)
+#  define qC4Critical(category, FMT, ...) SG_C4_LOG_AT(category, kC4LogError,   FMT, ## __VA_ARGS__)
+
+namespace Strata {
+    static const C4LogLevel kSGDefaultLogLevel = kC4LogInfo;
+
+    /** getLogDomain.
+    * @brief Returns the log domain with this name, created at kSGDefaultLogLevel if it doesn't exist yet.
+    * Used by Q_C4_LOGGING_CATEGORY. Thread Safe.
+    * @param domain_name The domain name, i.e "SG.replicator".
+    */
+    C4LogDomain getLogDomain(const char *domain_name);
+
+    /** setLogLevel.
+    * @brief Sets the level of a log domain, ours ("SG.replicator") or LiteCore's ("Sync"). Also lowers the log
+    * callback level if needed, so the messages reach it. Returns false if there is no such LiteCore domain. Thread Safe.
+    * @param domain_name The domain name.
+    * @param level The lowest level logged, i.e kC4LogDebug.
+    */
+    bool setLogLevel(const std::string &domain_name, C4LogLevel level);
+
+    /** setLogLevel.
+    * @brief Sets the level of every log domain of this library. Thread Safe.
+    * @param level The lowest level logged, i.e kC4LogDebug.
+    */
+    void setLogLevel(C4LogLevel level);
+}
 
 #endif //SGLOGGING_H
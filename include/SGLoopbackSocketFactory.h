@@ -0,0 +1,148 @@
+//
+//  SGLoopbackSocketFactory.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGLOOPBACKSOCKETFACTORY_H
+#define SGLOOPBACKSOCKETFACTORY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "SGDatabase.h"
+#include "SGSocketFactory.h"
+#include "SGWebSocketCodec.h"
+
+namespace Strata {
+    /*
+     * In-process transport: every connection opened by a replicator using this factory is answered by a passive
+     * replicator on remote_database, with messages handed over in memory. No network, no Sync Gateway.
+     * Meant for benchmarks and tests. The URL endpoint of the replicator configuration is only used as a label.
+     *
+     * Messages go through the same WebSocket framing and permessage-deflate compression as a network transport, so
+     * the wire bytes and compression cost in getStats() are representative. They are delivered by a single internal
+     * thread, in order, per factory.
+     * Stop every replicator using the factory before destroying it.
+     */
+    class SGLoopbackSocketFactory : public SGSocketFactory {
+    public:
+        /** SGLoopbackSocketFactory.
+        * @brief Initial setup of the loopback transport.
+        * @param remote_database The database the passive replicators run against. Must be open and outlive the factory.
+        */
+        explicit SGLoopbackSocketFactory(SGDatabase *remote_database);
+
+        virtual ~SGLoopbackSocketFactory();
+
+        /** SGLoopbackSocketFactory setCompressionLevel.
+        * @brief permessage-deflate level for new connections, SGWebSocketCodec::kCompressionDisabled (default) or 1 to 9.
+        * @param compression_level The zlib compression level.
+        */
+        void setCompressionLevel(int compression_level);
+
+        int getCompressionLevel() const;
+
+    protected:
+        void open(C4Socket *socket, const C4Address *address, C4Slice options) override;
+
+        void write(C4Socket *socket, C4SliceResult data) override;
+
+        void completedReceive(C4Socket *socket, size_t byte_count) override;
+
+        void close(C4Socket *socket) override;
+
+        void requestClose(C4Socket *socket, int status, C4String message) override;
+
+        void dispose(C4Socket *socket) override;
+
+    private:
+        // Both ends of a connection. Sockets are only used from the delivery thread.
+        struct LoopbackConnection {
+            std::mutex lock;
+            C4Socket *sockets[2] {nullptr, nullptr};
+            bool is_open[2] {false, false};
+            bool is_closed[2] {false, false};
+            // Each side encodes what it sends and decodes what it receives
+            std::unique_ptr<SGWebSocketCodec> codecs[2];
+        };
+
+        struct LoopbackHandle : public SGSocketHandle {
+            LoopbackHandle(SGSocketFactory *socket_factory, const std::shared_ptr<LoopbackConnection> &loopback_connection,
+                           int connection_side)
+                    : SGSocketHandle(socket_factory), connection(loopback_connection), side(connection_side) {}
+
+            std::shared_ptr<LoopbackConnection> connection;
+            int side;// 0 for the active replicator, 1 for the passive replicator.
+        };
+
+        static const int kActiveSide = 0;
+        static const int kPassiveSide = 1;
+
+        SGDatabase *remote_database_ {nullptr};
+        std::atomic<int> compression_level_ {SGWebSocketCodec::kCompressionDisabled};
+
+        // Passive replicators still running
+        std::mutex passive_replicators_lock_;
+        std::set<C4Replicator *> passive_replicators_;
+
+        // Delivery thread
+        std::mutex tasks_lock_;
+        std::condition_variable tasks_available_;
+        std::deque<std::function<void()>> tasks_;
+        bool stopping_ {false};
+        std::thread delivery_thread_;
+
+        void post(const std::function<void()> &task);
+
+        void runTasks();
+
+        /** SGLoopbackSocketFactory connect.
+        * @brief Starts the passive replicator answering the active socket. Runs on the delivery thread.
+        * @param connection The connection to set up.
+        * @param address The address the active replicator connects to.
+        */
+        void connect(const std::shared_ptr<LoopbackConnection> &connection, const C4Address &address);
+
+        /** SGLoopbackSocketFactory openSide.
+        * @brief Reports one end of the connection as open, once. Runs on the delivery thread.
+        */
+        void openSide(const std::shared_ptr<LoopbackConnection> &connection, int side);
+
+        /** SGLoopbackSocketFactory closeConnection.
+        * @brief Closes both ends of the connection. Runs on the delivery thread.
+        */
+        void closeConnection(const std::shared_ptr<LoopbackConnection> &connection, const C4Error &error);
+
+        static C4Socket *socketOf(const std::shared_ptr<LoopbackConnection> &connection, int side);
+
+        static void onPassiveStatusChanged(C4Replicator *replicator, C4ReplicatorStatus status, void *context);
+    };
+}
+
+#endif //SGLOOPBACKSOCKETFACTORY_H
@@ -0,0 +1,122 @@
+//
+//  SGMemoryTracker.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGMEMORYTRACKER_H
+#define SGMEMORYTRACKER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace Strata {
+    enum class SGMemoryCategory {
+        kDocument = 0,      // Live SGDocuments, bytes are the objects and their ids.
+        kDocumentBody,      // Fleece bodies kept by SGMutableDocument::setBody().
+        kC4Document,        // C4Documents held by SGDocuments, bytes are their current revision body.
+        kRevisionPipeline,  // Revisions queued in an SGRevisionPipeline, bytes are their JSON bodies.
+        kCategoryCount
+    };
+
+    struct SGMemoryCategoryUsage {
+        uint64_t count {0};
+        uint64_t bytes {0};
+    };
+
+    struct SGMemoryUsage {
+        // Indexed by SGMemoryCategory
+        SGMemoryCategoryUsage categories[(size_t) SGMemoryCategory::kCategoryCount];
+
+        const SGMemoryCategoryUsage &get(SGMemoryCategory category) const {
+            return categories[(size_t) category];
+        }
+
+        uint64_t totalBytes() const;
+    };
+
+    /*
+     * Live object counts and bytes per SGMemoryCategory. The objects report themselves to the process wide tracker,
+     * see process(), and documents also to the tracker of their SGDatabase.
+     * Bytes are what the objects reference, not what the allocator spent on them. Changes made to a document with
+     * SGMutableDocument::set() aren't counted until it's saved.
+     *
+     * All functions are thread safe, add() and remove() are lock-free unless a thread waits in waitForBytesBelow().
+     */
+    class SGMemoryTracker {
+    public:
+        SGMemoryTracker();
+
+        virtual ~SGMemoryTracker() {}
+
+        /** SGMemoryTracker process.
+        * @brief The tracker every object of the process reports to.
+        */
+        static SGMemoryTracker &process();
+
+        /** SGMemoryTracker add.
+        * @brief Counts a new object.
+        * @param category The object type.
+        * @param bytes The memory it references.
+        */
+        void add(SGMemoryCategory category, uint64_t bytes);
+
+        /** SGMemoryTracker remove.
+        * @brief Uncounts an object, with the bytes it was last counted with.
+        */
+        void remove(SGMemoryCategory category, uint64_t bytes);
+
+        /** SGMemoryTracker resize.
+        * @brief An object now references new_bytes instead of old_bytes.
+        */
+        void resize(SGMemoryCategory category, uint64_t old_bytes, uint64_t new_bytes);
+
+        SGMemoryUsage getUsage() const;
+
+        uint64_t getTotalBytes() const;
+
+        /** SGMemoryTracker waitForBytesBelow.
+        * @brief Blocks until the total bytes drop to the limit or the timeout expires. Returns false on timeout.
+        * @param limit The total bytes to get down to.
+        * @param timeout How long to wait at most.
+        */
+        bool waitForBytesBelow(uint64_t limit, std::chrono::milliseconds timeout);
+
+    private:
+        std::atomic<uint64_t> counts_[(size_t) SGMemoryCategory::kCategoryCount];
+        std::atomic<uint64_t> bytes_[(size_t) SGMemoryCategory::kCategoryCount];
+        std::atomic<uint64_t> total_bytes_ {0};
+
+        std::mutex waiters_lock_;
+        std::condition_variable bytes_released_;
+        std::atomic<unsigned> waiter_count_ {0};
+
+        void released();
+
+        SGMemoryTracker(const SGMemoryTracker &) = delete;
+        SGMemoryTracker &operator=(const SGMemoryTracker &) = delete;
+    };
+}
+
+#endif //SGMEMORYTRACKER_H
@@ -0,0 +1,171 @@
+//
+//  SGMetrics.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGMETRICS_H
+#define SGMETRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SGHistogram.h"
+
+namespace Strata {
+    // Label name to value, i.e {"db", "db2"}
+    typedef std::map<std::string, std::string> SGMetricLabels;
+
+    /*
+     * Monotonic counter. increment() is lock-free and can be called from any thread.
+     */
+    class SGCounter {
+    public:
+        void increment(uint64_t count = 1) {
+            value_.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        uint64_t get() const {
+            return value_.load(std::memory_order_relaxed);
+        }
+
+        void reset() {
+            value_.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> value_ {0};
+    };
+
+    struct SGMetricsSnapshot {
+        struct Counter {
+            std::string name;
+            SGMetricLabels labels;
+            uint64_t value {0};
+        };
+
+        struct Histogram {
+            std::string name;
+            SGMetricLabels labels;
+            SGHistogramSnapshot snapshot;
+        };
+
+        // Sorted by name then labels
+        std::vector<Counter> counters;
+        std::vector<Histogram> histograms;
+
+        /** SGMetricsSnapshot toText.
+        * @brief Prometheus text format. Histograms are exported as summaries with the 50, 90, 99 and 99.9 percentiles,
+        * the JSON export also has their min and max.
+        */
+        std::string toText() const;
+
+        /** SGMetricsSnapshot toJson.
+        * @brief {"counters": [{"name", "labels", "value"}], "histograms": [{"name", "labels", "count", "sum", "min",
+        * "max", "mean", "p50", "p90", "p99", "p999"}]}
+        */
+        std::string toJson() const;
+    };
+
+    /*
+     * Registry of named counters and histograms, i.e to scrape without linking a metrics library.
+     * A metric is identified by its name and labels and created on first use. Metrics are never removed, so
+     * references stay valid for the lifetime of the registry: look them up once and record on the reference, recording
+     * is lock-free.
+     *
+     * All functions are thread safe.
+     */
+    class SGMetrics {
+    public:
+        SGMetrics();
+
+        virtual ~SGMetrics();
+
+        /** SGMetrics counter.
+        * @brief Returns the counter, creating it on first use.
+        * @param name The metric name, i.e "sg_database_documents_not_found_total".
+        * @param labels The labels telling it apart from other metrics with the same name.
+        */
+        SGCounter &counter(const std::string &name, const SGMetricLabels &labels = SGMetricLabels());
+
+        /** SGMetrics histogram.
+        * @brief Returns the histogram, creating it on first use. Include the unit in the name, i.e "_us" or "_bytes".
+        * @param name The metric name.
+        * @param labels The labels telling it apart from other metrics with the same name.
+        */
+        SGHistogram &histogram(const std::string &name, const SGMetricLabels &labels = SGMetricLabels());
+
+        SGMetricsSnapshot snapshot() const;
+
+        /** SGMetrics reset.
+        * @brief Zeroes every metric, the metrics stay registered.
+        */
+        void reset();
+
+    private:
+        typedef std::pair<std::string, SGMetricLabels> MetricKey;
+
+        mutable std::mutex lock_;
+        std::map<MetricKey, std::unique_ptr<SGCounter>> counters_;
+        std::map<MetricKey, std::unique_ptr<SGHistogram>> histograms_;
+
+        SGMetrics(const SGMetrics &) = delete;
+        SGMetrics &operator=(const SGMetrics &) = delete;
+    };
+
+    /*
+     * Latency histograms of an operation, one per status it returns. The histogram of a status is registered the first
+     * time the status is recorded, so statuses never returned cost nothing.
+     * record() is lock-free once the status was seen.
+     */
+    class SGOperationMetrics {
+    public:
+        static const size_t kMaxStatusCount = 32;
+
+        /** SGOperationMetrics.
+        * @param metrics The registry, must outlive this object.
+        * @param name The histogram name, i.e "sg_database_operation_latency_us".
+        * @param labels Labels of every status, a "status" label is added.
+        */
+        SGOperationMetrics(SGMetrics &metrics, const std::string &name, const SGMetricLabels &labels);
+
+        /** SGOperationMetrics record.
+        * @param status_index Index of the status, below kMaxStatusCount. Higher indexes are ignored.
+        * @param status_name Value of the "status" label.
+        * @param latency_us How long the operation took.
+        */
+        void record(size_t status_index, const char *status_name, uint64_t latency_us);
+
+    private:
+        SGMetrics &metrics_;
+        const std::string name_;
+        const SGMetricLabels labels_;
+        std::atomic<SGHistogram *> latency_us_[kMaxStatusCount];
+    };
+}
+
+#endif //SGMETRICS_H
@@ -31,6 +31,8 @@ namespace Strata {
     public:
         SGMutableDocument(SGDatabase *database, const std::string &docId);
 
+        virtual ~SGMutableDocument();
+
         template<typename T>
         void set(const std::string &key, T value) { mutable_dict_->set(key, value); }
 
@@ -44,6 +46,14 @@ namespace Strata {
         */
         bool setBody(const std::string &body);
 
+        /** SGMutableDocument setBlob.
+        * @brief Stores the blob under the key. Its content, see SGDatabase::saveBlob(), is pushed along with the
+        * document, and only again when the blob changes.
+        * @param key The reference to the key.
+        * @param blob The blob to store.
+        */
+        void setBlob(const std::string &key, const SGBlob &blob);
+
     private:
         fleece::alloc_slice alloc_slice_;
     };
@@ -0,0 +1,135 @@
+//
+//  SGProfiledMutex.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGPROFILEDMUTEX_H
+#define SGPROFILEDMUTEX_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "SGHistogram.h"
+
+namespace Strata {
+    struct SGLockStats {
+        uint64_t acquisition_count {0};     // Profiled acquisitions.
+        uint64_t contended_count {0};       // Acquisitions that waited for another thread to release the lock.
+        SGHistogramSnapshot wait_us;        // Time to acquire the lock, in microseconds.
+        SGHistogramSnapshot hold_us;        // Time the lock was held, in microseconds.
+        uint64_t longest_hold_us {0};       // Longest time the lock was held.
+        std::string longest_hold_operation; // Operation that held the lock for longest_hold_us.
+    };
+
+    /*
+     * std::mutex that can record how it's acquired: acquisition and contention counts, wait and hold time histograms,
+     * and which operation held it the longest. Used for the database and replicator locks, to measure whether they
+     * limit scaling.
+     * Profiling is off unless enabled with setProfilingEnabled(), or built with -DSG_LOCK_PROFILING=ON which turns it
+     * on by default. When off, lock() costs a relaxed atomic load over std::mutex.
+     *
+     * Meets the Lockable requirements, so std::lock_guard and std::unique_lock work with it. Use SGProfiledLock to
+     * name the operation holding the lock.
+     */
+    class SGProfiledMutex {
+    public:
+        SGProfiledMutex();
+
+        virtual ~SGProfiledMutex() {}
+
+        void lock() {
+            lock(nullptr);
+        }
+
+        /** SGProfiledMutex lock.
+        * @param operation What the lock is acquired for, reported by getStats() if it holds the lock the longest.
+        * Must be a string literal.
+        */
+        void lock(const char *operation);
+
+        bool try_lock();
+
+        void unlock();
+
+        /** SGProfiledMutex setProfilingEnabled.
+        * @brief Starts or stops profiling. Takes effect from the next acquisition, recorded stats are kept.
+        */
+        void setProfilingEnabled(bool enabled);
+
+        bool isProfilingEnabled() const;
+
+        SGLockStats getStats() const;
+
+        void resetStats();
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        std::mutex mutex_;
+        std::atomic<bool> profiling_enabled_;
+
+        // Set by the holder, only read by the holder
+        bool profiled_hold_ {false};
+        Clock::time_point acquired_at_;
+        const char *operation_ {nullptr};
+
+        std::atomic<uint64_t> acquisition_count_ {0};
+        std::atomic<uint64_t> contended_count_ {0};
+        SGHistogram wait_us_;
+        SGHistogram hold_us_;
+
+        // Only taken when a hold beats the longest one
+        mutable std::mutex longest_hold_lock_;
+        std::atomic<uint64_t> longest_hold_us_ {0};
+        const char *longest_hold_operation_ {nullptr};
+
+        void acquired(const char *operation, Clock::time_point requested_at, bool contended);
+
+        SGProfiledMutex(const SGProfiledMutex &) = delete;
+        SGProfiledMutex &operator=(const SGProfiledMutex &) = delete;
+    };
+
+    /*
+     * Like std::lock_guard, naming the operation holding the lock.
+     */
+    class SGProfiledLock {
+    public:
+        SGProfiledLock(SGProfiledMutex &mutex, const char *operation) : mutex_(mutex) {
+            mutex_.lock(operation);
+        }
+
+        ~SGProfiledLock() {
+            mutex_.unlock();
+        }
+
+    private:
+        SGProfiledMutex &mutex_;
+
+        SGProfiledLock(const SGProfiledLock &) = delete;
+        SGProfiledLock &operator=(const SGProfiledLock &) = delete;
+    };
+}
+
+#endif //SGPROFILEDMUTEX_H
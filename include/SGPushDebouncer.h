@@ -0,0 +1,192 @@
+//
+//  SGPushDebouncer.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGPUSHDEBOUNCER_H
+#define SGPUSHDEBOUNCER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SGDatabase.h"
+#include "SGScheduler.h"
+
+namespace Strata {
+    /*
+     * Push debouncing, see SGReplicatorConfiguration::setPushDebounce().
+     * Holds back the revisions of a document for a window starting at its first change, then pushes only its latest
+     * revision. LiteCore's push filter can only skip a revision for good, so once windows close their documents are
+     * handed to the releaser, which pushes their current revision without writing a new one, see
+     * SGReplicator::releaseDebouncedDocuments(). One release runs at a time, the documents whose window closes
+     * meanwhile go with the next one.
+     * The pending documents are kept in a local document of the database, see SGDatabase::saveLocalDocument(), one per
+     * replicator, so the ones held back when the process stopped are released by restore() on the next start. The
+     * record is written in batches on the worker, shortly after the pending documents changed.
+     *
+     * All functions are thread safe.
+     */
+    class SGPushDebouncer {
+    public:
+        /** SGPushDebouncer.
+        * @brief Creates the debouncer, configure() turns it on.
+        * @param scheduler Runs the window timers, never blocked by the debouncer.
+        * @param worker Runs the database writes and the releaser, which may block.
+        * @param releaser Starts pushing the current revision of the documents, onReleased() must be called once it's
+        * done. Returns false if it couldn't start, e.g the replicator isn't running.
+        */
+        SGPushDebouncer(SGScheduler &scheduler, SGScheduler &worker,
+                        const std::function<bool(const std::vector<std::string> &doc_ids)> &releaser);
+
+        virtual ~SGPushDebouncer();
+
+        /** SGPushDebouncer configure.
+        * @brief Set the database and the documents to debounce. Pending documents are kept.
+        * @param database The local database of the replicator.
+        * @param replicator_key Identifies the replicator in the database, i.e its endpoint URL, so replicators sharing
+        * the database keep their own pending documents.
+        * @param window How long revisions are held back, zero disables debouncing.
+        * @param doc_id_prefixes Only documents with one of these ID prefixes are debounced, all of them if empty.
+        */
+        void configure(SGDatabase *database, const std::string &replicator_key, const std::chrono::milliseconds &window,
+                       const std::vector<std::string> &doc_id_prefixes);
+
+        /** SGPushDebouncer shouldPush.
+        * @brief Called from the push filter. Returns false if the revision is held back. Doesn't touch the database.
+        * @param doc_id The document ID.
+        * @param deleted True for a deletion, which is never held back.
+        */
+        bool shouldPush(const std::string &doc_id, bool deleted);
+
+        /** SGPushDebouncer restore.
+        * @brief Releases the documents still pending when the process stopped, and the ones whose window closed while
+        * the replicator wasn't running. Call after configure(), once the replicator runs. The documents are released on
+        * the worker.
+        */
+        void restore();
+
+        /** SGPushDebouncer flush.
+        * @brief Closes every pending window now and writes the pending documents, e.g before stopping the replicator.
+        * Their latest revision is released by restore() on the next start.
+        */
+        void flush();
+
+        /** SGPushDebouncer onReleased.
+        * @brief Called once a release started by the releaser is over.
+        * @param doc_ids The released documents.
+        * @param pushed True if their current revision reached the server, false to retry them after another window.
+        */
+        void onReleased(const std::vector<std::string> &doc_ids, bool pushed);
+
+        /** SGPushDebouncer isPending.
+        * @brief Returns true if the document has a revision held back, or released but not pushed yet.
+        */
+        bool isPending(const std::string &doc_id);
+
+        std::vector<std::string> getPendingDocumentIds();
+
+        /** SGPushDebouncer getHeldBackCount.
+        * @brief Number of revisions held back so far, i.e that never went on the wire.
+        */
+        uint64_t getHeldBackCount() const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        SGScheduler &scheduler_;
+        SGScheduler &worker_;
+        const std::function<bool(const std::vector<std::string> &doc_ids)> releaser_;
+
+        // Local document keeping the pending document IDs, followed by the replicator key.
+        static constexpr const char *kPendingDocumentsKeyPrefix = "SGPushDebouncer.pending:";
+
+        // Delay batching the writes of the pending documents. Well under the time LiteCore takes to save its
+        // checkpoint, so a crash rarely loses a held back revision.
+        static constexpr std::chrono::milliseconds kPersistDelay {250};
+
+        // Shortest wait before releasing a document again, when debouncing is off.
+        static constexpr std::chrono::milliseconds kMinRetryWindow {1000};
+
+        // Serializes writes of the pending documents, so the last one written is the latest
+        std::mutex persist_lock_;
+
+        std::mutex debouncer_lock_;
+        SGDatabase *database_ {nullptr};
+        std::string pending_documents_key_;
+        std::chrono::milliseconds window_ {0};
+        std::vector<std::string> doc_id_prefixes_;
+        // Documents held back, true once their window closed and the next revision can go
+        std::unordered_map<std::string, bool> pending_documents_;
+        // Open windows by end time. Every window has the same length so this stays sorted, and a single scheduler
+        // task for the first one is enough however many documents are pending.
+        std::deque<std::pair<Clock::time_point, std::string>> windows_;
+        SGScheduler::TaskId window_task_ {0};
+        // Window closed, waiting for a release
+        std::vector<std::string> releasable_doc_ids_;
+        bool releasing_ {false};
+        bool persist_scheduled_ {false};
+
+        std::atomic<uint64_t> held_back_count_ {0};
+
+        bool matches(const std::string &doc_id) const;
+
+        /** SGPushDebouncer schedulePersist.
+        * @brief Writes the pending documents on the worker shortly. Called internally inside locked functions.
+        */
+        void _schedulePersist();
+
+        /** SGPushDebouncer persist.
+        * @brief Writes the pending document IDs to the database. Called without debouncer_lock_, on the worker.
+        */
+        void persist();
+
+        /** SGPushDebouncer openWindow.
+        * @brief Holds the document back until its window closes. Called internally inside locked functions.
+        */
+        void _openWindow(const std::string &doc_id, const std::chrono::milliseconds &window);
+
+        /** SGPushDebouncer closeWindows.
+        * @brief Scheduler task: queues the documents whose window is over for release and schedules the next window
+        * end.
+        */
+        void closeWindows();
+
+        /** SGPushDebouncer scheduleRelease.
+        * @brief Hands the queued documents to the releaser on the worker, unless a release is running. Called
+        * internally inside locked functions.
+        */
+        void _scheduleRelease();
+
+        /** SGPushDebouncer release.
+        * @brief Worker task: starts releasing the documents, they stay pending if the releaser can't start.
+        */
+        void release(const std::vector<std::string> &doc_ids);
+    };
+}
+
+#endif //SGPUSHDEBOUNCER_H
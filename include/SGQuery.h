@@ -0,0 +1,94 @@
+//
+//  SGQuery.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGQUERY_H
+#define SGQUERY_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <litecore/c4.h>
+
+namespace Strata {
+    class SGDatabase;
+
+    // A query that ran longer than the threshold, see SGDatabase::setSlowQueryThreshold().
+    struct SGSlowQuery {
+        std::string query;          // The JSON query
+        std::string parameters;     // The JSON parameters, empty if none
+        uint64_t row_count {0};
+        uint64_t duration_us {0};   // From running the query to reading its last row
+        bool full_scan {false};     // The plan reads every document instead of using an index
+        std::string plan;           // See SGQuery::explain()
+        std::chrono::system_clock::time_point finished_at;
+    };
+
+    /*
+     * A query compiled once and run as many times as needed, with different parameters. Queries use the LiteCore
+     * JSON query schema, i.e ["SELECT", {"WHAT": [["._id"]], "WHERE": ["=", [".type"], ["$type"]]}].
+     * Runs longer than the database's slow query threshold are logged, see SGDatabase::getSlowQueries().
+     *
+     * Thread safe, the functions serialize on the database lock. Destroy queries before closing the database.
+     */
+    class SGQuery {
+    public:
+        SGQuery(SGDatabase *database, const std::string &json_query);
+
+        virtual ~SGQuery();
+
+        /** SGQuery isValid.
+        * @brief False if the query couldn't be compiled, i.e invalid JSON or the database isn't open.
+        */
+        bool isValid() const;
+
+        const std::string &getQuery() const;
+
+        /** SGQuery run.
+        * @brief Runs the query and appends each row, its columns as a JSON array. True on success, false otherwise.
+        * @param rows The rows to append to.
+        * @param parameters The values of the query's $ parameters as a JSON dictionary, i.e {"type": "user"}.
+        */
+        bool run(std::vector<std::string> &rows, const std::string &parameters = std::string());
+
+        /** SGQuery explain.
+        * @brief Returns the SQL the query was translated to and the SQLite query plan, empty on error. A plan with
+        * "SCAN TABLE kv_default", or "SCAN kv_default" since SQLite 3.36, reads every document: the query needs an
+        * index. Explained once per compiled query.
+        */
+        std::string explain();
+
+    private:
+        SGDatabase *database_ {nullptr};
+        C4Query *c4query_ {nullptr};
+        std::string query_;
+        std::string plan_;// Set on the first explain, guarded by the database lock
+
+        SGQuery(const SGQuery &) = delete;
+        SGQuery &operator=(const SGQuery &) = delete;
+    };
+}
+
+#endif //SGQUERY_H
@@ -25,10 +25,25 @@
 #ifndef SGREPLICATOR_H
 #define SGREPLICATOR_H
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <litecore/c4.h>
 
 #include "SGDatabase.h"
+#include "SGDocumentEventQueue.h"
+#include "SGProfiledMutex.h"
+#include "SGPushDebouncer.h"
 #include "SGReplicatorConfiguration.h"
+#include "SGReplicatorStats.h"
+#include "SGRevisionPipeline.h"
+#include "SGScheduler.h"
 namespace Strata {
     typedef struct {
         uint64_t completed;// The number of completed changes processed.
@@ -36,6 +51,39 @@ namespace Strata {
         uint64_t document_count;// Number of documents transferred so far.
     } SGReplicatorProgress;
 
+    typedef struct {
+        bool is_error;// True if the replication ended because of an error.
+        std::string error_message;// Description of the error, empty if there wasn't one.
+        SGReplicatorProgress progress;// Progress at the time the replicator stopped.
+    } SGReplicatorCompletion;
+
+    typedef struct {
+        bool pushing;// True for an upload, false for a download.
+        std::string doc_id;// Document referencing the blob.
+        std::string property;// Path of the blob in the document.
+        std::string digest;// See SGBlob::getDigest().
+        uint64_t bytes_completed;// Bytes transferred so far.
+        uint64_t bytes_total;// Size of the blob.
+        bool is_error;// True if the transfer failed.
+        std::string error_message;// Description of the error, empty if there wasn't one.
+    } SGBlobProgress;
+
+    typedef struct {
+        bool pushed;// True if the revision, or a newer one, reached the server.
+        bool timed_out;// True if the timeout expired first.
+        std::string error_message;// Why the revision wasn't pushed, empty if it was or the wait timed out.
+    } SGPushCompletion;
+
+    typedef struct {
+        std::vector<std::string> added_channels;// Channels the update added.
+        std::vector<std::string> removed_channels;// Channels the update removed.
+        bool restarted;// True if the replicator had to restart, see SGReplicator::updateChannels().
+        bool is_error;// True if the new channels could not be fetched.
+        std::string error_message;// Description of the error, empty if there wasn't one.
+        uint64_t duration_ms;// Time from the update to the new channels being caught up.
+        uint64_t document_count;// Documents pulled to catch up.
+    } SGChannelUpdate;
+
     enum class SGReplicatorReturnStatus {
         kNoError,
         kStillRunning,
@@ -57,7 +105,8 @@ namespace Strata {
      * Warning: This object can be initialized only once in the program life cycle. See constructor for more information.
      *
      * Thread safe is guaranteed on these functions:
-     * start(), stop(),
+     * start(), stop(), getStats(), getPendingDocumentIds(), isDocumentPending(), waitForPush(), setLockProfilingEnabled(),
+     * getLockStats()
      */
     class SGReplicator {
     public:
@@ -102,6 +151,21 @@ namespace Strata {
         void restart();
 
 
+        /** SGReplicator updateChannels.
+        * @brief Change the pulled channels without restarting the replicator. Added channels are fetched in the
+        * background by a pull-only replicator for just those channels: one more connection to the server, with its own
+        * authentication and checkpoint, per update. The running connection and its checkpoint are kept, automatic
+        * reconnections included, each replicator reconnects with its own channels.
+        * Removing a channel the replicator started with does need a restart, LiteCore can't narrow a running pull.
+        * start() and restart() pull every channel again on a single connection, with a new checkpoint: that walks the
+        * change feed of every channel again.
+        * If the replicator isn't running this is the same as SGReplicatorConfiguration::setChannels(). Thread Safe.
+        * @param channels The complete list of channels to pull.
+        * @param callback Called once the added channels are caught up, on a replicator thread. May be nullptr.
+        */
+        SGReplicatorReturnStatus updateChannels(const std::vector<std::string> &channels,
+                                                const std::function<void(const SGChannelUpdate &update)> &callback = nullptr);
+
         /** SGReplicator free.
         * @brief Free the replicator (make sure to stop() it first and wait till it ends).
         */
@@ -121,29 +185,151 @@ namespace Strata {
                 const std::function<void(bool pushing, std::string doc_id, std::string error_message, bool is_error,
                                          bool error_is_transient)> &callback);
 
+        /** SGReplicator setDocumentEventQueue.
+        * @brief Queue document ended events for the application to drain in batches on its own thread, instead of
+        * (or in addition to) calling the addDocumentEndedListener callback on the replicator thread.
+        * Must be set before start() and outlive the replicator. Pass nullptr to stop queuing.
+        * @param document_event_queue The queue to push events to.
+        */
+        void setDocumentEventQueue(SGDocumentEventQueue *document_event_queue);
+
+        /** SGReplicator setRevisionPipeline.
+        * @brief Run the addValidationListener callback on the pipeline's workers instead of the puller thread, so a
+        * slow callback doesn't hold up the pull. The revision is loaded back by its revID once LiteCore saved it and
+        * handed to the pipeline. Revisions that failed to save are skipped. Revisions of a document are still
+        * handled in order. If the pipeline was stopped the callback runs on the replicator thread instead. Must be set before start() and outlive the replicator.
+        * Pass nullptr to run the callback on the puller thread again.
+        * @param revision_pipeline The pipeline to hand revisions to.
+        */
+        void setRevisionPipeline(SGRevisionPipeline *revision_pipeline);
+
         /** SGReplicator addValidationListener.
         * @brief Adds the callback function to the replicator's validationFunc event. All incoming revisions from SyncGateway will be accepted!
+        * Without a revision pipeline the callback runs on the puller thread before the revision is saved: the
+        * database still holds the previous revision, json_body is the incoming one. See setRevisionPipeline().
         * @param callback The callback function.
         */
         void addValidationListener(
                 const std::function<void(const std::string &doc_id, const std::string &json_body)> &callback);
 
+        /** SGReplicator addBlobProgressListener.
+        * @brief Adds the callback function to the replicator's onBlobProgress event, called as blobs are uploaded and
+        * downloaded. Must be set before start(). Not reported by the kInitialSync profile.
+        * @param callback The callback function, called on a replicator thread.
+        */
+        void addBlobProgressListener(const std::function<void(const SGBlobProgress &progress)> &callback);
+
         /** SGReplicator getReplicatorConfig.
         * @brief Returns the current replicator configuration
         */
         SGReplicatorConfiguration* getReplicatorConfig();
 
+        /** SGReplicator getCompletion.
+        * @brief Returns a future resolved when the replicator stops for good: a one-shot replicator reached the end of
+        * the change feed, stop() was called or an error ended the replication. Automatic reconnections and restart()
+        * don't resolve it. If the replicator isn't running, the future belongs to the next start(). Thread Safe.
+        */
+        std::shared_future<SGReplicatorCompletion> getCompletion();
+
+        /** SGReplicator getPendingDocumentIds.
+        * @brief Returns the IDs of the local documents with changes not pushed yet, including the ones held back by
+        * the push debouncing. Empty if the replicator isn't running or doesn't push. Thread Safe.
+        */
+        std::vector<std::string> getPendingDocumentIds();
+
+        /** SGReplicator isDocumentPending.
+        * @brief Returns true if the document has changes not pushed yet, cheaper than getPendingDocumentIds(). Thread Safe.
+        * @param doc_id The document ID.
+        */
+        bool isDocumentPending(const std::string &doc_id);
+
+        /** SGReplicator waitForPush.
+        * @brief Returns a future resolved once the current revision of the document, or a newer one, was pushed.
+        * It also resolves when the push fails for good, the replicator stops for good or the timeout expires, see
+        * SGPushCompletion. Resolved right away if the document has nothing pending, and as not pushed, with an error,
+        * if the replicator is configured not to push. While the replicator isn't running it waits for the next start().
+        * Relies on the per document notifications (progress level kNotifyOnEveryDocumentChange or more), which a
+        * pushing replicator always keeps, see SGReplicatorConfiguration::setSyncProfile(). Thread Safe.
+        * @param doc_id The document ID.
+        * @param timeout How long to wait for the push.
+        */
+        std::shared_future<SGPushCompletion> waitForPush(const std::string &doc_id, const std::chrono::milliseconds &timeout);
+
+        /** SGReplicator getStats.
+        * @brief Returns a snapshot of the replication throughput, latency and error counters. Thread Safe.
+        */
+        SGReplicatorStats getStats();
+
+        /** SGReplicator addStatsListener.
+        * @brief Calls the callback function periodically with a fresh getStats() snapshot. The callback runs on its own
+        * internal thread, a slow callback only delays the next one.
+        * @param callback The callback function.
+        * @param interval Time between two callbacks.
+        */
+        void addStatsListener(const std::function<void(const SGReplicatorStats &stats)> &callback,
+                              const std::chrono::milliseconds &interval = std::chrono::milliseconds(5000));
+
+        /** SGReplicator setLockProfilingEnabled.
+        * @brief Profiles the lock serializing start(), stop(), the status callbacks and the pending push queries, see
+        * getLockStats().
+        * @param enabled Whether acquisitions are profiled.
+        */
+        void setLockProfilingEnabled(bool enabled);
+
+        /** SGReplicator getLockStats.
+        * @brief Acquisitions, contention, wait and hold times of the replicator lock, and the operation that held it
+        * the longest, since profiling was enabled.
+        */
+        SGLockStats getLockStats() const;
+
     private:
         C4Replicator *c4replicator_{nullptr};
         SGReplicatorConfiguration *replicator_configuration_{nullptr};
         C4ReplicatorParameters replicator_parameters_;
         C4Error c4error_ {};
-        std::mutex replicator_lock_;
+        SGProfiledMutex replicator_lock_;
 
         std::function<void(SGReplicator::ActivityLevel, SGReplicatorProgress progress)> on_status_changed_callback_;
         std::function<void(bool pushing, std::string doc_id, std::string error_message, bool is_error,
                            bool error_is_transient)> on_document_error_callback_;
         std::function<void(const std::string &doc_id, const std::string &json_body)> on_validation_callback_;
+        std::function<void(const SGBlobProgress &progress)> on_blob_progress_callback_;
+        SGDocumentEventQueue *document_event_queue_ {nullptr};
+        SGRevisionPipeline *revision_pipeline_ {nullptr};
+        std::function<void(const SGReplicatorStats &stats)> on_stats_callback_;
+
+        // Timers only, its tasks never block: the stats sampling, the waitForPush() timeouts and the debounce windows.
+        SGScheduler scheduler_;
+        // Runs the internal work that may block: the connect watchdog and the lane restarts, which take
+        // replicator_lock_, and the database reads and writes of the stats collector and the push debouncer.
+        SGScheduler worker_;
+        // Runs the application's stats listener, a slow listener only delays itself.
+        SGScheduler listener_scheduler_;
+        SGScheduler::TaskId stats_sampling_task_ {0};
+        SGScheduler::TaskId stats_listener_task_ {0};
+        SGReplicatorStatsCollector stats_collector_ {worker_};
+
+        // See SGReplicatorConfiguration::setPushDebounce()
+        SGPushDebouncer push_debouncer_ {scheduler_, worker_, [this](const std::vector<std::string> &doc_ids) {
+            return releaseDebouncedDocuments(doc_ids);
+        }};
+
+        // kInitialSync profile in effect for this run, only on an empty database. Set by start().
+        bool initial_sync_ = false;
+
+        // Push-only replicator for high priority documents, see SGReplicatorConfiguration::setPriorityDocIdPrefixes().
+        // Guarded by replicator_lock_, frees itself once stopped.
+        C4Replicator *priority_c4replicator_{nullptr};
+        bool priority_lane_enabled_ = false;
+
+        // One-shot push replicator releasing debounced documents, see releaseDebouncedDocuments(). Guarded by
+        // replicator_lock_, frees itself once stopped.
+        C4Replicator *release_c4replicator_{nullptr};
+        std::vector<std::string> released_doc_ids_;
+        bool release_stopped_ = false;// Stopped by stop(), its documents may not be pushed
+
+        // Rates in SGReplicatorStats are computed over this window.
+        static constexpr std::chrono::milliseconds::rep kStatsSamplingIntervalMs = 1000;
 
         /** SGReplicator setReplicatorType.
         * @brief Set the replicator type to the C4ReplicatorParameters.
@@ -153,19 +339,186 @@ namespace Strata {
 
         bool isValidSGReplicatorConfiguration();
 
+        /** SGReplicator needsDocumentNotifications.
+        * @brief Whether waitForPush(), the push stats, the debouncer, the document listeners, the revision pipeline or
+        * the conflict policy rely on onDocumentEnded callbacks, which need a progress level of at least kNotifyOnEveryDocumentChange.
+        */
+        bool needsDocumentNotifications();
+
+        /** SGReplicator replicatorOptions.
+        * @brief The configuration's options, with base_channels_ and with the progress level raised when blob progress
+        * is listened to. Called internally inside locked functions.
+        */
+        fleece::Retained<fleece::impl::MutableDict> replicatorOptions();
+
+        /** SGReplicator startReplicator.
+        * @brief Implements start().
+        * @param merge_channels True to pull every configured channel on the replicator and stop the channel lanes,
+        * false to keep the channels of each replicator, see updateChannels().
+        */
+        SGReplicatorReturnStatus startReplicator(bool merge_channels);
+
         /** SGReplicator automatedRestart.
         * @brief Internal function used to automatically attempt to reconnect the replication if it is unintentionally stopped.
         * @param delay_seconds Time, in seconds, to wait before each attempt at reconnection.
         */
         SGReplicatorReturnStatus automatedRestart(const int &delay_seconds);
 
+        /** SGReplicator getPendingPushCount.
+        * @brief Number of local documents not pushed yet. Called internally inside locked functions.
+        */
+        uint64_t _getPendingPushCount();
+
+        std::vector<std::string> _getPendingDocumentIds();
+
+        bool _isDocumentPending(const std::string &doc_id);
+
+        // Waiting on waitForPush(). Guarded by push_waiters_lock_, which is never held while calling LiteCore.
+        struct PushWaiter {
+            unsigned generation {0};// Revision generation to wait for
+            std::chrono::steady_clock::time_point deadline;
+            std::promise<SGPushCompletion> promise;
+        };
+        std::mutex push_waiters_lock_;
+        std::unordered_multimap<std::string, std::shared_ptr<PushWaiter>> push_waiters_;
+        SGScheduler::TaskId push_waiters_task_ {0};
+
+        // How often the waitForPush() timeouts are checked.
+        static const unsigned kPushWaiterCheckIntervalMs = 100;
+
+        /** SGReplicator onRevisionPulled.
+        * @brief Loads the revision LiteCore saved and hands it to the revision pipeline. Does nothing if it couldn't
+        * be saved.
+        * @param doc_id The document pulled.
+        * @param rev_id The revision pulled.
+        */
+        void onRevisionPulled(const std::string &doc_id, C4String rev_id, const C4Error &error);
+
+        /** SGReplicator onDocumentPushed.
+        * @brief Resolves the waiters of a document once a revision of it was pushed or failed for good.
+        */
+        void onDocumentPushed(const std::string &doc_id, C4String rev_id, const C4Error &error, bool error_is_transient);
+
+        /** SGReplicator expirePushWaiters.
+        * @brief Scheduler task: resolves the waiters whose timeout expired.
+        */
+        void expirePushWaiters();
+
+        /** SGReplicator resolvePushWaiters.
+        * @brief Resolves every waiter, e.g when the replicator stops for good.
+        */
+        void resolvePushWaiters(const std::string &error_message);
+
+        /** SGReplicator startPriorityLane.
+        * @brief Starts the priority push replicator if it isn't running. Called internally inside locked functions.
+        */
+        void _startPriorityLane();
+
+        /** SGReplicator pushFilter.
+        * @brief Push filter of the main replicator: leaves high priority documents to the priority lane and applies
+        * the push debouncing.
+        */
+        static bool pushFilter(C4String docID, C4RevisionFlags flags, FLDict body, void *context);
+
+        /** SGReplicator priorityPushFilter.
+        * @brief Push filter of the priority lane: only high priority documents, debounced too.
+        */
+        static bool priorityPushFilter(C4String docID, C4RevisionFlags flags, FLDict body, void *context);
+
+        /** SGReplicator releaseDebouncedDocuments.
+        * @brief Releaser of the push debouncer: starts a one-shot push replicator for just these documents, which pushes
+        * their current revision without saving a new one. Returns false if the replicator isn't running or a release
+        * is still running.
+        */
+        bool releaseDebouncedDocuments(const std::vector<std::string> &doc_ids);
+
+        /** SGReplicator onReleaseStatusChanged.
+        * @brief Status callback of the release replicator: frees it once stopped and tells the push debouncer.
+        */
+        static void onReleaseStatusChanged(C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context);
+
+        /** SGReplicator onPriorityStatusChanged.
+        * @brief Status callback of the priority lane: frees it once stopped and retries it after an error when the
+        * reconnection policy asks for it.
+        */
+        static void onPriorityStatusChanged(C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context);
+
         // c4repl_stop is async and we need to track it so we don't endup with running another replicator.
         // When Activity status changed to stopped then we can free the replicator.
         SGReplicatorInternalStatus internal_status_ = SGReplicatorInternalStatus::kStopped;
 
+        // Completion of the current run, see getCompletion()
+        std::promise<SGReplicatorCompletion> completion_promise_;
+        std::shared_future<SGReplicatorCompletion> completion_future_;
+        bool completion_pending_ = false;
+        std::mutex completion_lock_;
+
+        /** SGReplicator resolveCompletion.
+        * @brief Resolve the completion future of the current run, if anyone can still wait on it.
+        * @param replicator_status The final status of the replicator.
+        */
+        void resolveCompletion(const C4ReplicatorStatus &replicator_status);
+
+        // Channel updates, see updateChannels(). Lock order: replicator_lock_, then channel_lock_. The channel lanes'
+        // status callbacks only use channel_lock_, so they never wait on a thread waiting for the replicator.
+        struct ChannelLane {
+            std::vector<std::string> channels;// Pulled by the lane
+            C4Replicator *c4replicator {nullptr};// Pull-only replicator for the channels, nullptr if not running
+            std::chrono::steady_clock::time_point started_at;
+            bool armed {false};// A restart update only reports once the restarted replicator catches up
+            bool reported {false};
+            SGChannelUpdate update;
+            std::function<void(const SGChannelUpdate &update)> callback;
+        };
+        std::mutex channel_lock_;
+        std::vector<std::shared_ptr<ChannelLane>> channel_lanes_;
+        std::shared_ptr<ChannelLane> restart_channel_update_;// Waiting for the replicator restart
+        // Channels of c4replicator_, kept by the automatic reconnections. Guarded by replicator_lock_.
+        std::vector<std::string> base_channels_;
+
+        /** SGReplicator startChannelLane.
+        * @brief Starts the pull replicator of a channel lane. Returns false if it failed. Called internally inside
+        * locked functions (both locks).
+        */
+        bool _startChannelLane(const std::shared_ptr<ChannelLane> &lane);
+
+        /** SGReplicator restartChannelLanes.
+        * @brief Starts the channel lanes that aren't running, when the replicator reconnects. Called internally inside
+        * locked functions (both locks).
+        */
+        void _restartChannelLanes();
+
+        /** SGReplicator stopChannelLanes.
+        * @brief Stops every channel lane, they free themselves. Called internally inside locked functions (both locks).
+        */
+        void _stopChannelLanes();
+
+        /** SGReplicator onChannelLaneStatusChanged.
+        * @brief Status callback of the channel lanes: reports the update once caught up and frees the lane when stopped.
+        */
+        static void onChannelLaneStatusChanged(C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context);
+
+        /** SGReplicator checkRestartChannelUpdate.
+        * @brief Reports a channel update that needed a restart once the restarted replicator catches up.
+        */
+        void checkRestartChannelUpdate(const C4ReplicatorStatus &replicator_status);
+
+        static void reportChannelUpdate(ChannelLane &lane, const C4ReplicatorStatus &replicator_status);
+
         // Replication restarting control flags
         bool replicator_can_restart_ = true;
         bool manual_restart_requested_ = false;
+
+        // Connect timeout, see SGReplicatorConfiguration::setConnectTimeout()
+        SGScheduler::TaskId connect_watchdog_task_ {0};
+        std::mutex connect_watchdog_lock_;
+        std::atomic<bool> connection_timed_out_ {false};
+
+        /** SGReplicator watchConnection.
+        * @brief Arms the connect timeout when the replicator starts connecting, disarms it on any other level.
+        * @param level The new replicator activity level.
+        */
+        void watchConnection(C4ReplicatorActivityLevel level);
     };
 }
 
@@ -25,10 +25,17 @@
 #ifndef SGREPLICATORCONFIGURATION_H
 #define SGREPLICATORCONFIGURATION_H
 
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 #include "SGDatabase.h"
 #include "SGURLEndpoint.h"
 #include "SGAuthenticator.h"
+#include "SGBandwidthLimiter.h"
+#include "SGSocketFactory.h"
 namespace Strata {
     class SGReplicatorConfiguration {
     public:
@@ -49,6 +56,16 @@ namespace Strata {
             kPull
         };
 
+        enum class ReplicatorMode {
+            kContinuous = 0,    // Keep replicating until stopped
+            kOneShot            // Stop once caught up with the end of the change feed
+        };
+
+        enum class SyncProfile {
+            kDefaultProfile = 0,
+            kInitialSync        // Bounded catch-up of a new node, see setSyncProfile()
+        };
+
         enum class ConflictResolutionPolicy {
             kDefaultBehavior,
             kResolveToRemoteRevision
@@ -61,6 +78,8 @@ namespace Strata {
 
         friend std::ostream& operator << (std::ostream& os, const ReplicatorType& rep_type);
 
+        friend std::ostream& operator << (std::ostream& os, const ReplicatorMode& rep_mode);
+
         SGDatabase *getDatabase() const;
 
         void setDatabase(SGDatabase *database);
@@ -73,16 +92,53 @@ namespace Strata {
 
         void setReplicatorType(ReplicatorType replicator_type);
 
+        ReplicatorMode getReplicatorMode() const;
+
+        /** SGReplicatorConfiguration setReplicatorMode.
+        * @brief Set whether the replicator runs continuously or stops at the end of the change feed. This option should be set before the replicator is started.
+        * @param replicator_mode The desired replicator mode.
+        */
+        void setReplicatorMode(ReplicatorMode replicator_mode);
+
+        SyncProfile getSyncProfile() const;
+
+        /** SGReplicatorConfiguration setSyncProfile.
+        * @brief Tune the replicator for a workload. kInitialSync runs one-shot, skips deleted documents, only reports
+        * progress at the end and checkpoints less often, trading per-document notifications for catch-up speed.
+        * It only applies to an empty database: the checkpoint is kept by later runs, so deletions skipped on a database
+        * with documents would never be pulled. Per-document notifications stay on when the replicator pushes, has a
+        * document ended listener or event queue, or resolves conflicts to the remote revision.
+        * This option should be set before the replicator is started.
+        * @param sync_profile The desired sync profile.
+        */
+        void setSyncProfile(SyncProfile sync_profile);
+
         void setAuthenticator(SGAuthenticator *authenticator);
 
         const SGAuthenticator *getAuthenticator() const;
 
+        SGAuthenticator *getAuthenticator();
+
         void setChannels(const std::vector<std::string> &channels);
 
+        const std::vector<std::string> &getChannels() const;
+
+        /** SGReplicatorConfiguration setSocketFactory.
+        * @brief Use a custom transport instead of the default civetweb WebSocket. The factory must outlive the
+        * replicator. Pass nullptr to go back to the default. This option should be set before the replicator is started.
+        * @param socket_factory The socket factory to use.
+        */
+        void setSocketFactory(SGSocketFactory *socket_factory);
+
+        SGSocketFactory *getSocketFactory() const;
+
         /** SGReplicatorConfiguration effectiveOptions.
         * @brief Initialize and build the options for the replicator
+        * @param sync_profile The profile to apply, the replicator falls back to kDefaultProfile when kInitialSync
+        * doesn't apply.
+        * @param document_notifications Whether the replicator needs its onDocumentEnded callbacks.
         */
-        fleece::Retained<fleece::impl::MutableDict> effectiveOptions();
+        fleece::Retained<fleece::impl::MutableDict> effectiveOptions(SyncProfile sync_profile, bool document_notifications);
 
         /** SGReplicatorConfiguration isValid.
         * @brief Validate database_ and url_endpoint_ references.
@@ -122,23 +178,122 @@ namespace Strata {
         */
         int getReconnectionTimer();
 
+        /** SGReplicatorConfiguration setHeartbeatInterval.
+        * @brief Set how often a WebSocket ping is sent to keep the connection alive and find dead peers. 0 keeps
+        * LiteCore's default (5 minutes). This option should be set before the replicator is started.
+        * @param heartbeat_interval_sec The heartbeat interval, in seconds.
+        */
+        void setHeartbeatInterval(const unsigned int &heartbeat_interval_sec);
+
+        unsigned int getHeartbeatInterval() const;
+
+        /** SGReplicatorConfiguration setIdleTimeout.
+        * @brief Set how long a connection can go without receiving anything before it is considered dead, which
+        * takes the replicator offline so the reconnection policy applies. Should be a few heartbeat intervals.
+        * Enforced by the SG socket factories (see setSocketFactory()), 0 disables it.
+        * This option should be set before the replicator is started.
+        * @param idle_timeout_sec The idle timeout, in seconds.
+        */
+        void setIdleTimeout(const unsigned int &idle_timeout_sec);
+
+        unsigned int getIdleTimeout() const;
+
+        /** SGReplicatorConfiguration setConnectTimeout.
+        * @brief Set how long the replicator can stay connecting, handshake included, before giving up on the
+        * attempt. The replicator then goes offline and the reconnection policy applies. 0 waits for the OS timeout.
+        * This option should be set before the replicator is started.
+        * @param connect_timeout_sec The connect timeout, in seconds.
+        */
+        void setConnectTimeout(const unsigned int &connect_timeout_sec);
+
+        unsigned int getConnectTimeout() const;
+
+        /** SGReplicatorConfiguration setPushDebounce.
+        * @brief Coalesce the revisions of rapidly changing documents: the first change of a document starts the window,
+        * and only its latest revision is pushed once the window is over. Deletions are never held back.
+        * The latest revisions are pushed by a short one-shot push replicator for just those documents, an extra
+        * connection to the server whenever windows close, one at a time. No new revision is saved.
+        * A zero window disables it. This option should be set before the replicator is started.
+        * @param window How long the revisions of a document are held back.
+        * @param doc_id_prefixes Only debounce documents with one of these ID prefixes, every document if empty.
+        */
+        void setPushDebounce(const std::chrono::milliseconds &window,
+                             const std::vector<std::string> &doc_id_prefixes = std::vector<std::string>());
+
+        std::chrono::milliseconds getPushDebounceWindow() const;
+
+        const std::vector<std::string> &getPushDebounceDocIdPrefixes() const;
+
+        /** SGReplicatorConfiguration setPriorityDocIdPrefixes.
+        * @brief Push documents with one of these ID prefixes on a priority lane, so they don't wait behind bulk changes.
+        * The lane is a second push connection to the same endpoint. Empty (the default) disables it unless a priority
+        * filter is set. This option should be set before the replicator is started.
+        * @param doc_id_prefixes The document ID prefixes of high priority documents.
+        */
+        void setPriorityDocIdPrefixes(const std::vector<std::string> &doc_id_prefixes);
+
+        const std::vector<std::string> &getPriorityDocIdPrefixes() const;
+
+        /** SGReplicatorConfiguration setPriorityFilter.
+        * @brief Like setPriorityDocIdPrefixes(), with a function returning true for high priority documents. It runs on
+        * the replicator thread for every outgoing revision, keep it cheap. Pass nullptr to remove it.
+        * This option should be set before the replicator is started.
+        * @param priority_filter The filter, called with the document ID.
+        */
+        void setPriorityFilter(const std::function<bool(const std::string &doc_id)> &priority_filter);
+
+        /** SGReplicatorConfiguration hasPriorityLane.
+        * @brief True if priority prefixes or a priority filter are set.
+        */
+        bool hasPriorityLane() const;
+
+        /** SGReplicatorConfiguration isPriorityDocument.
+        * @brief True if the document goes on the priority lane.
+        * @param doc_id The document ID.
+        */
+        bool isPriorityDocument(const std::string &doc_id) const;
+
+        /** SGReplicatorConfiguration setBandwidthLimit.
+        * @brief Limit the bandwidth of this replicator, in bytes per second on the wire, 0 for unlimited. Can be called
+        * while the replicator runs, connections pick the new limits up right away. Enforced by the SG socket factories
+        * (see setSocketFactory()), on top of the process wide SGBandwidthLimiter::process() limits.
+        * The time spent throttled is reported in SGReplicatorStats.
+        * @param upload_bytes_per_second The upload limit.
+        * @param download_bytes_per_second The download limit.
+        * @param burst_bytes How many bytes can go at once after an idle period, 0 for one second worth of traffic.
+        */
+        void setBandwidthLimit(uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second,
+                               uint64_t burst_bytes = 0);
+
+        SGBandwidthLimiter *getBandwidthLimiter() const;
+
     private:
         SGDatabase *database_{nullptr};
         SGAuthenticator *authenticator_{nullptr};
 
         SGURLEndpoint *url_endpoint_{nullptr};
 
+        SGSocketFactory *socket_factory_{nullptr};
+
         ReplicatorType replicator_type_;
 
+        ReplicatorMode replicator_mode_ = ReplicatorMode::kContinuous;
+
+        SyncProfile sync_profile_ = SyncProfile::kDefaultProfile;
+
         std::vector<std::string> channels_;
 
         // Holds all extra configuration for the replicator
         fleece::Retained<fleece::impl::MutableDict> options_;
 
         // Options for the replicator progress level
+        const int kNotifyOnCompletionOnly = 0;
         const int kNotifyOnEveryDocumentChange = 1;
         const int kNotifyOnEveryAttachmentChange = 2;
 
+        // Checkpoint interval, in seconds, used by the kInitialSync profile
+        const int kInitialSyncCheckpointIntervalSec = 30;
+
         // Conflict resolution policy
         ConflictResolutionPolicy conflict_resolution_policy_ = ConflictResolutionPolicy::kDefaultBehavior;
 
@@ -146,6 +301,20 @@ namespace Strata {
         ReconnectionPolicy reconnection_policy_ = ReconnectionPolicy::kDefaultBehavior;
         // Automatic replication restart timer
         unsigned int reconnection_timer_sec_ = 5;
+
+        // Dead connection detection, 0 means LiteCore's or the OS default
+        unsigned int heartbeat_interval_sec_ = 0;
+        unsigned int idle_timeout_sec_ = 0;
+        unsigned int connect_timeout_sec_ = 0;
+
+        // Push debouncing and priority lane
+        std::chrono::milliseconds push_debounce_window_ {0};
+        std::vector<std::string> push_debounce_doc_id_prefixes_;
+        std::vector<std::string> priority_doc_id_prefixes_;
+        std::function<bool(const std::string &doc_id)> priority_filter_;
+
+        // Shared with the connections of the replicator, so limit changes apply while it runs
+        std::shared_ptr<SGBandwidthLimiter> bandwidth_limiter_;
     };
 }
 
@@ -0,0 +1,299 @@
+//
+//  SGReplicatorListener.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGREPLICATORLISTENER_H
+#define SGREPLICATORLISTENER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <litecore/c4Replicator.h>
+
+#include "SGDatabase.h"
+#include "SGReplicator.h"
+#include "SGSocketFactory.h"
+
+struct mg_context;
+struct mg_connection;
+
+namespace Strata {
+    typedef struct {
+        uint64_t peer_id;// Unique for the listener's lifetime.
+        std::string remote_address;
+        uint16_t remote_port;
+        int64_t connected_ms;// Time since the peer connected.
+        SGReplicator::ActivityLevel activity_level;// Activity of the passive replicator serving the peer.
+        uint64_t bytes_received;
+        uint64_t bytes_sent;
+        uint64_t documents_received;// Documents pushed by the peer.
+        uint64_t documents_sent;// Documents pulled by the peer.
+        uint64_t document_error_count;
+    } SGReplicatorPeerStats;
+
+    typedef struct {
+        uint64_t accepted_count;// Connections accepted since start().
+        uint64_t rejected_count;// Connections refused because of the connection limit.
+        uint64_t unauthorized_count;// Connections refused because of the credentials or the allowed peers.
+        uint64_t bytes_received;// Total over all peers, including disconnected ones.
+        uint64_t bytes_sent;
+        std::vector<SGReplicatorPeerStats> peers;// Currently connected peers.
+    } SGReplicatorListenerStats;
+
+    enum class SGReplicatorListenerReturnStatus {
+        kNoError,
+        kAlreadyRunning,
+        kConfigurationError,
+        kInternalError
+    };
+
+    std::ostream& operator << (std::ostream& os, const SGReplicatorListenerReturnStatus& return_status);
+
+    /*
+     * Accepts replication connections from other devices, so peers on the same network can sync directly instead of
+     * going through a Sync Gateway. Peers point a regular SGReplicator at ws://<host>:<port>/<database name>.
+     * Every connection is served by its own passive LiteCore replicator against the database.
+     *
+     * Listens on the loopback interface unless setNetworkInterface() says otherwise. Listening on a network requires
+     * credentials, see setCredentials(), or allowed peers, see setAllowedPeers(). There is no TLS: credentials and
+     * documents travel in clear, only use on trusted networks.
+     *
+     * Thread safe is guaranteed on these functions:
+     * start(), stop(), isRunning(), getStats()
+     */
+    class SGReplicatorListener : private SGSocketFactory {
+    public:
+        static const uint16_t kDefaultPort = 4984;
+        static const unsigned kDefaultMaxConnections = 8;
+        static constexpr const char *kDefaultNetworkInterface = "127.0.0.1";
+
+        /** SGReplicatorListener.
+        * @brief Initial setup of the listener.
+        * @param database The database to share. Must be open and outlive the listener.
+        * @param port The TCP port to listen on.
+        */
+        SGReplicatorListener(SGDatabase *database, uint16_t port = kDefaultPort);
+
+        virtual ~SGReplicatorListener();
+
+        /** SGReplicatorListener setMaxConnections.
+        * @brief Connections above this limit are refused. Each connection uses one listener thread. This option should
+        * be set before the listener is started.
+        * @param max_connections The maximum number of simultaneous peers.
+        */
+        void setMaxConnections(unsigned max_connections);
+
+        unsigned getMaxConnections() const;
+
+        /** SGReplicatorListener setNetworkInterface.
+        * @brief Only listen on this IP address, i.e "192.168.1.10", or on every interface if empty. Listens on
+        * kDefaultNetworkInterface, reachable from this device only, by default. This option should be set before the
+        * listener is started.
+        * @param ip_address The local address to bind to.
+        */
+        void setNetworkInterface(const std::string &ip_address);
+
+        /** SGReplicatorListener setCredentials.
+        * @brief Only accept peers sending these credentials, peers set them with an SGBasicAuthenticator. This option
+        * should be set before the listener is started.
+        * @param username The username, empty accepts peers without credentials.
+        * @param password The password.
+        */
+        void setCredentials(const std::string &username, const std::string &password);
+
+        /** SGReplicatorListener setAllowedPeers.
+        * @brief Only accept peers connecting from these IP addresses, i.e "192.168.1.11". This option should be set
+        * before the listener is started.
+        * @param ip_addresses The addresses, empty accepts any address.
+        */
+        void setAllowedPeers(const std::vector<std::string> &ip_addresses);
+
+        /** SGReplicatorListener setReadOnly.
+        * @brief Peers can only pull: documents they push are refused. This option should be set before the listener
+        * is started.
+        * @param read_only True to refuse pushes.
+        */
+        void setReadOnly(bool read_only);
+
+        uint16_t getPort() const;
+
+        /** SGReplicatorListener getPath.
+        * @brief Path peers connect to, i.e "/db/_blipsync".
+        */
+        std::string getPath() const;
+
+        SGReplicatorListenerReturnStatus start();
+
+        /** SGReplicatorListener stop.
+        * @brief Disconnects every peer and stops listening.
+        */
+        void stop();
+
+        bool isRunning();
+
+        SGReplicatorListenerStats getStats();
+
+    private:
+        // One connected peer. Shared between the civetweb connection and the LiteCore socket.
+        struct Peer {
+            SGReplicatorListener *listener {nullptr};
+            uint64_t id {0};
+            std::string remote_address;
+            uint16_t remote_port {0};
+            std::chrono::steady_clock::time_point connected_at;
+
+            // Guards connection, it is only valid until civetweb's close handler returns.
+            std::mutex write_lock;
+            mg_connection *connection {nullptr};
+
+            std::mutex lock;
+            std::condition_variable receive_window;
+            C4Socket *socket {nullptr};
+            C4Replicator *replicator {nullptr};
+            bool socket_open {false};
+            bool socket_closed {false};
+            bool connection_closed {false};
+            bool replicator_stopped {false};
+            size_t unread_bytes {0};
+            std::string partial_message;// Fragments of a message not complete yet.
+
+            std::atomic<int> activity_level {kC4Connecting};
+            std::atomic<uint64_t> bytes_received {0};
+            std::atomic<uint64_t> bytes_sent {0};
+            std::atomic<uint64_t> documents_received {0};
+            std::atomic<uint64_t> documents_sent {0};
+            std::atomic<uint64_t> document_error_count {0};
+        };
+
+        struct PeerHandle : public SGSocketHandle {
+            PeerHandle(SGSocketFactory *socket_factory, const std::shared_ptr<Peer> &connected_peer)
+                    : SGSocketHandle(socket_factory), peer(connected_peer) {}
+
+            std::shared_ptr<Peer> peer;
+        };
+
+        // Unread bytes handed to LiteCore above which we stop reading from the peer.
+        static const size_t kMaxUnreadBytes = 1024 * 1024;
+
+        // Extra civetweb threads beside the one per websocket connection.
+        static const unsigned kSpareServerThreads = 2;
+
+        // Idle time after which civetweb drops a connection. Longer than the replicator's heartbeat.
+        static const unsigned kWebSocketTimeoutMs = 10 * 60 * 1000;
+
+        // How long stop() waits for the passive replicators to wind down.
+        static const unsigned kStopTimeoutMs = 5000;
+
+        SGDatabase *database_ {nullptr};
+        uint16_t port_ {kDefaultPort};
+        unsigned max_connections_ {kDefaultMaxConnections};
+        std::string network_interface_ {kDefaultNetworkInterface};
+        // Expected Authorization header, empty without credentials
+        std::string authorization_;
+        std::vector<std::string> allowed_peers_;
+        bool read_only_ {false};
+
+        std::mutex listener_lock_;
+        mg_context *context_ {nullptr};
+
+        std::mutex peers_lock_;
+        std::condition_variable peers_released_;
+        std::map<uint64_t, std::shared_ptr<Peer>> peers_;
+        uint64_t next_peer_id_ {1};
+        unsigned connection_count_ {0};
+
+        std::atomic<uint64_t> accepted_count_ {0};
+        std::atomic<uint64_t> rejected_count_ {0};
+        std::atomic<uint64_t> unauthorized_count_ {0};
+
+        // SGSocketFactory
+        void open(C4Socket *socket, const C4Address *address, C4Slice options) override;
+
+        void write(C4Socket *socket, C4SliceResult data) override;
+
+        void completedReceive(C4Socket *socket, size_t byte_count) override;
+
+        void close(C4Socket *socket) override;
+
+        void requestClose(C4Socket *socket, int status, C4String message) override;
+
+        /** SGReplicatorListener startPassiveReplicator.
+        * @brief Creates the LiteCore socket and passive replicator serving a new peer.
+        * @param peer The connected peer.
+        */
+        bool startPassiveReplicator(const std::shared_ptr<Peer> &peer);
+
+        /** SGReplicatorListener closeSocket.
+        * @brief Tells LiteCore the peer's socket is closed, once.
+        */
+        void closeSocket(const std::shared_ptr<Peer> &peer, const C4Error &error);
+
+        /** SGReplicatorListener reportOpen.
+        * @brief Tells LiteCore the peer's socket is open, once.
+        */
+        void reportOpen(const std::shared_ptr<Peer> &peer);
+
+        /** SGReplicatorListener releasePeer.
+        * @brief Forgets the peer once both its connection and its replicator are done.
+        * @param peer_id The peer id.
+        */
+        void releasePeer(uint64_t peer_id);
+
+        std::shared_ptr<Peer> peerOf(const mg_connection *connection);
+
+        /** SGReplicatorListener isAuthorized.
+        * @brief Checks the peer's address and credentials.
+        */
+        bool isAuthorized(const mg_connection *connection) const;
+
+        /** SGReplicatorListener isLoopback.
+        * @brief True if the listener is only reachable from this device.
+        */
+        bool isLoopback() const;
+
+        // civetweb callbacks
+        static int onConnect(const mg_connection *connection, void *context);
+
+        static void onReady(mg_connection *connection, void *context);
+
+        static int onData(mg_connection *connection, int opcode_bits, char *data, size_t data_length, void *context);
+
+        static void onClose(const mg_connection *connection, void *context);
+
+        // Passive replicator callbacks
+        static void onPassiveStatusChanged(C4Replicator *replicator, C4ReplicatorStatus status, void *context);
+
+        static void onPassiveDocumentEnded(C4Replicator *replicator, bool pushing, C4HeapString doc_id,
+                                           C4HeapString rev_id, C4RevisionFlags flags, C4Error error,
+                                           bool error_is_transient, void *context);
+    };
+}
+
+#endif //SGREPLICATORLISTENER_H
@@ -0,0 +1,166 @@
+//
+//  SGReplicatorStats.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGREPLICATORSTATS_H
+#define SGREPLICATORSTATS_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <litecore/c4.h>
+
+#include "SGHistogram.h"
+#include "SGScheduler.h"
+
+namespace Strata {
+    struct SGReplicatorDirectionStats {
+        uint64_t document_count {0};        // Documents completed since the replicator was created.
+        uint64_t byte_count {0};            // Revision body bytes completed since the replicator was created.
+        double documents_per_second {0.0};  // Rate over the last sampling window.
+        double bytes_per_second {0.0};      // Rate over the last sampling window.
+    };
+
+    struct SGReplicatorStats {
+        SGReplicatorDirectionStats push;
+        SGReplicatorDirectionStats pull;
+
+        // Local documents the replicator still has to push, see SGReplicator::getPendingDocumentIds().
+        uint64_t pending_push_count {0};
+
+        // LiteCore saves its checkpoint when the replicator settles down to idle, -1 if that never happened.
+        int64_t time_since_last_checkpoint_ms {-1};
+
+        // Number of automatic reconnection attempts.
+        uint64_t reconnect_count {0};
+
+        // Time the connections were held back by the bandwidth limits, see SGReplicatorConfiguration::setBandwidthLimit().
+        uint64_t upload_throttle_time_ms {0};
+        uint64_t download_throttle_time_ms {0};
+
+        // Replicator and document errors, keyed by C4ErrorDomain.
+        std::map<C4ErrorDomain, uint64_t> error_count_by_domain;
+
+        // Time from the local save of a document to the server acknowledging it, in microseconds.
+        SGHistogramSnapshot push_latency_us;
+    };
+
+    /*
+     * Collects the raw numbers behind SGReplicatorStats. Fed by the SGReplicator callbacks and by a database observer
+     * on the local database, which provides the save time and body size of local changes.
+     *
+     * All functions are thread safe.
+     */
+    class SGReplicatorStatsCollector {
+    public:
+        /** SGReplicatorStatsCollector.
+        * @brief Creates the collector, startObserving() starts tracking local saves.
+        * @param scheduler Runs the reads of the database changes, which may block.
+        */
+        SGReplicatorStatsCollector(SGScheduler &scheduler);
+
+        virtual ~SGReplicatorStatsCollector();
+
+        /** SGReplicatorStatsCollector startObserving.
+        * @brief Start tracking local saves on the given database. Only updates track_saves if it is already observed.
+        * @param c4db The local database used by the replicator.
+        * @param track_saves Whether local saves are kept until pushed for the push latency. False when the replicator
+        * doesn't push, nothing would ever acknowledge them.
+        */
+        void startObserving(C4Database *c4db, bool track_saves);
+
+        void stopObserving();
+
+        void onStatusChanged(const C4ReplicatorStatus &status);
+
+        void onDocumentEnded(bool pushing, C4String doc_id, const C4Error &error);
+
+        void onReconnect();
+
+        /** SGReplicatorStatsCollector sample.
+        * @brief Closes the current rate window. Called periodically by the SGReplicator.
+        */
+        void sample();
+
+        /** SGReplicatorStatsCollector snapshot.
+        * @brief Returns the collected numbers. pending_push_count is left to the caller.
+        */
+        SGReplicatorStats snapshot();
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct PendingSave {
+            Clock::time_point saved_at;
+            uint64_t body_size;
+        };
+
+        // Upper bound on the number of unacknowledged local saves being tracked for latency.
+        static constexpr size_t kMaxTrackedSaves = 100000;
+        // Saves not pushed within this time are no longer tracked, e.g. saves that are never pushed on their own.
+        static constexpr std::chrono::seconds::rep kMaxTrackedSaveAgeSec = 15 * 60;
+        static constexpr uint32_t kObserverBatchSize = 100;
+
+        SGScheduler &scheduler_;
+
+        // The observer callback may run while LiteCore holds its own locks, so it only touches drain_lock_.
+        C4DatabaseObserver *observer_ {nullptr};
+        std::mutex observer_lock_;
+        bool track_saves_ {false};// Guarded by observer_lock_
+        bool drain_scheduled_ {false};
+        Clock::time_point first_unread_change_;
+        std::mutex drain_lock_;
+
+        std::unordered_map<std::string, PendingSave> pending_saves_;
+        Clock::time_point last_save_expiry_;
+
+        SGReplicatorStats stats_;
+        SGReplicatorDirectionStats last_push_sample_;
+        SGReplicatorDirectionStats last_pull_sample_;
+        Clock::time_point last_sample_time_;
+
+        C4ReplicatorActivityLevel last_level_ {kC4Stopped};
+        bool has_checkpoint_ {false};
+        Clock::time_point last_checkpoint_;
+
+        SGHistogram push_latency_us_;
+
+        std::mutex stats_lock_;
+
+        static void onDatabaseChanged(C4DatabaseObserver *observer, void *context);
+
+        void drainDatabaseChanges();
+
+        void countError(const C4Error &error);
+
+        /** SGReplicatorStatsCollector _expirePendingSaves.
+        * @brief Drops the saves older than kMaxTrackedSaveAgeSec. stats_lock_ must be held.
+        */
+        void _expirePendingSaves(const Clock::time_point &now);
+    };
+}
+
+#endif //SGREPLICATORSTATS_H
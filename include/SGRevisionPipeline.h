@@ -0,0 +1,151 @@
+//
+//  SGRevisionPipeline.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGREVISIONPIPELINE_H
+#define SGREVISIONPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SGHistogram.h"
+
+namespace Strata {
+    struct SGRevisionPipelineStats {
+        uint64_t queued_count {0};          // Revisions waiting for a worker right now.
+        uint64_t max_queued_count {0};      // Highest queued_count seen.
+        uint64_t processed_count {0};       // Revisions handled.
+        uint64_t blocked_count {0};         // Submissions that had to wait for room, each one held up the puller.
+        uint64_t refused_count {0};         // Submissions refused because the pipeline was stopped.
+
+        // Time from the puller accepting a revision to a worker starting its handler, in microseconds.
+        SGHistogramSnapshot queue_latency_us;
+
+        // Time spent in the handler, in microseconds.
+        SGHistogramSnapshot handler_latency_us;
+    };
+
+    /*
+     * Worker pool running incoming revision handlers, see SGReplicator::setRevisionPipeline(), so slow application
+     * logic doesn't hold up the puller.
+     * Every revision of a document goes to the same worker, so a document's revisions are handled in the order they
+     * were pulled. Different documents are handled concurrently.
+     * The queues are bounded: when a worker's queue is full, submit() waits, throttling the pull rather than
+     * growing without limit.
+     *
+     * Thread safe is guaranteed on all functions.
+     */
+    class SGRevisionPipeline {
+    public:
+        static constexpr unsigned kDefaultWorkerCount = 4;
+        static constexpr size_t kDefaultCapacity = 4096;
+
+        /** SGRevisionPipeline.
+        * @brief Creates the pipeline and starts its workers.
+        * @param worker_count Number of worker threads.
+        * @param capacity Number of revisions that can be queued, split between the workers.
+        */
+        explicit SGRevisionPipeline(unsigned worker_count = kDefaultWorkerCount, size_t capacity = kDefaultCapacity);
+
+        /** SGRevisionPipeline.
+        * @brief Runs the queued revisions, then stops the workers.
+        */
+        virtual ~SGRevisionPipeline();
+
+        /** SGRevisionPipeline submit.
+        * @brief Queues a handler on the worker of the document. Waits for room if that worker's queue is full.
+        * Returns false once the pipeline is stopped, the handler is not run then and the caller has to handle it.
+        * @param doc_id The document the handler is for.
+        * @param handler The function to run on the worker.
+        * @param byte_size The memory the handler holds on to until it ran, i.e the revision body it captured. Counted
+        * by SGMemoryTracker::process() while queued.
+        */
+        bool submit(const std::string &doc_id, const std::function<void()> &handler, size_t byte_size = 0);
+
+        /** SGRevisionPipeline waitForIdle.
+        * @brief Blocks until every queued handler ran or timeout expires. Returns true if the pipeline is idle.
+        * @param timeout Maximum time to wait.
+        */
+        bool waitForIdle(const std::chrono::milliseconds &timeout);
+
+        /** SGRevisionPipeline stop.
+        * @brief Runs the queued handlers and stops the workers. Later submissions are refused.
+        */
+        void stop();
+
+        unsigned getWorkerCount() const;
+
+        SGRevisionPipelineStats getStats() const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Task {
+            std::function<void()> handler;
+            Clock::time_point queued_at;
+            size_t byte_size {0};
+        };
+
+        struct Worker {
+            std::mutex lock;
+            std::condition_variable task_available;
+            std::condition_variable space_available;
+            std::deque<Task> tasks;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        const size_t worker_capacity_;
+        std::atomic<bool> stopping_ {false};
+        std::mutex stop_lock_;
+
+        // Idle notifications, see waitForIdle()
+        std::mutex idle_lock_;
+        std::condition_variable idle_;
+
+        std::atomic<uint64_t> pending_count_ {0};// Queued or running
+        std::atomic<uint64_t> queued_count_ {0};
+        std::atomic<uint64_t> max_queued_count_ {0};
+        std::atomic<uint64_t> processed_count_ {0};
+        std::atomic<uint64_t> blocked_count_ {0};
+        std::atomic<uint64_t> refused_count_ {0};
+        SGHistogram queue_latency_us_;
+        SGHistogram handler_latency_us_;
+
+        void run(Worker &worker);
+
+        SGRevisionPipeline(const SGRevisionPipeline &) = delete;
+        SGRevisionPipeline &operator=(const SGRevisionPipeline &) = delete;
+    };
+}
+
+#endif //SGREVISIONPIPELINE_H
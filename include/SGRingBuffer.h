@@ -0,0 +1,148 @@
+//
+//  SGRingBuffer.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGRINGBUFFER_H
+#define SGRINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace Strata {
+    /*
+     * Bounded lock-free multi-producer/multi-consumer queue (Dmitry Vyukov's array based design).
+     * Each slot carries a sequence number telling producers and consumers whose turn it is, so pushes and pops
+     * only contend on a single atomic increment. The capacity is rounded up to a power of two.
+     *
+     * T must be default constructible and movable. Slots are allocated once, in the constructor.
+     */
+    template<typename T>
+    class SGRingBuffer {
+    public:
+        explicit SGRingBuffer(size_t capacity) {
+            size_t rounded_capacity = 2;
+            while (rounded_capacity < capacity) {
+                rounded_capacity <<= 1;
+            }
+            mask_ = rounded_capacity - 1;
+            buffer_.reset(new Cell[rounded_capacity]);
+            for (size_t index = 0; index < rounded_capacity; ++index) {
+                buffer_[index].sequence.store(index, std::memory_order_relaxed);
+            }
+            enqueue_position_.store(0, std::memory_order_relaxed);
+            dequeue_position_.store(0, std::memory_order_relaxed);
+        }
+
+        virtual ~SGRingBuffer() {}
+
+        /** SGRingBuffer tryPush.
+        * @brief Moves the item into the queue. Returns false, leaving the item untouched, if the queue is full.
+        * @param item The item to enqueue.
+        */
+        bool tryPush(T &&item) {
+            Cell *cell;
+            size_t position = enqueue_position_.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &buffer_[position & mask_];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+                if (difference == 0) {
+                    if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = enqueue_position_.load(std::memory_order_relaxed);
+                }
+            }
+            cell->data = std::move(item);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** SGRingBuffer tryPop.
+        * @brief Moves the oldest item out of the queue. Returns false if the queue is empty.
+        * @param item The item to write to.
+        */
+        bool tryPop(T &item) {
+            Cell *cell;
+            size_t position = dequeue_position_.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &buffer_[position & mask_];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+                if (difference == 0) {
+                    if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = dequeue_position_.load(std::memory_order_relaxed);
+                }
+            }
+            item = std::move(cell->data);
+            cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t capacity() const {
+            return mask_ + 1;
+        }
+
+        /** SGRingBuffer sizeApprox.
+        * @brief Number of queued items. Only a hint while producers or consumers are running.
+        */
+        size_t sizeApprox() const {
+            size_t enqueued = enqueue_position_.load(std::memory_order_relaxed);
+            size_t dequeued = dequeue_position_.load(std::memory_order_relaxed);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        static constexpr size_t kCacheLineSize = 64;
+
+        std::unique_ptr<Cell[]> buffer_;
+        size_t mask_;
+
+        // Producers and consumers each get their own cache line.
+        char padding_before_enqueue_[kCacheLineSize];
+        std::atomic<size_t> enqueue_position_;
+        char padding_before_dequeue_[kCacheLineSize];
+        std::atomic<size_t> dequeue_position_;
+        char padding_after_dequeue_[kCacheLineSize];
+
+        SGRingBuffer(const SGRingBuffer &) = delete;
+        SGRingBuffer &operator=(const SGRingBuffer &) = delete;
+    };
+}
+
+#endif //SGRINGBUFFER_H
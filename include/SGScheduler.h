@@ -0,0 +1,104 @@
+//
+//  SGScheduler.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGSCHEDULER_H
+#define SGSCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Strata {
+    /*
+     * Single background thread running delayed and periodic tasks.
+     * Tasks run one at a time on the scheduler thread, a task that blocks holds up every task due after it. Keep
+     * timers on a scheduler whose tasks don't block, and hand what may block, i.e application callbacks, database
+     * I/O or waiting on a lock, to another scheduler used as an executor (a zero delay runs the task as soon as
+     * possible, in scheduling order).
+     *
+     * Thread safe is guaranteed on these functions:
+     * scheduleAfter(), scheduleEvery(), cancel(), stop()
+     */
+    class SGScheduler {
+    public:
+        typedef uint64_t TaskId;
+
+        SGScheduler();
+
+        virtual ~SGScheduler();
+
+        /** SGScheduler scheduleAfter.
+        * @brief Runs the task once after the given delay. Thread Safe.
+        * @param delay Time to wait before running the task.
+        * @param task The function to run on the scheduler thread.
+        */
+        TaskId scheduleAfter(const std::chrono::milliseconds &delay, const std::function<void()> &task);
+
+        /** SGScheduler scheduleEvery.
+        * @brief Runs the task repeatedly, first after one interval, until it is cancelled. Thread Safe.
+        * @param interval Time between two runs of the task.
+        * @param task The function to run on the scheduler thread.
+        */
+        TaskId scheduleEvery(const std::chrono::milliseconds &interval, const std::function<void()> &task);
+
+        /** SGScheduler cancel.
+        * @brief Removes a pending task. A task that is already running will finish. Thread Safe.
+        * @param task_id The id returned by scheduleAfter() or scheduleEvery().
+        */
+        void cancel(TaskId task_id);
+
+        /** SGScheduler stop.
+        * @brief Drops all pending tasks and joins the scheduler thread. Thread Safe, but can't be called from a task.
+        */
+        void stop();
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Task {
+            Clock::time_point due;
+            std::chrono::milliseconds interval;
+            std::function<void()> function;
+        };
+
+        std::map<TaskId, Task> tasks_;
+        TaskId next_task_id_ {1};
+        bool stopping_ {false};
+
+        std::thread thread_;
+        std::mutex scheduler_lock_;
+        std::condition_variable scheduler_cv_;
+
+        TaskId schedule(const std::chrono::milliseconds &delay, const std::chrono::milliseconds &interval,
+                        const std::function<void()> &task);
+
+        void run();
+    };
+}
+
+#endif //SGSCHEDULER_H
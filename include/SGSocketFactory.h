@@ -0,0 +1,251 @@
+//
+//  SGSocketFactory.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGSOCKETFACTORY_H
+#define SGSOCKETFACTORY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <litecore/c4Socket.h>
+
+#include "SGBandwidthLimiter.h"
+
+namespace Strata {
+    class SGSocketFactory;
+
+    /*
+     * Per-socket state of a SGSocketFactory. Stored in C4Socket::nativeHandle, LiteCore only passes the factory
+     * context to open(), so this is how the other callbacks find their factory.
+     */
+    struct SGSocketHandle {
+        explicit SGSocketHandle(SGSocketFactory *socket_factory) : factory(socket_factory) {}
+
+        virtual ~SGSocketHandle() {}
+
+        SGSocketFactory *factory;
+
+        bool is_open {false};// Set by SGSocketFactory::opened(), cleared by SGSocketFactory::closed().
+    };
+
+    typedef struct {
+        uint64_t bytes_written;// Bytes LiteCore handed to the transport.
+        uint64_t bytes_received;// Bytes the transport handed to LiteCore.
+        uint64_t connection_count;// Connections opened since the factory was created.
+        uint64_t open_connection_count;// Connections currently open.
+        uint64_t wire_bytes_written;// Bytes sent on the wire, after framing and compression. 0 if not tracked.
+        uint64_t wire_bytes_received;// Bytes received from the wire, before decompression. 0 if not tracked.
+        uint64_t compression_time_us;// Time spent compressing and decompressing.
+        uint64_t throttle_time_us;// Time connections were held back by the bandwidth limits, see SGBandwidthLimiter.
+    } SGSocketFactoryStats;
+
+    /*
+     * Base class for custom replicator transports. Wraps a C4SocketFactory and forwards its callbacks to virtual
+     * functions, counting bytes and connections on the way.
+     * Set on a replicator with SGReplicatorConfiguration::setSocketFactory(). The factory must outlive every
+     * replicator using it.
+     */
+    class SGSocketFactory {
+    public:
+        /** SGSocketFactory.
+        * @brief Initial setup of the C4SocketFactory.
+        * @param framing kC4NoFraming if the transport delivers whole messages, or kC4WebSocketClientFraming if
+        * LiteCore should do the WebSocket framing and the transport only moves bytes.
+        */
+        explicit SGSocketFactory(C4SocketFraming framing);
+
+        virtual ~SGSocketFactory();
+
+        /** SGSocketFactory getC4SocketFactory.
+        * @brief Returns the LiteCore socket factory to use in C4ReplicatorParameters.
+        */
+        const C4SocketFactory *getC4SocketFactory() const;
+
+        SGSocketFactoryStats getStats() const;
+
+        // Socket options SGReplicatorConfiguration adds for the SG socket factories, in seconds. The heartbeat
+        // interval uses LiteCore's kC4ReplicatorHeartbeatInterval.
+        static constexpr const char *kOptionIdleTimeout = "idleTimeout";
+        static constexpr const char *kOptionConnectTimeout = "connectTimeout";
+        // ID of the replicator's SGBandwidthLimiter.
+        static constexpr const char *kOptionBandwidthLimiter = "bandwidthLimiter";
+
+    protected:
+        /** SGSocketFactory open.
+        * @brief LiteCore wants a new connection. Set socket->nativeHandle to a SGSocketHandle, then call
+        * c4socket_opened() once connected (or c4socket_closed() on failure).
+        * @param socket The LiteCore socket.
+        * @param address The remote address.
+        * @param options Fleece encoded socket options.
+        */
+        virtual void open(C4Socket *socket, const C4Address *address, C4Slice options) = 0;
+
+        /** SGSocketFactory write.
+        * @brief Send data to the peer, then call c4socket_completedWrite(). The data must be released with
+        * c4slice_free() once sent.
+        * @param socket The LiteCore socket.
+        * @param data The data to send.
+        */
+        virtual void write(C4Socket *socket, C4SliceResult data) = 0;
+
+        /** SGSocketFactory completedReceive.
+        * @brief LiteCore consumed byte_count bytes previously passed to c4socket_received().
+        * @param socket The LiteCore socket.
+        * @param byte_count Number of bytes processed.
+        */
+        virtual void completedReceive(C4Socket *socket, size_t byte_count) = 0;
+
+        /** SGSocketFactory close.
+        * @brief Close the connection (WebSocket framing done by LiteCore). Call c4socket_closed() once closed.
+        * @param socket The LiteCore socket.
+        */
+        virtual void close(C4Socket *socket);
+
+        /** SGSocketFactory requestClose.
+        * @brief Run the close handshake (kC4NoFraming). Call c4socket_closed() once closed.
+        * @param socket The LiteCore socket.
+        * @param status The WebSocket close status.
+        * @param message The close message.
+        */
+        virtual void requestClose(C4Socket *socket, int status, C4String message);
+
+        /** SGSocketFactory dispose.
+        * @brief LiteCore freed the socket. The default implementation deletes the SGSocketHandle.
+        * @param socket The LiteCore socket.
+        */
+        virtual void dispose(C4Socket *socket);
+
+        /** SGSocketFactory received.
+        * @brief Hands data from the peer to LiteCore and counts it. Use instead of c4socket_received().
+        * @param socket The LiteCore socket.
+        * @param data The received data.
+        */
+        void received(C4Socket *socket, C4Slice data);
+
+        /** SGSocketFactory opened.
+        * @brief Tells LiteCore the connection is open and counts it. Use instead of c4socket_opened().
+        * @param socket The LiteCore socket.
+        */
+        void opened(C4Socket *socket);
+
+        /** SGSocketFactory closed.
+        * @brief Tells LiteCore the connection is closed. Use instead of c4socket_closed().
+        * Must be called once per socket passed to opened().
+        * @param socket The LiteCore socket.
+        * @param error The close status, code 0 for a normal close.
+        */
+        void closed(C4Socket *socket, C4Error error);
+
+        /** SGSocketFactory countWireBytes.
+        * @brief For transports doing their own framing: bytes actually sent and received on the wire.
+        */
+        void countWireBytes(size_t bytes_written, size_t bytes_received);
+
+        void countCompressionTime(uint64_t compression_time_ns);
+
+        /** SGSocketFactory makeUpgradeRequest.
+        * @brief For transports doing their own WebSocket framing: the HTTP upgrade request, with the headers LiteCore
+        * expects from the socket options (subprotocol, basic authentication, cookies and extra headers).
+        * @param host The remote host.
+        * @param port The remote port.
+        * @param path The request path.
+        * @param options Fleece encoded socket options, as passed to open().
+        * @param extensions Sec-WebSocket-Extensions to offer, empty for none.
+        * @param websocket_key Set to the Sec-WebSocket-Key sent, see SGWebSocketCodec::acceptKey().
+        */
+        static std::string makeUpgradeRequest(const std::string &host, uint16_t port, const std::string &path,
+                                              C4Slice options, const std::string &extensions,
+                                              std::string &websocket_key);
+
+        /** SGSocketFactory parseUpgradeResponse.
+        * @brief Parses the upgrade response header block and reports it to LiteCore with c4socket_gotHTTPResponse().
+        * Returns the HTTP status, 0 if the status line is malformed.
+        * @param socket The LiteCore socket.
+        * @param response The response, up to but excluding the empty line ending the headers.
+        * @param reason Set to the reason phrase.
+        * @param headers Filled with the headers, names in lower case.
+        */
+        static int parseUpgradeResponse(C4Socket *socket, const std::string &response, std::string &reason,
+                                        std::map<std::string, std::string> &headers);
+
+        /** SGSocketFactory getSecondsOption.
+        * @brief Reads a duration option, in seconds, from the socket options. Returns 0 if it isn't set.
+        * @param options Fleece encoded socket options, as passed to open().
+        * @param key The option name.
+        */
+        static unsigned getSecondsOption(C4Slice options, const char *key);
+
+        /** SGSocketFactory getBandwidthLimiter.
+        * @brief Returns the replicator's bandwidth limiter from the socket options, nullptr if there is none.
+        * @param options Fleece encoded socket options, as passed to open().
+        */
+        static std::shared_ptr<SGBandwidthLimiter> getBandwidthLimiter(C4Slice options);
+
+        /** SGSocketFactory throttle.
+        * @brief Charges bytes moved on a connection to its replicator's and to the process bandwidth limiter, and
+        * returns how long the connection must wait before moving more data in this direction. Counts the throttle time.
+        * @param limiter The replicator's limiter, may be nullptr.
+        * @param direction Upload or download.
+        * @param byte_count Bytes moved on the wire.
+        * @param throttled_until The end of the current wait of the connection in this direction, updated.
+        */
+        std::chrono::nanoseconds throttle(SGBandwidthLimiter *limiter, SGBandwidthLimiter::Direction direction,
+                                          size_t byte_count, std::chrono::steady_clock::time_point &throttled_until);
+
+    private:
+        C4SocketFactory c4socket_factory_;
+
+        std::atomic<uint64_t> bytes_written_ {0};
+        std::atomic<uint64_t> bytes_received_ {0};
+        std::atomic<uint64_t> connection_count_ {0};
+        std::atomic<uint64_t> open_connection_count_ {0};
+        std::atomic<uint64_t> wire_bytes_written_ {0};
+        std::atomic<uint64_t> wire_bytes_received_ {0};
+        std::atomic<uint64_t> compression_time_ns_ {0};
+        std::atomic<uint64_t> throttle_time_ns_ {0};
+
+        static SGSocketFactory *factoryOf(C4Socket *socket);
+
+        static void openCallback(C4Socket *socket, const C4Address *address, C4Slice options, void *context);
+
+        static void writeCallback(C4Socket *socket, C4SliceResult data);
+
+        static void completedReceiveCallback(C4Socket *socket, size_t byte_count);
+
+        static void closeCallback(C4Socket *socket);
+
+        static void requestCloseCallback(C4Socket *socket, int status, C4String message);
+
+        static void disposeCallback(C4Socket *socket);
+
+        SGSocketFactory(const SGSocketFactory &) = delete;
+        SGSocketFactory &operator=(const SGSocketFactory &) = delete;
+    };
+}
+
+#endif //SGSOCKETFACTORY_H
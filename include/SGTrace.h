@@ -0,0 +1,128 @@
+//
+//  SGTrace.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGTRACE_H
+#define SGTRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace Strata {
+    /*
+     * Records timed spans of the database, document and replicator operations, to see where a slow operation spent
+     * its time. Spans go to a buffer per thread, so recording doesn't contend with other threads, and are exported as
+     * Chrome trace JSON, loaded with chrome://tracing or https://ui.perfetto.dev.
+     * Disabled by default, a disabled span costs a relaxed atomic load.
+     * Each thread keeps at most kMaxEventsPerThread spans until clear(), later ones are dropped and counted.
+     */
+    class SGTrace {
+    public:
+        static const size_t kMaxEventsPerThread = 100000;
+
+        /** SGTrace setEnabled.
+        * @brief Starts or stops recording spans. Spans already recorded are kept.
+        * @param enabled Whether spans are recorded.
+        */
+        static void setEnabled(bool enabled);
+
+        static bool isEnabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        /** SGTrace clear.
+        * @brief Drops the recorded spans and the dropped count.
+        */
+        static void clear();
+
+        /** SGTrace toJson.
+        * @brief Returns the recorded spans as a Chrome trace event JSON object.
+        */
+        static std::string toJson();
+
+        /** SGTrace dump.
+        * @brief Writes toJson() to a file. Returns false if the file can't be written.
+        * @param file_path The trace file, usually ending with .json.
+        */
+        static bool dump(const std::string &file_path);
+
+        /** SGTrace getDroppedCount.
+        * @brief Spans dropped because the thread's buffer was full.
+        */
+        static uint64_t getDroppedCount();
+
+    private:
+        friend class SGTraceSpan;
+
+        static std::atomic<bool> enabled_;
+
+        // Nanoseconds on the steady clock
+        static int64_t now();
+
+        static void record(const char *category, const char *name, int64_t start_ns, int64_t end_ns);
+    };
+
+    /*
+     * Times the current scope, or until end(). The category and name must be string literals, they're kept as
+     * pointers until the trace is exported.
+     */
+    class SGTraceSpan {
+    public:
+        SGTraceSpan(const char *category, const char *name) : category_(category), name_(name) {
+            if(SGTrace::isEnabled()) {
+                start_ns_ = SGTrace::now();
+            }
+        }
+
+        ~SGTraceSpan() {
+            end();
+        }
+
+        /** SGTraceSpan end.
+        * @brief Ends the span before the end of the scope, e.g once a lock is acquired.
+        */
+        void end() {
+            if(start_ns_ >= 0) {
+                SGTrace::record(category_, name_, start_ns_, SGTrace::now());
+                start_ns_ = -1;
+            }
+        }
+
+    private:
+        const char *category_;
+        const char *name_;
+        int64_t start_ns_ {-1};
+
+        SGTraceSpan(const SGTraceSpan &) = delete;
+        SGTraceSpan &operator=(const SGTraceSpan &) = delete;
+    };
+}
+
+#define SG_TRACE_CONCAT_(a, b) a##b
+#define SG_TRACE_CONCAT(a, b) SG_TRACE_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope
+#define SG_TRACE_SPAN(category, name) Strata::SGTraceSpan SG_TRACE_CONCAT(sg_trace_span_, __LINE__)(category, name)
+
+#endif //SGTRACE_H
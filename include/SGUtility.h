@@ -30,5 +30,7 @@
 namespace Strata {
 
     std::string C4ErrorToString(const C4Error &err);
+
+    std::string Base64Encode(const std::string &data);
 }
 #endif //SGUTILITY_H
@@ -0,0 +1,184 @@
+//
+//  SGWebSocketCodec.h
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef SGWEBSOCKETCODEC_H
+#define SGWEBSOCKETCODEC_H
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+
+#include <zlib.h>
+
+namespace Strata {
+    /*
+     * WebSocket (RFC 6455) framing with the permessage-deflate extension (RFC 7692), for the SG socket factories.
+     * Encodes whole messages into single frames and decodes a byte stream back into messages.
+     *
+     * Not thread safe: use one codec per connection, encode from one thread and decode from one thread.
+     */
+    class SGWebSocketCodec {
+    public:
+        enum class Role {
+            kClient,    // Masks outgoing frames
+            kServer
+        };
+
+        static const int kOpcodeContinuation = 0x0;
+        static const int kOpcodeText = 0x1;
+        static const int kOpcodeBinary = 0x2;
+        static const int kOpcodeClose = 0x8;
+        static const int kOpcodePing = 0x9;
+        static const int kOpcodePong = 0xA;
+
+        // zlib level, from 1 (fastest) to 9 (smallest). 0 doesn't offer permessage-deflate at all.
+        static const int kCompressionDisabled = 0;
+        static const int kDefaultCompressionLevel = 6;
+
+        // Messages smaller than this aren't worth compressing.
+        static const size_t kMinCompressedMessageSize = 64;
+
+        // Bigger incoming messages are a protocol error (close status 1009).
+        static const size_t kMaxMessageSize = 64 * 1024 * 1024;
+
+        // Close status to send when encode() fails.
+        static const int kCloseInternalError = 1011;
+
+        explicit SGWebSocketCodec(Role role);
+
+        virtual ~SGWebSocketCodec();
+
+        /** SGWebSocketCodec extensionOffer.
+        * @brief Sec-WebSocket-Extensions value a client sends to offer permessage-deflate.
+        */
+        static std::string extensionOffer();
+
+        /** SGWebSocketCodec acceptKey.
+        * @brief Sec-WebSocket-Accept value the server must answer for a Sec-WebSocket-Key (RFC 6455 section 4.2.2).
+        * @param websocket_key The base64 Sec-WebSocket-Key sent by the client.
+        */
+        static std::string acceptKey(const std::string &websocket_key);
+
+        /** SGWebSocketCodec acceptExtension.
+        * @brief Client side: enables permessage-deflate if the server's Sec-WebSocket-Extensions accepted it.
+        * Returns true if compression is on. With client_max_window_bits=8, which zlib can't compress to, incoming
+        * messages are inflated and outgoing ones are sent uncompressed.
+        * @param extensions_header The server's Sec-WebSocket-Extensions header, empty if missing.
+        * @param compression_level The zlib level for outgoing messages.
+        */
+        bool acceptExtension(const std::string &extensions_header, int compression_level);
+
+        /** SGWebSocketCodec enableDeflate.
+        * @brief Turn permessage-deflate on with explicit parameters.
+        * @param compression_level The zlib level for outgoing messages.
+        * @param compress_no_context_takeover Reset the compressor after each message.
+        * @param decompress_no_context_takeover Reset the decompressor after each message.
+        * @param compress_window_bits LZ77 window of the compressor, from 9 to 15. Below 9 nothing is compressed.
+        */
+        void enableDeflate(int compression_level, bool compress_no_context_takeover = false,
+                           bool decompress_no_context_takeover = false, int compress_window_bits = 15);
+
+        bool isDeflateEnabled() const;
+
+        /** SGWebSocketCodec encode.
+        * @brief Appends a single frame holding the whole message. Data messages are compressed when deflate is on.
+        * Returns false, leaving frame untouched, if compression failed: the compressor's window now holds data the
+        * peer never got, so no data message can be sent anymore. Close the connection with kCloseInternalError.
+        * @param opcode The frame opcode.
+        * @param data The message payload.
+        * @param size The payload size.
+        * @param frame The string to append the frame to.
+        */
+        bool encode(int opcode, const void *data, size_t size, std::string &frame);
+
+        /** SGWebSocketCodec decode.
+        * @brief Feeds bytes received from the peer. on_message is called for every complete message and control
+        * frame, in order. Returns false on a protocol error, see getCloseStatus().
+        * @param data Received bytes.
+        * @param size Number of bytes.
+        * @param on_message Called with the opcode and the (decompressed) payload.
+        */
+        bool decode(const void *data, size_t size,
+                    const std::function<void(int opcode, const std::string &payload)> &on_message);
+
+        /** SGWebSocketCodec getCloseStatus.
+        * @brief WebSocket close status matching the last decode() error.
+        */
+        int getCloseStatus() const;
+
+        /** SGWebSocketCodec getCompressionTimeNs.
+        * @brief Time spent in deflate and inflate so far, in nanoseconds.
+        */
+        uint64_t getCompressionTimeNs() const;
+
+        /** SGWebSocketCodec getDeflateTimeNs.
+        * @brief Time spent in deflate, only safe to read from the encoding thread.
+        */
+        uint64_t getDeflateTimeNs() const;
+
+        /** SGWebSocketCodec getInflateTimeNs.
+        * @brief Time spent in inflate, only safe to read from the decoding thread.
+        */
+        uint64_t getInflateTimeNs() const;
+
+    private:
+        Role role_;
+
+        bool deflate_enabled_ {false};
+        bool compress_no_context_takeover_ {false};
+        bool decompress_no_context_takeover_ {false};
+        z_stream deflate_stream_;
+        z_stream inflate_stream_;
+        bool deflate_initialized_ {false};
+        bool inflate_initialized_ {false};
+        // Set by the encoding thread once deflate failed
+        bool deflate_failed_ {false};
+        // Written by the encoding and the decoding thread respectively
+        uint64_t deflate_time_ns_ {0};
+        uint64_t inflate_time_ns_ {0};
+
+        std::mt19937 mask_generator_;
+
+        // Decoder state
+        std::string input_;
+        size_t input_offset_ {0};
+        std::string message_;
+        int message_opcode_ {0};
+        bool message_compressed_ {false};
+        bool in_message_ {false};
+        int close_status_ {0};
+
+        bool deflate(const char *data, size_t size, std::string &output);
+
+        bool inflate(const std::string &input, std::string &output);
+
+        void releaseStreams();
+
+        SGWebSocketCodec(const SGWebSocketCodec &) = delete;
+        SGWebSocketCodec &operator=(const SGWebSocketCodec &) = delete;
+    };
+}
+
+#endif //SGWEBSOCKETCODEC_H
@@ -0,0 +1,290 @@
+//
+//  SGAsyncLogSink.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+#include <cstring>
+#include <ctime>
+
+#include "SGAsyncLogSink.h"
+
+using namespace std;
+
+namespace Strata {
+    constexpr size_t SGAsyncLogSink::kDefaultCapacity;
+    constexpr uint64_t SGAsyncLogSink::kDefaultMaxFileSize;
+    constexpr unsigned SGAsyncLogSink::kDefaultMaxRotateCount;
+    constexpr size_t SGAsyncLogSink::kMaxMessageLength;
+
+    atomic<SGAsyncLogSink *> SGAsyncLogSink::active_sink_ {nullptr};
+    atomic<int> SGAsyncLogSink::active_callbacks_ {0};
+
+    // How often the drain thread wakes up when the buffer isn't filling up.
+    static const chrono::milliseconds kDrainInterval(100);
+
+    // Same names as LiteCore's console output, indexed by C4LogLevel
+    static const char *const kLevelNames[] = {"Debug", "Verbose", "Info", "WARNING", "ERROR"};
+
+    static string rotatedFilePath(const string &file_path, unsigned index) {
+        return file_path + "." + to_string(index);
+    }
+
+    static string formatTime(chrono::system_clock::time_point time) {
+        time_t seconds = chrono::system_clock::to_time_t(time);
+        long milliseconds = (long) (chrono::duration_cast<chrono::milliseconds>(time.time_since_epoch()).count() % 1000);
+        struct tm utc {};
+#ifdef _WIN32
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        char buffer[32];
+        size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+        snprintf(buffer + length, sizeof(buffer) - length, ".%03ldZ", milliseconds);
+        return buffer;
+    }
+
+    SGAsyncLogSink::SGAsyncLogSink(const std::string &file_path, uint64_t max_file_size, unsigned max_rotate_count,
+                                   size_t capacity)
+            : file_path_(file_path), max_file_size_(max_file_size), max_rotate_count_(max_rotate_count),
+              ring_buffer_(capacity) {}
+
+    SGAsyncLogSink::~SGAsyncLogSink() {
+        stop();
+    }
+
+    bool SGAsyncLogSink::start(C4LogLevel level) {
+        lock_guard<mutex> lock(drain_lock_);
+        if (thread_.joinable()) {
+            return false;
+        }
+
+        SGAsyncLogSink *expected = nullptr;
+        if (!active_sink_.compare_exchange_strong(expected, this)) {
+            return false;
+        }
+
+        file_ = fopen(file_path_.c_str(), "ab");
+        if (file_ == nullptr) {
+            active_sink_.store(nullptr);
+            return false;
+        }
+        fseek(file_, 0, SEEK_END);
+        long size = ftell(file_);
+        file_size_ = size > 0 ? (uint64_t) size : 0;
+
+        stopping_ = false;
+        thread_ = thread(&SGAsyncLogSink::run, this);
+        previous_callback_ = c4log_getCallback();
+        previous_level_ = c4log_callbackLevel();
+        c4log_writeToCallback(level, &SGAsyncLogSink::logCallback, false);
+        return true;
+    }
+
+    void SGAsyncLogSink::stop() {
+        {
+            lock_guard<mutex> lock(drain_lock_);
+            if (!thread_.joinable()) {
+                return;
+            }
+        }
+
+        // LiteCore's own callbacks take the format and arguments, like ours
+        c4log_writeToCallback(previous_level_, previous_callback_, false);
+        previous_callback_ = nullptr;
+        active_sink_.store(nullptr);
+        // A callback may still be pushing a message
+        while (active_callbacks_.load() > 0) {
+            this_thread::yield();
+        }
+
+        {
+            lock_guard<mutex> lock(drain_lock_);
+            stopping_ = true;
+        }
+        drain_wakeup_.notify_all();
+        thread_.join();
+
+        if (file_ != nullptr) {
+            fclose(file_);
+            file_ = nullptr;
+        }
+    }
+
+    void SGAsyncLogSink::flush() {
+        unique_lock<mutex> lock(drain_lock_);
+        if (!thread_.joinable() || stopping_) {
+            return;
+        }
+        uint64_t request = ++flush_requests_;
+        drain_wakeup_.notify_all();
+        drained_.wait(lock, [this, request] { return flushed_requests_ >= request || stopping_; });
+    }
+
+    SGAsyncLogSinkStats SGAsyncLogSink::getStats() const {
+        SGAsyncLogSinkStats stats {};
+        stats.logged_count = logged_count_.load(memory_order_relaxed);
+        stats.dropped_count = dropped_count_.load(memory_order_relaxed);
+        stats.truncated_count = truncated_count_.load(memory_order_relaxed);
+        stats.written_bytes = written_bytes_.load(memory_order_relaxed);
+        stats.rotation_count = rotation_count_.load(memory_order_relaxed);
+        return stats;
+    }
+
+    bool SGAsyncLogSink::enableBinaryLogFiles(const std::string &directory, C4LogLevel level, uint64_t max_file_size,
+                                              unsigned max_rotate_count) {
+        C4LogFileOptions options {};
+        options.log_level = level;
+        options.base_path = c4str(directory.c_str());
+        options.max_size_bytes = (int64_t) max_file_size;
+        options.max_rotate_count = (int32_t) max_rotate_count;
+        options.use_plaintext = false;
+        C4Error error {};
+        return c4log_writeToBinaryFile(options, &error);
+    }
+
+    void SGAsyncLogSink::logCallback(C4LogDomain domain, C4LogLevel level, const char *fmt, va_list args) {
+        active_callbacks_.fetch_add(1);
+        SGAsyncLogSink *sink = active_sink_.load();
+        if (sink != nullptr) {
+            sink->push(domain, level, fmt, args);
+        }
+        active_callbacks_.fetch_sub(1);
+    }
+
+    void SGAsyncLogSink::push(C4LogDomain domain, C4LogLevel level, const char *fmt, va_list args) {
+        LogRecord record;
+        record.time = chrono::system_clock::now();
+        record.domain = domain;
+        record.level = level;
+        int length = vsnprintf(record.message, kMaxMessageLength, fmt, args);
+        if (length < 0) {
+            length = 0;
+        } else if ((size_t) length >= kMaxMessageLength) {
+            length = (int) kMaxMessageLength - 1;
+            truncated_count_.fetch_add(1, memory_order_relaxed);
+        }
+        record.length = (uint16_t) length;
+
+        if (!ring_buffer_.tryPush(move(record))) {
+            dropped_count_.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        // Don't wait for the next interval once the buffer is filling up. Notifying without the lock may miss the
+        // drain thread, it then wakes up on its interval.
+        if (ring_buffer_.sizeApprox() >= ring_buffer_.capacity() / 2) {
+            drain_wakeup_.notify_one();
+        }
+    }
+
+    void SGAsyncLogSink::run() {
+        while (true) {
+            uint64_t request;
+            bool stopping;
+            {
+                unique_lock<mutex> lock(drain_lock_);
+                drain_wakeup_.wait_for(lock, kDrainInterval,
+                                       [this] { return stopping_ || flush_requests_ != flushed_requests_; });
+                request = flush_requests_;
+                stopping = stopping_;
+            }
+
+            drain();
+
+            {
+                lock_guard<mutex> lock(drain_lock_);
+                flushed_requests_ = request;
+            }
+            drained_.notify_all();
+
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    void SGAsyncLogSink::drain() {
+        LogRecord record;
+        while (ring_buffer_.tryPop(record)) {
+            write(record);
+        }
+
+        uint64_t dropped_count = dropped_count_.load(memory_order_relaxed);
+        if (dropped_count != reported_dropped_count_) {
+            writeLine(formatTime(chrono::system_clock::now()) + " WARNING SG.log: " +
+                      to_string(dropped_count - reported_dropped_count_) + " messages dropped, the log buffer was full\n");
+            reported_dropped_count_ = dropped_count;
+        }
+
+        if (file_ != nullptr) {
+            fflush(file_);
+        }
+    }
+
+    void SGAsyncLogSink::write(const LogRecord &record) {
+        const char *domain_name = record.domain != nullptr ? c4log_getDomainName(record.domain) : nullptr;
+        const char *level_name = record.level >= kC4LogDebug && record.level <= kC4LogError ? kLevelNames[record.level] : "";
+
+        string line = formatTime(record.time);
+        line += ' ';
+        line += level_name;
+        line += ' ';
+        line += domain_name != nullptr ? domain_name : "";
+        line += ": ";
+        line.append(record.message, record.length);
+        line += '\n';
+        writeLine(line);
+        logged_count_.fetch_add(1, memory_order_relaxed);
+    }
+
+    void SGAsyncLogSink::writeLine(const std::string &line) {
+        if (file_size_ > 0 && file_size_ + line.size() > max_file_size_) {
+            rotate();
+        }
+        if (file_ == nullptr) {
+            return;
+        }
+        size_t written = fwrite(line.data(), 1, line.size(), file_);
+        file_size_ += written;
+        written_bytes_.fetch_add(written, memory_order_relaxed);
+    }
+
+    void SGAsyncLogSink::rotate() {
+        if (file_ != nullptr) {
+            fclose(file_);
+            file_ = nullptr;
+        }
+
+        if (max_rotate_count_ == 0) {
+            remove(file_path_.c_str());
+        } else {
+            remove(rotatedFilePath(file_path_, max_rotate_count_).c_str());
+            for (unsigned index = max_rotate_count_; index > 1; --index) {
+                rename(rotatedFilePath(file_path_, index - 1).c_str(), rotatedFilePath(file_path_, index).c_str());
+            }
+            rename(file_path_.c_str(), rotatedFilePath(file_path_, 1).c_str());
+        }
+
+        file_ = fopen(file_path_.c_str(), "wb");
+        file_size_ = 0;
+        rotation_count_.fetch_add(1, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,113 @@
+//
+//  SGBandwidthLimiter.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <map>
+
+#include "SGBandwidthLimiter.h"
+
+using namespace std;
+
+namespace Strata {
+    // Limiters by ID, so the socket factories can find them from the replicator options
+    static mutex registry_lock;
+    static map<uint64_t, weak_ptr<SGBandwidthLimiter>> registry;
+    static uint64_t next_id = 1;
+
+    shared_ptr<SGBandwidthLimiter> SGBandwidthLimiter::create() {
+        lock_guard<mutex> lock(registry_lock);
+        for (auto iter = registry.begin(); iter != registry.end();) {
+            iter = iter->second.expired() ? registry.erase(iter) : next(iter);
+        }
+        shared_ptr<SGBandwidthLimiter> limiter(new SGBandwidthLimiter(next_id++));
+        registry[limiter->id_] = limiter;
+        return limiter;
+    }
+
+    shared_ptr<SGBandwidthLimiter> SGBandwidthLimiter::find(uint64_t id) {
+        lock_guard<mutex> lock(registry_lock);
+        auto iter = registry.find(id);
+        return iter == registry.end() ? nullptr : iter->second.lock();
+    }
+
+    SGBandwidthLimiter &SGBandwidthLimiter::process() {
+        static SGBandwidthLimiter process_limiter(0);
+        return process_limiter;
+    }
+
+    SGBandwidthLimiter::SGBandwidthLimiter(uint64_t id) : id_(id) {}
+
+    SGBandwidthLimiter::~SGBandwidthLimiter() {}
+
+    uint64_t SGBandwidthLimiter::getId() const {
+        return id_;
+    }
+
+    void SGBandwidthLimiter::setLimits(uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second,
+                                       uint64_t burst_bytes) {
+        lock_guard<mutex> lock(limiter_lock_);
+        uint64_t rates[2] = {upload_bytes_per_second, download_bytes_per_second};
+        for (int index = 0; index < 2; ++index) {
+            Bucket &bucket = buckets_[index];
+            bool was_limited = bucket.rate > 0;
+            bucket.rate = rates[index];
+            bucket.capacity = (double) (burst_bytes > 0 ? burst_bytes : bucket.rate);
+            // A new limit starts with a full bucket, a changed one keeps its debt
+            bucket.tokens = was_limited ? min(bucket.tokens, bucket.capacity) : bucket.capacity;
+            bucket.refilled_at = Clock::now();
+        }
+    }
+
+    uint64_t SGBandwidthLimiter::getLimit(Direction direction) const {
+        lock_guard<mutex> lock(limiter_lock_);
+        return buckets_[(int) direction].rate;
+    }
+
+    std::chrono::nanoseconds SGBandwidthLimiter::reserve(Direction direction, size_t byte_count) {
+        lock_guard<mutex> lock(limiter_lock_);
+        Bucket &bucket = buckets_[(int) direction];
+        if (bucket.rate == 0) {
+            return chrono::nanoseconds::zero();
+        }
+
+        Clock::time_point now = Clock::now();
+        double elapsed_seconds = chrono::duration<double>(now - bucket.refilled_at).count();
+        bucket.tokens = min(bucket.capacity, bucket.tokens + elapsed_seconds * bucket.rate);
+        bucket.refilled_at = now;
+
+        bucket.tokens -= byte_count;
+        if (bucket.tokens >= 0) {
+            return chrono::nanoseconds::zero();
+        }
+        return chrono::nanoseconds((int64_t) (-bucket.tokens * 1e9 / bucket.rate));
+    }
+
+    void SGBandwidthLimiter::addThrottleTime(Direction direction, const std::chrono::nanoseconds &throttle_time) {
+        buckets_[(int) direction].throttle_time_ns += throttle_time.count();
+    }
+
+    uint64_t SGBandwidthLimiter::getThrottleTimeMs(Direction direction) const {
+        return buckets_[(int) direction].throttle_time_ns / 1000000;
+    }
+}
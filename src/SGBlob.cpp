@@ -0,0 +1,245 @@
+//
+//  SGBlob.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <type_traits>
+
+#include "SGBlob.h"
+#include "SGDatabase.h"
+#include "SGUtility.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+using namespace fleece::impl;
+
+namespace Strata {
+    constexpr const char *SGBlob::kTypeProperty;
+    constexpr const char *SGBlob::kBlobType;
+    constexpr const char *SGBlob::kDigestProperty;
+    constexpr const char *SGBlob::kLengthProperty;
+    constexpr const char *SGBlob::kContentTypeProperty;
+
+    SGBlob::SGBlob() {}
+
+    SGBlob::SGBlob(const std::string &digest, uint64_t length, const std::string &content_type)
+            : digest_(digest), length_(length), content_type_(content_type) {}
+
+    SGBlob::~SGBlob() {}
+
+    bool SGBlob::fromDict(const fleece::impl::Dict *dict, SGBlob &blob) {
+        if (dict == nullptr) {
+            return false;
+        }
+        const Value *type = dict->get(slice(kTypeProperty));
+        const Value *digest = dict->get(slice(kDigestProperty));
+        if (type == nullptr || type->asString() != slice(kBlobType) || digest == nullptr || !digest->asString()) {
+            return false;
+        }
+
+        const Value *length = dict->get(slice(kLengthProperty));
+        const Value *content_type = dict->get(slice(kContentTypeProperty));
+        blob = SGBlob(digest->asString().asString(), length ? length->asUnsigned() : 0,
+                      content_type ? content_type->asString().asString() : string());
+        return true;
+    }
+
+    bool SGBlob::containsBlobs(const fleece::impl::Value *value) {
+        if (value == nullptr) {
+            return false;
+        }
+        const Dict *dict = value->asDict();
+        if (dict != nullptr) {
+            SGBlob blob;
+            if (fromDict(dict, blob)) {
+                return true;
+            }
+            for (Dict::iterator iter(dict); iter; ++iter) {
+                if (containsBlobs(iter.value())) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        const Array *array = value->asArray();
+        if (array != nullptr) {
+            for (Array::iterator iter(array); iter; ++iter) {
+                if (containsBlobs(iter.value())) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    fleece::Retained<fleece::impl::MutableDict> SGBlob::toDict() const {
+        Retained<MutableDict> dict = MutableDict::newDict();
+        dict->set(slice(kTypeProperty), slice(kBlobType));
+        dict->set(slice(kDigestProperty), slice(digest_));
+        dict->set(slice(kLengthProperty), length_);
+        if (!content_type_.empty()) {
+            dict->set(slice(kContentTypeProperty), slice(content_type_));
+        }
+        return dict;
+    }
+
+    const std::string &SGBlob::getDigest() const {
+        return digest_;
+    }
+
+    uint64_t SGBlob::getLength() const {
+        return length_;
+    }
+
+    const std::string &SGBlob::getContentType() const {
+        return content_type_;
+    }
+
+    bool SGBlob::isValid() const {
+        return !digest_.empty();
+    }
+
+    SGBlobWriter::SGBlobWriter(SGDatabase *database) {
+        C4Database *c4db = database ? database->acquireBlobStream() : nullptr;
+        if (c4db == nullptr) {
+            qC4Critical(logDomainSGDatabase, "Writing a blob while the DB is not open");
+            return;
+        }
+        database_ = database;
+        blob_store_ = c4db_getBlobStore(c4db, &c4error_);
+        if (blob_store_ != nullptr) {
+            write_stream_ = c4blob_openWriteStream(blob_store_, &c4error_);
+        }
+        if (write_stream_ == nullptr) {
+            qC4Critical(logDomainSGDatabase, "c4blob_openWriteStream Error: %s --", C4ErrorToString(c4error_).c_str());
+        }
+    }
+
+    SGBlobWriter::~SGBlobWriter() {
+        // Deletes the temporary file if the content wasn't installed
+        c4stream_closeWriter(write_stream_);
+        if (database_ != nullptr) {
+            database_->releaseBlobStream();
+        }
+    }
+
+    SGBlobReturnStatus SGBlobWriter::write(const void *data, size_t size) {
+        if (database_ == nullptr) {
+            return SGBlobReturnStatus::kOpenDBError;
+        }
+        if (write_stream_ == nullptr) {
+            return SGBlobReturnStatus::kOpenStreamError;
+        }
+        if (!c4stream_write(write_stream_, data, size, &c4error_)) {
+            qC4Critical(logDomainSGDatabase, "c4stream_write Error: %s --", C4ErrorToString(c4error_).c_str());
+            return SGBlobReturnStatus::kWriteError;
+        }
+        bytes_written_ += size;
+        return SGBlobReturnStatus::kNoError;
+    }
+
+    SGBlobReturnStatus SGBlobWriter::install(const std::string &content_type, SGBlob &blob) {
+        if (database_ == nullptr) {
+            return SGBlobReturnStatus::kOpenDBError;
+        }
+        if (write_stream_ == nullptr) {
+            return SGBlobReturnStatus::kOpenStreamError;
+        }
+
+        C4BlobKey blob_key = c4stream_computeBlobKey(write_stream_);
+        // Same digest, same content: keep the stored copy and drop the new one
+        deduplicated_ = c4blob_getSize(blob_store_, blob_key) >= 0;
+        if (!deduplicated_ && !c4stream_install(write_stream_, nullptr, &c4error_)) {
+            qC4Critical(logDomainSGDatabase, "c4stream_install Error: %s --", C4ErrorToString(c4error_).c_str());
+            return SGBlobReturnStatus::kInstallError;
+        }
+        c4stream_closeWriter(write_stream_);
+        write_stream_ = nullptr;
+
+        alloc_slice digest = c4blob_keyToString(blob_key);
+        blob = SGBlob(digest.asString(), bytes_written_, content_type);
+        qC4Debug(logDomainSGDatabase, "Installed blob %s, %llu bytes%s", blob.getDigest().c_str(),
+                 (unsigned long long) bytes_written_, deduplicated_ ? " (already stored)" : "");
+        return SGBlobReturnStatus::kNoError;
+    }
+
+    uint64_t SGBlobWriter::getBytesWritten() const {
+        return bytes_written_;
+    }
+
+    bool SGBlobWriter::wasDeduplicated() const {
+        return deduplicated_;
+    }
+
+    SGBlobReader::SGBlobReader(SGDatabase *database, const SGBlob &blob) {
+        C4Database *c4db = database ? database->acquireBlobStream() : nullptr;
+        if (c4db == nullptr) {
+            status_ = SGBlobReturnStatus::kOpenDBError;
+            return;
+        }
+        database_ = database;
+        C4BlobKey blob_key;
+        if (!c4blob_keyFromString(slice(blob.getDigest()), &blob_key)) {
+            status_ = SGBlobReturnStatus::kInvalidArgumentError;
+            return;
+        }
+
+        C4BlobStore *blob_store = c4db_getBlobStore(c4db, &c4error_);
+        if (blob_store == nullptr || c4blob_getSize(blob_store, blob_key) < 0) {
+            status_ = SGBlobReturnStatus::kNotFoundError;
+            return;
+        }
+        read_stream_ = c4blob_openReadStream(blob_store, blob_key, &c4error_);
+        if (read_stream_ == nullptr) {
+            qC4Critical(logDomainSGDatabase, "c4blob_openReadStream Error: %s --", C4ErrorToString(c4error_).c_str());
+            status_ = SGBlobReturnStatus::kOpenStreamError;
+        }
+    }
+
+    SGBlobReader::~SGBlobReader() {
+        c4stream_close(read_stream_);
+        if (database_ != nullptr) {
+            database_->releaseBlobStream();
+        }
+    }
+
+    SGBlobReturnStatus SGBlobReader::getStatus() const {
+        return status_;
+    }
+
+    size_t SGBlobReader::read(void *buffer, size_t size) {
+        if (read_stream_ == nullptr) {
+            return 0;
+        }
+        size_t bytes_read = c4stream_read(read_stream_, buffer, size, &c4error_);
+        if (bytes_read == 0 && c4error_.code != 0) {
+            qC4Critical(logDomainSGDatabase, "c4stream_read Error: %s --", C4ErrorToString(c4error_).c_str());
+            status_ = SGBlobReturnStatus::kReadError;
+        }
+        return bytes_read;
+    }
+
+    std::ostream& operator << (std::ostream& os, const SGBlobReturnStatus& return_status){
+        return os << static_cast<underlying_type<SGBlobReturnStatus>::type> (return_status);
+    }
+}
@@ -0,0 +1,420 @@
+//
+//  SGCivetWebSocketFactory.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <civetweb/civetweb.h>
+#include <litecore/c4Replicator.h>
+
+#include "SGCivetWebSocketFactory.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    const size_t SGCivetWebSocketFactory::kMaxUnreadBytes;
+    const size_t SGCivetWebSocketFactory::kReadBufferSize;
+    const size_t SGCivetWebSocketFactory::kMaxResponseHeaderSize;
+    const unsigned SGCivetWebSocketFactory::kStopTimeoutMs;
+    const unsigned SGCivetWebSocketFactory::kTimerResolutionMs;
+
+    typedef chrono::steady_clock Clock;
+
+    // civetweb feature flag for TLS, see mg_init_library()
+    static const unsigned kCivetWebFeatureTLS = 2;
+
+    SGCivetWebSocketFactory::SGCivetWebSocketFactory() : SGSocketFactory(kC4NoFraming) {
+        mg_init_library(kCivetWebFeatureTLS);
+    }
+
+    SGCivetWebSocketFactory::~SGCivetWebSocketFactory() {
+        unique_lock<mutex> lock(connections_lock_);
+        if (!connections_finished_.wait_for(lock, chrono::milliseconds(kStopTimeoutMs),
+                                            [this]() { return running_connections_ == 0; })) {
+            qC4Critical(logDomainSGReplicator, "%u WebSocket connections still running, stop the replicators before deleting their socket factory", running_connections_);
+        }
+        lock.unlock();
+        mg_exit_library();
+    }
+
+    void SGCivetWebSocketFactory::setCompressionLevel(int compression_level) {
+        compression_level_ = compression_level;
+    }
+
+    int SGCivetWebSocketFactory::getCompressionLevel() const {
+        return compression_level_;
+    }
+
+    void SGCivetWebSocketFactory::open(C4Socket *socket, const C4Address *address, C4Slice options) {
+        shared_ptr<Connection> connection = make_shared<Connection>();
+        connection->socket = socket;
+        connection->scheme = slice(address->scheme).asString();
+        connection->host = slice(address->hostname).asString();
+        connection->port = address->port;
+        connection->path = slice(address->path).asString();
+        connection->options = alloc_slice(options);
+        connection->compression_level = compression_level_;
+        connection->heartbeat_interval = chrono::seconds(getSecondsOption(options, kC4ReplicatorHeartbeatInterval));
+        connection->idle_timeout = chrono::seconds(getSecondsOption(options, kOptionIdleTimeout));
+        connection->bandwidth_limiter = getBandwidthLimiter(options);
+        socket->nativeHandle = new ConnectionHandle(this, connection);
+
+        {
+            lock_guard<mutex> lock(connections_lock_);
+            running_connections_++;
+        }
+        thread(&SGCivetWebSocketFactory::run, this, connection).detach();
+    }
+
+    void SGCivetWebSocketFactory::run(shared_ptr<Connection> connection) {
+        char error_buffer[256] = {0};
+        bool use_tls = connection->scheme == "wss";
+        mg_connection *civet_connection = mg_connect_client(connection->host.c_str(), connection->port, use_tls ? 1 : 0,
+                                                            error_buffer, sizeof(error_buffer));
+        if (civet_connection == nullptr) {
+            qC4Warning(logDomainSGReplicator, "Could not connect to %s:%u: %s", connection->host.c_str(), connection->port, error_buffer);
+            closeSocket(connection, c4error_make(POSIXDomain, ECONNREFUSED, slice(error_buffer)));
+        } else {
+            {
+                lock_guard<mutex> lock(connection->write_lock);
+                connection->connection = civet_connection;
+            }
+
+            string leftover;
+            if (handshake(connection, leftover)) {
+                qC4Info(logDomainSGReplicator, "WebSocket connected to %s:%u, compression %s", connection->host.c_str(), connection->port, connection->codec.isDeflateEnabled() ? "on" : "off");
+                SGScheduler::TaskId timer_task = 0;
+                if (connection->heartbeat_interval.count() > 0 || connection->idle_timeout.count() > 0) {
+                    {
+                        lock_guard<mutex> lock(connection->lock);
+                        connection->last_received = Clock::now();
+                        connection->next_heartbeat = connection->last_received + connection->heartbeat_interval;
+                    }
+                    timer_task = scheduler_.scheduleEvery(chrono::milliseconds(kTimerResolutionMs), [this, connection]() {
+                        checkTimers(connection);
+                    });
+                }
+                opened(connection->socket);
+
+                auto on_message = [this, &connection](int opcode, const string &payload) {
+                    if (!onMessage(connection, opcode, payload)) {
+                        lock_guard<mutex> lock(connection->lock);
+                        connection->socket_closed = true;
+                    }
+                };
+                vector<char> buffer(kReadBufferSize);
+                bool reading = connection->codec.decode(leftover.data(), leftover.size(), on_message);
+                while (reading) {
+                    {
+                        lock_guard<mutex> lock(connection->lock);
+                        if (connection->socket_closed) {
+                            break;
+                        }
+                    }
+                    int read_count = mg_read(civet_connection, buffer.data(), buffer.size());
+                    if (read_count <= 0) {
+                        break;
+                    }
+                    uint64_t inflate_time_ns = connection->codec.getInflateTimeNs();
+                    {
+                        lock_guard<mutex> lock(connection->lock);
+                        connection->last_received = Clock::now();
+                    }
+                    countWireBytes(0, read_count);
+                    reading = connection->codec.decode(buffer.data(), read_count, on_message);
+                    countCompressionTime(connection->codec.getInflateTimeNs() - inflate_time_ns);
+
+                    // Over the download limit: stop reading, TCP pushes back on the server
+                    chrono::nanoseconds throttle_delay = throttle(connection->bandwidth_limiter.get(),
+                                                                  SGBandwidthLimiter::Direction::kDownload, read_count,
+                                                                  connection->receive_throttled_until);
+                    if (throttle_delay.count() > 0) {
+                        unique_lock<mutex> lock(connection->lock);
+                        connection->receive_window.wait_for(lock, throttle_delay, [&connection]() {
+                            return connection->socket_closed;
+                        });
+                    }
+                }
+
+                if (connection->codec.getCloseStatus() != 0) {
+                    int status = connection->codec.getCloseStatus();
+                    qC4Warning(logDomainSGReplicator, "WebSocket protocol error from %s, closing with status %d", connection->host.c_str(), status);
+                    string payload;
+                    payload += (char) ((status >> 8) & 0xFF);
+                    payload += (char) (status & 0xFF);
+                    sendFrame(connection, SGWebSocketCodec::kOpcodeClose, payload.data(), payload.size());
+                    closeSocket(connection, c4error_make(WebSocketDomain, status, slice("WebSocket protocol error")));
+                }
+                closeSocket(connection, c4error_make(WebSocketDomain, kWebSocketCloseAbnormal, slice("Connection closed")));
+                if (timer_task != 0) {
+                    scheduler_.cancel(timer_task);
+                }
+            }
+
+            {
+                lock_guard<mutex> lock(connection->write_lock);
+                connection->connection = nullptr;
+            }
+            mg_close_connection(civet_connection);
+        }
+
+        {
+            lock_guard<mutex> lock(connections_lock_);
+            running_connections_--;
+        }
+        connections_finished_.notify_all();
+    }
+
+    bool SGCivetWebSocketFactory::handshake(const shared_ptr<Connection> &connection, std::string &leftover) {
+        string extensions;
+        if (connection->compression_level != SGWebSocketCodec::kCompressionDisabled) {
+            extensions = SGWebSocketCodec::extensionOffer();
+        }
+        string websocket_key;
+        string request = makeUpgradeRequest(connection->host, connection->port, connection->path, connection->options,
+                                            extensions, websocket_key);
+        mg_connection *civet_connection = connection->connection;
+        if (mg_write(civet_connection, request.data(), request.size()) != (int) request.size()) {
+            closeSocket(connection, c4error_make(POSIXDomain, ECONNRESET, slice("Could not send the WebSocket handshake")));
+            return false;
+        }
+        countWireBytes(request.size(), 0);
+
+        string response;
+        size_t header_end;
+        char buffer[1024];
+        while ((header_end = response.find("\r\n\r\n")) == string::npos) {
+            int read_count = mg_read(civet_connection, buffer, sizeof(buffer));
+            if (read_count <= 0 || response.size() > kMaxResponseHeaderSize) {
+                closeSocket(connection, c4error_make(POSIXDomain, ECONNRESET, slice("No WebSocket handshake response")));
+                return false;
+            }
+            response.append(buffer, read_count);
+        }
+        countWireBytes(0, header_end + 4);
+        leftover = response.substr(header_end + 4);
+        response.resize(header_end);
+
+        string reason;
+        map<string, string> headers;
+        int status = parseUpgradeResponse(connection->socket, response, reason, headers);
+
+        if (status != 101) {
+            qC4Warning(logDomainSGReplicator, "WebSocket handshake with %s:%u refused: %d %s", connection->host.c_str(), connection->port, status, reason.c_str());
+            closeSocket(connection, c4error_make(WebSocketDomain, status, slice(reason)));
+            return false;
+        }
+        if (headers["sec-websocket-accept"] != SGWebSocketCodec::acceptKey(websocket_key)) {
+            qC4Warning(logDomainSGReplicator, "WebSocket handshake with %s:%u failed: wrong Sec-WebSocket-Accept", connection->host.c_str(), connection->port);
+            closeSocket(connection, c4error_make(WebSocketDomain, kWebSocketCloseProtocolError, slice("Invalid Sec-WebSocket-Accept")));
+            return false;
+        }
+
+        connection->codec.acceptExtension(headers["sec-websocket-extensions"], connection->compression_level);
+        return true;
+    }
+
+    bool SGCivetWebSocketFactory::onMessage(const shared_ptr<Connection> &connection, int opcode,
+                                            const std::string &payload) {
+        switch (opcode) {
+            case SGWebSocketCodec::kOpcodeText:
+            case SGWebSocketCodec::kOpcodeBinary: {
+                unique_lock<mutex> lock(connection->lock);
+                // Stop reading from the server, and let TCP push back, while LiteCore is behind.
+                connection->receive_window.wait(lock, [&connection]() {
+                    return connection->unread_bytes < kMaxUnreadBytes || connection->socket_closed;
+                });
+                if (connection->socket_closed) {
+                    return false;
+                }
+                connection->unread_bytes += payload.size();
+                lock.unlock();
+                received(connection->socket, slice(payload));
+                return true;
+            }
+            case SGWebSocketCodec::kOpcodePing:
+                sendFrame(connection, SGWebSocketCodec::kOpcodePong, payload.data(), payload.size());
+                return true;
+            case SGWebSocketCodec::kOpcodeClose: {
+                int status = kWebSocketCloseNormal;
+                slice message;
+                if (payload.size() >= 2) {
+                    status = ((uint8_t) payload[0] << 8) | (uint8_t) payload[1];
+                    message = slice(payload.data() + 2, payload.size() - 2);
+                }
+                // Echo the close frame if the server started the close handshake
+                sendFrame(connection, SGWebSocketCodec::kOpcodeClose, payload.data(), min((size_t) 2, payload.size()));
+                C4Error error {};
+                if (status != kWebSocketCloseNormal) {
+                    error = c4error_make(WebSocketDomain, status, message);
+                }
+                closeSocket(connection, error);
+                return false;
+            }
+            default:
+                return true;
+        }
+    }
+
+    bool SGCivetWebSocketFactory::sendFrame(const shared_ptr<Connection> &connection, int opcode, const void *data,
+                                            size_t size, std::chrono::nanoseconds *throttle_delay) {
+        lock_guard<mutex> lock(connection->write_lock);
+        if (connection->connection == nullptr || connection->close_sent) {
+            return false;
+        }
+        if (opcode == SGWebSocketCodec::kOpcodeClose) {
+            connection->close_sent = true;
+        }
+
+        uint64_t deflate_time_ns = connection->codec.getDeflateTimeNs();
+        string frame;
+        bool encoded = connection->codec.encode(opcode, data, size, frame);
+        countCompressionTime(connection->codec.getDeflateTimeNs() - deflate_time_ns);
+        if (!encoded) {
+            // Start the close handshake instead, the socket is closed when the server's close frame arrives
+            qC4Warning(logDomainSGReplicator, "Compression failed for %s, closing with status %d", connection->host.c_str(), SGWebSocketCodec::kCloseInternalError);
+            string payload;
+            payload += (char) ((SGWebSocketCodec::kCloseInternalError >> 8) & 0xFF);
+            payload += (char) (SGWebSocketCodec::kCloseInternalError & 0xFF);
+            connection->codec.encode(SGWebSocketCodec::kOpcodeClose, payload.data(), payload.size(), frame);
+            connection->close_sent = true;
+            if (mg_write(connection->connection, frame.data(), frame.size()) == (int) frame.size()) {
+                countWireBytes(frame.size(), 0);
+            }
+            return false;
+        }
+
+        if (mg_write(connection->connection, frame.data(), frame.size()) != (int) frame.size()) {
+            return false;
+        }
+        countWireBytes(frame.size(), 0);
+        chrono::nanoseconds delay = throttle(connection->bandwidth_limiter.get(), SGBandwidthLimiter::Direction::kUpload,
+                                             frame.size(), connection->send_throttled_until);
+        if (throttle_delay != nullptr) {
+            *throttle_delay = delay;
+        }
+        return true;
+    }
+
+    void SGCivetWebSocketFactory::closeSocket(const shared_ptr<Connection> &connection, const C4Error &error) {
+        // closed() must only be called once per socket, the socket is cleared under the lock.
+        C4Socket *socket;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            socket = connection->socket;
+            connection->socket = nullptr;
+            connection->socket_closed = true;
+        }
+        connection->receive_window.notify_all();
+        if (socket != nullptr) {
+            closed(socket, error);
+        }
+    }
+
+    void SGCivetWebSocketFactory::checkTimers(const shared_ptr<Connection> &connection) {
+        Clock::time_point now = Clock::now();
+        bool idle_timeout_expired = false;
+        bool heartbeat_due = false;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            if (connection->socket_closed) {
+                return;
+            }
+            idle_timeout_expired = connection->idle_timeout.count() > 0 &&
+                                   now - connection->last_received >= connection->idle_timeout;
+            if (connection->heartbeat_interval.count() > 0 && now >= connection->next_heartbeat) {
+                heartbeat_due = true;
+                connection->next_heartbeat = now + connection->heartbeat_interval;
+            }
+        }
+
+        if (idle_timeout_expired) {
+            // A NAT or proxy silently dropping the connection only shows as silence
+            qC4Warning(logDomainSGReplicator, "Nothing received from %s:%u for %lld seconds, dropping the connection", connection->host.c_str(), connection->port, (long long) connection->idle_timeout.count());
+            closeSocket(connection, c4error_make(NetworkDomain, kC4NetErrTimeout, slice("Connection idle timeout")));
+        } else if (heartbeat_due) {
+            sendFrame(connection, SGWebSocketCodec::kOpcodePing, nullptr, 0);
+        }
+    }
+
+    void SGCivetWebSocketFactory::write(C4Socket *socket, C4SliceResult data) {
+        shared_ptr<Connection> connection = ((ConnectionHandle *) socket->nativeHandle)->connection;
+        size_t byte_count = data.size;
+        chrono::nanoseconds throttle_delay {0};
+        sendFrame(connection, SGWebSocketCodec::kOpcodeBinary, data.buf, data.size, &throttle_delay);
+        c4slice_free(data);
+
+        if (throttle_delay.count() > 0) {
+            // Over the upload limit. LiteCore stops writing once enough data is unacknowledged, so acknowledging late
+            // holds the uploads back.
+            chrono::milliseconds delay = chrono::duration_cast<chrono::milliseconds>(throttle_delay) + chrono::milliseconds(1);
+            scheduler_.scheduleAfter(delay, [connection, byte_count]() {
+                lock_guard<mutex> lock(connection->lock);
+                if (connection->socket != nullptr) {
+                    c4socket_completedWrite(connection->socket, byte_count);
+                }
+            });
+            return;
+        }
+
+        bool socket_closed;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            socket_closed = connection->socket == nullptr;
+        }
+        if (!socket_closed) {
+            c4socket_completedWrite(socket, byte_count);
+        }
+    }
+
+    void SGCivetWebSocketFactory::completedReceive(C4Socket *socket, size_t byte_count) {
+        shared_ptr<Connection> connection = ((ConnectionHandle *) socket->nativeHandle)->connection;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            connection->unread_bytes -= min(connection->unread_bytes, byte_count);
+        }
+        connection->receive_window.notify_all();
+    }
+
+    void SGCivetWebSocketFactory::requestClose(C4Socket *socket, int status, C4String message) {
+        shared_ptr<Connection> connection = ((ConnectionHandle *) socket->nativeHandle)->connection;
+        string payload;
+        payload += (char) ((status >> 8) & 0xFF);
+        payload += (char) (status & 0xFF);
+        payload.append((const char *) message.buf, message.size);
+        if (!sendFrame(connection, SGWebSocketCodec::kOpcodeClose, payload.data(), payload.size())) {
+            C4Error error {};
+            if (status != kWebSocketCloseNormal) {
+                error = c4error_make(WebSocketDomain, status, message);
+            }
+            closeSocket(connection, error);
+        }
+        // Otherwise the socket is closed when the server's close frame arrives or the connection drops.
+    }
+}
@@ -22,7 +22,9 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <chrono>
 #include <iostream>
+#include <vector>
 
 #include "SGDatabase.h"
 
@@ -36,12 +38,99 @@
 #include "SGUtility.h"
 #include "SGPath.h"
 #include "SGLoggingCategories.h"
+#include "SGTrace.h"
 
 using namespace std;
 using namespace fleece;
 using namespace fleece::impl;
 
 namespace Strata {
+    const size_t SGDatabase::kBlobChunkSize;
+    constexpr const char *SGDatabase::kLocalDocumentStore;
+    const int64_t SGDatabase::kDefaultMaxSaveDelayMs;
+    const size_t SGDatabase::kSlowQueryLogCapacity;
+
+    typedef chrono::steady_clock Clock;
+
+    static uint64_t elapsedUs(Clock::time_point started_at) {
+        return (uint64_t) chrono::duration_cast<chrono::microseconds>(Clock::now() - started_at).count();
+    }
+
+    static const char *statusName(SGDatabaseReturnStatus status) {
+        switch (status) {
+            case SGDatabaseReturnStatus::kNoError: return "kNoError";
+            case SGDatabaseReturnStatus::kOpenDBError: return "kOpenDBError";
+            case SGDatabaseReturnStatus::kCloseDBError: return "kCloseDBError";
+            case SGDatabaseReturnStatus::kCreateDocumentError: return "kCreateDocumentError";
+            case SGDatabaseReturnStatus::kUpdatDocumentError: return "kUpdatDocumentError";
+            case SGDatabaseReturnStatus::kBeginTransactionError: return "kBeginTransactionError";
+            case SGDatabaseReturnStatus::kEndTransactionError: return "kEndTransactionError";
+            case SGDatabaseReturnStatus::kDBNameError: return "kDBNameError";
+            case SGDatabaseReturnStatus::kCreateDBDirectoryError: return "kCreateDBDirectoryError";
+            case SGDatabaseReturnStatus::kInvalidDBPath: return "kInvalidDBPath";
+            case SGDatabaseReturnStatus::kDeleteDocumentError: return "kDeleteDocumentError";
+            case SGDatabaseReturnStatus::kInvalidArgumentError: return "kInvalidArgumentError";
+            case SGDatabaseReturnStatus::kInvalidDocBody: return "kInvalidDocBody";
+        }
+        return "kUnknown";
+    }
+
+    static SGMetricLabels operationLabels(const std::string &db_name, const char *operation) {
+        SGMetricLabels labels;
+        labels["db"] = db_name;
+        labels["operation"] = operation;
+        return labels;
+    }
+
+    struct SGDatabase::Metrics {
+        Metrics(SGMetrics &metrics, const std::string &db_name)
+                : open(metrics, kLatencyName, operationLabels(db_name, "open")),
+                  close(metrics, kLatencyName, operationLabels(db_name, "close")),
+                  save(metrics, kLatencyName, operationLabels(db_name, "save")),
+                  get_document_by_id(metrics, kLatencyName, operationLabels(db_name, "getDocumentById")),
+                  delete_document(metrics, kLatencyName, operationLabels(db_name, "deleteDocument")),
+                  get_all_documents_key(metrics, kLatencyName, operationLabels(db_name, "getAllDocumentsKey")) {
+            SGMetricLabels labels;
+            labels["db"] = db_name;
+            lock_wait_us = &metrics.histogram("sg_database_lock_wait_us", labels);
+            not_found_count = &metrics.counter("sg_database_documents_not_found_total", labels);
+            save_commit_us = &metrics.histogram("sg_database_commit_us", operationLabels(db_name, "save"));
+            get_commit_us = &metrics.histogram("sg_database_commit_us", operationLabels(db_name, "getDocumentById"));
+            delete_commit_us = &metrics.histogram("sg_database_commit_us", operationLabels(db_name, "deleteDocument"));
+            saved_body_bytes = &metrics.histogram("sg_database_body_bytes", operationLabels(db_name, "save"));
+            loaded_body_bytes = &metrics.histogram("sg_database_body_bytes", operationLabels(db_name, "getDocumentById"));
+        }
+
+        static constexpr const char *kLatencyName = "sg_database_operation_latency_us";
+
+        // Latency per returned status. getDocumentById() reports kNoError for missing documents, counted apart.
+        SGOperationMetrics open;
+        SGOperationMetrics close;
+        SGOperationMetrics save;
+        SGOperationMetrics get_document_by_id;
+        SGOperationMetrics delete_document;
+        SGOperationMetrics get_all_documents_key;
+
+        SGHistogram *lock_wait_us;
+        SGCounter *not_found_count;
+        SGHistogram *save_commit_us;
+        SGHistogram *get_commit_us;
+        SGHistogram *delete_commit_us;
+        SGHistogram *saved_body_bytes;
+        SGHistogram *loaded_body_bytes;
+    };
+
+    constexpr const char *SGDatabase::Metrics::kLatencyName;
+
+    static void recordOperation(SGOperationMetrics &operation, SGDatabaseReturnStatus status, Clock::time_point started_at) {
+        operation.record((size_t) status, statusName(status), elapsedUs(started_at));
+    }
+
+    // SQLite's plan for a table read without an index, the documents are in kv_default. SQLite 3.36 dropped "TABLE".
+    static bool isFullScan(const std::string &plan) {
+        return plan.find("SCAN TABLE kv_") != string::npos || plan.find("SCAN kv_") != string::npos;
+    }
+
     SGDatabase::SGDatabase() {}
 
     SGDatabase::SGDatabase(const std::string &db_name): SGDatabase(db_name, string())  {}
@@ -71,8 +160,110 @@ namespace Strata {
         return db_path_;
     }
 
+    void SGDatabase::setMetrics(SGMetrics *metrics) {
+        unique_ptr<Metrics> new_metrics(metrics != nullptr ? new Metrics(*metrics, db_name_) : nullptr);
+        unique_lock<SGProfiledMutex> lock = lockDatabase("setMetrics");
+        metrics_.swap(new_metrics);
+    }
+
+    void SGDatabase::setLockProfilingEnabled(bool enabled) {
+        db_lock_.setProfilingEnabled(enabled);
+    }
+
+    SGLockStats SGDatabase::getLockStats() const {
+        return db_lock_.getStats();
+    }
+
+    SGMemoryUsage SGDatabase::getMemoryUsage() const {
+        return memory_tracker_->getUsage();
+    }
+
+    void SGDatabase::setMemoryLimit(uint64_t soft_limit_bytes, std::chrono::milliseconds max_save_delay) {
+        max_save_delay_ms_ = max_save_delay.count();
+        memory_limit_bytes_ = soft_limit_bytes;
+    }
+
+    void SGDatabase::setMemoryPressureListener(const std::function<void(const SGMemoryUsage &usage)> &callback) {
+        lock_guard<mutex> lock(memory_listener_lock_);
+        on_memory_pressure_callback_ = callback;
+    }
+
+    SGMemoryLimitStats SGDatabase::getMemoryLimitStats() const {
+        SGMemoryLimitStats stats;
+        stats.pressure_count = memory_pressure_count_;
+        stats.throttled_save_count = throttled_save_count_;
+        stats.throttle_time_us = throttle_time_us_;
+        stats.throttle_timeout_count = throttle_timeout_count_;
+        return stats;
+    }
+
+    void SGDatabase::checkMemoryLimit(bool throttle_save) {
+        uint64_t limit = memory_limit_bytes_;
+        if(limit == 0 || memory_tracker_->getTotalBytes() <= limit){
+            over_memory_limit_ = false;
+            return;
+        }
+
+        if(!over_memory_limit_.exchange(true)){
+            memory_pressure_count_++;
+            SGMemoryUsage usage = memory_tracker_->getUsage();
+            qC4Info(logDomainSGDatabase, "Database %s is over its memory limit: %llu of %llu bytes", db_name_.c_str(),
+                    (unsigned long long) usage.totalBytes(), (unsigned long long) limit);
+            function<void(const SGMemoryUsage &usage)> callback;
+            {
+                lock_guard<mutex> lock(memory_listener_lock_);
+                callback = on_memory_pressure_callback_;
+            }
+            if(callback){
+                callback(usage);
+            }
+        }
+
+        if(!throttle_save){
+            return;
+        }
+        SG_TRACE_SPAN("SGDatabase", "memory limit wait");
+        Clock::time_point started_at = Clock::now();
+        bool below_limit = memory_tracker_->waitForBytesBelow(limit, chrono::milliseconds(max_save_delay_ms_.load()));
+        throttled_save_count_++;
+        throttle_time_us_ += elapsedUs(started_at);
+        if(!below_limit){
+            throttle_timeout_count_++;
+        }
+    }
+
+    std::unique_lock<SGProfiledMutex> SGDatabase::lockDatabase(const char *operation) {
+        SG_TRACE_SPAN("SGDatabase", "db_lock_ wait");
+        Clock::time_point requested_at = Clock::now();
+        db_lock_.lock(operation);
+        // metrics_ is guarded by db_lock_, see setMetrics()
+        if(metrics_ != nullptr){
+            metrics_->lock_wait_us->record(elapsedUs(requested_at));
+        }
+        return unique_lock<SGProfiledMutex>(db_lock_, adopt_lock);
+    }
+
+    bool SGDatabase::_endTransaction(SGHistogram *commit_us) {
+        SG_TRACE_SPAN("SGDatabase", "c4db_endTransaction");
+        Clock::time_point started_at = Clock::now();
+        bool committed = c4db_endTransaction(c4db_, true, &c4error_);
+        if(commit_us != nullptr){
+            commit_us->record(elapsedUs(started_at));
+        }
+        return committed;
+    }
+
     SGDatabaseReturnStatus SGDatabase::open() {
-        lock_guard<mutex> lock(db_lock_);
+        Clock::time_point started_at = Clock::now();
+        unique_lock<SGProfiledMutex> lock = lockDatabase("open");
+        SGDatabaseReturnStatus status = _openDatabase();
+        if(metrics_ != nullptr){
+            recordOperation(metrics_->open, status, started_at);
+        }
+        return status;
+    }
+
+    SGDatabaseReturnStatus SGDatabase::_openDatabase() {
         qC4Debug(logDomainSGDatabase, "Calling open");
 
         // Check for empty db name
@@ -119,12 +310,21 @@ namespace Strata {
     }
 
     bool SGDatabase::isOpen() {
-        lock_guard<mutex> lock(db_lock_);
+        unique_lock<SGProfiledMutex> lock = lockDatabase("isOpen");
         return _isOpen();
     }
 
     SGDatabaseReturnStatus SGDatabase::close() {
-        lock_guard<mutex> lock(db_lock_);
+        Clock::time_point started_at = Clock::now();
+        unique_lock<SGProfiledMutex> lock = lockDatabase("close");
+        SGDatabaseReturnStatus status = _closeDatabase(lock);
+        if(metrics_ != nullptr){
+            recordOperation(metrics_->close, status, started_at);
+        }
+        return status;
+    }
+
+    SGDatabaseReturnStatus SGDatabase::_closeDatabase(std::unique_lock<SGProfiledMutex> &lock) {
         qC4Debug(logDomainSGDatabase, "Calling close");
 
         if( !_isOpen() ){
@@ -132,6 +332,15 @@ namespace Strata {
             return SGDatabaseReturnStatus::kCloseDBError;
         }
 
+        // The blob streams use c4db_ without the lock
+        blob_streams_closed_.wait(lock, [this]() {
+            return open_blob_streams_ == 0;
+        });
+        if( !_isOpen() ){
+            qC4Critical(logDomainSGDatabase, "DB closed while waiting for the blob streams");
+            return SGDatabaseReturnStatus::kCloseDBError;
+        }
+
         if(!c4db_close(c4db_, &c4error_)){
             qC4Critical(logDomainSGDatabase, "Could not close db: %s --", C4ErrorToString(c4error_).c_str());
             return SGDatabaseReturnStatus::kCloseDBError;
@@ -147,17 +356,19 @@ namespace Strata {
     }
 
     C4Database *SGDatabase::getC4db() {
-        lock_guard<mutex> lock(db_lock_);
+        unique_lock<SGProfiledMutex> lock = lockDatabase("getC4db");
         return c4db_;
     }
 
-    SGDatabaseReturnStatus SGDatabase::_createNewDocument(SGDocument *doc, alloc_slice body) {
+    SGDatabaseReturnStatus SGDatabase::_createNewDocument(SGDocument *doc, alloc_slice body, C4RevisionFlags revision_flags) {
         // Document does not exist. Creating a new one
         qC4Debug(logDomainSGDatabase, "Creating a new document");
 
-        C4RevisionFlags revisionFlags = kRevNew;
+        C4RevisionFlags revisionFlags = kRevNew | revision_flags;
 
+        SGTraceSpan create_span("SGDatabase", "c4doc_create");
         C4Document *newdoc = c4doc_create(c4db_, slice(doc->getId()), body, revisionFlags, &c4error_);
+        create_span.end();
 
         if(newdoc == nullptr){
             qC4Critical(logDomainSGDatabase, "Could not create new document: %s --", C4ErrorToString(c4error_).c_str());
@@ -167,13 +378,15 @@ namespace Strata {
         return SGDatabaseReturnStatus::kNoError;
     }
 
-    SGDatabaseReturnStatus SGDatabase::_updateDocument(SGDocument *doc, alloc_slice new_body) {
+    SGDatabaseReturnStatus SGDatabase::_updateDocument(SGDocument *doc, alloc_slice new_body, C4RevisionFlags revision_flags) {
         // Document exist. Make modifications to the body
         qC4Debug(logDomainSGDatabase, "document Exist. Working on updating the document: %s", doc->getId().c_str());
-        string rev_id = slice(doc->c4document_->revID).asString();
-        qC4Debug(logDomainSGDatabase, "REV id: %s\n", rev_id.c_str());
+        qC4Debug(logDomainSGDatabase, "REV id: %s\n", slice(doc->c4document_->revID).asString().c_str());
 
-        C4Document *newdoc = c4doc_update(doc->c4document_, new_body, doc->c4document_->selectedRev.flags, &c4error_);
+        C4RevisionFlags flags = (doc->c4document_->selectedRev.flags & ~kRevHasAttachments) | revision_flags;
+        SGTraceSpan update_span("SGDatabase", "c4doc_update");
+        C4Document *newdoc = c4doc_update(doc->c4document_, new_body, flags, &c4error_);
+        update_span.end();
 
         if(newdoc == nullptr){
             qC4Critical(logDomainSGDatabase, "Could not update the body of an existing document: %s --", C4ErrorToString(c4error_).c_str());
@@ -186,7 +399,18 @@ namespace Strata {
     }
 
     SGDatabaseReturnStatus SGDatabase::save(SGDocument *doc) {
-        lock_guard<mutex> lock(db_lock_);
+        checkMemoryLimit(true);
+        SG_TRACE_SPAN("SGDatabase", "SGDatabase::save");
+        Clock::time_point started_at = Clock::now();
+        unique_lock<SGProfiledMutex> lock = lockDatabase("save");
+        SGDatabaseReturnStatus status = _saveDocument(doc);
+        if(metrics_ != nullptr){
+            recordOperation(metrics_->save, status, started_at);
+        }
+        return status;
+    }
+
+    SGDatabaseReturnStatus SGDatabase::_saveDocument(SGDocument *doc) {
         qC4Debug(logDomainSGDatabase, "Calling save\n");
 
         if(!_isOpen()){
@@ -204,27 +428,36 @@ namespace Strata {
         // Encode document mutable dictionary to fleece format
         alloc_slice fleece_data;
         try{
+            SG_TRACE_SPAN("SGDatabase", "JSON to fleece");
             fleece_data = JSONConverter::convertJSON(doc->mutable_dict_->toJSONString());
         }catch (const FleeceException& e){
             qC4Critical(logDomainSGDatabase, "Convert body error: %s", e.what());
             return SGDatabaseReturnStatus::kInvalidDocBody;
         }
+        if(metrics_ != nullptr){
+            metrics_->saved_body_bytes->record(fleece_data.size);
+        }
 
+        SGTraceSpan begin_span("SGDatabase", "c4db_beginTransaction");
         if(!c4db_beginTransaction(c4db_, &c4error_)){
             qC4Critical(logDomainSGDatabase, "save kBeginTransactionError: %s --", C4ErrorToString(c4error_).c_str());
             return SGDatabaseReturnStatus::kBeginTransactionError;
         }
+        begin_span.end();
 
         C4Document *c4doc = doc->getC4document();
 
+        // The replicator only looks for blobs to push in revisions flagged with attachments
+        C4RevisionFlags revision_flags = SGBlob::containsBlobs(doc->asDict()) ? kRevHasAttachments : 0;
+
         if (c4doc == nullptr) {
-            status = _createNewDocument(doc, fleece_data);
+            status = _createNewDocument(doc, fleece_data, revision_flags);
 
         } else {
-            status = _updateDocument(doc, fleece_data);
+            status = _updateDocument(doc, fleece_data, revision_flags);
         }
 
-        if(!c4db_endTransaction(c4db_, true, &c4error_)){
+        if(!_endTransaction(metrics_ != nullptr ? metrics_->save_commit_us : nullptr)){
             qC4Critical(logDomainSGDatabase, "save kEndTransactionError: %s --", C4ErrorToString(c4error_).c_str());
             return SGDatabaseReturnStatus::kEndTransactionError;
         }
@@ -234,9 +467,32 @@ namespace Strata {
     }
 
     C4Document *SGDatabase::getDocumentById(const std::string &doc_id) {
-        lock_guard<mutex> lock(db_lock_);
+        checkMemoryLimit(false);
+        SG_TRACE_SPAN("SGDatabase", "SGDatabase::getDocumentById");
+        Clock::time_point started_at = Clock::now();
+        unique_lock<SGProfiledMutex> lock = lockDatabase("getDocumentById");
+        SGDatabaseReturnStatus status;
+        C4Document *c4doc = _loadDocument(doc_id, status);
+        if(metrics_ == nullptr){
+            return c4doc;
+        }
+        recordOperation(metrics_->get_document_by_id, status, started_at);
+        if(c4doc != nullptr){
+            metrics_->loaded_body_bytes->record(c4doc->selectedRev.body.size);
+        } else if(status == SGDatabaseReturnStatus::kNoError){
+            metrics_->not_found_count->increment();
+        }
+        return c4doc;
+    }
 
-        if(!_isOpen() || doc_id.empty()){
+    C4Document *SGDatabase::_loadDocument(const std::string &doc_id, SGDatabaseReturnStatus &status) {
+        if(!_isOpen()){
+            status = SGDatabaseReturnStatus::kOpenDBError;
+            return nullptr;
+        }
+
+        if(doc_id.empty()){
+            status = SGDatabaseReturnStatus::kInvalidArgumentError;
             return nullptr;
         }
 
@@ -245,23 +501,37 @@ namespace Strata {
 
         if(!c4db_beginTransaction(c4db_, &c4error_)){
             qC4Critical(logDomainSGDatabase, "getDocumentById starting transaction failed on document %s, error: %s --", doc_id.c_str(), C4ErrorToString(c4error_).c_str());
+            status = SGDatabaseReturnStatus::kBeginTransactionError;
             return nullptr;
         }
 
+        SGTraceSpan get_span("SGDatabase", "c4doc_get");
         c4doc = c4doc_get(c4db_, slice(doc_id), true, &c4error_);
+        get_span.end();
 
-        if(!c4db_endTransaction(c4db_, true, &c4error_)){
+        if(!_endTransaction(metrics_ != nullptr ? metrics_->get_commit_us : nullptr)){
             qC4Critical(logDomainSGDatabase, "getDocumentById ending transaction failed on document %s", doc_id.c_str());
+            status = SGDatabaseReturnStatus::kEndTransactionError;
             return nullptr;
         }
 
         qC4Debug(logDomainSGDatabase, "END getDocumentById: %s", doc_id.c_str());
+        status = SGDatabaseReturnStatus::kNoError;
         return c4doc;
     }
 
     SGDatabaseReturnStatus SGDatabase::deleteDocument(SGDocument *doc) {
-        lock_guard<mutex> lock(db_lock_);
+        SG_TRACE_SPAN("SGDatabase", "SGDatabase::deleteDocument");
+        Clock::time_point started_at = Clock::now();
+        unique_lock<SGProfiledMutex> lock = lockDatabase("deleteDocument");
+        SGDatabaseReturnStatus status = _purgeDocument(doc);
+        if(metrics_ != nullptr){
+            recordOperation(metrics_->delete_document, status, started_at);
+        }
+        return status;
+    }
 
+    SGDatabaseReturnStatus SGDatabase::_purgeDocument(SGDocument *doc) {
         if(!_isOpen()){
             qC4Critical(logDomainSGDatabase, "Calling deleteDocument() while DB is not open");
             return SGDatabaseReturnStatus::kOpenDBError;
@@ -282,7 +552,7 @@ namespace Strata {
         // Try to delete the document
         bool is_deleted = c4db_purgeDoc(c4db_, slice(doc->getId()), &c4error_);
 
-        if(!c4db_endTransaction(c4db_, true, &c4error_)){
+        if(!_endTransaction(metrics_ != nullptr ? metrics_->delete_commit_us : nullptr)){
             qC4Critical(logDomainSGDatabase, "deleteDocument kEndTransactionError: %s --", C4ErrorToString(c4error_).c_str());
             return SGDatabaseReturnStatus::kEndTransactionError;
         }
@@ -300,9 +570,26 @@ namespace Strata {
         return SGDatabaseReturnStatus::kNoError;
     }
 
+    uint64_t SGDatabase::getDocumentCount() {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("getDocumentCount");
+        if(!_isOpen()){
+            return 0;
+        }
+        return c4db_getDocumentCount(c4db_);
+    }
+
     bool SGDatabase::getAllDocumentsKey(std::vector<std::string>& document_keys) {
-        lock_guard<mutex> lock(db_lock_);
+        Clock::time_point started_at = Clock::now();
+        unique_lock<SGProfiledMutex> lock = lockDatabase("getAllDocumentsKey");
+        bool succeeded = _queryAllDocumentsKey(document_keys);
+        if(metrics_ != nullptr){
+            // No status to report, every failure is labeled kQueryError
+            metrics_->get_all_documents_key.record(succeeded ? 0 : 1, succeeded ? "kNoError" : "kQueryError", elapsedUs(started_at));
+        }
+        return succeeded;
+    }
 
+    bool SGDatabase::_queryAllDocumentsKey(std::vector<std::string> &document_keys) {
         if(!_isOpen()){
             qC4Warning(logDomainSGDatabase, "Trying to run database query while DB is not open!");
             return false;
@@ -311,30 +598,226 @@ namespace Strata {
         const static string json = "[\"SELECT\", {\"WHAT\": [[\"._id\"]]}]";
         std::unique_ptr<C4Query, decltype(&c4query_free)> query(c4query_new(c4db_, slice(json), &c4error_), &c4query_free);
 
-        if(query != nullptr){
-            C4QueryOptions options = kC4DefaultQueryOptions;
-            std::unique_ptr<C4QueryEnumerator, decltype(&c4queryenum_free)> query_enumerator(c4query_run(query.get(), &options, c4str(nullptr), &c4error_), &c4queryenum_free);
-
-            if(query_enumerator != nullptr){
-                while (bool is_next_result_available = c4queryenum_next(query_enumerator.get(), &c4error_)) {
-
-                    if(is_next_result_available){
-                        slice doc_name = FLValue_AsString(FLArrayIterator_GetValueAt(&query_enumerator->columns, 0));
-                        document_keys.push_back(doc_name.asString());
-                    }else{
-                        qC4Critical(logDomainSGDatabase, "c4queryenum_next failed to run: %s --", C4ErrorToString(c4error_).c_str());
-                        return false;
-                    }
-                }
-            }else{
-                qC4Critical(logDomainSGDatabase, "C4QueryEnumerator failed to run: %s --", C4ErrorToString(c4error_).c_str());
-                return false;
-            }
-        }else{
+        if(query == nullptr){
             qC4Critical(logDomainSGDatabase, "C4Query failed to execute a query: %s --", C4ErrorToString(c4error_).c_str());
             return false;
         }
 
+        string plan;
+        return _runQuery(query.get(), json, string(), plan, [&document_keys](FLArrayIterator *columns) {
+            slice doc_name = FLValue_AsString(FLArrayIterator_GetValueAt(columns, 0));
+            document_keys.push_back(doc_name.asString());
+        });
+    }
+
+    void SGDatabase::setSlowQueryThreshold(std::chrono::milliseconds threshold) {
+        slow_query_threshold_us_ = chrono::duration_cast<chrono::microseconds>(threshold).count();
+    }
+
+    std::vector<SGSlowQuery> SGDatabase::getSlowQueries() const {
+        lock_guard<mutex> lock(slow_queries_lock_);
+        return vector<SGSlowQuery>(slow_queries_.begin(), slow_queries_.end());
+    }
+
+    void SGDatabase::clearSlowQueries() {
+        lock_guard<mutex> lock(slow_queries_lock_);
+        slow_queries_.clear();
+    }
+
+    C4Query *SGDatabase::compileQuery(const std::string &json_query) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("compileQuery");
+
+        if(!_isOpen()){
+            qC4Warning(logDomainSGDatabase, "Trying to compile a query while DB is not open!");
+            return nullptr;
+        }
+
+        C4Query *query = c4query_new(c4db_, slice(json_query), &c4error_);
+        if(query == nullptr){
+            qC4Critical(logDomainSGDatabase, "C4Query failed to compile %s: %s --", json_query.c_str(), C4ErrorToString(c4error_).c_str());
+        }
+        return query;
+    }
+
+    void SGDatabase::freeQuery(C4Query *query) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("freeQuery");
+        c4query_free(query);
+    }
+
+    bool SGDatabase::runQuery(C4Query *query, const std::string &json_query, const std::string &parameters,
+                              const char *operation, std::string &plan,
+                              const std::function<void(FLArrayIterator *columns)> &on_row) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase(operation);
+
+        if(!_isOpen()){
+            qC4Warning(logDomainSGDatabase, "Trying to run database query while DB is not open!");
+            return false;
+        }
+        return _runQuery(query, json_query, parameters, plan, on_row);
+    }
+
+    std::string SGDatabase::explainQuery(C4Query *query, std::string &plan) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("explainQuery");
+
+        if(!_isOpen()){
+            qC4Warning(logDomainSGDatabase, "Trying to explain a query while DB is not open!");
+            return string();
+        }
+        return _explainQuery(query, plan);
+    }
+
+    bool SGDatabase::_runQuery(C4Query *query, const std::string &json_query, const std::string &parameters,
+                               std::string &plan, const std::function<void(FLArrayIterator *columns)> &on_row) {
+        SG_TRACE_SPAN("SGDatabase", "c4query_run");
+        Clock::time_point started_at = Clock::now();
+
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        C4String encoded_parameters = parameters.empty() ? c4str(nullptr) : c4str(parameters.c_str());
+        std::unique_ptr<C4QueryEnumerator, decltype(&c4queryenum_free)> query_enumerator(c4query_run(query, &options, encoded_parameters, &c4error_), &c4queryenum_free);
+
+        if(query_enumerator == nullptr){
+            qC4Critical(logDomainSGDatabase, "C4QueryEnumerator failed to run: %s --", C4ErrorToString(c4error_).c_str());
+            return false;
+        }
+
+        uint64_t row_count = 0;
+        c4error_ = C4Error {};
+        while (c4queryenum_next(query_enumerator.get(), &c4error_)) {
+            on_row(&query_enumerator->columns);
+            row_count++;
+        }
+        if(c4error_.code != 0){
+            qC4Critical(logDomainSGDatabase, "c4queryenum_next failed to run: %s --", C4ErrorToString(c4error_).c_str());
+            return false;
+        }
+
+        uint64_t duration_us = elapsedUs(started_at);
+        int64_t threshold_us = slow_query_threshold_us_;
+        if(threshold_us <= 0 || duration_us < (uint64_t) threshold_us){
+            return true;
+        }
+
+        SGSlowQuery slow_query;
+        slow_query.query = json_query;
+        slow_query.parameters = parameters;
+        slow_query.row_count = row_count;
+        slow_query.duration_us = duration_us;
+        slow_query.plan = _explainQuery(query, plan);
+        slow_query.full_scan = isFullScan(slow_query.plan);
+        slow_query.finished_at = chrono::system_clock::now();
+        qC4Warning(logDomainSGDatabase, "Slow query on %s, %llu us, %llu rows%s: %s parameters: %s", db_name_.c_str(),
+                   (unsigned long long) duration_us, (unsigned long long) row_count,
+                   slow_query.full_scan ? ", full scan" : "", json_query.c_str(), parameters.c_str());
+
+        lock_guard<mutex> lock(slow_queries_lock_);
+        if(slow_queries_.size() >= kSlowQueryLogCapacity){
+            slow_queries_.pop_front();
+        }
+        slow_queries_.push_back(move(slow_query));
+        return true;
+    }
+
+    const std::string &SGDatabase::_explainQuery(C4Query *query, std::string &plan) {
+        // The plan doesn't change once the query is compiled
+        if(plan.empty()){
+            C4StringResult explained = c4query_explain(query);
+            plan.assign((const char *) explained.buf, explained.size);
+            c4slice_free(explained);
+        }
+        return plan;
+    }
+
+    C4Database *SGDatabase::acquireBlobStream() {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("acquireBlobStream");
+        if (!_isOpen()) {
+            return nullptr;
+        }
+        open_blob_streams_++;
+        return c4db_;
+    }
+
+    void SGDatabase::releaseBlobStream() {
+        {
+            unique_lock<SGProfiledMutex> lock = lockDatabase("releaseBlobStream");
+            open_blob_streams_--;
+        }
+        blob_streams_closed_.notify_all();
+    }
+
+    SGBlobReturnStatus SGDatabase::saveBlob(std::istream &input, const std::string &content_type, SGBlob &blob) {
+        // The blob store has its own locking, the writer keeps the database open without holding the lock
+        SGBlobWriter blob_writer(this);
+        vector<char> buffer(kBlobChunkSize);
+        while (input) {
+            input.read(buffer.data(), buffer.size());
+            if (input.gcount() <= 0) {
+                break;
+            }
+            SGBlobReturnStatus status = blob_writer.write(buffer.data(), (size_t) input.gcount());
+            if (status != SGBlobReturnStatus::kNoError) {
+                return status;
+            }
+        }
+        if (input.bad()) {
+            qC4Critical(logDomainSGDatabase, "Could not read the blob content");
+            return SGBlobReturnStatus::kReadError;
+        }
+        return blob_writer.install(content_type, blob);
+    }
+
+    SGBlobReturnStatus SGDatabase::readBlob(const SGBlob &blob, std::ostream &output) {
+        SGBlobReader blob_reader(this, blob);
+        if (blob_reader.getStatus() != SGBlobReturnStatus::kNoError) {
+            return blob_reader.getStatus();
+        }
+
+        vector<char> buffer(kBlobChunkSize);
+        size_t bytes_read;
+        while ((bytes_read = blob_reader.read(buffer.data(), buffer.size())) > 0) {
+            if (!output.write(buffer.data(), bytes_read)) {
+                qC4Critical(logDomainSGDatabase, "Could not write the content of blob %s", blob.getDigest().c_str());
+                return SGBlobReturnStatus::kWriteError;
+            }
+        }
+        return blob_reader.getStatus();
+    }
+
+    bool SGDatabase::hasBlob(const SGBlob &blob) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("hasBlob");
+        C4BlobKey blob_key;
+        if (!_isOpen() || !c4blob_keyFromString(slice(blob.getDigest()), &blob_key)) {
+            return false;
+        }
+        C4BlobStore *blob_store = c4db_getBlobStore(c4db_, &c4error_);
+        return blob_store != nullptr && c4blob_getSize(blob_store, blob_key) >= 0;
+    }
+
+    bool SGDatabase::saveLocalDocument(const std::string &key, const fleece::alloc_slice &data) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("saveLocalDocument");
+        if (!_isOpen()) {
+            qC4Critical(logDomainSGDatabase, "Calling saveLocalDocument() while DB is not open");
+            return false;
+        }
+        // A null body and meta delete the raw document
+        slice body = data.size > 0 ? slice(data) : nullslice;
+        if (!c4raw_put(c4db_, slice(kLocalDocumentStore), slice(key), nullslice, body, &c4error_)) {
+            qC4Critical(logDomainSGDatabase, "Could not save local document %s: %s --", key.c_str(), C4ErrorToString(c4error_).c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool SGDatabase::getLocalDocument(const std::string &key, fleece::alloc_slice &data) {
+        unique_lock<SGProfiledMutex> lock = lockDatabase("getLocalDocument");
+        if (!_isOpen()) {
+            return false;
+        }
+        C4RawDocument *raw_document = c4raw_get(c4db_, slice(kLocalDocumentStore), slice(key), &c4error_);
+        if (raw_document == nullptr) {
+            return false;
+        }
+        data = alloc_slice(raw_document->body);
+        c4raw_free(raw_document);
         return true;
     }
 
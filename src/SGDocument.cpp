@@ -25,18 +25,27 @@
 #include <string>
 #include "SGDocument.h"
 #include "SGLoggingCategories.h"
+#include "SGTrace.h"
 
 using fleece::impl::Value;
 using namespace std;
 
 namespace Strata {
-    SGDocument::SGDocument() {}
+    // Bytes a document is counted with besides its id, the MutableDict holds no copy of unchanged values
+    static const uint64_t kDocumentBytes = sizeof(SGDocument) + sizeof(fleece::impl::MutableDict);
+
+    SGDocument::SGDocument() {
+        accountMemory(SGMemoryCategory::kDocument, false, 0, true, kDocumentBytes);
+    }
 
     SGDocument::~SGDocument() {
-        c4doc_free(c4document_);
+        setC4document(nullptr);
+        accountMemory(SGMemoryCategory::kDocument, true, kDocumentBytes + id_.size(), false, 0);
     }
 
-    SGDocument::SGDocument(SGDatabase *database, const std::string &docId) {
+    SGDocument::SGDocument(SGDatabase *database, const std::string &docId) : database_memory_(database->memory_tracker_) {
+        SG_TRACE_SPAN("SGDocument", "SGDocument load");
+        accountMemory(SGMemoryCategory::kDocument, false, 0, true, kDocumentBytes);
         setC4document(database->getDocumentById(docId));
         setId(docId);
         initMutableDict();
@@ -47,6 +56,7 @@ namespace Strata {
     }
 
     void SGDocument::setId(const std::string &id) {
+        accountMemory(SGMemoryCategory::kDocument, true, kDocumentBytes + id_.size(), true, kDocumentBytes + id.size());
         id_ = id;
     }
 
@@ -73,6 +83,7 @@ namespace Strata {
 
     void SGDocument::initMutableDict() {
         if(exist()) {
+            SG_TRACE_SPAN("SGDocument", "fleece to MutableDict");
             mutable_dict_ = fleece::impl::MutableDict::newDict(Value::fromData(c4document_->selectedRev.body)->asDict());
             qC4Debug(logDomainSGDocument, "Doc Id: %s, body: %s, revision:%s", id_.c_str(), getBody().c_str(), fleece::slice(c4document_->selectedRev.revID).asString().c_str());
             return;
@@ -86,6 +97,11 @@ namespace Strata {
         return mutable_dict_->get(keyToFind);
     }
 
+    bool SGDocument::getBlob(const std::string &key, SGBlob &blob) {
+        const Value *value = mutable_dict_->get(key);
+        return value != nullptr && SGBlob::fromDict(value->asDict(), blob);
+    }
+
     bool SGDocument::empty() const {
         return mutable_dict_->empty();
     }
@@ -95,7 +111,29 @@ namespace Strata {
     }
 
     void SGDocument::setC4document(C4Document *doc) {
-        // TODO: Should we free c4document_ before setting it with new reference.
+        accountMemory(SGMemoryCategory::kC4Document,
+                      c4document_ != nullptr, c4document_ != nullptr ? c4document_->selectedRev.body.size : 0,
+                      doc != nullptr, doc != nullptr ? doc->selectedRev.body.size : 0);
+        // c4doc_update() returns a new document, the replaced one is still ours to free
+        if(c4document_ != doc) {
+            c4doc_free(c4document_);
+        }
         c4document_ = doc;
     }
+
+    void SGDocument::accountMemory(SGMemoryCategory category, bool was_live, uint64_t old_bytes, bool is_live, uint64_t new_bytes) {
+        SGMemoryTracker *trackers[] = {&SGMemoryTracker::process(), database_memory_.get()};
+        for (SGMemoryTracker *tracker : trackers) {
+            if (tracker == nullptr) {
+                continue;
+            }
+            if (was_live && is_live) {
+                tracker->resize(category, old_bytes, new_bytes);
+            } else if (was_live) {
+                tracker->remove(category, old_bytes);
+            } else if (is_live) {
+                tracker->add(category, new_bytes);
+            }
+        }
+    }
 }
@@ -0,0 +1,290 @@
+//
+//  SGDocumentEventQueue.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#include "SGDocumentEventQueue.h"
+#include "SGUtility.h"
+
+using namespace std;
+
+namespace Strata {
+    constexpr size_t SGDocumentEndedEvent::kInlineDocIdLength;
+    constexpr size_t SGDocumentEventQueue::kDefaultCapacity;
+
+    // How long a blocked producer sleeps before re-checking for room, in case a wake up was missed.
+    static const chrono::milliseconds kBlockedProducerPollInterval(10);
+
+    SGDocumentEndedEvent::SGDocumentEndedEvent() {}
+
+    SGDocumentEndedEvent::SGDocumentEndedEvent(bool pushing, C4String doc_id, C4Error error, bool error_is_transient)
+            : pushing_(pushing), error_is_transient_(error_is_transient), error_(error) {
+        doc_id_length_ = (uint32_t) doc_id.size;
+        if (doc_id.size <= kInlineDocIdLength) {
+            if (doc_id.size > 0) {
+                memcpy(inline_doc_id_, doc_id.buf, doc_id.size);
+            }
+        } else {
+            long_doc_id_.assign((const char *) doc_id.buf, doc_id.size);
+        }
+    }
+
+    bool SGDocumentEndedEvent::isPushing() const {
+        return pushing_;
+    }
+
+    std::string SGDocumentEndedEvent::getDocId() const {
+        if (doc_id_length_ > kInlineDocIdLength) {
+            return long_doc_id_;
+        }
+        return string(inline_doc_id_, doc_id_length_);
+    }
+
+    bool SGDocumentEndedEvent::isError() const {
+        return error_.code > 0;
+    }
+
+    bool SGDocumentEndedEvent::isErrorTransient() const {
+        return error_is_transient_;
+    }
+
+    C4Error SGDocumentEndedEvent::getError() const {
+        return error_;
+    }
+
+    std::string SGDocumentEndedEvent::getErrorMessage() const {
+        if (!isError()) {
+            return string();
+        }
+        return C4ErrorToString(error_);
+    }
+
+    uint32_t SGDocumentEndedEvent::getCoalescedCount() const {
+        return coalesced_count_;
+    }
+
+    SGDocumentEventQueue::SGDocumentEventQueue(size_t capacity, OverflowPolicy overflow_policy)
+            : ring_buffer_(capacity), overflow_policy_(overflow_policy) {}
+
+    SGDocumentEventQueue::~SGDocumentEventQueue() {
+        close();
+    }
+
+    void SGDocumentEventQueue::push(bool pushing, C4String doc_id, C4Error error, bool error_is_transient) {
+        SGDocumentEndedEvent event(pushing, doc_id, error, error_is_transient);
+
+        if (closed_.load(memory_order_relaxed)) {
+            dropped_count_++;
+            return;
+        }
+
+        switch (overflow_policy_) {
+            case OverflowPolicy::kBlock:
+                pushBlocking(move(event));
+                break;
+            case OverflowPolicy::kDropOldest:
+                pushDroppingOldest(move(event));
+                break;
+            case OverflowPolicy::kCoalesce:
+                pushCoalescing(move(event));
+                break;
+        }
+        notifyConsumer();
+    }
+
+    void SGDocumentEventQueue::pushBlocking(SGDocumentEndedEvent &&event) {
+        if (ring_buffer_.tryPush(move(event))) {
+            enqueued_count_++;
+            return;
+        }
+
+        blocked_count_++;
+        waiting_producers_++;
+        while (!ring_buffer_.tryPush(move(event))) {
+            if (closed_.load()) {
+                waiting_producers_--;
+                dropped_count_++;
+                return;
+            }
+            notifyConsumer();
+            unique_lock<mutex> lock(wait_lock_);
+            space_available_.wait_for(lock, kBlockedProducerPollInterval, [this]() {
+                return closed_.load() || ring_buffer_.sizeApprox() < ring_buffer_.capacity();
+            });
+        }
+        waiting_producers_--;
+        enqueued_count_++;
+    }
+
+    void SGDocumentEventQueue::pushDroppingOldest(SGDocumentEndedEvent &&event) {
+        SGDocumentEndedEvent oldest_event;
+        while (!ring_buffer_.tryPush(move(event))) {
+            if (ring_buffer_.tryPop(oldest_event)) {
+                dropped_count_++;
+            }
+        }
+        enqueued_count_++;
+    }
+
+    void SGDocumentEventQueue::pushCoalescing(SGDocumentEndedEvent &&event) {
+        if (!has_overflow_events_.load(memory_order_acquire) && ring_buffer_.tryPush(move(event))) {
+            enqueued_count_++;
+            return;
+        }
+
+        string key(1, event.pushing_ ? 'P' : 'p');
+        key += event.getDocId();
+
+        lock_guard<mutex> lock(overflow_lock_);
+        auto iter = overflow_index_.find(key);
+        if (iter != overflow_index_.end()) {
+            SGDocumentEndedEvent &older_event = overflow_events_[iter->second];
+            event.coalesced_count_ = older_event.coalesced_count_ + 1;
+            older_event = move(event);
+            coalesced_count_++;
+        } else if (overflow_events_.size() < ring_buffer_.capacity()) {
+            overflow_index_.emplace(move(key), overflow_events_.size());
+            overflow_events_.push_back(move(event));
+            enqueued_count_++;
+        } else {
+            // Overflow is bounded too: past that point the only option left is to lose the event.
+            dropped_count_++;
+        }
+        has_overflow_events_.store(true, memory_order_release);
+    }
+
+    size_t SGDocumentEventQueue::drain(std::vector<SGDocumentEndedEvent> &events, size_t max_events) {
+        size_t drained_count = 0;
+        SGDocumentEndedEvent event;
+        while (drained_count < max_events && ring_buffer_.tryPop(event)) {
+            events.push_back(move(event));
+            drained_count++;
+        }
+
+        // Overflow events are newer than anything in the ring buffer, so only take them once it's empty.
+        if (drained_count < max_events && has_overflow_events_.load(memory_order_acquire)) {
+            lock_guard<mutex> lock(overflow_lock_);
+            while (drained_count < max_events && ring_buffer_.tryPop(event)) {
+                events.push_back(move(event));
+                drained_count++;
+            }
+            size_t overflow_taken = 0;
+            while (drained_count < max_events && overflow_taken < overflow_events_.size()) {
+                events.push_back(move(overflow_events_[overflow_taken++]));
+                drained_count++;
+            }
+            if (overflow_taken == overflow_events_.size()) {
+                overflow_events_.clear();
+                overflow_index_.clear();
+                has_overflow_events_.store(false, memory_order_release);
+            } else if (overflow_taken > 0) {
+                overflow_events_.erase(overflow_events_.begin(), overflow_events_.begin() + overflow_taken);
+                overflow_index_.clear();
+                for (size_t index = 0; index < overflow_events_.size(); ++index) {
+                    string key(1, overflow_events_[index].pushing_ ? 'P' : 'p');
+                    key += overflow_events_[index].getDocId();
+                    overflow_index_[key] = index;
+                }
+            }
+        }
+
+        delivered_count_ += drained_count;
+        if (drained_count > 0) {
+            notifyProducers();
+        }
+        return drained_count;
+    }
+
+    bool SGDocumentEventQueue::waitForEvents(const std::chrono::milliseconds &timeout) {
+        auto has_events = [this]() {
+            return ring_buffer_.sizeApprox() > 0 || has_overflow_events_.load(memory_order_acquire);
+        };
+        if (has_events()) {
+            return true;
+        }
+
+        waiting_consumers_++;
+        atomic_thread_fence(memory_order_seq_cst);
+        bool result;
+        {
+            unique_lock<mutex> lock(wait_lock_);
+            result = events_available_.wait_for(lock, timeout, [this, &has_events]() {
+                return closed_.load() || has_events();
+            });
+        }
+        waiting_consumers_--;
+        return result && has_events();
+    }
+
+    void SGDocumentEventQueue::close() {
+        closed_ = true;
+        lock_guard<mutex> lock(wait_lock_);
+        events_available_.notify_all();
+        space_available_.notify_all();
+    }
+
+    bool SGDocumentEventQueue::isClosed() const {
+        return closed_.load();
+    }
+
+    SGDocumentEventQueue::OverflowPolicy SGDocumentEventQueue::getOverflowPolicy() const {
+        return overflow_policy_;
+    }
+
+    size_t SGDocumentEventQueue::getCapacity() const {
+        return ring_buffer_.capacity();
+    }
+
+    SGDocumentEventQueueStats SGDocumentEventQueue::getStats() const {
+        SGDocumentEventQueueStats stats;
+        stats.enqueued_count = enqueued_count_.load();
+        stats.delivered_count = delivered_count_.load();
+        stats.dropped_count = dropped_count_.load();
+        stats.coalesced_count = coalesced_count_.load();
+        stats.blocked_count = blocked_count_.load();
+        return stats;
+    }
+
+    void SGDocumentEventQueue::notifyConsumer() {
+        // Pairs with the fence in waitForEvents(): either the consumer sees the new event or we see it waiting.
+        atomic_thread_fence(memory_order_seq_cst);
+        if (waiting_consumers_.load(memory_order_relaxed) > 0) {
+            lock_guard<mutex> lock(wait_lock_);
+            events_available_.notify_one();
+        }
+    }
+
+    void SGDocumentEventQueue::notifyProducers() {
+        if (waiting_producers_.load() > 0) {
+            lock_guard<mutex> lock(wait_lock_);
+            space_available_.notify_all();
+        }
+    }
+
+    std::ostream& operator << (std::ostream& os, const SGDocumentEventQueue::OverflowPolicy& overflow_policy){
+        return os << static_cast<underlying_type<SGDocumentEventQueue::OverflowPolicy>::type> (overflow_policy);
+    }
+}
@@ -0,0 +1,775 @@
+//
+//  SGEventLoopSocketFactory.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fleece/FleeceImpl.hh>
+#include <litecore/c4Replicator.h>
+
+#include "SGEventLoopSocketFactory.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    const unsigned SGEventLoopSocketFactory::kDefaultIOThreadCount;
+    const size_t SGEventLoopSocketFactory::kMaxUnreadBytes;
+    const size_t SGEventLoopSocketFactory::kReadBufferSize;
+    const size_t SGEventLoopSocketFactory::kMaxResponseHeaderSize;
+    const int SGEventLoopSocketFactory::kMaxEventsPerWait;
+    const int SGEventLoopSocketFactory::kTimerResolutionMs;
+
+    typedef chrono::steady_clock Clock;
+
+    SGEventLoopSocketFactory::SGEventLoopSocketFactory(unsigned io_thread_count) : SGSocketFactory(kC4NoFraming) {
+        io_thread_count = max(io_thread_count, 1u);
+        for (unsigned index = 0; index < io_thread_count; ++index) {
+            unique_ptr<EventLoop> loop(new EventLoop());
+            loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (loop->epoll_fd < 0 || loop->wakeup_fd < 0) {
+                qC4Critical(logDomainSGReplicator, "Can't create the event loop: %s", strerror(errno));
+            }
+            epoll_event event {};
+            event.events = EPOLLIN;
+            event.data.fd = loop->wakeup_fd;
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wakeup_fd, &event);
+            loop->read_buffer.resize(kReadBufferSize);
+            loop->thread = thread(&SGEventLoopSocketFactory::run, this, loop.get());
+            loops_.push_back(move(loop));
+        }
+    }
+
+    SGEventLoopSocketFactory::~SGEventLoopSocketFactory() {
+        for (unique_ptr<EventLoop> &loop : loops_) {
+            {
+                lock_guard<mutex> lock(loop->lock);
+                loop->stopping = true;
+            }
+            wakeUp(loop.get());
+        }
+        for (unique_ptr<EventLoop> &loop : loops_) {
+            if (loop->thread.joinable()) {
+                loop->thread.join();
+            }
+            ::close(loop->epoll_fd);
+            ::close(loop->wakeup_fd);
+        }
+    }
+
+    void SGEventLoopSocketFactory::setCompressionLevel(int compression_level) {
+        compression_level_ = compression_level;
+    }
+
+    int SGEventLoopSocketFactory::getCompressionLevel() const {
+        return compression_level_;
+    }
+
+    unsigned SGEventLoopSocketFactory::getIOThreadCount() const {
+        return (unsigned) loops_.size();
+    }
+
+    void SGEventLoopSocketFactory::open(C4Socket *socket, const C4Address *address, C4Slice options) {
+        shared_ptr<Connection> connection = make_shared<Connection>();
+        connection->socket = socket;
+        connection->host = slice(address->hostname).asString();
+        connection->port = address->port;
+        connection->compression_level = compression_level_;
+        connection->heartbeat_interval = chrono::seconds(getSecondsOption(options, kC4ReplicatorHeartbeatInterval));
+        connection->idle_timeout = chrono::seconds(getSecondsOption(options, kOptionIdleTimeout));
+        connection->connect_timeout = chrono::seconds(getSecondsOption(options, kOptionConnectTimeout));
+        connection->bandwidth_limiter = getBandwidthLimiter(options);
+        connection->opened_at = Clock::now();
+        connection->loop = loops_[next_loop_++ % loops_.size()].get();
+        socket->nativeHandle = new ConnectionHandle(this, connection);
+
+        if (slice(address->scheme) != slice("ws")) {
+            connection->open_error = c4error_make(LiteCoreDomain, kC4ErrorUnsupported,
+                                                  slice("SGEventLoopSocketFactory only supports ws:// URLs"));
+        } else {
+            // Resolving blocks, better here on the replicator's thread than on an event loop shared with others
+            addrinfo hints {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *addresses = nullptr;
+            int result = getaddrinfo(connection->host.c_str(), to_string(connection->port).c_str(), &hints, &addresses);
+            if (result != 0) {
+                qC4Warning(logDomainSGReplicator, "Can't resolve %s: %s", connection->host.c_str(), gai_strerror(result));
+                connection->open_error = c4error_make(NetworkDomain, kC4NetErrUnknownHost, slice(gai_strerror(result)));
+            } else {
+                // Kept for onConnected(): an asynchronous connect can still fail, e.g. localhost resolving to ::1
+                // while the server only listens on 127.0.0.1
+                for (addrinfo *candidate = addresses; candidate != nullptr; candidate = candidate->ai_next) {
+                    Address candidate_address;
+                    candidate_address.family = candidate->ai_family;
+                    candidate_address.socket_address.assign((const char *) candidate->ai_addr, candidate->ai_addrlen);
+                    connection->addresses.push_back(candidate_address);
+                }
+                freeaddrinfo(addresses);
+                int connect_error = ECONNREFUSED;
+                if (!connectNext(*connection, connect_error)) {
+                    connection->open_error = c4error_make(POSIXDomain, connect_error, slice(strerror(connect_error)));
+                }
+            }
+        }
+
+        if (connection->fd >= 0) {
+            string extensions;
+            if (connection->compression_level != SGWebSocketCodec::kCompressionDisabled) {
+                extensions = SGWebSocketCodec::extensionOffer();
+            }
+            lock_guard<mutex> lock(connection->lock);
+            connection->outbox = makeUpgradeRequest(connection->host, connection->port, slice(address->path).asString(),
+                                                    options, extensions, connection->websocket_key);
+            connection->queued_bytes = connection->outbox.size();
+        }
+        post(connection);
+    }
+
+    void SGEventLoopSocketFactory::write(C4Socket *socket, C4SliceResult data) {
+        shared_ptr<Connection> connection = ((ConnectionHandle *) socket->nativeHandle)->connection;
+        bool queued;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            queued = queueFrame(*connection, SGWebSocketCodec::kOpcodeBinary, data.buf, data.size, data.size);
+        }
+        c4slice_free(data);
+        if (queued) {
+            post(connection);
+        }
+    }
+
+    void SGEventLoopSocketFactory::completedReceive(C4Socket *socket, size_t byte_count) {
+        shared_ptr<Connection> connection = ((ConnectionHandle *) socket->nativeHandle)->connection;
+        bool resume;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            bool window_full = connection->unread_bytes >= kMaxUnreadBytes;
+            connection->unread_bytes -= min(connection->unread_bytes, byte_count);
+            resume = window_full && connection->unread_bytes < kMaxUnreadBytes;
+        }
+        if (resume) {
+            post(connection);
+        }
+    }
+
+    void SGEventLoopSocketFactory::requestClose(C4Socket *socket, int status, C4String message) {
+        shared_ptr<Connection> connection = ((ConnectionHandle *) socket->nativeHandle)->connection;
+        string payload;
+        payload += (char) ((status >> 8) & 0xFF);
+        payload += (char) (status & 0xFF);
+        payload.append((const char *) message.buf, message.size);
+        {
+            lock_guard<mutex> lock(connection->lock);
+            connection->close_requested = true;
+            if (status != kWebSocketCloseNormal) {
+                connection->close_error = c4error_make(WebSocketDomain, status, message);
+            }
+            queueFrame(*connection, SGWebSocketCodec::kOpcodeClose, payload.data(), payload.size(), 0);
+        }
+        // The socket is closed when the server's close frame arrives or the connection drops.
+        post(connection);
+    }
+
+    void SGEventLoopSocketFactory::post(const shared_ptr<Connection> &connection) {
+        EventLoop *loop = connection->loop;
+        {
+            lock_guard<mutex> lock(loop->lock);
+            loop->posted.push_back(connection);
+        }
+        wakeUp(loop);
+    }
+
+    void SGEventLoopSocketFactory::wakeUp(EventLoop *loop) {
+        uint64_t one = 1;
+        if (::write(loop->wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            qC4Critical(logDomainSGReplicator, "Can't wake the event loop up: %s", strerror(errno));
+        }
+    }
+
+    void SGEventLoopSocketFactory::run(EventLoop *loop) {
+        epoll_event events[kMaxEventsPerWait];
+        vector<shared_ptr<Connection>> posted;
+        int throttle_timeout_ms = -1;
+        while (true) {
+            int timeout_ms = loop->timed_connection_count > 0 ? kTimerResolutionMs : -1;
+            if (throttle_timeout_ms >= 0 && (timeout_ms < 0 || throttle_timeout_ms < timeout_ms)) {
+                timeout_ms = throttle_timeout_ms;
+            }
+            int event_count = epoll_wait(loop->epoll_fd, events, kMaxEventsPerWait, timeout_ms);
+            if (event_count < 0 && errno != EINTR) {
+                qC4Critical(logDomainSGReplicator, "Event loop failed: %s", strerror(errno));
+                break;
+            }
+            for (int index = 0; index < event_count; ++index) {
+                int fd = events[index].data.fd;
+                if (fd == loop->wakeup_fd) {
+                    uint64_t count;
+                    while (read(loop->wakeup_fd, &count, sizeof(count)) > 0) {}
+                    continue;
+                }
+                auto iter = loop->connections.find(fd);
+                if (iter != loop->connections.end()) {
+                    shared_ptr<Connection> connection = iter->second;
+                    onEvents(connection, events[index].events);
+                }
+            }
+
+            bool stopping;
+            {
+                lock_guard<mutex> lock(loop->lock);
+                posted.swap(loop->posted);
+                stopping = loop->stopping;
+            }
+            for (const shared_ptr<Connection> &connection : posted) {
+                if (connection->state == ConnectionState::kClosed) {
+                    continue;
+                }
+                if (connection->fd < 0) {
+                    closeConnection(connection, connection->open_error);
+                    continue;
+                }
+                if (loop->connections.find(connection->fd) == loop->connections.end()) {
+                    loop->connections[connection->fd] = connection;
+                    if (connection->heartbeat_interval.count() > 0 || connection->idle_timeout.count() > 0 ||
+                        connection->connect_timeout.count() > 0) {
+                        connection->timed = true;
+                        loop->timed_connection_count++;
+                    }
+                    epoll_event event {};
+                    event.data.fd = connection->fd;
+                    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, connection->fd, &event);
+                }
+
+                bool close_requested;
+                C4Error close_error;
+                {
+                    lock_guard<mutex> lock(connection->lock);
+                    close_requested = connection->close_requested;
+                    close_error = connection->close_error;
+                }
+                if (close_requested && connection->state != ConnectionState::kOpen) {
+                    closeConnection(connection, close_error);
+                    continue;
+                }
+                // Send what LiteCore just wrote right away, most of the time it fits in the socket buffer
+                if (connection->state != ConnectionState::kConnecting && !flush(connection)) {
+                    continue;
+                }
+                updateEvents(connection);
+            }
+            posted.clear();
+
+            throttle_timeout_ms = loop->throttled.empty() ? -1 : resumeThrottled(loop);
+
+            if (loop->timed_connection_count > 0 &&
+                Clock::now() - loop->last_timer_check >= chrono::milliseconds(kTimerResolutionMs)) {
+                checkTimers(loop);
+                loop->last_timer_check = Clock::now();
+            }
+
+            if (stopping) {
+                vector<shared_ptr<Connection>> connections;
+                for (auto &entry : loop->connections) {
+                    connections.push_back(entry.second);
+                }
+                if (!connections.empty()) {
+                    qC4Critical(logDomainSGReplicator, "Closing %zu connections, stop the replicators before deleting their socket factory", connections.size());
+                }
+                for (const shared_ptr<Connection> &connection : connections) {
+                    closeConnection(connection, c4error_make(WebSocketDomain, kWebSocketCloseAbnormal,
+                                                             slice("Socket factory destroyed")));
+                }
+                break;
+            }
+        }
+    }
+
+    void SGEventLoopSocketFactory::onEvents(const shared_ptr<Connection> &connection, uint32_t events) {
+        if (connection->state == ConnectionState::kConnecting) {
+            onConnected(connection);
+            // Closed, or still connecting to the next address
+            if (connection->state != ConnectionState::kHandshake) {
+                return;
+            }
+        }
+        if ((events & EPOLLOUT) && !flush(connection)) {
+            return;
+        }
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !onReadable(connection)) {
+            return;
+        }
+        updateEvents(connection);
+    }
+
+    void SGEventLoopSocketFactory::onConnected(const shared_ptr<Connection> &connection) {
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &error_size) < 0) {
+            error = errno;
+        }
+        if (error == 0) {
+            connection->state = ConnectionState::kHandshake;
+            return;
+        }
+        qC4Warning(logDomainSGReplicator, "Could not connect to %s:%u: %s", connection->host.c_str(), connection->port, strerror(error));
+
+        EventLoop *loop = connection->loop;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+        loop->connections.erase(connection->fd);
+        ::close(connection->fd);
+        connection->fd = -1;
+        connection->registered_events = 0;
+        if (!connectNext(*connection, error)) {
+            closeConnection(connection, c4error_make(POSIXDomain, error, slice(strerror(error))));
+            return;
+        }
+        qC4Info(logDomainSGReplicator, "Trying the next address of %s:%u", connection->host.c_str(), connection->port);
+        loop->connections[connection->fd] = connection;
+        epoll_event event {};
+        event.data.fd = connection->fd;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, connection->fd, &event);
+        updateEvents(connection);
+    }
+
+    bool SGEventLoopSocketFactory::connectNext(Connection &connection, int &connect_error) {
+        while (!connection.addresses.empty()) {
+            Address address = move(connection.addresses.front());
+            connection.addresses.pop_front();
+            int fd = ::socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                connect_error = errno;
+                continue;
+            }
+            const sockaddr *socket_address = (const sockaddr *) address.socket_address.data();
+            if (connect(fd, socket_address, (socklen_t) address.socket_address.size()) == 0 || errno == EINPROGRESS) {
+                int no_delay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+                connection.fd = fd;
+                return true;
+            }
+            connect_error = errno;
+            ::close(fd);
+        }
+        return false;
+    }
+
+    bool SGEventLoopSocketFactory::onReadable(const shared_ptr<Connection> &connection) {
+        vector<char> &buffer = connection->loop->read_buffer;
+        while (true) {
+            {
+                // Leave the rest in the socket, TCP pushes back on the server until LiteCore catches up
+                lock_guard<mutex> lock(connection->lock);
+                if (connection->unread_bytes >= kMaxUnreadBytes) {
+                    return true;
+                }
+            }
+            ssize_t read_count = recv(connection->fd, buffer.data(), buffer.size(), 0);
+            if (read_count > 0) {
+                connection->last_received = Clock::now();
+                countWireBytes(0, read_count);
+                bool ok = connection->state == ConnectionState::kHandshake ?
+                          onHandshakeData(connection, buffer.data(), read_count) :
+                          onFrameData(connection, buffer.data(), read_count);
+                if (!ok) {
+                    return false;
+                }
+                if (throttle(connection->bandwidth_limiter.get(), SGBandwidthLimiter::Direction::kDownload, read_count,
+                             connection->receive_throttled_until).count() > 0) {
+                    // Over the download limit: leave the rest in the socket until the wait is over
+                    markThrottled(connection);
+                    return true;
+                }
+            } else if (read_count == 0) {
+                closeConnection(connection, c4error_make(WebSocketDomain, kWebSocketCloseAbnormal,
+                                                         slice("Connection closed by the server")));
+                return false;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            } else if (errno != EINTR) {
+                int error = errno;
+                closeConnection(connection, c4error_make(POSIXDomain, error, slice(strerror(error))));
+                return false;
+            }
+        }
+    }
+
+    bool SGEventLoopSocketFactory::onHandshakeData(const shared_ptr<Connection> &connection, const char *data,
+                                                   size_t size) {
+        connection->response.append(data, size);
+        size_t header_end = connection->response.find("\r\n\r\n");
+        if (header_end == string::npos) {
+            if (connection->response.size() > kMaxResponseHeaderSize) {
+                closeConnection(connection, c4error_make(POSIXDomain, ECONNRESET, slice("Invalid WebSocket handshake response")));
+                return false;
+            }
+            return true;
+        }
+        string leftover = connection->response.substr(header_end + 4);
+        connection->response.resize(header_end);
+
+        string reason;
+        map<string, string> headers;
+        int status = parseUpgradeResponse(connection->socket, connection->response, reason, headers);
+        string().swap(connection->response);
+        if (status != 101) {
+            qC4Warning(logDomainSGReplicator, "WebSocket handshake with %s:%u refused: %d %s", connection->host.c_str(), connection->port, status, reason.c_str());
+            closeConnection(connection, c4error_make(WebSocketDomain, status, slice(reason)));
+            return false;
+        }
+        if (headers["sec-websocket-accept"] != SGWebSocketCodec::acceptKey(connection->websocket_key)) {
+            qC4Warning(logDomainSGReplicator, "WebSocket handshake with %s:%u failed: wrong Sec-WebSocket-Accept", connection->host.c_str(), connection->port);
+            closeConnection(connection, c4error_make(WebSocketDomain, kWebSocketCloseProtocolError, slice("Invalid Sec-WebSocket-Accept")));
+            return false;
+        }
+
+        bool compressed;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            compressed = connection->codec.acceptExtension(headers["sec-websocket-extensions"], connection->compression_level);
+        }
+        qC4Info(logDomainSGReplicator, "WebSocket connected to %s:%u, compression %s", connection->host.c_str(), connection->port, compressed ? "on" : "off");
+        connection->state = ConnectionState::kOpen;
+        connection->last_received = Clock::now();
+        connection->next_heartbeat = connection->last_received + connection->heartbeat_interval;
+        opened(connection->socket);
+        return leftover.empty() || onFrameData(connection, leftover.data(), leftover.size());
+    }
+
+    bool SGEventLoopSocketFactory::onFrameData(const shared_ptr<Connection> &connection, const char *data,
+                                               size_t size) {
+        bool open = true;
+        auto on_message = [this, &connection, &open](int opcode, const string &payload) {
+            if (!open) {
+                return;
+            }
+            switch (opcode) {
+                case SGWebSocketCodec::kOpcodeText:
+                case SGWebSocketCodec::kOpcodeBinary: {
+                    {
+                        lock_guard<mutex> lock(connection->lock);
+                        connection->unread_bytes += payload.size();
+                    }
+                    received(connection->socket, slice(payload));
+                    break;
+                }
+                case SGWebSocketCodec::kOpcodePing: {
+                    lock_guard<mutex> lock(connection->lock);
+                    queueFrame(*connection, SGWebSocketCodec::kOpcodePong, payload.data(), payload.size(), 0);
+                    break;
+                }
+                case SGWebSocketCodec::kOpcodeClose: {
+                    int status = kWebSocketCloseNormal;
+                    slice message;
+                    if (payload.size() >= 2) {
+                        status = ((uint8_t) payload[0] << 8) | (uint8_t) payload[1];
+                        message = slice(payload.data() + 2, payload.size() - 2);
+                    }
+                    {
+                        // Echo the close frame if the server started the close handshake
+                        lock_guard<mutex> lock(connection->lock);
+                        queueFrame(*connection, SGWebSocketCodec::kOpcodeClose, payload.data(),
+                                   min((size_t) 2, payload.size()), 0);
+                    }
+                    C4Error error {};
+                    if (status != kWebSocketCloseNormal) {
+                        error = c4error_make(WebSocketDomain, status, message);
+                    }
+                    if (flush(connection)) {
+                        closeConnection(connection, error);
+                    }
+                    open = false;
+                    break;
+                }
+                default:
+                    break;
+            }
+        };
+
+        uint64_t inflate_time_ns = connection->codec.getInflateTimeNs();
+        bool decoded = connection->codec.decode(data, size, on_message);
+        countCompressionTime(connection->codec.getInflateTimeNs() - inflate_time_ns);
+        if (!open) {
+            return false;
+        }
+        if (!decoded) {
+            int status = connection->codec.getCloseStatus();
+            qC4Warning(logDomainSGReplicator, "WebSocket protocol error from %s, closing with status %d", connection->host.c_str(), status);
+            string payload;
+            payload += (char) ((status >> 8) & 0xFF);
+            payload += (char) (status & 0xFF);
+            {
+                lock_guard<mutex> lock(connection->lock);
+                queueFrame(*connection, SGWebSocketCodec::kOpcodeClose, payload.data(), payload.size(), 0);
+            }
+            if (flush(connection)) {
+                closeConnection(connection, c4error_make(WebSocketDomain, status, slice("WebSocket protocol error")));
+            }
+            return false;
+        }
+        return true;
+    }
+
+    bool SGEventLoopSocketFactory::queueFrame(Connection &connection, int opcode, const void *data, size_t size,
+                                              size_t byte_count) {
+        if (connection.close_sent || connection.socket_closed) {
+            return false;
+        }
+        if (opcode == SGWebSocketCodec::kOpcodeClose) {
+            connection.close_sent = true;
+        }
+        size_t outbox_size = connection.outbox.size();
+        uint64_t deflate_time_ns = connection.codec.getDeflateTimeNs();
+        bool encoded = connection.codec.encode(opcode, data, size, connection.outbox);
+        countCompressionTime(connection.codec.getDeflateTimeNs() - deflate_time_ns);
+        if (!encoded) {
+            // Start the close handshake instead, the socket is closed when the server's close frame arrives
+            qC4Warning(logDomainSGReplicator, "Compression failed for %s, closing with status %d", connection.host.c_str(), SGWebSocketCodec::kCloseInternalError);
+            string payload;
+            payload += (char) ((SGWebSocketCodec::kCloseInternalError >> 8) & 0xFF);
+            payload += (char) (SGWebSocketCodec::kCloseInternalError & 0xFF);
+            connection.codec.encode(SGWebSocketCodec::kOpcodeClose, payload.data(), payload.size(), connection.outbox);
+            connection.close_sent = true;
+            connection.queued_bytes += connection.outbox.size() - outbox_size;
+            return true;
+        }
+        connection.queued_bytes += connection.outbox.size() - outbox_size;
+        if (byte_count > 0) {
+            connection.pending_writes.push_back({connection.queued_bytes, byte_count});
+        }
+        return true;
+    }
+
+    bool SGEventLoopSocketFactory::flush(const shared_ptr<Connection> &connection) {
+        if (connection->state == ConnectionState::kClosed) {
+            return false;
+        }
+        if (Clock::now() < connection->send_throttled_until) {
+            // Sent when the wait is over, see resumeThrottled()
+            return true;
+        }
+        vector<size_t> completed_writes;
+        size_t sent_count = 0;
+        int error = 0;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            string &outbox = connection->outbox;
+            while (connection->outbox_offset < outbox.size()) {
+                ssize_t count = send(connection->fd, outbox.data() + connection->outbox_offset,
+                                     outbox.size() - connection->outbox_offset, MSG_NOSIGNAL);
+                if (count > 0) {
+                    connection->outbox_offset += count;
+                    sent_count += count;
+                    if (throttle(connection->bandwidth_limiter.get(), SGBandwidthLimiter::Direction::kUpload, count,
+                                 connection->send_throttled_until).count() > 0) {
+                        markThrottled(connection);
+                        break;
+                    }
+                } else if (count < 0 && errno == EINTR) {
+                    continue;
+                } else {
+                    if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                        error = errno;
+                    }
+                    break;
+                }
+            }
+            if (connection->outbox_offset == outbox.size()) {
+                outbox.clear();
+                connection->outbox_offset = 0;
+            } else if (connection->outbox_offset >= kReadBufferSize) {
+                outbox.erase(0, connection->outbox_offset);
+                connection->outbox_offset = 0;
+            }
+
+            connection->sent_bytes += sent_count;
+            while (!connection->pending_writes.empty() &&
+                   connection->pending_writes.front().end_offset <= connection->sent_bytes) {
+                completed_writes.push_back(connection->pending_writes.front().byte_count);
+                connection->pending_writes.pop_front();
+            }
+        }
+        countWireBytes(sent_count, 0);
+
+        if (error != 0) {
+            closeConnection(connection, c4error_make(POSIXDomain, error, slice(strerror(error))));
+            return false;
+        }
+        for (size_t byte_count : completed_writes) {
+            c4socket_completedWrite(connection->socket, byte_count);
+        }
+        return true;
+    }
+
+    void SGEventLoopSocketFactory::updateEvents(const shared_ptr<Connection> &connection) {
+        if (connection->state == ConnectionState::kClosed) {
+            return;
+        }
+        uint32_t events = 0;
+        Clock::time_point now = Clock::now();
+        {
+            lock_guard<mutex> lock(connection->lock);
+            if (connection->state == ConnectionState::kConnecting ||
+                (connection->outbox_offset < connection->outbox.size() && now >= connection->send_throttled_until)) {
+                events |= EPOLLOUT;
+            }
+            if (connection->state != ConnectionState::kConnecting && connection->unread_bytes < kMaxUnreadBytes &&
+                now >= connection->receive_throttled_until) {
+                events |= EPOLLIN;
+            }
+        }
+        if (events != connection->registered_events) {
+            epoll_event event {};
+            event.events = events;
+            event.data.fd = connection->fd;
+            epoll_ctl(connection->loop->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+            connection->registered_events = events;
+        }
+    }
+
+    void SGEventLoopSocketFactory::markThrottled(const shared_ptr<Connection> &connection) {
+        if (!connection->throttled) {
+            connection->throttled = true;
+            connection->loop->throttled.push_back(connection);
+        }
+    }
+
+    int SGEventLoopSocketFactory::resumeThrottled(EventLoop *loop) {
+        Clock::time_point now = Clock::now();
+        vector<shared_ptr<Connection>> throttled;
+        throttled.swap(loop->throttled);
+        for (const shared_ptr<Connection> &connection : throttled) {
+            connection->throttled = false;
+        }
+
+        for (const shared_ptr<Connection> &connection : throttled) {
+            if (connection->state == ConnectionState::kClosed) {
+                continue;
+            }
+            if (now >= connection->send_throttled_until && !flush(connection)) {
+                continue;
+            }
+            updateEvents(connection);
+            if (connection->send_throttled_until > now || connection->receive_throttled_until > now) {
+                markThrottled(connection);
+            }
+        }
+
+        if (loop->throttled.empty()) {
+            return -1;
+        }
+        Clock::time_point next_resume = Clock::time_point::max();
+        for (const shared_ptr<Connection> &connection : loop->throttled) {
+            if (connection->send_throttled_until > now) {
+                next_resume = min(next_resume, connection->send_throttled_until);
+            }
+            if (connection->receive_throttled_until > now) {
+                next_resume = min(next_resume, connection->receive_throttled_until);
+            }
+        }
+        if (next_resume == Clock::time_point::max()) {
+            return 0;
+        }
+        // Round up, waking up early would only find the connections still held back
+        return (int) chrono::duration_cast<chrono::milliseconds>(next_resume - now).count() + 1;
+    }
+
+    void SGEventLoopSocketFactory::checkTimers(EventLoop *loop) {
+        Clock::time_point now = Clock::now();
+        vector<shared_ptr<Connection>> connections;
+        for (auto &entry : loop->connections) {
+            if (entry.second->timed) {
+                connections.push_back(entry.second);
+            }
+        }
+
+        for (const shared_ptr<Connection> &connection : connections) {
+            if (connection->state == ConnectionState::kConnecting || connection->state == ConnectionState::kHandshake) {
+                if (connection->connect_timeout.count() > 0 && now - connection->opened_at >= connection->connect_timeout) {
+                    qC4Warning(logDomainSGReplicator, "Could not connect to %s:%u within %lld seconds", connection->host.c_str(), connection->port, (long long) connection->connect_timeout.count());
+                    closeConnection(connection, c4error_make(NetworkDomain, kC4NetErrTimeout, slice("Connection timed out")));
+                }
+            } else if (connection->state == ConnectionState::kOpen) {
+                // A NAT or proxy silently dropping the connection only shows as silence
+                if (connection->idle_timeout.count() > 0 && now - connection->last_received >= connection->idle_timeout) {
+                    qC4Warning(logDomainSGReplicator, "Nothing received from %s:%u for %lld seconds, dropping the connection", connection->host.c_str(), connection->port, (long long) connection->idle_timeout.count());
+                    closeConnection(connection, c4error_make(NetworkDomain, kC4NetErrTimeout, slice("Connection idle timeout")));
+                    continue;
+                }
+                if (connection->heartbeat_interval.count() > 0 && now >= connection->next_heartbeat) {
+                    connection->next_heartbeat = now + connection->heartbeat_interval;
+                    {
+                        lock_guard<mutex> lock(connection->lock);
+                        queueFrame(*connection, SGWebSocketCodec::kOpcodePing, nullptr, 0, 0);
+                    }
+                    if (flush(connection)) {
+                        updateEvents(connection);
+                    }
+                }
+            }
+        }
+    }
+
+    void SGEventLoopSocketFactory::closeConnection(const shared_ptr<Connection> &connection, const C4Error &error) {
+        if (connection->state == ConnectionState::kClosed) {
+            return;
+        }
+        connection->state = ConnectionState::kClosed;
+        if (connection->timed) {
+            connection->timed = false;
+            connection->loop->timed_connection_count--;
+        }
+        if (connection->fd >= 0) {
+            epoll_ctl(connection->loop->epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+            connection->loop->connections.erase(connection->fd);
+            ::close(connection->fd);
+            connection->fd = -1;
+        }
+
+        C4Socket *socket;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            connection->socket_closed = true;
+            connection->outbox.clear();
+            connection->pending_writes.clear();
+            socket = connection->socket;
+            connection->socket = nullptr;
+        }
+        if (socket != nullptr) {
+            closed(socket, error);
+        }
+    }
+}
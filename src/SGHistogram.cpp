@@ -0,0 +1,138 @@
+//
+//  SGHistogram.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <limits>
+
+#include "SGHistogram.h"
+
+using namespace std;
+
+namespace Strata {
+    namespace {
+        unsigned mostSignificantBit(uint64_t value) {
+            unsigned msb = 0;
+            for (unsigned shift = 32; shift > 0; shift >>= 1) {
+                if (value >> shift) {
+                    value >>= shift;
+                    msb += shift;
+                }
+            }
+            return msb;
+        }
+    }
+
+    constexpr unsigned SGHistogram::kSubBucketBits;
+    constexpr unsigned SGHistogram::kSubBucketCount;
+    constexpr size_t SGHistogram::kBucketCount;
+
+    SGHistogram::SGHistogram() {
+        reset();
+    }
+
+    size_t SGHistogram::bucketIndex(uint64_t value) {
+        if (value < kSubBucketCount) {
+            return static_cast<size_t>(value);
+        }
+        unsigned shift = mostSignificantBit(value) - kSubBucketBits;
+        size_t sub_bucket = static_cast<size_t>(value >> shift) - kSubBucketCount;
+        return kSubBucketCount + shift * kSubBucketCount + sub_bucket;
+    }
+
+    uint64_t SGHistogram::bucketUpperBound(size_t index) {
+        if (index < kSubBucketCount) {
+            return index;
+        }
+        size_t shift = (index - kSubBucketCount) / kSubBucketCount;
+        uint64_t mantissa = kSubBucketCount + (index - kSubBucketCount) % kSubBucketCount;
+        if (shift + kSubBucketBits >= 63 && mantissa == 2 * kSubBucketCount - 1) {
+            return numeric_limits<uint64_t>::max();
+        }
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    void SGHistogram::record(uint64_t value) {
+        counts_[bucketIndex(value)].fetch_add(1, memory_order_relaxed);
+        count_.fetch_add(1, memory_order_relaxed);
+        sum_.fetch_add(value, memory_order_relaxed);
+
+        uint64_t current = min_.load(memory_order_relaxed);
+        while (value < current && !min_.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+
+        current = max_.load(memory_order_relaxed);
+        while (value > current && !max_.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+    }
+
+    SGHistogramSnapshot SGHistogram::snapshot() const {
+        SGHistogramSnapshot snapshot;
+        snapshot.bucket_counts.resize(kBucketCount);
+        for (size_t index = 0; index < kBucketCount; ++index) {
+            snapshot.bucket_counts[index] = counts_[index].load(memory_order_relaxed);
+        }
+        snapshot.count = count_.load(memory_order_relaxed);
+        snapshot.sum = sum_.load(memory_order_relaxed);
+        snapshot.max = max_.load(memory_order_relaxed);
+        snapshot.min = snapshot.count > 0 ? min_.load(memory_order_relaxed) : 0;
+        return snapshot;
+    }
+
+    void SGHistogram::reset() {
+        for (size_t index = 0; index < kBucketCount; ++index) {
+            counts_[index].store(0, memory_order_relaxed);
+        }
+        count_.store(0, memory_order_relaxed);
+        sum_.store(0, memory_order_relaxed);
+        min_.store(numeric_limits<uint64_t>::max(), memory_order_relaxed);
+        max_.store(0, memory_order_relaxed);
+    }
+
+    double SGHistogramSnapshot::mean() const {
+        return count > 0 ? static_cast<double>(sum) / count : 0.0;
+    }
+
+    uint64_t SGHistogramSnapshot::percentile(double percentile) const {
+        if (count == 0) {
+            return 0;
+        }
+        if (percentile < 0.0) {
+            percentile = 0.0;
+        } else if (percentile > 100.0) {
+            percentile = 100.0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+        if (rank == 0) {
+            rank = 1;
+        }
+
+        uint64_t seen = 0;
+        for (size_t index = 0; index < bucket_counts.size(); ++index) {
+            seen += bucket_counts[index];
+            if (seen >= rank) {
+                uint64_t upper_bound = SGHistogram::bucketUpperBound(index);
+                return upper_bound < max ? upper_bound : max;
+            }
+        }
+        return max;
+    }
+}
@@ -22,8 +22,13 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <cstring>
+#include <mutex>
+
 #include "SGLoggingCategories.h"
 
+using namespace std;
+
 namespace Strata {
     Q_C4_LOGGING_CATEGORY(logDomainSGDatabase, "SG.database")
     Q_C4_LOGGING_CATEGORY(logDomainSGDocument, "SG.document")
@@ -31,4 +36,46 @@ namespace Strata {
     Q_C4_LOGGING_CATEGORY(logDomainSGPath, "SG.path")
     Q_C4_LOGGING_CATEGORY(logDomainSGReplicator, "SG.replicator")
     Q_C4_LOGGING_CATEGORY(logDomainSGURLEndpoint, "SG.URLendpoint")
+
+    // Our domains are created on first use, by a log line or a setLogLevel() call, whichever comes first
+    static const char *kSGLogDomainPrefix = "SG.";
+
+    static mutex log_domain_lock;
+
+    C4LogDomain getLogDomain(const char *domain_name) {
+        lock_guard<mutex> lock(log_domain_lock);
+        C4LogDomain domain = c4log_getDomain(domain_name, false);
+        if (domain == nullptr) {
+            // LiteCore keeps the name pointer and domains are never freed, so neither is the copy
+            domain = c4log_getDomain(strdup(domain_name), true);
+            c4log_setLevel(domain, kSGDefaultLogLevel);
+        }
+        return domain;
+    }
+
+    bool setLogLevel(const std::string &domain_name, C4LogLevel level) {
+        C4LogDomain domain = domain_name.compare(0, strlen(kSGLogDomainPrefix), kSGLogDomainPrefix) == 0 ?
+                             getLogDomain(domain_name.c_str()) : c4log_getDomain(domain_name.c_str(), false);
+        if (domain == nullptr) {
+            return false;
+        }
+        c4log_setLevel(domain, level);
+        if (level < c4log_callbackLevel()) {
+            c4log_setCallbackLevel(level);
+        }
+        return true;
+    }
+
+    void setLogLevel(C4LogLevel level) {
+        C4LogDomain &(*categories[])() = {
+                logDomainSGDatabase, logDomainSGDocument, logDomainSGMutableDocument, logDomainSGPath,
+                logDomainSGReplicator, logDomainSGURLEndpoint
+        };
+        for (C4LogDomain &(*category)() : categories) {
+            c4log_setLevel(category(), level);
+        }
+        if (level < c4log_callbackLevel()) {
+            c4log_setCallbackLevel(level);
+        }
+    }
 }
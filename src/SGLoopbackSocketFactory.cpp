@@ -0,0 +1,310 @@
+//
+//  SGLoopbackSocketFactory.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <chrono>
+#include <vector>
+
+#include <litecore/c4Replicator.h>
+
+#include "SGLoopbackSocketFactory.h"
+#include "SGUtility.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    const int SGLoopbackSocketFactory::kActiveSide;
+    const int SGLoopbackSocketFactory::kPassiveSide;
+
+    // How long the destructor waits for the passive replicators to stop.
+    static const chrono::milliseconds kPassiveReplicatorStopTimeout(5000);
+
+    SGLoopbackSocketFactory::SGLoopbackSocketFactory(SGDatabase *remote_database)
+            : SGSocketFactory(kC4NoFraming), remote_database_(remote_database) {
+        delivery_thread_ = thread(&SGLoopbackSocketFactory::runTasks, this);
+    }
+
+    SGLoopbackSocketFactory::~SGLoopbackSocketFactory() {
+        vector<C4Replicator *> passive_replicators;
+        {
+            lock_guard<mutex> lock(passive_replicators_lock_);
+            passive_replicators.assign(passive_replicators_.begin(), passive_replicators_.end());
+            passive_replicators_.clear();
+        }
+        for (C4Replicator *replicator : passive_replicators) {
+            c4repl_stop(replicator);
+        }
+        auto deadline = chrono::steady_clock::now() + kPassiveReplicatorStopTimeout;
+        for (C4Replicator *replicator : passive_replicators) {
+            while (c4repl_getStatus(replicator).level != kC4Stopped && chrono::steady_clock::now() < deadline) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+            c4repl_free(replicator);
+        }
+
+        {
+            lock_guard<mutex> lock(tasks_lock_);
+            stopping_ = true;
+        }
+        tasks_available_.notify_all();
+        if (delivery_thread_.joinable()) {
+            delivery_thread_.join();
+        }
+    }
+
+    void SGLoopbackSocketFactory::setCompressionLevel(int compression_level) {
+        compression_level_ = compression_level;
+    }
+
+    int SGLoopbackSocketFactory::getCompressionLevel() const {
+        return compression_level_;
+    }
+
+    void SGLoopbackSocketFactory::open(C4Socket *socket, const C4Address *address, C4Slice options) {
+        if (socket->nativeHandle != nullptr) {
+            // Passive end, created in connect()
+            LoopbackHandle *handle = (LoopbackHandle *) socket->nativeHandle;
+            shared_ptr<LoopbackConnection> connection = handle->connection;
+            post([this, connection]() {
+                openSide(connection, kPassiveSide);
+            });
+            return;
+        }
+
+        shared_ptr<LoopbackConnection> connection = make_shared<LoopbackConnection>();
+        connection->sockets[kActiveSide] = socket;
+        connection->codecs[kActiveSide].reset(new SGWebSocketCodec(SGWebSocketCodec::Role::kClient));
+        connection->codecs[kPassiveSide].reset(new SGWebSocketCodec(SGWebSocketCodec::Role::kServer));
+        int compression_level = compression_level_;
+        if (compression_level != SGWebSocketCodec::kCompressionDisabled) {
+            connection->codecs[kActiveSide]->enableDeflate(compression_level);
+            connection->codecs[kPassiveSide]->enableDeflate(compression_level);
+        }
+        socket->nativeHandle = new LoopbackHandle(this, connection, kActiveSide);
+
+        // The address slices are only valid during this call, keep our own copy for the passive socket.
+        shared_ptr<string> url = make_shared<string>(alloc_slice(c4address_toURL(*address)).asString());
+        post([this, connection, url]() {
+            C4Address passive_address {};
+            C4String unused_db_name;
+            if (!c4address_fromURL(slice(*url), &passive_address, &unused_db_name)) {
+                passive_address.scheme = slice("ws");
+                passive_address.hostname = slice("loopback");
+            }
+            connect(connection, passive_address);
+        });
+    }
+
+    void SGLoopbackSocketFactory::connect(const shared_ptr<LoopbackConnection> &connection, const C4Address &address) {
+        C4Socket *passive_socket = c4socket_fromNative(*getC4SocketFactory(),
+                                                       new LoopbackHandle(this, connection, kPassiveSide),
+                                                       &address);
+        {
+            lock_guard<mutex> lock(connection->lock);
+            connection->sockets[kPassiveSide] = passive_socket;
+        }
+
+        C4ReplicatorParameters passive_parameters {};
+        passive_parameters.push = kC4Passive;
+        passive_parameters.pull = kC4Passive;
+        passive_parameters.onStatusChanged = &SGLoopbackSocketFactory::onPassiveStatusChanged;
+        passive_parameters.callbackContext = this;
+
+        C4Error c4error {};
+        C4Replicator *passive_replicator = c4repl_newWithSocket(remote_database_->getC4db(), passive_socket,
+                                                                passive_parameters, &c4error);
+        if (passive_replicator == nullptr) {
+            qC4Critical(logDomainSGReplicator, "Loopback passive replicator failed: %s --", C4ErrorToString(c4error).c_str());
+            closeConnection(connection, c4error);
+            return;
+        }
+        {
+            lock_guard<mutex> lock(passive_replicators_lock_);
+            passive_replicators_.insert(passive_replicator);
+        }
+
+        openSide(connection, kPassiveSide);
+        openSide(connection, kActiveSide);
+    }
+
+    void SGLoopbackSocketFactory::write(C4Socket *socket, C4SliceResult data) {
+        LoopbackHandle *handle = (LoopbackHandle *) socket->nativeHandle;
+        shared_ptr<LoopbackConnection> connection = handle->connection;
+        int side = handle->side;
+        post([this, connection, side, data]() {
+            C4Socket *sender = socketOf(connection, side);
+            C4Socket *receiver = socketOf(connection, 1 - side);
+            if (receiver != nullptr) {
+                SGWebSocketCodec &encoder = *connection->codecs[side];
+                SGWebSocketCodec &decoder = *connection->codecs[1 - side];
+                uint64_t compression_time_ns = encoder.getCompressionTimeNs() + decoder.getCompressionTimeNs();
+
+                string frame;
+                if (!encoder.encode(SGWebSocketCodec::kOpcodeBinary, data.buf, data.size, frame)) {
+                    c4slice_free(data);
+                    closeConnection(connection, c4error_make(WebSocketDomain, SGWebSocketCodec::kCloseInternalError,
+                                                             slice("Compression failed")));
+                    return;
+                }
+                bool decoded = decoder.decode(frame.data(), frame.size(), [this, receiver](int opcode, const string &payload) {
+                    received(receiver, slice(payload));
+                });
+                if (!decoded) {
+                    c4slice_free(data);
+                    closeConnection(connection, c4error_make(WebSocketDomain, decoder.getCloseStatus(),
+                                                             slice("WebSocket protocol error")));
+                    return;
+                }
+
+                countWireBytes(frame.size(), frame.size());
+                countCompressionTime(encoder.getCompressionTimeNs() + decoder.getCompressionTimeNs() - compression_time_ns);
+            }
+            if (sender != nullptr) {
+                c4socket_completedWrite(sender, data.size);
+            }
+            c4slice_free(data);
+        });
+    }
+
+    void SGLoopbackSocketFactory::completedReceive(C4Socket *socket, size_t byte_count) {
+        // Messages are delivered as soon as they are written, there is no receive window to reopen.
+    }
+
+    void SGLoopbackSocketFactory::close(C4Socket *socket) {
+        requestClose(socket, kWebSocketCloseNormal, C4String {});
+    }
+
+    void SGLoopbackSocketFactory::requestClose(C4Socket *socket, int status, C4String message) {
+        LoopbackHandle *handle = (LoopbackHandle *) socket->nativeHandle;
+        shared_ptr<LoopbackConnection> connection = handle->connection;
+        C4Error error {};
+        if (status != kWebSocketCloseNormal) {
+            error = c4error_make(WebSocketDomain, status, message);
+        }
+        // Queued behind the pending writes, so the peer gets everything that was sent before the close.
+        post([this, connection, error]() {
+            closeConnection(connection, error);
+        });
+    }
+
+    void SGLoopbackSocketFactory::dispose(C4Socket *socket) {
+        LoopbackHandle *handle = (LoopbackHandle *) socket->nativeHandle;
+        {
+            lock_guard<mutex> lock(handle->connection->lock);
+            handle->connection->sockets[handle->side] = nullptr;
+        }
+        SGSocketFactory::dispose(socket);
+    }
+
+    void SGLoopbackSocketFactory::post(const function<void()> &task) {
+        {
+            lock_guard<mutex> lock(tasks_lock_);
+            tasks_.push_back(task);
+        }
+        tasks_available_.notify_one();
+    }
+
+    void SGLoopbackSocketFactory::runTasks() {
+        unique_lock<mutex> lock(tasks_lock_);
+        while (true) {
+            tasks_available_.wait(lock, [this]() {
+                return stopping_ || !tasks_.empty();
+            });
+            if (tasks_.empty()) {
+                // stopping_
+                return;
+            }
+            function<void()> task = move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    void SGLoopbackSocketFactory::openSide(const shared_ptr<LoopbackConnection> &connection, int side) {
+        C4Socket *socket = nullptr;
+        {
+            lock_guard<mutex> lock(connection->lock);
+            if (connection->is_open[side] || connection->is_closed[side]) {
+                return;
+            }
+            connection->is_open[side] = true;
+            socket = connection->sockets[side];
+        }
+        if (socket != nullptr) {
+            opened(socket);
+        }
+    }
+
+    void SGLoopbackSocketFactory::closeConnection(const shared_ptr<LoopbackConnection> &connection,
+                                                  const C4Error &error) {
+        for (int side = kActiveSide; side <= kPassiveSide; ++side) {
+            C4Socket *socket = nullptr;
+            {
+                lock_guard<mutex> lock(connection->lock);
+                if (connection->is_closed[side]) {
+                    continue;
+                }
+                connection->is_closed[side] = true;
+                socket = connection->sockets[side];
+            }
+            if (socket != nullptr) {
+                closed(socket, error);
+            }
+        }
+    }
+
+    C4Socket *SGLoopbackSocketFactory::socketOf(const shared_ptr<LoopbackConnection> &connection, int side) {
+        lock_guard<mutex> lock(connection->lock);
+        if (connection->is_closed[side]) {
+            return nullptr;
+        }
+        return connection->sockets[side];
+    }
+
+    void SGLoopbackSocketFactory::onPassiveStatusChanged(C4Replicator *replicator, C4ReplicatorStatus status,
+                                                         void *context) {
+        if (status.level != kC4Stopped) {
+            return;
+        }
+        if (status.error.code != 0) {
+            qC4Warning(logDomainSGReplicator, "Loopback passive replicator stopped: %s --", C4ErrorToString(status.error).c_str());
+        }
+
+        SGLoopbackSocketFactory *factory = (SGLoopbackSocketFactory *) context;
+        {
+            lock_guard<mutex> lock(factory->passive_replicators_lock_);
+            if (factory->passive_replicators_.erase(replicator) == 0) {
+                // Already stopped by the destructor, which frees it.
+                return;
+            }
+        }
+        // Not from inside LiteCore's callback, free it from the delivery thread.
+        factory->post([replicator]() {
+            c4repl_free(replicator);
+        });
+    }
+}
@@ -0,0 +1,103 @@
+//
+//  SGMemoryTracker.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+#include "SGMemoryTracker.h"
+
+using namespace std;
+
+namespace Strata {
+    uint64_t SGMemoryUsage::totalBytes() const {
+        uint64_t total_bytes = 0;
+        for (const SGMemoryCategoryUsage &category : categories) {
+            total_bytes += category.bytes;
+        }
+        return total_bytes;
+    }
+
+    SGMemoryTracker::SGMemoryTracker() {
+        for (size_t index = 0; index < (size_t) SGMemoryCategory::kCategoryCount; ++index) {
+            counts_[index].store(0, memory_order_relaxed);
+            bytes_[index].store(0, memory_order_relaxed);
+        }
+    }
+
+    SGMemoryTracker &SGMemoryTracker::process() {
+        static SGMemoryTracker process_tracker;
+        return process_tracker;
+    }
+
+    void SGMemoryTracker::add(SGMemoryCategory category, uint64_t bytes) {
+        counts_[(size_t) category].fetch_add(1, memory_order_relaxed);
+        bytes_[(size_t) category].fetch_add(bytes, memory_order_relaxed);
+        total_bytes_.fetch_add(bytes, memory_order_relaxed);
+    }
+
+    void SGMemoryTracker::remove(SGMemoryCategory category, uint64_t bytes) {
+        counts_[(size_t) category].fetch_sub(1, memory_order_relaxed);
+        bytes_[(size_t) category].fetch_sub(bytes, memory_order_relaxed);
+        total_bytes_.fetch_sub(bytes, memory_order_relaxed);
+        released();
+    }
+
+    void SGMemoryTracker::resize(SGMemoryCategory category, uint64_t old_bytes, uint64_t new_bytes) {
+        if (new_bytes >= old_bytes) {
+            bytes_[(size_t) category].fetch_add(new_bytes - old_bytes, memory_order_relaxed);
+            total_bytes_.fetch_add(new_bytes - old_bytes, memory_order_relaxed);
+            return;
+        }
+        bytes_[(size_t) category].fetch_sub(old_bytes - new_bytes, memory_order_relaxed);
+        total_bytes_.fetch_sub(old_bytes - new_bytes, memory_order_relaxed);
+        released();
+    }
+
+    SGMemoryUsage SGMemoryTracker::getUsage() const {
+        SGMemoryUsage usage;
+        for (size_t index = 0; index < (size_t) SGMemoryCategory::kCategoryCount; ++index) {
+            usage.categories[index].count = counts_[index].load(memory_order_relaxed);
+            usage.categories[index].bytes = bytes_[index].load(memory_order_relaxed);
+        }
+        return usage;
+    }
+
+    uint64_t SGMemoryTracker::getTotalBytes() const {
+        return total_bytes_.load(memory_order_relaxed);
+    }
+
+    bool SGMemoryTracker::waitForBytesBelow(uint64_t limit, std::chrono::milliseconds timeout) {
+        unique_lock<mutex> lock(waiters_lock_);
+        waiter_count_++;
+        bool below = bytes_released_.wait_for(lock, timeout, [this, limit] {
+            return total_bytes_.load(memory_order_relaxed) <= limit;
+        });
+        waiter_count_--;
+        return below;
+    }
+
+    void SGMemoryTracker::released() {
+        // Taking the lock orders the notification after the waiter's check
+        if (waiter_count_.load() > 0) {
+            lock_guard<mutex> lock(waiters_lock_);
+            bytes_released_.notify_all();
+        }
+    }
+}
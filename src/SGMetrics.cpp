@@ -0,0 +1,235 @@
+//
+//  SGMetrics.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+#include <cstdio>
+
+#include "SGMetrics.h"
+
+using namespace std;
+
+namespace Strata {
+    const size_t SGOperationMetrics::kMaxStatusCount;
+
+    // Percentiles exported for each histogram, with their Prometheus quantile and JSON key
+    static const struct {
+        double percentile;
+        const char *quantile;
+        const char *json_key;
+    } kExportedPercentiles[] = {
+            {50, "0.5", "p50"},
+            {90, "0.9", "p90"},
+            {99, "0.99", "p99"},
+            {99.9, "0.999", "p999"},
+    };
+
+    static void appendEscaped(string &out, const string &value) {
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+    }
+
+    // name{label="value",...}, extra_label is added last when not empty
+    static string seriesName(const string &name, const SGMetricLabels &labels, const string &extra_label = string()) {
+        string series = name;
+        if (labels.empty() && extra_label.empty()) {
+            return series;
+        }
+        series += '{';
+        bool first = true;
+        for (const auto &label : labels) {
+            if (!first) {
+                series += ',';
+            }
+            first = false;
+            series += label.first;
+            series += "=\"";
+            appendEscaped(series, label.second);
+            series += '"';
+        }
+        if (!extra_label.empty()) {
+            if (!first) {
+                series += ',';
+            }
+            series += extra_label;
+        }
+        series += '}';
+        return series;
+    }
+
+    static string jsonLabels(const SGMetricLabels &labels) {
+        string json = "{";
+        bool first = true;
+        for (const auto &label : labels) {
+            if (!first) {
+                json += ',';
+            }
+            first = false;
+            json += '"';
+            appendEscaped(json, label.first);
+            json += "\":\"";
+            appendEscaped(json, label.second);
+            json += '"';
+        }
+        json += '}';
+        return json;
+    }
+
+    std::string SGMetricsSnapshot::toText() const {
+        string text;
+        string last_name;
+        for (const Counter &counter : counters) {
+            if (counter.name != last_name) {
+                text += "# TYPE " + counter.name + " counter\n";
+                last_name = counter.name;
+            }
+            text += seriesName(counter.name, counter.labels) + " " + to_string(counter.value) + "\n";
+        }
+
+        last_name.clear();
+        for (const Histogram &histogram : histograms) {
+            if (histogram.name != last_name) {
+                text += "# TYPE " + histogram.name + " summary\n";
+                last_name = histogram.name;
+            }
+            const SGHistogramSnapshot &snapshot = histogram.snapshot;
+            for (const auto &exported : kExportedPercentiles) {
+                text += seriesName(histogram.name, histogram.labels, string("quantile=\"") + exported.quantile + "\"") +
+                        " " + to_string(snapshot.percentile(exported.percentile)) + "\n";
+            }
+            text += seriesName(histogram.name + "_sum", histogram.labels) + " " + to_string(snapshot.sum) + "\n";
+            text += seriesName(histogram.name + "_count", histogram.labels) + " " + to_string(snapshot.count) + "\n";
+        }
+        return text;
+    }
+
+    std::string SGMetricsSnapshot::toJson() const {
+        string json = "{\"counters\":[";
+        for (size_t index = 0; index < counters.size(); ++index) {
+            const Counter &counter = counters[index];
+            json += index == 0 ? "\n" : ",\n";
+            json += "{\"name\":\"";
+            appendEscaped(json, counter.name);
+            json += "\",\"labels\":" + jsonLabels(counter.labels) + ",\"value\":" + to_string(counter.value) + "}";
+        }
+        json += "],\"histograms\":[";
+        for (size_t index = 0; index < histograms.size(); ++index) {
+            const Histogram &histogram = histograms[index];
+            const SGHistogramSnapshot &snapshot = histogram.snapshot;
+            char mean[32];
+            snprintf(mean, sizeof(mean), "%.1f", snapshot.mean());
+            json += index == 0 ? "\n" : ",\n";
+            json += "{\"name\":\"";
+            appendEscaped(json, histogram.name);
+            json += "\",\"labels\":" + jsonLabels(histogram.labels) + ",\"count\":" + to_string(snapshot.count) +
+                    ",\"sum\":" + to_string(snapshot.sum) + ",\"min\":" + to_string(snapshot.min) + ",\"max\":" +
+                    to_string(snapshot.max) + ",\"mean\":" + mean;
+            for (const auto &exported : kExportedPercentiles) {
+                json += string(",\"") + exported.json_key + "\":" + to_string(snapshot.percentile(exported.percentile));
+            }
+            json += "}";
+        }
+        json += "]}\n";
+        return json;
+    }
+
+    SGMetrics::SGMetrics() {}
+
+    SGMetrics::~SGMetrics() {}
+
+    SGCounter &SGMetrics::counter(const std::string &name, const SGMetricLabels &labels) {
+        lock_guard<mutex> lock(lock_);
+        unique_ptr<SGCounter> &counter = counters_[MetricKey(name, labels)];
+        if (counter == nullptr) {
+            counter.reset(new SGCounter());
+        }
+        return *counter;
+    }
+
+    SGHistogram &SGMetrics::histogram(const std::string &name, const SGMetricLabels &labels) {
+        lock_guard<mutex> lock(lock_);
+        unique_ptr<SGHistogram> &histogram = histograms_[MetricKey(name, labels)];
+        if (histogram == nullptr) {
+            histogram.reset(new SGHistogram());
+        }
+        return *histogram;
+    }
+
+    SGMetricsSnapshot SGMetrics::snapshot() const {
+        SGMetricsSnapshot snapshot;
+        lock_guard<mutex> lock(lock_);
+        for (const auto &counter : counters_) {
+            SGMetricsSnapshot::Counter counter_snapshot;
+            counter_snapshot.name = counter.first.first;
+            counter_snapshot.labels = counter.first.second;
+            counter_snapshot.value = counter.second->get();
+            snapshot.counters.push_back(counter_snapshot);
+        }
+        for (const auto &histogram : histograms_) {
+            SGMetricsSnapshot::Histogram histogram_snapshot;
+            histogram_snapshot.name = histogram.first.first;
+            histogram_snapshot.labels = histogram.first.second;
+            histogram_snapshot.snapshot = histogram.second->snapshot();
+            snapshot.histograms.push_back(histogram_snapshot);
+        }
+        return snapshot;
+    }
+
+    void SGMetrics::reset() {
+        lock_guard<mutex> lock(lock_);
+        for (const auto &counter : counters_) {
+            counter.second->reset();
+        }
+        for (const auto &histogram : histograms_) {
+            histogram.second->reset();
+        }
+    }
+
+    SGOperationMetrics::SGOperationMetrics(SGMetrics &metrics, const std::string &name, const SGMetricLabels &labels)
+            : metrics_(metrics), name_(name), labels_(labels) {
+        for (atomic<SGHistogram *> &latency_us : latency_us_) {
+            latency_us.store(nullptr, memory_order_relaxed);
+        }
+    }
+
+    void SGOperationMetrics::record(size_t status_index, const char *status_name, uint64_t latency_us) {
+        if (status_index >= kMaxStatusCount) {
+            return;
+        }
+        SGHistogram *histogram = latency_us_[status_index].load(memory_order_acquire);
+        if (histogram == nullptr) {
+            SGMetricLabels labels = labels_;
+            labels["status"] = status_name;
+            // The registry returns the same histogram to racing threads
+            histogram = &metrics_.histogram(name_, labels);
+            latency_us_[status_index].store(histogram, memory_order_release);
+        }
+        histogram->record(latency_us);
+    }
+}
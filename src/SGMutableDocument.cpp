@@ -14,9 +14,21 @@
 namespace Strata {
     SGMutableDocument::SGMutableDocument(class SGDatabase *database, const std::string &docId) : SGDocument(database, docId) {}
 
+    SGMutableDocument::~SGMutableDocument() {
+        accountMemory(SGMemoryCategory::kDocumentBody, alloc_slice_ ? true : false, alloc_slice_.size, false, 0);
+    }
+
+    void SGMutableDocument::setBlob(const std::string &key, const SGBlob &blob) {
+        fleece::Retained<fleece::impl::MutableDict> blob_dict = blob.toDict();
+        mutable_dict_->set(fleece::slice(key), blob_dict);
+    }
+
     bool SGMutableDocument::setBody(const std::string &body) {
         try {
-            alloc_slice_ = fleece::impl::JSONConverter::convertJSON(body);
+            fleece::alloc_slice fleece_body = fleece::impl::JSONConverter::convertJSON(body);
+            accountMemory(SGMemoryCategory::kDocumentBody, alloc_slice_ ? true : false, alloc_slice_.size,
+                          fleece_body ? true : false, fleece_body.size);
+            alloc_slice_ = fleece_body;
             if(!alloc_slice_){
                 qC4Warning(logDomainSGMutableDocument, "Tried to convert invalid json to fleece data: %s", body.c_str());
                 return false;
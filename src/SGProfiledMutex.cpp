@@ -0,0 +1,127 @@
+//
+//  SGProfiledMutex.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+#include "SGProfiledMutex.h"
+
+using namespace std;
+
+namespace Strata {
+#ifdef SG_LOCK_PROFILING
+    static const bool kProfilingEnabledByDefault = true;
+#else
+    static const bool kProfilingEnabledByDefault = false;
+#endif
+
+    static const char *const kUnnamedOperation = "unnamed";
+
+    static uint64_t elapsedUs(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+        return (uint64_t) chrono::duration_cast<chrono::microseconds>(to - from).count();
+    }
+
+    SGProfiledMutex::SGProfiledMutex() : profiling_enabled_(kProfilingEnabledByDefault) {}
+
+    void SGProfiledMutex::lock(const char *operation) {
+        if (!profiling_enabled_.load(memory_order_relaxed)) {
+            mutex_.lock();
+            profiled_hold_ = false;
+            return;
+        }
+
+        Clock::time_point requested_at = Clock::now();
+        bool contended = !mutex_.try_lock();
+        if (contended) {
+            mutex_.lock();
+        }
+        acquired(operation, requested_at, contended);
+    }
+
+    bool SGProfiledMutex::try_lock() {
+        if (!mutex_.try_lock()) {
+            return false;
+        }
+        if (profiling_enabled_.load(memory_order_relaxed)) {
+            acquired(nullptr, Clock::now(), false);
+        } else {
+            profiled_hold_ = false;
+        }
+        return true;
+    }
+
+    void SGProfiledMutex::unlock() {
+        if (profiled_hold_) {
+            uint64_t hold_us = elapsedUs(acquired_at_, Clock::now());
+            hold_us_.record(hold_us);
+            if (hold_us > longest_hold_us_.load(memory_order_relaxed)) {
+                lock_guard<mutex> lock(longest_hold_lock_);
+                if (hold_us > longest_hold_us_.load(memory_order_relaxed)) {
+                    longest_hold_us_.store(hold_us, memory_order_relaxed);
+                    longest_hold_operation_ = operation_;
+                }
+            }
+        }
+        mutex_.unlock();
+    }
+
+    void SGProfiledMutex::acquired(const char *operation, Clock::time_point requested_at, bool contended) {
+        acquired_at_ = Clock::now();
+        profiled_hold_ = true;
+        operation_ = operation != nullptr ? operation : kUnnamedOperation;
+        acquisition_count_.fetch_add(1, memory_order_relaxed);
+        if (contended) {
+            contended_count_.fetch_add(1, memory_order_relaxed);
+        }
+        wait_us_.record(elapsedUs(requested_at, acquired_at_));
+    }
+
+    void SGProfiledMutex::setProfilingEnabled(bool enabled) {
+        profiling_enabled_.store(enabled, memory_order_relaxed);
+    }
+
+    bool SGProfiledMutex::isProfilingEnabled() const {
+        return profiling_enabled_.load(memory_order_relaxed);
+    }
+
+    SGLockStats SGProfiledMutex::getStats() const {
+        SGLockStats stats;
+        stats.acquisition_count = acquisition_count_.load(memory_order_relaxed);
+        stats.contended_count = contended_count_.load(memory_order_relaxed);
+        stats.wait_us = wait_us_.snapshot();
+        stats.hold_us = hold_us_.snapshot();
+        lock_guard<mutex> lock(longest_hold_lock_);
+        stats.longest_hold_us = longest_hold_us_.load(memory_order_relaxed);
+        if (longest_hold_operation_ != nullptr) {
+            stats.longest_hold_operation = longest_hold_operation_;
+        }
+        return stats;
+    }
+
+    void SGProfiledMutex::resetStats() {
+        acquisition_count_.store(0, memory_order_relaxed);
+        contended_count_.store(0, memory_order_relaxed);
+        wait_us_.reset();
+        hold_us_.reset();
+        lock_guard<mutex> lock(longest_hold_lock_);
+        longest_hold_us_.store(0, memory_order_relaxed);
+        longest_hold_operation_ = nullptr;
+    }
+}
@@ -0,0 +1,313 @@
+//
+//  SGPushDebouncer.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+
+#include "SGPushDebouncer.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    constexpr const char *SGPushDebouncer::kPendingDocumentsKeyPrefix;
+    constexpr std::chrono::milliseconds SGPushDebouncer::kPersistDelay;
+    constexpr std::chrono::milliseconds SGPushDebouncer::kMinRetryWindow;
+
+    SGPushDebouncer::SGPushDebouncer(SGScheduler &scheduler, SGScheduler &worker,
+                                     const std::function<bool(const std::vector<std::string> &doc_ids)> &releaser)
+            : scheduler_(scheduler), worker_(worker), releaser_(releaser) {}
+
+    SGPushDebouncer::~SGPushDebouncer() {
+        lock_guard<mutex> lock(debouncer_lock_);
+        if (window_task_ != 0) {
+            scheduler_.cancel(window_task_);
+        }
+    }
+
+    void SGPushDebouncer::configure(SGDatabase *database, const std::string &replicator_key,
+                                    const std::chrono::milliseconds &window,
+                                    const std::vector<std::string> &doc_id_prefixes) {
+        lock_guard<mutex> lock(debouncer_lock_);
+        database_ = database;
+        pending_documents_key_ = kPendingDocumentsKeyPrefix + replicator_key;
+        window_ = window;
+        doc_id_prefixes_ = doc_id_prefixes;
+    }
+
+    bool SGPushDebouncer::matches(const std::string &doc_id) const {
+        if (doc_id_prefixes_.empty()) {
+            return true;
+        }
+        for (const string &prefix : doc_id_prefixes_) {
+            if (doc_id.compare(0, prefix.size(), prefix) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool SGPushDebouncer::shouldPush(const std::string &doc_id, bool deleted) {
+        lock_guard<mutex> lock(debouncer_lock_);
+        auto iter = pending_documents_.find(doc_id);
+        if (iter != pending_documents_.end() && (iter->second || deleted)) {
+            // A deletion inside the window goes out right away, its window entry is skipped when it ends
+            pending_documents_.erase(iter);
+            _schedulePersist();
+            return true;
+        }
+        if (deleted || window_.count() == 0 || !matches(doc_id)) {
+            return true;
+        }
+        held_back_count_++;
+        if (iter == pending_documents_.end()) {
+            // The window starts at the first change, so a document changing all the time still goes out every window
+            _openWindow(doc_id, window_);
+            // Written before LiteCore moves its checkpoint past the revision held back
+            _schedulePersist();
+        }
+        return false;
+    }
+
+    void SGPushDebouncer::_openWindow(const std::string &doc_id, const std::chrono::milliseconds &window) {
+        pending_documents_[doc_id] = false;
+        pair<Clock::time_point, string> window_end = make_pair(Clock::now() + window, doc_id);
+        windows_.insert(upper_bound(windows_.begin(), windows_.end(), window_end), window_end);
+        if (window_task_ == 0) {
+            window_task_ = scheduler_.scheduleAfter(window, [this]() {
+                closeWindows();
+            });
+        }
+    }
+
+    void SGPushDebouncer::restore() {
+        SGDatabase *database;
+        string pending_documents_key;
+        {
+            lock_guard<mutex> lock(debouncer_lock_);
+            database = database_;
+            pending_documents_key = pending_documents_key_;
+        }
+        alloc_slice data;
+        const impl::Array *pending_doc_ids = nullptr;
+        if (database != nullptr && database->getLocalDocument(pending_documents_key, data)) {
+            const impl::Value *value = impl::Value::fromData(data);
+            pending_doc_ids = value != nullptr ? value->asArray() : nullptr;
+        }
+
+        lock_guard<mutex> lock(debouncer_lock_);
+        if (pending_doc_ids != nullptr) {
+            size_t restored_count = 0;
+            for (impl::Array::iterator iter(pending_doc_ids); iter; ++iter) {
+                string doc_id = iter.value()->asString().asString();
+                // Documents pending in this process are released by their window
+                if (!doc_id.empty() && pending_documents_.find(doc_id) == pending_documents_.end()) {
+                    pending_documents_[doc_id] = true;
+                    releasable_doc_ids_.push_back(doc_id);
+                    restored_count++;
+                }
+            }
+            if (restored_count > 0) {
+                qC4Info(logDomainSGReplicator, "Releasing %zu debounced documents held back when the process stopped", restored_count);
+            }
+        }
+        // And the ones whose window closed while the replicator wasn't running
+        _scheduleRelease();
+    }
+
+    void SGPushDebouncer::_schedulePersist() {
+        if (persist_scheduled_) {
+            return;
+        }
+        persist_scheduled_ = true;
+        if (worker_.scheduleAfter(kPersistDelay, [this]() {
+            persist();
+        }) == 0) {
+            // Stopping, flush() writes them
+            persist_scheduled_ = false;
+        }
+    }
+
+    void SGPushDebouncer::persist() {
+        lock_guard<mutex> persist_lock(persist_lock_);
+        SGDatabase *database;
+        string pending_documents_key;
+        vector<string> doc_ids;
+        {
+            lock_guard<mutex> lock(debouncer_lock_);
+            persist_scheduled_ = false;
+            database = database_;
+            pending_documents_key = pending_documents_key_;
+            doc_ids.reserve(pending_documents_.size());
+            for (const auto &entry : pending_documents_) {
+                doc_ids.push_back(entry.first);
+            }
+        }
+        if (database == nullptr) {
+            return;
+        }
+
+        alloc_slice data;
+        if (!doc_ids.empty()) {
+            impl::Encoder encoder;
+            encoder.beginArray();
+            for (const string &doc_id : doc_ids) {
+                encoder.writeString(slice(doc_id));
+            }
+            encoder.endArray();
+            data = encoder.finish();
+        }
+        if (!database->saveLocalDocument(pending_documents_key, data)) {
+            qC4Warning(logDomainSGReplicator, "Could not store the debounced documents, %zu would be lost on a crash", doc_ids.size());
+        }
+    }
+
+    void SGPushDebouncer::closeWindows() {
+        lock_guard<mutex> lock(debouncer_lock_);
+        window_task_ = 0;
+        Clock::time_point now = Clock::now();
+        while (!windows_.empty() && windows_.front().first <= now) {
+            auto iter = pending_documents_.find(windows_.front().second);
+            if (iter != pending_documents_.end() && !iter->second) {
+                iter->second = true;
+                releasable_doc_ids_.push_back(iter->first);
+            }
+            windows_.pop_front();
+        }
+        if (!windows_.empty()) {
+            auto delay = chrono::duration_cast<chrono::milliseconds>(windows_.front().first - now);
+            window_task_ = scheduler_.scheduleAfter(delay + chrono::milliseconds(1), [this]() {
+                closeWindows();
+            });
+        }
+        _scheduleRelease();
+    }
+
+    void SGPushDebouncer::_scheduleRelease() {
+        if (releasing_ || releasable_doc_ids_.empty()) {
+            return;
+        }
+        vector<string> doc_ids;
+        doc_ids.swap(releasable_doc_ids_);
+        releasing_ = true;
+        if (worker_.scheduleAfter(chrono::milliseconds::zero(), [this, doc_ids]() {
+            release(doc_ids);
+        }) == 0) {
+            releasing_ = false;
+            releasable_doc_ids_.swap(doc_ids);
+        }
+    }
+
+    void SGPushDebouncer::release(const std::vector<std::string> &doc_ids) {
+        vector<string> released_doc_ids;
+        {
+            lock_guard<mutex> lock(debouncer_lock_);
+            // Skip the documents pushed meanwhile by a newer revision, and the ones listed twice
+            for (const string &doc_id : doc_ids) {
+                auto iter = pending_documents_.find(doc_id);
+                if (iter != pending_documents_.end() && iter->second &&
+                    find(released_doc_ids.begin(), released_doc_ids.end(), doc_id) == released_doc_ids.end()) {
+                    released_doc_ids.push_back(doc_id);
+                }
+            }
+            if (released_doc_ids.empty()) {
+                releasing_ = false;
+                _scheduleRelease();
+                return;
+            }
+        }
+
+        if (releaser_(released_doc_ids)) {
+            return;
+        }
+        // Released by the next restore(), or with the next window closing
+        qC4Debug(logDomainSGReplicator, "Could not release %zu debounced documents now", released_doc_ids.size());
+        lock_guard<mutex> lock(debouncer_lock_);
+        releasing_ = false;
+        releasable_doc_ids_.insert(releasable_doc_ids_.end(), released_doc_ids.begin(), released_doc_ids.end());
+    }
+
+    void SGPushDebouncer::onReleased(const std::vector<std::string> &doc_ids, bool pushed) {
+        lock_guard<mutex> lock(debouncer_lock_);
+        releasing_ = false;
+        bool pending_changed = false;
+        for (const string &doc_id : doc_ids) {
+            auto iter = pending_documents_.find(doc_id);
+            if (iter == pending_documents_.end() || !iter->second) {
+                // An edit made meanwhile was pushed, or is held back again
+                continue;
+            }
+            if (pushed) {
+                pending_documents_.erase(iter);
+                pending_changed = true;
+            } else {
+                _openWindow(doc_id, max(window_, kMinRetryWindow));
+            }
+        }
+        if (!pushed) {
+            qC4Warning(logDomainSGReplicator, "Could not push the latest revision of %zu debounced documents, retrying after another window", doc_ids.size());
+        }
+        if (pending_changed) {
+            _schedulePersist();
+        }
+        _scheduleRelease();
+    }
+
+    void SGPushDebouncer::flush() {
+        {
+            lock_guard<mutex> lock(debouncer_lock_);
+            if (window_task_ != 0) {
+                scheduler_.cancel(window_task_);
+                window_task_ = 0;
+            }
+            for (auto &entry : pending_documents_) {
+                if (!entry.second) {
+                    entry.second = true;
+                    releasable_doc_ids_.push_back(entry.first);
+                }
+            }
+            windows_.clear();
+        }
+        persist();
+    }
+
+    bool SGPushDebouncer::isPending(const std::string &doc_id) {
+        lock_guard<mutex> lock(debouncer_lock_);
+        return pending_documents_.find(doc_id) != pending_documents_.end();
+    }
+
+    std::vector<std::string> SGPushDebouncer::getPendingDocumentIds() {
+        lock_guard<mutex> lock(debouncer_lock_);
+        vector<string> doc_ids;
+        doc_ids.reserve(pending_documents_.size());
+        for (const auto &entry : pending_documents_) {
+            doc_ids.push_back(entry.first);
+        }
+        return doc_ids;
+    }
+
+    uint64_t SGPushDebouncer::getHeldBackCount() const {
+        return held_back_count_;
+    }
+}
@@ -0,0 +1,86 @@
+//
+//  SGQuery.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+#include "SGQuery.h"
+#include "SGDatabase.h"
+#include "SGLoggingCategories.h"
+#include "SGUtility.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    SGQuery::SGQuery(SGDatabase *database, const std::string &json_query) : database_(database), query_(json_query) {
+        if (database_ == nullptr) {
+            qC4Critical(logDomainSGDatabase, "Creating a query without a database");
+            return;
+        }
+        c4query_ = database_->compileQuery(query_);
+    }
+
+    SGQuery::~SGQuery() {
+        if (c4query_ != nullptr) {
+            database_->freeQuery(c4query_);
+        }
+    }
+
+    bool SGQuery::isValid() const {
+        return c4query_ != nullptr;
+    }
+
+    const std::string &SGQuery::getQuery() const {
+        return query_;
+    }
+
+    bool SGQuery::run(std::vector<std::string> &rows, const std::string &parameters) {
+        if (c4query_ == nullptr) {
+            qC4Warning(logDomainSGDatabase, "Running a query that didn't compile: %s", query_.c_str());
+            return false;
+        }
+        unsigned column_count = c4query_columnCount(c4query_);
+        return database_->runQuery(c4query_, query_, parameters, "SGQuery::run", plan_, [&rows, column_count](FLArrayIterator *columns) {
+            string row = "[";
+            for (unsigned column = 0; column < column_count; ++column) {
+                if (column > 0) {
+                    row += ",";
+                }
+                FLValue value = FLArrayIterator_GetValueAt(columns, column);
+                if (value == nullptr) {
+                    row += "null";
+                    continue;
+                }
+                alloc_slice json = FLValue_ToJSON(value);
+                row.append((const char *) json.buf, json.size);
+            }
+            row += "]";
+            rows.push_back(row);
+        });
+    }
+
+    std::string SGQuery::explain() {
+        if (c4query_ == nullptr) {
+            return string();
+        }
+        return database_->explainQuery(c4query_, plan_);
+    }
+}
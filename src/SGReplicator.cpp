@@ -22,6 +22,9 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <algorithm>
+#include <cstdlib>
+#include <set>
 #include <string>
 
 #include <litecore/CivetWebSocket.hh>
@@ -29,12 +32,28 @@
 #include "SGReplicator.h"
 #include "SGUtility.h"
 #include "SGLoggingCategories.h"
+#include "SGTrace.h"
 
 using namespace std;
 using namespace fleece;
 using namespace fleece::impl;
 
 namespace Strata {
+    constexpr std::chrono::milliseconds::rep SGReplicator::kStatsSamplingIntervalMs;
+
+    const unsigned SGReplicator::kPushWaiterCheckIntervalMs;
+
+    // WebSocketDomain code Sync Gateway reports when the credentials were refused
+    static const int kAuthenticationFailedStatus = 401;
+
+    // kC4ReplicatorOptionProgressLevel reporting every blob transfer
+    static const int kBlobProgressLevel = 2;
+
+    // Revision IDs look like "3-a1b2c3", the generation is the number before the dash
+    static unsigned revisionGeneration(const string &rev_id) {
+        return (unsigned) strtoul(rev_id.c_str(), nullptr, 10);
+    }
+
     SGReplicator::SGReplicator() {
         replicator_parameters_.callbackContext = this;
         replicator_parameters_.push = kC4Disabled;
@@ -51,9 +70,33 @@ namespace Strata {
     }
 
     SGReplicator::~SGReplicator() {
+        // Stop the timers and their workers first, they use the replicator.
+        scheduler_.stop();
+        worker_.stop();
+        listener_scheduler_.stop();
         stop();
         join();
         free();
+        {
+            SGProfiledLock lock(replicator_lock_, "~SGReplicator");
+            if(priority_c4replicator_ != nullptr) {
+                c4repl_free(priority_c4replicator_);
+                priority_c4replicator_ = nullptr;
+            }
+            if(release_c4replicator_ != nullptr) {
+                c4repl_free(release_c4replicator_);
+                release_c4replicator_ = nullptr;
+            }
+            lock_guard<mutex> channel_lock(channel_lock_);
+            for(const shared_ptr<ChannelLane> &lane : channel_lanes_) {
+                if(lane->c4replicator != nullptr) {
+                    c4repl_free(lane->c4replicator);
+                }
+            }
+            channel_lanes_.clear();
+        }
+        stats_collector_.stopObserving();
+        resolvePushWaiters("The replicator was destroyed");
     }
 
     SGReplicator::SGReplicator(SGReplicatorConfiguration *replicator_configuration): SGReplicator() {
@@ -62,34 +105,68 @@ namespace Strata {
     }
 
     void SGReplicator::stop() {
-        lock_guard<mutex> lock(replicator_lock_);
+        // Don't lose the latest revision of debounced documents, they are pushed on the next start
+        push_debouncer_.flush();
+
+        SGProfiledLock lock(replicator_lock_, "stop");
         if(c4replicator_ != nullptr) {
             internal_status_ = Strata::SGReplicatorInternalStatus::kStopping;
             c4repl_stop(c4replicator_);
         }
+        if(priority_c4replicator_ != nullptr) {
+            c4repl_stop(priority_c4replicator_);
+        }
+        if(release_c4replicator_ != nullptr) {
+            release_stopped_ = true;
+            c4repl_stop(release_c4replicator_);
+        }
+        {
+            lock_guard<mutex> channel_lock(channel_lock_);
+            _stopChannelLanes();
+        }
         replicator_can_restart_ = false;
     }
 
     void SGReplicator::join() {
         // first wait for the replicator to terminate
         {
-            lock_guard<mutex> lock(replicator_lock_);
+            SGProfiledLock lock(replicator_lock_, "join");
             if(c4replicator_ != nullptr) {
                 while (c4repl_getStatus(c4replicator_).level != kC4Stopped)
                     this_thread::sleep_for(chrono::milliseconds(1));
             }
+            if(priority_c4replicator_ != nullptr) {
+                while (c4repl_getStatus(priority_c4replicator_).level != kC4Stopped)
+                    this_thread::sleep_for(chrono::milliseconds(1));
+            }
+            if(release_c4replicator_ != nullptr) {
+                while (c4repl_getStatus(release_c4replicator_).level != kC4Stopped)
+                    this_thread::sleep_for(chrono::milliseconds(1));
+            }
         }
 
-        // then wait for the onStatusChanged event to be emitted and terminated
+        // then wait for the onStatusChanged events to be emitted and terminated
         unsigned count = 0;     // in case the C4Replicator would fail to emit onStatusChanged event
-        while ((internal_status_ != Strata::SGReplicatorInternalStatus::kStopped) && (count < 200)) {
+        while (count < 200) {
+            {
+                SGProfiledLock lock(replicator_lock_, "join");
+                lock_guard<mutex> channel_lock(channel_lock_);
+                if(internal_status_ == Strata::SGReplicatorInternalStatus::kStopped && priority_c4replicator_ == nullptr &&
+                   release_c4replicator_ == nullptr && channel_lanes_.empty()) {
+                    break;
+                }
+            }
             this_thread::sleep_for(chrono::milliseconds(1));
             ++count;
         }
     }
 
     SGReplicatorReturnStatus SGReplicator::start() {
-        lock_guard<mutex> lock(replicator_lock_);
+        return startReplicator(true);
+    }
+
+    SGReplicatorReturnStatus SGReplicator::startReplicator(bool merge_channels) {
+        SGProfiledLock lock(replicator_lock_, "start");
 
         if(internal_status_ == Strata::SGReplicatorInternalStatus::kStopping) {
             return SGReplicatorReturnStatus::kAboutToStop;
@@ -105,20 +182,50 @@ namespace Strata {
 
         internal_status_ = Strata::SGReplicatorInternalStatus::kStarting;
 
+        // Pick up replicator type or mode changes made since the last start
+        setReplicatorType(replicator_configuration_->getReplicatorType());
+
+        // Make sure this run has a completion future
+        getCompletion();
+
+        // Deletions skipped now would never be pulled later, the checkpoint outlives this run
+        initial_sync_ = false;
+        if(replicator_configuration_->getSyncProfile() == SGReplicatorConfiguration::SyncProfile::kInitialSync) {
+            uint64_t document_count = replicator_configuration_->getDatabase()->getDocumentCount();
+            if(document_count == 0) {
+                initial_sync_ = true;
+            } else {
+                qC4Warning(logDomainSGReplicator, "Initial sync profile ignored, the database already has %llu documents.",
+                           (unsigned long long) document_count);
+            }
+        }
+
+        if(merge_channels) {
+            // Every configured channel on this replicator, the channel lanes aren't needed anymore. Changing the
+            // channels gives it a new checkpoint.
+            base_channels_ = replicator_configuration_->getChannels();
+        }
+
         Encoder encoder;
-        encoder.writeValue(replicator_configuration_->effectiveOptions());
+        encoder.writeValue(replicatorOptions());
         alloc_slice replicator_options = encoder.finish();
         replicator_parameters_.optionsDictFleece = replicator_options;
 
-        // Callback function for outgoing revision event
-        // This is used for log purposes!
-        replicator_parameters_.pushFilter = [](C4String docID, C4RevisionFlags ref, FLDict body, void *context) {
-            qC4Debug(logDomainSGReplicator, "pushFilter");
-            alloc_slice fleece_body = FLValue_ToJSON((FLValue) body);
-            qC4Debug(logDomainSGReplicator, "Doc ID: %s, pushing body json:%s", slice(docID).asString().c_str(),
-                  fleece_body.asString().c_str());
-            return true;
-        };
+        // Custom transport, if any. Otherwise LiteCore uses the registered civetweb factory.
+        SGSocketFactory *socket_factory = replicator_configuration_->getSocketFactory();
+        replicator_parameters_.socketFactory = socket_factory ? socket_factory->getC4SocketFactory() : nullptr;
+
+        // Callback function for outgoing revision event, see pushFilter()
+        priority_lane_enabled_ = replicator_parameters_.push != kC4Disabled && replicator_configuration_->hasPriorityLane();
+        // Keyed by endpoint, replicators sharing the database keep their own pending documents
+        const SGURLEndpoint *url_endpoint = replicator_configuration_->getUrlEndpoint();
+        string replicator_key = url_endpoint->getSchema() + "://" + url_endpoint->getHost() + ":" +
+                                to_string(url_endpoint->getPort()) + url_endpoint->getPath();
+        push_debouncer_.configure(replicator_configuration_->getDatabase(), replicator_key,
+                                  replicator_configuration_->getPushDebounceWindow(),
+                                  replicator_configuration_->getPushDebounceDocIdPrefixes());
+        push_debouncer_.restore();
+        replicator_parameters_.pushFilter = &SGReplicator::pushFilter;
 
         if(on_status_changed_callback_ == nullptr){
             addChangeListener([](SGReplicator::ActivityLevel, SGReplicatorProgress progress){
@@ -127,12 +234,17 @@ namespace Strata {
             });
         }
 
-        if(on_document_error_callback_ == nullptr &&
-        replicator_configuration_->getConflictResolutionPolicy() == SGReplicatorConfiguration::ConflictResolutionPolicy::kResolveToRemoteRevision) {
-            addDocumentEndedListener([](bool pushing, std::string doc_id, std::string error_message, bool is_error,
-                                     bool error_is_transient){
-                // placeholder to make sure replicator_parameters_.onDocumentEnded has a callback if the "ResolveToRemoteRevision" policy is selected.
-                // If the "ResolveToRemoteRevision" policy is selected, onDocumentEnded needs to run regardless if addDocumentEndedListener is used by the application or not.
+        if(replicator_parameters_.onDocumentEnded == nullptr) {
+            // onDocumentEnded feeds the replicator stats, the document event queue and the "ResolveToRemoteRevision" policy, so it needs to run regardless if addDocumentEndedListener is used by the application or not.
+            addDocumentEndedListener(nullptr);
+        }
+
+        // Only pushed saves are ever acknowledged
+        stats_collector_.startObserving(replicator_configuration_->getDatabase()->getC4db(),
+                                        replicator_parameters_.push != kC4Disabled);
+        if(stats_sampling_task_ == 0) {
+            stats_sampling_task_ = scheduler_.scheduleEvery(chrono::milliseconds(kStatsSamplingIntervalMs), [this]() {
+                stats_collector_.sample();
             });
         }
 
@@ -147,28 +259,218 @@ namespace Strata {
         if(c4replicator_ == nullptr){
             qC4Critical(logDomainSGReplicator, "Replication failed: %s --", C4ErrorToString(c4error_).c_str());
             internal_status_ = Strata::SGReplicatorInternalStatus::kStopped;
+            C4ReplicatorStatus failed_status {};
+            failed_status.level = kC4Stopped;
+            failed_status.error = c4error_;
+            resolveCompletion(failed_status);
             return SGReplicatorReturnStatus::kInternalError;
         }
 
+        if(priority_lane_enabled_) {
+            _startPriorityLane();
+        }
+
+        {
+            lock_guard<mutex> channel_lock(channel_lock_);
+            if(merge_channels) {
+                _stopChannelLanes();
+                if(restart_channel_update_ != nullptr) {
+                    restart_channel_update_->armed = true;
+                }
+            } else {
+                // Reconnecting: every replicator keeps its channels, and so its checkpoint
+                _restartChannelLanes();
+            }
+        }
+
         internal_status_ = Strata::SGReplicatorInternalStatus::kStarted;
         manual_restart_requested_ = false;
         return SGReplicatorReturnStatus::kNoError;
     }
 
+    void SGReplicator::_startPriorityLane() {
+        if(priority_c4replicator_ != nullptr) {
+            return;
+        }
+
+        // Different filter parameters give the lane its own checkpoint. Sharing the main replicator's one would make
+        // each replicator skip the documents the other one filtered out.
+        Retained<MutableDict> lane_options = replicatorOptions();
+        Retained<MutableDict> filter_params = MutableDict::newDict();
+        filter_params->set(slice("lane"), slice("priority"));
+        lane_options->set(slice(kC4ReplicatorOptionFilterParams), filter_params);
+        Encoder encoder;
+        encoder.writeValue(lane_options);
+        alloc_slice lane_options_data = encoder.finish();
+
+        C4ReplicatorParameters lane_parameters = replicator_parameters_;
+        lane_parameters.pull = kC4Disabled;
+        lane_parameters.optionsDictFleece = lane_options_data;
+        lane_parameters.pushFilter = &SGReplicator::priorityPushFilter;
+        lane_parameters.validationFunc = nullptr;
+        lane_parameters.onStatusChanged = &SGReplicator::onPriorityStatusChanged;
+
+        C4Error c4error {};
+        priority_c4replicator_ = c4repl_new(replicator_configuration_->getDatabase()->getC4db(),
+                                            replicator_configuration_->getUrlEndpoint()->getC4Address(),
+                                            slice(replicator_configuration_->getUrlEndpoint()->getPath()),
+                                            nullptr,
+                                            lane_parameters,
+                                            &c4error
+        );
+        if(priority_c4replicator_ == nullptr) {
+            // High priority documents stay pending until the lane runs again
+            qC4Warning(logDomainSGReplicator, "Priority push lane failed: %s --", C4ErrorToString(c4error).c_str());
+        }
+    }
+
+    bool SGReplicator::pushFilter(C4String docID, C4RevisionFlags flags, FLDict body, void *context) {
+        SGReplicator *ref = (SGReplicator *) context;
+        string doc_id = slice(docID).asString();
+        qC4Debug(logDomainSGReplicator, "pushFilter, Doc ID: %s", doc_id.c_str());
+
+        if(ref->priority_lane_enabled_ && ref->replicator_configuration_->isPriorityDocument(doc_id)) {
+            return false;
+        }
+        return ref->push_debouncer_.shouldPush(doc_id, (flags & kRevDeleted) != 0);
+    }
+
+    bool SGReplicator::priorityPushFilter(C4String docID, C4RevisionFlags flags, FLDict body, void *context) {
+        SGReplicator *ref = (SGReplicator *) context;
+        string doc_id = slice(docID).asString();
+        if(!ref->replicator_configuration_->isPriorityDocument(doc_id)) {
+            return false;
+        }
+        qC4Debug(logDomainSGReplicator, "priorityPushFilter, Doc ID: %s", doc_id.c_str());
+        return ref->push_debouncer_.shouldPush(doc_id, (flags & kRevDeleted) != 0);
+    }
+
+    bool SGReplicator::releaseDebouncedDocuments(const std::vector<std::string> &doc_ids) {
+        SGProfiledLock lock(replicator_lock_, "releaseDebouncedDocuments");
+        if(c4replicator_ == nullptr || internal_status_ != Strata::SGReplicatorInternalStatus::kStarted ||
+           release_c4replicator_ != nullptr) {
+            return false;
+        }
+
+        // Just these documents, from the first sequence: their current revision may be older than any checkpoint.
+        // Revisions the server already has are skipped. Its own filter parameters keep the checkpoints of the other
+        // replicators untouched.
+        Retained<MutableDict> release_options = replicatorOptions();
+        Retained<MutableArray> doc_ids_array = MutableArray::newArray((uint32_t) doc_ids.size());
+        for(unsigned int index = 0; index < doc_ids.size(); index++) {
+            doc_ids_array->set(index, doc_ids[index]);
+        }
+        release_options->set(slice(kC4ReplicatorOptionDocIDs), doc_ids_array);
+        release_options->set(slice(kC4ReplicatorResetCheckpoint), true);
+        Retained<MutableDict> filter_params = MutableDict::newDict();
+        filter_params->set(slice("lane"), slice("debounce"));
+        release_options->set(slice(kC4ReplicatorOptionFilterParams), filter_params);
+        Encoder encoder;
+        encoder.writeValue(release_options);
+        alloc_slice release_options_data = encoder.finish();
+
+        C4ReplicatorParameters release_parameters = replicator_parameters_;
+        release_parameters.push = kC4OneShot;
+        release_parameters.pull = kC4Disabled;
+        release_parameters.optionsDictFleece = release_options_data;
+        release_parameters.pushFilter = nullptr;
+        release_parameters.validationFunc = nullptr;
+        release_parameters.onStatusChanged = &SGReplicator::onReleaseStatusChanged;
+
+        C4Error c4error {};
+        release_c4replicator_ = c4repl_new(replicator_configuration_->getDatabase()->getC4db(),
+                                           replicator_configuration_->getUrlEndpoint()->getC4Address(),
+                                           slice(replicator_configuration_->getUrlEndpoint()->getPath()),
+                                           nullptr,
+                                           release_parameters,
+                                           &c4error
+        );
+        if(release_c4replicator_ == nullptr) {
+            qC4Warning(logDomainSGReplicator, "Debounced documents release failed: %s --", C4ErrorToString(c4error).c_str());
+            return false;
+        }
+        released_doc_ids_ = doc_ids;
+        release_stopped_ = false;
+        qC4Debug(logDomainSGReplicator, "Releasing %zu debounced documents", doc_ids.size());
+        return true;
+    }
+
+    void SGReplicator::onReleaseStatusChanged(C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context) {
+        qC4Debug(logDomainSGReplicator, "onReleaseStatusChanged: %d", replicator_status.level);
+        if(replicator_status.level != kC4Stopped) {
+            return;
+        }
+
+        SGReplicator *ref = (SGReplicator *) context;
+        vector<string> doc_ids;
+        bool pushed;
+        {
+            SGProfiledLock lock(ref->replicator_lock_, "onReleaseStatusChanged");
+            if(ref->release_c4replicator_ != replicator) {
+                return;
+            }
+            c4repl_free(replicator);
+            ref->release_c4replicator_ = nullptr;
+            doc_ids.swap(ref->released_doc_ids_);
+            pushed = replicator_status.error.code == 0 && !ref->release_stopped_;
+        }
+        if(replicator_status.error.code != 0) {
+            qC4Warning(logDomainSGReplicator, "Debounced documents release stopped: %s --", C4ErrorToString(replicator_status.error).c_str());
+        }
+        ref->push_debouncer_.onReleased(doc_ids, pushed);
+    }
+
+    void SGReplicator::onPriorityStatusChanged(C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context) {
+        qC4Debug(logDomainSGReplicator, "onPriorityStatusChanged: %d", replicator_status.level);
+        if(replicator_status.level != kC4Stopped) {
+            return;
+        }
+
+        SGReplicator *ref = (SGReplicator *) context;
+        {
+            SGProfiledLock lock(ref->replicator_lock_, "onPriorityStatusChanged");
+            if(ref->priority_c4replicator_ == replicator) {
+                c4repl_free(replicator);
+                ref->priority_c4replicator_ = nullptr;
+            }
+        }
+
+        if(replicator_status.error.code == 0) {
+            return;
+        }
+        qC4Warning(logDomainSGReplicator, "Priority push lane stopped: %s --", C4ErrorToString(replicator_status.error).c_str());
+        if(ref->replicator_can_restart_ &&
+           ref->getReplicatorConfig()->getReconnectionPolicy() == SGReplicatorConfiguration::ReconnectionPolicy::kAutomaticallyReconnect) {
+            // Only while the main replicator runs, restarting it restarts the lane as well
+            ref->worker_.scheduleAfter(chrono::seconds(ref->getReplicatorConfig()->getReconnectionTimer()), [ref]() {
+                SGProfiledLock lock(ref->replicator_lock_, "priority lane restart");
+                if(ref->c4replicator_ != nullptr && ref->replicator_can_restart_) {
+                    ref->_startPriorityLane();
+                }
+            });
+        }
+    }
+
     void SGReplicator::setReplicatorType(SGReplicatorConfiguration::ReplicatorType replicator_type) {
+        // One-shot replicators stop by themselves once they reach the end of the change feed
+        C4ReplicatorMode mode = kC4Continuous;
+        if(replicator_configuration_ != nullptr &&
+           replicator_configuration_->getReplicatorMode() == SGReplicatorConfiguration::ReplicatorMode::kOneShot) {
+            mode = kC4OneShot;
+        }
 
         switch (replicator_type) {
             case SGReplicatorConfiguration::ReplicatorType::kPushAndPull:
-                replicator_parameters_.push = kC4Continuous;
-                replicator_parameters_.pull = kC4Continuous;
+                replicator_parameters_.push = mode;
+                replicator_parameters_.pull = mode;
                 break;
             case SGReplicatorConfiguration::ReplicatorType::kPush:
-                replicator_parameters_.push = kC4Continuous;
+                replicator_parameters_.push = mode;
                 replicator_parameters_.pull = kC4Disabled;
                 break;
             case SGReplicatorConfiguration::ReplicatorType::kPull:
                 replicator_parameters_.push = kC4Disabled;
-                replicator_parameters_.pull = kC4Continuous;
+                replicator_parameters_.pull = mode;
                 break;
             default:
                 qC4Warning(logDomainSGReplicator, "No replicator type has been provided.");
@@ -183,24 +485,44 @@ namespace Strata {
     void SGReplicator::addChangeListener(const std::function<void(SGReplicator::ActivityLevel, SGReplicatorProgress progress)> &callback) {
         on_status_changed_callback_ = callback;
         replicator_parameters_.onStatusChanged = [](C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context) {
+            SG_TRACE_SPAN("SGReplicator", "onStatusChanged");
             qC4Debug(logDomainSGReplicator, "onStatusChanged: %d", replicator_status.level);
 
             SGReplicator *ref = ((SGReplicator *) context);
             if(ref != nullptr) {
+                ref->watchConnection(replicator_status.level);
+                if(replicator_status.level == kC4Stopped && ref->connection_timed_out_) {
+                    // Stopped by the connect watchdog, this is a failed connection, not an intentional stop
+                    ref->connection_timed_out_ = false;
+                    replicator_status.error = c4error_make(NetworkDomain, kC4NetErrTimeout, slice("Connection timed out"));
+                }
+                ref->stats_collector_.onStatusChanged(replicator_status);
+                ref->checkRestartChannelUpdate(replicator_status);
+                if(replicator_status.level == kC4Stopped && replicator_status.error.domain == WebSocketDomain &&
+                   replicator_status.error.code == kAuthenticationFailedStatus &&
+                   ref->getReplicatorConfig()->getAuthenticator() != nullptr) {
+                    // Stale credentials, e.g an expired session cookie, should not be reused on reconnect
+                    ref->getReplicatorConfig()->getAuthenticator()->authenticationFailed();
+                }
+
+                // Error code == 0 means no errors were found
+                // In that case, do not restart since stopping was intentional
+                bool will_reconnect = replicator_status.level == kC4Stopped &&
+                                      replicator_status.error.code != 0 &&
+                                      ref->replicator_can_restart_ &&
+                                      ref->getReplicatorConfig()->getReconnectionPolicy() == SGReplicatorConfiguration::ReconnectionPolicy::kAutomaticallyReconnect;
+
                 SGReplicatorProgress progress;
                 progress.total = replicator_status.progress.unitsTotal;
                 progress.completed = replicator_status.progress.unitsCompleted;
                 progress.document_count = replicator_status.progress.documentCount;
-                ref->on_status_changed_callback_((SGReplicator::ActivityLevel) replicator_status.level, progress);
+                // A lost connection about to be retried is reported as offline rather than stopped
+                ref->on_status_changed_callback_(will_reconnect ? SGReplicator::ActivityLevel::kOffline : (SGReplicator::ActivityLevel) replicator_status.level, progress);
 
                 if(replicator != nullptr) {
                     if(replicator_status.level == kC4Stopped) {
                         ref->free();
-                        // Error code == 0 means no errors were found
-                        // In that case, do not restart since stopping was intentional
-                        if(replicator_status.error.code != 0 &&
-                           ref->replicator_can_restart_ &&
-                           ref->getReplicatorConfig()->getReconnectionPolicy() == SGReplicatorConfiguration::ReconnectionPolicy::kAutomaticallyReconnect)
+                        if(will_reconnect)
                         {
                             qC4Info(logDomainSGReplicator, "Disconnection detected. Attempting to reconnect in %d seconds...", ref->getReplicatorConfig()->getReconnectionTimer());
                             ref->internal_status_ = Strata::SGReplicatorInternalStatus::kStopped;
@@ -213,6 +535,8 @@ namespace Strata {
                             ref->start();
                         }
                         else {
+                            ref->resolvePushWaiters(replicator_status.error.code != 0 ? C4ErrorToString(replicator_status.error) : "The replicator stopped");
+                            ref->resolveCompletion(replicator_status);
                             ref->internal_status_ = Strata::SGReplicatorInternalStatus::kStopped;   // do not use ref after this point
                         }
                     }
@@ -225,6 +549,263 @@ namespace Strata {
         };
     }
 
+    void SGReplicator::watchConnection(C4ReplicatorActivityLevel level) {
+        lock_guard<mutex> lock(connect_watchdog_lock_);
+        if(level != kC4Connecting) {
+            if(connect_watchdog_task_ != 0) {
+                worker_.cancel(connect_watchdog_task_);
+                connect_watchdog_task_ = 0;
+            }
+            return;
+        }
+
+        unsigned int connect_timeout_sec = replicator_configuration_->getConnectTimeout();
+        if(connect_timeout_sec == 0 || connect_watchdog_task_ != 0) {
+            return;
+        }
+        // On worker_, it waits for replicator_lock_
+        connect_watchdog_task_ = worker_.scheduleAfter(chrono::seconds(connect_timeout_sec), [this, connect_timeout_sec]() {
+            {
+                lock_guard<mutex> watchdog_lock(connect_watchdog_lock_);
+                connect_watchdog_task_ = 0;
+            }
+            SGProfiledLock lock(replicator_lock_, "connect watchdog");
+            if(c4replicator_ != nullptr && c4repl_getStatus(c4replicator_).level == kC4Connecting) {
+                qC4Warning(logDomainSGReplicator, "Could not connect within %u seconds, dropping the connection attempt.", connect_timeout_sec);
+                connection_timed_out_ = true;
+                c4repl_stop(c4replicator_);
+            }
+        });
+    }
+
+    SGReplicatorReturnStatus SGReplicator::updateChannels(const std::vector<std::string> &channels,
+                                                          const std::function<void(const SGChannelUpdate &update)> &callback) {
+        shared_ptr<ChannelLane> lane = make_shared<ChannelLane>();
+        lane->started_at = chrono::steady_clock::now();
+        lane->callback = callback;
+        lane->update.restarted = false;
+        lane->update.is_error = false;
+        lane->update.duration_ms = 0;
+        lane->update.document_count = 0;
+        bool report_now = false;
+        {
+            SGProfiledLock lock(replicator_lock_, "updateChannels");
+            if(replicator_configuration_ == nullptr) {
+                return SGReplicatorReturnStatus::kConfigurationError;
+            }
+
+            set<string> old_channels(replicator_configuration_->getChannels().begin(), replicator_configuration_->getChannels().end());
+            set<string> new_channels(channels.begin(), channels.end());
+            replicator_configuration_->setChannels(channels);
+            if(c4replicator_ == nullptr || internal_status_ != Strata::SGReplicatorInternalStatus::kStarted ||
+               replicator_parameters_.pull == kC4Disabled) {
+                // Picked up by the next start
+                return SGReplicatorReturnStatus::kNoError;
+            }
+
+            set_difference(new_channels.begin(), new_channels.end(), old_channels.begin(), old_channels.end(),
+                           back_inserter(lane->update.added_channels));
+            set_difference(old_channels.begin(), old_channels.end(), new_channels.begin(), new_channels.end(),
+                           back_inserter(lane->update.removed_channels));
+
+            // No channel means all of them, the replicator can only narrow that down with a restart
+            bool needs_restart = base_channels_.empty() && !channels.empty();
+            for(const string &channel : lane->update.removed_channels) {
+                if(find(base_channels_.begin(), base_channels_.end(), channel) != base_channels_.end()) {
+                    needs_restart = true;
+                }
+            }
+
+            lock_guard<mutex> channel_lock(channel_lock_);
+            if(needs_restart) {
+                lane->update.restarted = true;
+                restart_channel_update_ = lane;
+            } else {
+                // A lane pulling a removed channel is replaced, the new lane takes its other channels over
+                lane->channels = lane->update.added_channels;
+                for(const shared_ptr<ChannelLane> &existing_lane : channel_lanes_) {
+                    bool lane_removed = false;
+                    for(const string &channel : existing_lane->channels) {
+                        lane_removed |= new_channels.count(channel) == 0;
+                    }
+                    if(!lane_removed) {
+                        continue;
+                    }
+                    for(const string &channel : existing_lane->channels) {
+                        if(new_channels.count(channel) != 0) {
+                            lane->channels.push_back(channel);
+                        }
+                    }
+                    if(existing_lane->c4replicator != nullptr) {
+                        c4repl_stop(existing_lane->c4replicator);
+                    }
+                    existing_lane->channels.clear();
+                }
+                channel_lanes_.erase(remove_if(channel_lanes_.begin(), channel_lanes_.end(), [](const shared_ptr<ChannelLane> &existing_lane) {
+                    return existing_lane->channels.empty() && existing_lane->c4replicator == nullptr;
+                }), channel_lanes_.end());
+
+                if(lane->channels.empty()) {
+                    report_now = true;
+                } else if(_startChannelLane(lane)) {
+                    channel_lanes_.push_back(lane);
+                } else {
+                    lane->update.is_error = true;
+                    lane->update.error_message = "Could not start the replicator for the new channels";
+                    report_now = true;
+                }
+            }
+        }
+
+        if(lane->update.restarted) {
+            qC4Info(logDomainSGReplicator, "Removed a channel the replicator started with, restarting it.");
+            restart();
+        } else if(report_now && lane->callback) {
+            lane->callback(lane->update);
+        }
+        return lane->update.is_error ? SGReplicatorReturnStatus::kInternalError : SGReplicatorReturnStatus::kNoError;
+    }
+
+    bool SGReplicator::_startChannelLane(const std::shared_ptr<ChannelLane> &lane) {
+        // A replicator with only the new channels: its own checkpoint, the running one's is left alone
+        Retained<MutableDict> lane_options = replicatorOptions();
+        Retained<MutableArray> channels_array = MutableArray::newArray(lane->channels.size());
+        for(unsigned int index = 0; index < lane->channels.size(); index++) {
+            channels_array->set(index, lane->channels[index]);
+        }
+        lane_options->set(slice(kC4ReplicatorOptionChannels), channels_array);
+        Encoder encoder;
+        encoder.writeValue(lane_options);
+        alloc_slice lane_options_data = encoder.finish();
+
+        C4ReplicatorParameters lane_parameters = replicator_parameters_;
+        lane_parameters.push = kC4Disabled;
+        lane_parameters.optionsDictFleece = lane_options_data;
+        lane_parameters.pushFilter = nullptr;
+        lane_parameters.onStatusChanged = &SGReplicator::onChannelLaneStatusChanged;
+
+        C4Error c4error {};
+        lane->c4replicator = c4repl_new(replicator_configuration_->getDatabase()->getC4db(),
+                                        replicator_configuration_->getUrlEndpoint()->getC4Address(),
+                                        slice(replicator_configuration_->getUrlEndpoint()->getPath()),
+                                        nullptr,
+                                        lane_parameters,
+                                        &c4error
+        );
+        if(lane->c4replicator == nullptr) {
+            qC4Warning(logDomainSGReplicator, "Channel lane failed: %s --", C4ErrorToString(c4error).c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void SGReplicator::_restartChannelLanes() {
+        for(const shared_ptr<ChannelLane> &lane : channel_lanes_) {
+            // A lane failing to start is tried again on the next reconnection
+            if(lane->c4replicator == nullptr && !lane->channels.empty()) {
+                _startChannelLane(lane);
+            }
+        }
+    }
+
+    void SGReplicator::_stopChannelLanes() {
+        for(const shared_ptr<ChannelLane> &lane : channel_lanes_) {
+            lane->channels.clear();
+            if(lane->c4replicator != nullptr) {
+                c4repl_stop(lane->c4replicator);
+            }
+        }
+        // Running lanes leave once stopped, see onChannelLaneStatusChanged()
+        channel_lanes_.erase(remove_if(channel_lanes_.begin(), channel_lanes_.end(), [](const shared_ptr<ChannelLane> &lane) {
+            return lane->c4replicator == nullptr;
+        }), channel_lanes_.end());
+    }
+
+    void SGReplicator::onChannelLaneStatusChanged(C4Replicator *replicator, C4ReplicatorStatus replicator_status, void *context) {
+        qC4Debug(logDomainSGReplicator, "onChannelLaneStatusChanged: %d", replicator_status.level);
+        SGReplicator *ref = (SGReplicator *) context;
+        shared_ptr<ChannelLane> lane;
+        bool report = false;
+        bool retry = false;
+        {
+            lock_guard<mutex> lock(ref->channel_lock_);
+            auto iter = find_if(ref->channel_lanes_.begin(), ref->channel_lanes_.end(), [replicator](const shared_ptr<ChannelLane> &channel_lane) {
+                return channel_lane->c4replicator == replicator;
+            });
+            if(iter == ref->channel_lanes_.end()) {
+                return;
+            }
+            lane = *iter;
+
+            // Caught up: idle for a continuous replicator, stopped for a one-shot one
+            bool caught_up = replicator_status.level == kC4Idle ||
+                             (replicator_status.level == kC4Stopped && ref->replicator_parameters_.pull == kC4OneShot);
+            if(!lane->reported && (caught_up || (replicator_status.level == kC4Stopped && replicator_status.error.code != 0))) {
+                lane->reported = true;
+                report = true;
+            }
+
+            if(replicator_status.level == kC4Stopped) {
+                c4repl_free(replicator);
+                lane->c4replicator = nullptr;
+                retry = replicator_status.error.code != 0 && !lane->channels.empty() && ref->replicator_can_restart_ &&
+                        ref->getReplicatorConfig()->getReconnectionPolicy() == SGReplicatorConfiguration::ReconnectionPolicy::kAutomaticallyReconnect;
+                if(!retry) {
+                    ref->channel_lanes_.erase(iter);
+                }
+            }
+        }
+
+        if(report) {
+            reportChannelUpdate(*lane, replicator_status);
+        }
+        if(retry) {
+            qC4Warning(logDomainSGReplicator, "Channel lane stopped: %s --, retrying in %d seconds", C4ErrorToString(replicator_status.error).c_str(), ref->getReplicatorConfig()->getReconnectionTimer());
+            ref->worker_.scheduleAfter(chrono::seconds(ref->getReplicatorConfig()->getReconnectionTimer()), [ref, lane]() {
+                SGProfiledLock lock(ref->replicator_lock_, "channel lane restart");
+                lock_guard<mutex> channel_lock(ref->channel_lock_);
+                auto iter = find(ref->channel_lanes_.begin(), ref->channel_lanes_.end(), lane);
+                if(iter == ref->channel_lanes_.end() || lane->c4replicator != nullptr) {
+                    return;
+                }
+                if(lane->channels.empty()) {
+                    ref->channel_lanes_.erase(iter);
+                } else if(ref->c4replicator_ != nullptr) {
+                    // Tried again on the next reconnection if it fails
+                    ref->_startChannelLane(lane);
+                }
+                // Otherwise the main replicator is reconnecting, it restarts the lane
+            });
+        }
+    }
+
+    void SGReplicator::checkRestartChannelUpdate(const C4ReplicatorStatus &replicator_status) {
+        shared_ptr<ChannelLane> lane;
+        {
+            lock_guard<mutex> lock(channel_lock_);
+            if(restart_channel_update_ == nullptr || !restart_channel_update_->armed ||
+               (replicator_status.level != kC4Idle && replicator_status.level != kC4Stopped)) {
+                return;
+            }
+            lane.swap(restart_channel_update_);
+        }
+        reportChannelUpdate(*lane, replicator_status);
+    }
+
+    void SGReplicator::reportChannelUpdate(ChannelLane &lane, const C4ReplicatorStatus &replicator_status) {
+        lane.update.duration_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - lane.started_at).count();
+        lane.update.document_count = replicator_status.progress.documentCount;
+        lane.update.is_error = replicator_status.error.code != 0;
+        if(lane.update.is_error) {
+            lane.update.error_message = C4ErrorToString(replicator_status.error);
+        }
+        qC4Info(logDomainSGReplicator, "Channel update %s in %llu ms, %llu documents pulled", lane.update.is_error ? "failed" : "caught up",
+                (unsigned long long) lane.update.duration_ms, (unsigned long long) lane.update.document_count);
+        if(lane.callback) {
+            lane.callback(lane.update);
+        }
+    }
+
     void SGReplicator::restart() {
         if(internal_status_ == Strata::SGReplicatorInternalStatus::kStopped) {
             start();
@@ -235,7 +816,7 @@ namespace Strata {
     }
 
     void SGReplicator::free() {
-        lock_guard<mutex> lock(replicator_lock_);
+        SGProfiledLock lock(replicator_lock_, "free");
         if(c4replicator_ != nullptr) {
             c4repl_free(c4replicator_);
             c4replicator_ = nullptr;
@@ -253,7 +834,8 @@ namespace Strata {
         }
 
         qC4Info(logDomainSGReplicator, "Attempting to reconnect now.");
-        return this->start();
+        stats_collector_.onReconnect();
+        return startReplicator(false);
     }
 
     void SGReplicator::addDocumentEndedListener(
@@ -268,6 +850,14 @@ namespace Strata {
                                                     C4Error error,
                                                     bool errorIsTransient,
                                                     void *context) {
+            SG_TRACE_SPAN("SGReplicator", "onDocumentEnded");
+
+            ((SGReplicator *) context)->stats_collector_.onDocumentEnded(pushing, docID, error);
+            if(pushing) {
+                ((SGReplicator *) context)->onDocumentPushed(slice(docID).asString(), revID, error, errorIsTransient);
+            } else {
+                ((SGReplicator *) context)->onRevisionPulled(slice(docID).asString(), revID, error);
+            }
 
             if(flags == kRevIsConflict &&
             ((SGReplicator *) context)->getReplicatorConfig()->getConflictResolutionPolicy() == SGReplicatorConfiguration::ConflictResolutionPolicy::kResolveToRemoteRevision) {
@@ -308,21 +898,75 @@ namespace Strata {
 
                 qC4Info(logDomainSGReplicator, "Resolved conflict in document '%s' to the remote revision.", slice(docID).asString().c_str());
             }
-            ((SGReplicator *) context)->on_document_error_callback_(pushing, slice(docID).asString(),
-                                                                    C4ErrorToString(error), error.code > 0,
-                                                                    errorIsTransient);
+            SGDocumentEventQueue *document_event_queue = ((SGReplicator *) context)->document_event_queue_;
+            if(document_event_queue) {
+                document_event_queue->push(pushing, docID, error, errorIsTransient);
+            }
+
+            if(((SGReplicator *) context)->on_document_error_callback_) {
+                ((SGReplicator *) context)->on_document_error_callback_(pushing, slice(docID).asString(),
+                                                                        C4ErrorToString(error), error.code > 0,
+                                                                        errorIsTransient);
+            }
         };
     }
 
+    void SGReplicator::addBlobProgressListener(const std::function<void(const SGBlobProgress &progress)> &callback) {
+        on_blob_progress_callback_ = callback;
+        replicator_parameters_.onBlobProgress = [](C4Replicator *C4NONNULL,
+                                                   bool pushing,
+                                                   C4String docID,
+                                                   C4String docProperty,
+                                                   C4BlobKey blobKey,
+                                                   uint64_t bytesComplete,
+                                                   uint64_t bytesTotal,
+                                                   C4Error error,
+                                                   void *context) {
+            SG_TRACE_SPAN("SGReplicator", "onBlobProgress");
+            SGReplicator *ref = (SGReplicator *) context;
+            if(!ref->on_blob_progress_callback_) {
+                return;
+            }
+
+            SGBlobProgress progress;
+            progress.pushing = pushing;
+            progress.doc_id = slice(docID).asString();
+            progress.property = slice(docProperty).asString();
+            progress.digest = alloc_slice(c4blob_keyToString(blobKey)).asString();
+            progress.bytes_completed = bytesComplete;
+            progress.bytes_total = bytesTotal;
+            progress.is_error = error.code != 0;
+            if(progress.is_error) {
+                progress.error_message = C4ErrorToString(error);
+            }
+            ref->on_blob_progress_callback_(progress);
+        };
+    }
+
+    void SGReplicator::setDocumentEventQueue(SGDocumentEventQueue *document_event_queue) {
+        document_event_queue_ = document_event_queue;
+    }
+
+    void SGReplicator::setRevisionPipeline(SGRevisionPipeline *revision_pipeline) {
+        revision_pipeline_ = revision_pipeline;
+    }
+
     void SGReplicator::addValidationListener(
             const std::function<void(const std::string &doc_id, const std::string &json_body)> &callback) {
         on_validation_callback_ = callback;
         qC4Debug(logDomainSGReplicator, "addValidationListener");
-        replicator_parameters_.validationFunc = [](C4String docID, C4RevisionFlags ref, FLDict body, void *context) {
+        replicator_parameters_.validationFunc = [](C4String docID, C4RevisionFlags flags, FLDict body, void *context) {
+            SG_TRACE_SPAN("SGReplicator", "validationFunc");
             qC4Debug(logDomainSGReplicator, "validationFunc");
 
-            alloc_slice fleece_json_string = FLValue_ToJSON((FLValue) body);
-            ((SGReplicator *) context)->on_validation_callback_(slice(docID).asString(), fleece_json_string.asString());
+            SGReplicator *ref = (SGReplicator *) context;
+            if(ref->revision_pipeline_ == nullptr) {
+                SGTraceSpan json_span("SGReplicator", "fleece to JSON");
+                alloc_slice fleece_json_string = FLValue_ToJSON((FLValue) body);
+                json_span.end();
+                ref->on_validation_callback_(slice(docID).asString(), fleece_json_string.asString());
+            }
+            // Otherwise onRevisionPulled() hands the revision to the pipeline once it's saved
 
             // Accept All documents
             return true;
@@ -337,7 +981,332 @@ namespace Strata {
         return os << static_cast<underlying_type<SGReplicator::ActivityLevel>::type> (activity_level);
     }
 
+    bool SGReplicator::needsDocumentNotifications() {
+        return replicator_parameters_.push != kC4Disabled ||
+               on_document_error_callback_ ||
+               document_event_queue_ != nullptr ||
+               revision_pipeline_ != nullptr ||
+               replicator_configuration_->getConflictResolutionPolicy() ==
+               SGReplicatorConfiguration::ConflictResolutionPolicy::kResolveToRemoteRevision;
+    }
+
+    fleece::Retained<fleece::impl::MutableDict> SGReplicator::replicatorOptions() {
+        SGReplicatorConfiguration::SyncProfile sync_profile = initial_sync_ ?
+                SGReplicatorConfiguration::SyncProfile::kInitialSync : SGReplicatorConfiguration::SyncProfile::kDefaultProfile;
+        Retained<MutableDict> configuration_options = replicator_configuration_->effectiveOptions(sync_profile, needsDocumentNotifications());
+        // Copy, the configuration keeps its own channels and progress level
+        Retained<MutableDict> options = MutableDict::newDict(configuration_options);
+        // The configured channels may include the ones of the channel lanes, see updateChannels()
+        if(base_channels_.empty()) {
+            options->remove(slice(kC4ReplicatorOptionChannels));
+        } else {
+            Retained<MutableArray> channels_array = MutableArray::newArray((uint32_t) base_channels_.size());
+            for(unsigned int index = 0; index < base_channels_.size(); index++) {
+                channels_array->set(index, base_channels_[index]);
+            }
+            options->set(slice(kC4ReplicatorOptionChannels), channels_array);
+        }
+        if(on_blob_progress_callback_ && !initial_sync_) {
+            options->set(slice(kC4ReplicatorOptionProgressLevel), kBlobProgressLevel);
+        }
+        return options;
+    }
+
     SGReplicatorConfiguration* SGReplicator::getReplicatorConfig() {
         return replicator_configuration_;
     }
+
+    std::shared_future<SGReplicatorCompletion> SGReplicator::getCompletion() {
+        lock_guard<mutex> lock(completion_lock_);
+        if(!completion_pending_) {
+            completion_promise_ = promise<SGReplicatorCompletion>();
+            completion_future_ = completion_promise_.get_future().share();
+            completion_pending_ = true;
+        }
+        return completion_future_;
+    }
+
+    void SGReplicator::resolveCompletion(const C4ReplicatorStatus &replicator_status) {
+        lock_guard<mutex> lock(completion_lock_);
+        if(!completion_pending_) {
+            return;
+        }
+
+        SGReplicatorCompletion completion;
+        completion.is_error = replicator_status.error.code != 0;
+        if(completion.is_error) {
+            completion.error_message = C4ErrorToString(replicator_status.error);
+        }
+        completion.progress.total = replicator_status.progress.unitsTotal;
+        completion.progress.completed = replicator_status.progress.unitsCompleted;
+        completion.progress.document_count = replicator_status.progress.documentCount;
+
+        completion_promise_.set_value(completion);
+        completion_pending_ = false;
+    }
+
+    uint64_t SGReplicator::_getPendingPushCount() {
+        return _getPendingDocumentIds().size();
+    }
+
+    std::vector<std::string> SGReplicator::_getPendingDocumentIds() {
+        if(c4replicator_ == nullptr || replicator_parameters_.push == kC4Disabled) {
+            return vector<string>();
+        }
+
+        set<string> pending_documents;
+        C4Replicator *replicators[] = {c4replicator_, priority_c4replicator_};
+        for(C4Replicator *replicator : replicators) {
+            if(replicator == nullptr) {
+                continue;
+            }
+            alloc_slice pending_doc_ids = c4repl_getPendingDocIDs(replicator, &c4error_);
+            if(!pending_doc_ids) {
+                if(c4error_.code != 0) {
+                    qC4Warning(logDomainSGReplicator, "c4repl_getPendingDocIDs Error: %s --", C4ErrorToString(c4error_).c_str());
+                }
+                continue;
+            }
+
+            const Value *value = Value::fromData(pending_doc_ids);
+            const Array *doc_ids = value ? value->asArray() : nullptr;
+            for(uint32_t i = 0; doc_ids != nullptr && i < doc_ids->count(); ++i) {
+                string doc_id = doc_ids->get(i)->asString().asString();
+                // Each replicator may list the other one's documents, only trust the one pushing the document
+                bool priority_document = priority_c4replicator_ != nullptr && replicator_configuration_->isPriorityDocument(doc_id);
+                if(priority_document == (replicator == priority_c4replicator_)) {
+                    pending_documents.insert(doc_id);
+                }
+            }
+        }
+
+        // Held back revisions were filtered out, LiteCore doesn't know they are still to be pushed
+        for(const string &doc_id : push_debouncer_.getPendingDocumentIds()) {
+            pending_documents.insert(doc_id);
+        }
+        return vector<string>(pending_documents.begin(), pending_documents.end());
+    }
+
+    bool SGReplicator::_isDocumentPending(const std::string &doc_id) {
+        if(c4replicator_ == nullptr || replicator_parameters_.push == kC4Disabled) {
+            return false;
+        }
+        if(push_debouncer_.isPending(doc_id)) {
+            return true;
+        }
+
+        bool priority_document = priority_c4replicator_ != nullptr && replicator_configuration_->isPriorityDocument(doc_id);
+        C4Error c4error {};
+        bool pending = c4repl_isDocumentPending(priority_document ? priority_c4replicator_ : c4replicator_,
+                                                slice(doc_id), &c4error);
+        if(c4error.code != 0) {
+            qC4Warning(logDomainSGReplicator, "c4repl_isDocumentPending Error: %s --", C4ErrorToString(c4error).c_str());
+        }
+        return pending;
+    }
+
+    std::vector<std::string> SGReplicator::getPendingDocumentIds() {
+        SGProfiledLock lock(replicator_lock_, "getPendingDocumentIds");
+        return _getPendingDocumentIds();
+    }
+
+    bool SGReplicator::isDocumentPending(const std::string &doc_id) {
+        SGProfiledLock lock(replicator_lock_, "isDocumentPending");
+        return _isDocumentPending(doc_id);
+    }
+
+    std::shared_future<SGPushCompletion> SGReplicator::waitForPush(const std::string &doc_id,
+                                                                   const std::chrono::milliseconds &timeout) {
+        shared_ptr<PushWaiter> waiter = make_shared<PushWaiter>();
+        waiter->deadline = chrono::steady_clock::now() + timeout;
+        shared_future<SGPushCompletion> push_future = waiter->promise.get_future().share();
+        if(replicator_configuration_ == nullptr ||
+           replicator_configuration_->getReplicatorType() == SGReplicatorConfiguration::ReplicatorType::kPull) {
+            // Nothing will ever push it, _isDocumentPending() would report it as pushed
+            waiter->promise.set_value(SGPushCompletion {false, false, "The replicator doesn't push"});
+            return push_future;
+        }
+        if(replicator_configuration_->getDatabase() != nullptr) {
+            SGDocument document(replicator_configuration_->getDatabase(), doc_id);
+            waiter->generation = revisionGeneration(document.getRevision());
+        }
+
+        // Registered before checking, so a push ending in between isn't missed
+        {
+            lock_guard<mutex> lock(push_waiters_lock_);
+            push_waiters_.insert(make_pair(doc_id, waiter));
+            if(push_waiters_task_ == 0) {
+                push_waiters_task_ = scheduler_.scheduleEvery(chrono::milliseconds(kPushWaiterCheckIntervalMs), [this]() {
+                    expirePushWaiters();
+                });
+            }
+        }
+
+        bool pending;
+        {
+            SGProfiledLock lock(replicator_lock_, "waitForPush");
+            // A running pull-only replicator, configured to push since, pushes after the next start()
+            pending = c4replicator_ == nullptr || replicator_parameters_.push == kC4Disabled || _isDocumentPending(doc_id);
+        }
+        if(!pending) {
+            bool registered = false;
+            {
+                lock_guard<mutex> lock(push_waiters_lock_);
+                auto range = push_waiters_.equal_range(doc_id);
+                for(auto iter = range.first; iter != range.second; ++iter) {
+                    if(iter->second == waiter) {
+                        push_waiters_.erase(iter);
+                        registered = true;
+                        break;
+                    }
+                }
+            }
+            if(registered) {
+                waiter->promise.set_value(SGPushCompletion {true, false, string()});
+            }
+        }
+        return push_future;
+    }
+
+    void SGReplicator::onDocumentPushed(const std::string &doc_id, C4String rev_id, const C4Error &error,
+                                        bool error_is_transient) {
+        if(error.code != 0 && error_is_transient) {
+            // LiteCore retries it
+            return;
+        }
+
+        unsigned generation = revisionGeneration(slice(rev_id).asString());
+        vector<shared_ptr<PushWaiter>> resolved;
+        {
+            lock_guard<mutex> lock(push_waiters_lock_);
+            auto range = push_waiters_.equal_range(doc_id);
+            for(auto iter = range.first; iter != range.second;) {
+                if(iter->second->generation <= generation) {
+                    resolved.push_back(iter->second);
+                    iter = push_waiters_.erase(iter);
+                } else {
+                    ++iter;
+                }
+            }
+        }
+
+        SGPushCompletion completion {error.code == 0, false, error.code == 0 ? string() : C4ErrorToString(error)};
+        for(const shared_ptr<PushWaiter> &waiter : resolved) {
+            waiter->promise.set_value(completion);
+        }
+    }
+
+    void SGReplicator::onRevisionPulled(const std::string &doc_id, C4String rev_id, const C4Error &error) {
+        SGRevisionPipeline *revision_pipeline = revision_pipeline_;
+        function<void(const string &doc_id, const string &json_body)> callback = on_validation_callback_;
+        if(revision_pipeline == nullptr || !callback) {
+            return;
+        }
+        if(error.code != 0) {
+            // Not saved. LiteCore validates it again if it retries.
+            qC4Info(logDomainSGReplicator, "Revision of '%s' not saved, skipping its handler: %s", doc_id.c_str(), C4ErrorToString(error).c_str());
+            return;
+        }
+
+        // The revision LiteCore just saved, by its revID: a later one may already be current
+        SGTraceSpan load_span("SGReplicator", "load pulled revision");
+        C4Database *db = getReplicatorConfig()->getDatabase()->getC4db();
+        C4Error c4error {};
+        C4Document *doc = c4doc_get(db, slice(doc_id), true, &c4error);
+        if(doc == nullptr) {
+            qC4Warning(logDomainSGReplicator, "Pulled document '%s' not found, skipping its handler: %s", doc_id.c_str(), C4ErrorToString(c4error).c_str());
+            return;
+        }
+        alloc_slice json_body;
+        if(c4doc_selectRevision(doc, rev_id, true, &c4error)) {
+            json_body = c4doc_bodyAsJSON(doc, false, &c4error);
+        }
+        c4doc_free(doc);
+        load_span.end();
+        if(!json_body) {
+            qC4Warning(logDomainSGReplicator, "Revision %.*s of '%s' not loaded, skipping its handler: %s", (int) rev_id.size, (const char *) rev_id.buf, doc_id.c_str(), C4ErrorToString(c4error).c_str());
+            return;
+        }
+
+        string json_string = json_body.asString();
+        if(!revision_pipeline->submit(doc_id, [callback, doc_id, json_string]() {
+            callback(doc_id, json_string);
+        }, doc_id.size() + json_string.size())) {
+            qC4Warning(logDomainSGReplicator, "Revision pipeline stopped, handling '%s' on the replicator thread", doc_id.c_str());
+            callback(doc_id, json_string);
+        }
+    }
+
+    void SGReplicator::expirePushWaiters() {
+        vector<shared_ptr<PushWaiter>> expired;
+        {
+            lock_guard<mutex> lock(push_waiters_lock_);
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            for(auto iter = push_waiters_.begin(); iter != push_waiters_.end();) {
+                if(iter->second->deadline <= now) {
+                    expired.push_back(iter->second);
+                    iter = push_waiters_.erase(iter);
+                } else {
+                    ++iter;
+                }
+            }
+            if(push_waiters_.empty() && push_waiters_task_ != 0) {
+                scheduler_.cancel(push_waiters_task_);
+                push_waiters_task_ = 0;
+            }
+        }
+
+        for(const shared_ptr<PushWaiter> &waiter : expired) {
+            waiter->promise.set_value(SGPushCompletion {false, true, string()});
+        }
+    }
+
+    void SGReplicator::resolvePushWaiters(const std::string &error_message) {
+        unordered_multimap<string, shared_ptr<PushWaiter>> push_waiters;
+        {
+            lock_guard<mutex> lock(push_waiters_lock_);
+            push_waiters.swap(push_waiters_);
+        }
+
+        for(const auto &entry : push_waiters) {
+            entry.second->promise.set_value(SGPushCompletion {false, false, error_message});
+        }
+    }
+
+    void SGReplicator::setLockProfilingEnabled(bool enabled) {
+        replicator_lock_.setProfilingEnabled(enabled);
+    }
+
+    SGLockStats SGReplicator::getLockStats() const {
+        return replicator_lock_.getStats();
+    }
+
+    SGReplicatorStats SGReplicator::getStats() {
+        SGReplicatorStats stats = stats_collector_.snapshot();
+        if(replicator_configuration_ != nullptr) {
+            SGBandwidthLimiter *bandwidth_limiter = replicator_configuration_->getBandwidthLimiter();
+            stats.upload_throttle_time_ms = bandwidth_limiter->getThrottleTimeMs(SGBandwidthLimiter::Direction::kUpload);
+            stats.download_throttle_time_ms = bandwidth_limiter->getThrottleTimeMs(SGBandwidthLimiter::Direction::kDownload);
+        }
+        SGProfiledLock lock(replicator_lock_, "getStats");
+        stats.pending_push_count = _getPendingPushCount();
+        return stats;
+    }
+
+    void SGReplicator::addStatsListener(const std::function<void(const SGReplicatorStats &stats)> &callback,
+                                        const std::chrono::milliseconds &interval) {
+        if(stats_listener_task_ != 0) {
+            listener_scheduler_.cancel(stats_listener_task_);
+            stats_listener_task_ = 0;
+        }
+
+        on_stats_callback_ = callback;
+        if(on_stats_callback_ == nullptr) {
+            return;
+        }
+
+        stats_listener_task_ = listener_scheduler_.scheduleEvery(interval, [this]() {
+            on_stats_callback_(getStats());
+        });
+    }
 }
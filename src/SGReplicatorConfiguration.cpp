@@ -32,6 +32,7 @@ namespace Strata {
     SGReplicatorConfiguration::SGReplicatorConfiguration() {
         replicator_type_ = ReplicatorType::kPull;
         options_ = fleece::impl::MutableDict::newDict();
+        bandwidth_limiter_ = SGBandwidthLimiter::create();
     }
 
     SGReplicatorConfiguration::~SGReplicatorConfiguration() {}
@@ -66,6 +67,23 @@ namespace Strata {
         replicator_type_ = replicator_type;
     }
 
+    SGReplicatorConfiguration::ReplicatorMode SGReplicatorConfiguration::getReplicatorMode() const {
+        // An initial sync has to end, whatever the mode says
+        return sync_profile_ == SyncProfile::kInitialSync ? ReplicatorMode::kOneShot : replicator_mode_;
+    }
+
+    void SGReplicatorConfiguration::setReplicatorMode(SGReplicatorConfiguration::ReplicatorMode replicator_mode) {
+        replicator_mode_ = replicator_mode;
+    }
+
+    SGReplicatorConfiguration::SyncProfile SGReplicatorConfiguration::getSyncProfile() const {
+        return sync_profile_;
+    }
+
+    void SGReplicatorConfiguration::setSyncProfile(SGReplicatorConfiguration::SyncProfile sync_profile) {
+        sync_profile_ = sync_profile;
+    }
+
     void SGReplicatorConfiguration::setAuthenticator(SGAuthenticator *authenticator) {
         authenticator_ = authenticator;
     }
@@ -74,12 +92,28 @@ namespace Strata {
         return authenticator_;
     }
 
+    SGAuthenticator *SGReplicatorConfiguration::getAuthenticator() {
+        return authenticator_;
+    }
+
+    void SGReplicatorConfiguration::setSocketFactory(SGSocketFactory *socket_factory) {
+        socket_factory_ = socket_factory;
+    }
+
+    SGSocketFactory *SGReplicatorConfiguration::getSocketFactory() const {
+        return socket_factory_;
+    }
+
     void SGReplicatorConfiguration::setChannels(const std::vector<std::string> &channels) {
         // Pass vector channels by copy!
         channels_ = channels;
     }
 
-    fleece::Retained<fleece::impl::MutableDict> SGReplicatorConfiguration::effectiveOptions() {
+    const std::vector<std::string> &SGReplicatorConfiguration::getChannels() const {
+        return channels_;
+    }
+
+    fleece::Retained<fleece::impl::MutableDict> SGReplicatorConfiguration::effectiveOptions(SyncProfile sync_profile, bool document_notifications) {
 
         if (authenticator_ != nullptr) {
             // This will add authentication options to the fleece dictionary.
@@ -87,8 +121,39 @@ namespace Strata {
         }
         // Here we can process more options and add it to options_
 
-        // If >=1, notify on every doc; if >=2, on every attachment (int)
-        options_->set(slice(kC4ReplicatorOptionProgressLevel), kNotifyOnEveryDocumentChange);
+        if (sync_profile == SyncProfile::kInitialSync) {
+            // A new node has nothing to delete and only cares about the end of the catch-up.
+            // Per document notifications and frequent checkpoints cost more than they are worth here.
+            options_->set(slice(kC4ReplicatorOptionProgressLevel),
+                          document_notifications ? kNotifyOnEveryDocumentChange : kNotifyOnCompletionOnly);
+            options_->set(slice(kC4ReplicatorOptionSkipDeleted), true);
+            options_->set(slice(kC4ReplicatorCheckpointInterval), kInitialSyncCheckpointIntervalSec);
+        } else {
+            // If >=1, notify on every doc; if >=2, on every attachment (int)
+            options_->set(slice(kC4ReplicatorOptionProgressLevel), kNotifyOnEveryDocumentChange);
+            options_->remove(slice(kC4ReplicatorOptionSkipDeleted));
+            options_->remove(slice(kC4ReplicatorCheckpointInterval));
+        }
+
+        // Dead connection detection. LiteCore sends the heartbeats of its own transport, the SG socket factories
+        // read all three options.
+        if (heartbeat_interval_sec_ > 0) {
+            options_->set(slice(kC4ReplicatorHeartbeatInterval), heartbeat_interval_sec_);
+        } else {
+            options_->remove(slice(kC4ReplicatorHeartbeatInterval));
+        }
+        if (idle_timeout_sec_ > 0) {
+            options_->set(slice(SGSocketFactory::kOptionIdleTimeout), idle_timeout_sec_);
+        } else {
+            options_->remove(slice(SGSocketFactory::kOptionIdleTimeout));
+        }
+        if (connect_timeout_sec_ > 0) {
+            options_->set(slice(SGSocketFactory::kOptionConnectTimeout), connect_timeout_sec_);
+        } else {
+            options_->remove(slice(SGSocketFactory::kOptionConnectTimeout));
+        }
+        // The limits themselves can change later, the socket factories look the limiter up by ID
+        options_->set(slice(SGSocketFactory::kOptionBandwidthLimiter), bandwidth_limiter_->getId());
 
         // Get all channels name to be filtered by the pull replicator
         if (!channels_.empty()) {
@@ -99,6 +164,8 @@ namespace Strata {
             }
             options_->set(slice(kC4ReplicatorOptionChannels), channels_array);
 
+        } else {
+            options_->remove(slice(kC4ReplicatorOptionChannels));
         }
 
         return options_;
@@ -122,6 +189,10 @@ namespace Strata {
         return os << static_cast<underlying_type<SGReplicatorConfiguration::ReplicatorType>::type> (rep_type);
     }
 
+    std::ostream& operator << (std::ostream& os, const SGReplicatorConfiguration::ReplicatorMode& rep_mode){
+        return os << static_cast<underlying_type<SGReplicatorConfiguration::ReplicatorMode>::type> (rep_mode);
+    }
+
     void SGReplicatorConfiguration::setConflictResolutionPolicy(const ConflictResolutionPolicy &policy) {
         conflict_resolution_policy_ = policy;
     }
@@ -145,4 +216,76 @@ namespace Strata {
     int SGReplicatorConfiguration::getReconnectionTimer() {
         return reconnection_timer_sec_;
     }    
+
+    void SGReplicatorConfiguration::setHeartbeatInterval(const unsigned int &heartbeat_interval_sec) {
+        heartbeat_interval_sec_ = heartbeat_interval_sec;
+    }
+
+    unsigned int SGReplicatorConfiguration::getHeartbeatInterval() const {
+        return heartbeat_interval_sec_;
+    }
+
+    void SGReplicatorConfiguration::setIdleTimeout(const unsigned int &idle_timeout_sec) {
+        idle_timeout_sec_ = idle_timeout_sec;
+    }
+
+    unsigned int SGReplicatorConfiguration::getIdleTimeout() const {
+        return idle_timeout_sec_;
+    }
+
+    void SGReplicatorConfiguration::setConnectTimeout(const unsigned int &connect_timeout_sec) {
+        connect_timeout_sec_ = connect_timeout_sec;
+    }
+
+    unsigned int SGReplicatorConfiguration::getConnectTimeout() const {
+        return connect_timeout_sec_;
+    }
+
+    void SGReplicatorConfiguration::setPushDebounce(const std::chrono::milliseconds &window,
+                                                    const std::vector<std::string> &doc_id_prefixes) {
+        push_debounce_window_ = window;
+        push_debounce_doc_id_prefixes_ = doc_id_prefixes;
+    }
+
+    std::chrono::milliseconds SGReplicatorConfiguration::getPushDebounceWindow() const {
+        return push_debounce_window_;
+    }
+
+    const std::vector<std::string> &SGReplicatorConfiguration::getPushDebounceDocIdPrefixes() const {
+        return push_debounce_doc_id_prefixes_;
+    }
+
+    void SGReplicatorConfiguration::setPriorityDocIdPrefixes(const std::vector<std::string> &doc_id_prefixes) {
+        priority_doc_id_prefixes_ = doc_id_prefixes;
+    }
+
+    const std::vector<std::string> &SGReplicatorConfiguration::getPriorityDocIdPrefixes() const {
+        return priority_doc_id_prefixes_;
+    }
+
+    void SGReplicatorConfiguration::setPriorityFilter(const std::function<bool(const std::string &doc_id)> &priority_filter) {
+        priority_filter_ = priority_filter;
+    }
+
+    bool SGReplicatorConfiguration::hasPriorityLane() const {
+        return !priority_doc_id_prefixes_.empty() || priority_filter_ != nullptr;
+    }
+
+    bool SGReplicatorConfiguration::isPriorityDocument(const std::string &doc_id) const {
+        for (const string &prefix : priority_doc_id_prefixes_) {
+            if (doc_id.compare(0, prefix.size(), prefix) == 0) {
+                return true;
+            }
+        }
+        return priority_filter_ != nullptr && priority_filter_(doc_id);
+    }
+
+    void SGReplicatorConfiguration::setBandwidthLimit(uint64_t upload_bytes_per_second,
+                                                      uint64_t download_bytes_per_second, uint64_t burst_bytes) {
+        bandwidth_limiter_->setLimits(upload_bytes_per_second, download_bytes_per_second, burst_bytes);
+    }
+
+    SGBandwidthLimiter *SGReplicatorConfiguration::getBandwidthLimiter() const {
+        return bandwidth_limiter_.get();
+    }
 }
@@ -0,0 +1,559 @@
+//
+//  SGReplicatorListener.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include <civetweb/civetweb.h>
+
+#include "SGReplicatorListener.h"
+#include "SGUtility.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    const uint16_t SGReplicatorListener::kDefaultPort;
+    const unsigned SGReplicatorListener::kDefaultMaxConnections;
+    constexpr const char *SGReplicatorListener::kDefaultNetworkInterface;
+    const size_t SGReplicatorListener::kMaxUnreadBytes;
+    const unsigned SGReplicatorListener::kSpareServerThreads;
+    const unsigned SGReplicatorListener::kWebSocketTimeoutMs;
+    const unsigned SGReplicatorListener::kStopTimeoutMs;
+
+    // WebSocket sub-protocol spoken by the LiteCore replicator.
+    static char kBLIPProtocol[] = "BLIP_3+CBMobile_2";
+    static char *kSubprotocolList[] = {kBLIPProtocol};
+    static mg_websocket_subprotocols kSubprotocols = {1, kSubprotocolList};
+
+    // The FIN bit of a websocket frame, civetweb passes it along with the opcode.
+    static const int kWebSocketFinalFragment = 0x80;
+
+    std::ostream& operator << (std::ostream& os, const SGReplicatorListenerReturnStatus& return_status){
+        return os << static_cast<underlying_type<SGReplicatorListenerReturnStatus>::type> (return_status);
+    }
+
+    SGReplicatorListener::SGReplicatorListener(SGDatabase *database, uint16_t port)
+            : SGSocketFactory(kC4NoFraming), database_(database), port_(port) {}
+
+    SGReplicatorListener::~SGReplicatorListener() {
+        stop();
+    }
+
+    void SGReplicatorListener::setMaxConnections(unsigned max_connections) {
+        max_connections_ = max_connections;
+    }
+
+    unsigned SGReplicatorListener::getMaxConnections() const {
+        return max_connections_;
+    }
+
+    void SGReplicatorListener::setNetworkInterface(const std::string &ip_address) {
+        network_interface_ = ip_address;
+    }
+
+    void SGReplicatorListener::setCredentials(const std::string &username, const std::string &password) {
+        // Same header as LiteCore sends for an SGBasicAuthenticator
+        authorization_ = username.empty() ? string() : "Basic " + Base64Encode(username + ":" + password);
+    }
+
+    void SGReplicatorListener::setAllowedPeers(const std::vector<std::string> &ip_addresses) {
+        allowed_peers_ = ip_addresses;
+    }
+
+    void SGReplicatorListener::setReadOnly(bool read_only) {
+        read_only_ = read_only;
+    }
+
+    bool SGReplicatorListener::isLoopback() const {
+        return network_interface_ == "127.0.0.1" || network_interface_ == "::1" || network_interface_ == "[::1]" ||
+               network_interface_ == "localhost";
+    }
+
+    bool SGReplicatorListener::isAuthorized(const mg_connection *connection) const {
+        const mg_request_info *request_info = mg_get_request_info(connection);
+        if (!allowed_peers_.empty() &&
+            find(allowed_peers_.begin(), allowed_peers_.end(), string(request_info->remote_addr)) == allowed_peers_.end()) {
+            return false;
+        }
+        if (authorization_.empty()) {
+            return true;
+        }
+        const char *authorization = mg_get_header(connection, "Authorization");
+        if (authorization == nullptr || strlen(authorization) != authorization_.size()) {
+            return false;
+        }
+        // Compares every byte, so the time taken doesn't tell how much of the header matched
+        unsigned char difference = 0;
+        for (size_t index = 0; index < authorization_.size(); ++index) {
+            difference |= (unsigned char) (authorization[index] ^ authorization_[index]);
+        }
+        return difference == 0;
+    }
+
+    uint16_t SGReplicatorListener::getPort() const {
+        return port_;
+    }
+
+    std::string SGReplicatorListener::getPath() const {
+        return "/" + database_->getDBName() + "/_blipsync";
+    }
+
+    SGReplicatorListenerReturnStatus SGReplicatorListener::start() {
+        lock_guard<mutex> lock(listener_lock_);
+        if (context_ != nullptr) {
+            return SGReplicatorListenerReturnStatus::kAlreadyRunning;
+        }
+        if (database_ == nullptr || !database_->isOpen() || max_connections_ == 0) {
+            return SGReplicatorListenerReturnStatus::kConfigurationError;
+        }
+        if (!isLoopback() && authorization_.empty() && allowed_peers_.empty()) {
+            qC4Critical(logDomainSGReplicator, "Refusing to share the database on '%s' with anybody: set credentials or allowed peers", network_interface_.c_str());
+            return SGReplicatorListenerReturnStatus::kConfigurationError;
+        }
+
+        // Every websocket connection keeps a civetweb thread busy for its whole life.
+        string listening_ports = to_string(port_);
+        if (!network_interface_.empty()) {
+            listening_ports = network_interface_ + ":" + listening_ports;
+        }
+        string num_threads = to_string(max_connections_ + kSpareServerThreads);
+        string websocket_timeout = to_string(kWebSocketTimeoutMs);
+        const char *options[] = {
+            "listening_ports", listening_ports.c_str(),
+            "num_threads", num_threads.c_str(),
+            "websocket_timeout_ms", websocket_timeout.c_str(),
+            nullptr
+        };
+
+        accepted_count_ = 0;
+        rejected_count_ = 0;
+        unauthorized_count_ = 0;
+
+        mg_callbacks callbacks {};
+        context_ = mg_start(&callbacks, this, options);
+        if (context_ == nullptr) {
+            qC4Critical(logDomainSGReplicator, "Could not start the replication listener on %s", listening_ports.c_str());
+            return SGReplicatorListenerReturnStatus::kInternalError;
+        }
+
+        mg_set_websocket_handler_with_subprotocols(context_, getPath().c_str(), &kSubprotocols,
+                                                   &SGReplicatorListener::onConnect, &SGReplicatorListener::onReady,
+                                                   &SGReplicatorListener::onData, &SGReplicatorListener::onClose,
+                                                   this);
+
+        qC4Info(logDomainSGReplicator, "Replication listener on port %s, path %s", listening_ports.c_str(), getPath().c_str());
+        return SGReplicatorListenerReturnStatus::kNoError;
+    }
+
+    void SGReplicatorListener::stop() {
+        mg_context *context;
+        {
+            lock_guard<mutex> lock(listener_lock_);
+            context = context_;
+            context_ = nullptr;
+        }
+        if (context == nullptr) {
+            return;
+        }
+
+        // Closing the connections closes the LiteCore sockets, which stops the passive replicators.
+        mg_stop(context);
+
+        unique_lock<mutex> lock(peers_lock_);
+        if (!peers_released_.wait_for(lock, chrono::milliseconds(kStopTimeoutMs), [this]() { return peers_.empty(); })) {
+            qC4Warning(logDomainSGReplicator, "%zu passive replicators still running after the listener stopped", peers_.size());
+        }
+        qC4Info(logDomainSGReplicator, "Replication listener stopped");
+    }
+
+    bool SGReplicatorListener::isRunning() {
+        lock_guard<mutex> lock(listener_lock_);
+        return context_ != nullptr;
+    }
+
+    SGReplicatorListenerStats SGReplicatorListener::getStats() {
+        SGReplicatorListenerStats stats;
+        stats.accepted_count = accepted_count_.load();
+        stats.rejected_count = rejected_count_.load();
+        stats.unauthorized_count = unauthorized_count_.load();
+        SGSocketFactoryStats socket_stats = SGSocketFactory::getStats();
+        stats.bytes_received = socket_stats.bytes_received;
+        stats.bytes_sent = socket_stats.bytes_written;
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        lock_guard<mutex> lock(peers_lock_);
+        for (const auto &entry : peers_) {
+            const shared_ptr<Peer> &peer = entry.second;
+            SGReplicatorPeerStats peer_stats;
+            peer_stats.peer_id = peer->id;
+            peer_stats.remote_address = peer->remote_address;
+            peer_stats.remote_port = peer->remote_port;
+            peer_stats.connected_ms = chrono::duration_cast<chrono::milliseconds>(now - peer->connected_at).count();
+            peer_stats.activity_level = (SGReplicator::ActivityLevel) peer->activity_level.load();
+            peer_stats.bytes_received = peer->bytes_received.load();
+            peer_stats.bytes_sent = peer->bytes_sent.load();
+            peer_stats.documents_received = peer->documents_received.load();
+            peer_stats.documents_sent = peer->documents_sent.load();
+            peer_stats.document_error_count = peer->document_error_count.load();
+            stats.peers.push_back(peer_stats);
+        }
+        return stats;
+    }
+
+    bool SGReplicatorListener::startPassiveReplicator(const shared_ptr<Peer> &peer) {
+        string path = getPath();
+        C4Address address {};
+        address.scheme = slice("ws");
+        address.hostname = slice(peer->remote_address);
+        address.port = peer->remote_port;
+        address.path = slice(path);
+
+        C4Socket *socket = c4socket_fromNative(*getC4SocketFactory(), new PeerHandle(this, peer), &address);
+        {
+            lock_guard<mutex> lock(peer->lock);
+            peer->socket = socket;
+        }
+
+        C4ReplicatorParameters passive_parameters {};
+        passive_parameters.push = kC4Passive;
+        // Passive pull accepts the peer's pushes
+        passive_parameters.pull = read_only_ ? kC4Disabled : kC4Passive;
+        passive_parameters.onStatusChanged = &SGReplicatorListener::onPassiveStatusChanged;
+        passive_parameters.onDocumentEnded = &SGReplicatorListener::onPassiveDocumentEnded;
+        passive_parameters.callbackContext = peer.get();
+
+        C4Error c4error {};
+        C4Replicator *replicator = c4repl_newWithSocket(database_->getC4db(), socket, passive_parameters, &c4error);
+        if (replicator == nullptr) {
+            qC4Critical(logDomainSGReplicator, "Passive replicator for %s failed: %s --", peer->remote_address.c_str(), C4ErrorToString(c4error).c_str());
+            lock_guard<mutex> lock(peer->lock);
+            peer->replicator_stopped = true;
+            return false;
+        }
+        {
+            lock_guard<mutex> lock(peer->lock);
+            peer->replicator = replicator;
+        }
+        reportOpen(peer);
+        return true;
+    }
+
+    void SGReplicatorListener::reportOpen(const shared_ptr<Peer> &peer) {
+        C4Socket *socket = nullptr;
+        {
+            lock_guard<mutex> lock(peer->lock);
+            if (peer->socket_open || peer->socket_closed) {
+                return;
+            }
+            peer->socket_open = true;
+            socket = peer->socket;
+        }
+        if (socket != nullptr) {
+            opened(socket);
+        }
+    }
+
+    void SGReplicatorListener::closeSocket(const shared_ptr<Peer> &peer, const C4Error &error) {
+        C4Socket *socket = nullptr;
+        {
+            lock_guard<mutex> lock(peer->lock);
+            if (peer->socket_closed) {
+                return;
+            }
+            peer->socket_closed = true;
+            socket = peer->socket;
+        }
+        peer->receive_window.notify_all();
+        if (socket != nullptr) {
+            closed(socket, error);
+        }
+    }
+
+    void SGReplicatorListener::releasePeer(uint64_t peer_id) {
+        {
+            lock_guard<mutex> lock(peers_lock_);
+            auto iter = peers_.find(peer_id);
+            if (iter == peers_.end()) {
+                return;
+            }
+            {
+                lock_guard<mutex> peer_lock(iter->second->lock);
+                if (!iter->second->connection_closed || !iter->second->replicator_stopped) {
+                    return;
+                }
+            }
+            peers_.erase(iter);
+        }
+        peers_released_.notify_all();
+    }
+
+    shared_ptr<SGReplicatorListener::Peer> SGReplicatorListener::peerOf(const mg_connection *connection) {
+        uint64_t peer_id = (uint64_t) (uintptr_t) mg_get_user_connection_data(connection);
+        lock_guard<mutex> lock(peers_lock_);
+        auto iter = peers_.find(peer_id);
+        if (iter == peers_.end()) {
+            return nullptr;
+        }
+        return iter->second;
+    }
+
+    void SGReplicatorListener::open(C4Socket *socket, const C4Address *address, C4Slice options) {
+        // The peer is already connected when the passive socket is created.
+        reportOpen(((PeerHandle *) socket->nativeHandle)->peer);
+    }
+
+    void SGReplicatorListener::write(C4Socket *socket, C4SliceResult data) {
+        shared_ptr<Peer> peer = ((PeerHandle *) socket->nativeHandle)->peer;
+        size_t byte_count = data.size;
+        {
+            lock_guard<mutex> lock(peer->write_lock);
+            if (peer->connection != nullptr &&
+                mg_websocket_write(peer->connection, MG_WEBSOCKET_OPCODE_BINARY, (const char *) data.buf, data.size) > 0) {
+                peer->bytes_sent += byte_count;
+            }
+        }
+        c4slice_free(data);
+
+        bool socket_closed;
+        {
+            lock_guard<mutex> lock(peer->lock);
+            socket_closed = peer->socket_closed;
+        }
+        if (!socket_closed) {
+            c4socket_completedWrite(socket, byte_count);
+        }
+    }
+
+    void SGReplicatorListener::completedReceive(C4Socket *socket, size_t byte_count) {
+        shared_ptr<Peer> peer = ((PeerHandle *) socket->nativeHandle)->peer;
+        {
+            lock_guard<mutex> lock(peer->lock);
+            peer->unread_bytes -= min(peer->unread_bytes, byte_count);
+        }
+        peer->receive_window.notify_all();
+    }
+
+    void SGReplicatorListener::close(C4Socket *socket) {
+        requestClose(socket, kWebSocketCloseNormal, C4String {});
+    }
+
+    void SGReplicatorListener::requestClose(C4Socket *socket, int status, C4String message) {
+        shared_ptr<Peer> peer = ((PeerHandle *) socket->nativeHandle)->peer;
+
+        // Close frame payload: 2 bytes status code, big endian, then the reason
+        string payload;
+        payload += (char) ((status >> 8) & 0xFF);
+        payload += (char) (status & 0xFF);
+        payload.append((const char *) message.buf, message.size);
+
+        bool sent = false;
+        {
+            lock_guard<mutex> lock(peer->write_lock);
+            if (peer->connection != nullptr) {
+                sent = mg_websocket_write(peer->connection, MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE, payload.data(),
+                                          payload.size()) > 0;
+            }
+        }
+        if (!sent) {
+            // Nobody left to answer the close handshake
+            C4Error error {};
+            if (status != kWebSocketCloseNormal) {
+                error = c4error_make(WebSocketDomain, status, message);
+            }
+            closeSocket(peer, error);
+        }
+        // Otherwise the socket is closed when the peer's close frame arrives, or when civetweb drops the connection.
+    }
+
+    int SGReplicatorListener::onConnect(const mg_connection *connection, void *context) {
+        SGReplicatorListener *listener = (SGReplicatorListener *) context;
+        const mg_request_info *request_info = mg_get_request_info(connection);
+
+        if (!listener->isAuthorized(connection)) {
+            listener->unauthorized_count_++;
+            qC4Warning(logDomainSGReplicator, "Refused unauthorized replication connection from %s", request_info->remote_addr);
+            return 1;
+        }
+
+        lock_guard<mutex> lock(listener->peers_lock_);
+        if (listener->connection_count_ >= listener->max_connections_) {
+            listener->rejected_count_++;
+            qC4Warning(logDomainSGReplicator, "Refused replication connection from %s: %u peers already connected", request_info->remote_addr, listener->connection_count_);
+            return 1;
+        }
+
+        shared_ptr<Peer> peer = make_shared<Peer>();
+        peer->listener = listener;
+        peer->id = listener->next_peer_id_++;
+        peer->remote_address = request_info->remote_addr;
+        peer->remote_port = (uint16_t) request_info->remote_port;
+        peer->connected_at = chrono::steady_clock::now();
+        listener->peers_[peer->id] = peer;
+        listener->connection_count_++;
+        listener->accepted_count_++;
+        mg_set_user_connection_data(const_cast<mg_connection *>(connection), (void *) (uintptr_t) peer->id);
+
+        qC4Info(logDomainSGReplicator, "Replication connection from %s:%d", request_info->remote_addr, request_info->remote_port);
+        return 0;
+    }
+
+    void SGReplicatorListener::onReady(mg_connection *connection, void *context) {
+        SGReplicatorListener *listener = (SGReplicatorListener *) context;
+        shared_ptr<Peer> peer = listener->peerOf(connection);
+        if (!peer) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(peer->write_lock);
+            peer->connection = connection;
+        }
+
+        if (!listener->startPassiveReplicator(peer)) {
+            const char payload[] = {(char) (1011 >> 8), (char) (1011 & 0xFF)};// Internal server error
+            lock_guard<mutex> lock(peer->write_lock);
+            mg_websocket_write(connection, MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE, payload, sizeof(payload));
+        }
+    }
+
+    int SGReplicatorListener::onData(mg_connection *connection, int opcode_bits, char *data, size_t data_length,
+                                     void *context) {
+        SGReplicatorListener *listener = (SGReplicatorListener *) context;
+        shared_ptr<Peer> peer = listener->peerOf(connection);
+        if (!peer) {
+            return 0;
+        }
+
+        switch (opcode_bits & 0x0F) {
+            case MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE: {
+                int status = kWebSocketCloseNormal;
+                slice message;
+                if (data_length >= 2) {
+                    status = ((uint8_t) data[0] << 8) | (uint8_t) data[1];
+                    message = slice(data + 2, data_length - 2);
+                }
+                C4Error error {};
+                if (status != kWebSocketCloseNormal) {
+                    error = c4error_make(WebSocketDomain, status, message);
+                }
+                listener->closeSocket(peer, error);
+                return 0;
+            }
+            case MG_WEBSOCKET_OPCODE_PING: {
+                lock_guard<mutex> lock(peer->write_lock);
+                mg_websocket_write(connection, MG_WEBSOCKET_OPCODE_PONG, data, data_length);
+                return 1;
+            }
+            case MG_WEBSOCKET_OPCODE_PONG:
+                return 1;
+            default:
+                break;
+        }
+
+        unique_lock<mutex> lock(peer->lock);
+        if ((opcode_bits & kWebSocketFinalFragment) == 0) {
+            peer->partial_message.append(data, data_length);
+            return 1;
+        }
+        string message;
+        if (!peer->partial_message.empty()) {
+            message.swap(peer->partial_message);
+        }
+        message.append(data, data_length);
+
+        // Stop reading from the peer, and let TCP push back, while LiteCore is behind.
+        peer->receive_window.wait(lock, [&peer]() {
+            return peer->unread_bytes < kMaxUnreadBytes || peer->socket_closed;
+        });
+        if (peer->socket_closed || peer->socket == nullptr) {
+            return 0;
+        }
+        peer->unread_bytes += message.size();
+        C4Socket *socket = peer->socket;
+        lock.unlock();
+
+        peer->bytes_received += message.size();
+        listener->received(socket, slice(message));
+        return 1;
+    }
+
+    void SGReplicatorListener::onClose(const mg_connection *connection, void *context) {
+        SGReplicatorListener *listener = (SGReplicatorListener *) context;
+        shared_ptr<Peer> peer = listener->peerOf(connection);
+        if (!peer) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(peer->write_lock);
+            peer->connection = nullptr;
+        }
+        listener->closeSocket(peer, c4error_make(WebSocketDomain, kWebSocketCloseAbnormal, slice("Connection closed")));
+        {
+            lock_guard<mutex> lock(peer->lock);
+            peer->connection_closed = true;
+        }
+        {
+            lock_guard<mutex> lock(listener->peers_lock_);
+            listener->connection_count_--;
+        }
+        qC4Info(logDomainSGReplicator, "Replication connection from %s:%u closed", peer->remote_address.c_str(), peer->remote_port);
+        listener->releasePeer(peer->id);
+    }
+
+    void SGReplicatorListener::onPassiveStatusChanged(C4Replicator *replicator, C4ReplicatorStatus status,
+                                                      void *context) {
+        Peer *peer = (Peer *) context;
+        peer->activity_level = status.level;
+        if (status.level != kC4Stopped) {
+            return;
+        }
+        if (status.error.code != 0) {
+            qC4Warning(logDomainSGReplicator, "Passive replicator for %s stopped: %s --", peer->remote_address.c_str(), C4ErrorToString(status.error).c_str());
+        }
+
+        {
+            lock_guard<mutex> lock(peer->lock);
+            peer->replicator = nullptr;
+            peer->replicator_stopped = true;
+        }
+        c4repl_free(replicator);
+        peer->listener->releasePeer(peer->id);
+    }
+
+    void SGReplicatorListener::onPassiveDocumentEnded(C4Replicator *replicator, bool pushing, C4HeapString doc_id,
+                                                      C4HeapString rev_id, C4RevisionFlags flags, C4Error error,
+                                                      bool error_is_transient, void *context) {
+        Peer *peer = (Peer *) context;
+        if (error.code != 0) {
+            peer->document_error_count++;
+        } else if (pushing) {
+            peer->documents_sent++;
+        } else {
+            peer->documents_received++;
+        }
+    }
+}
@@ -0,0 +1,213 @@
+//
+//  SGReplicatorStats.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "SGReplicatorStats.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+
+namespace Strata {
+    constexpr size_t SGReplicatorStatsCollector::kMaxTrackedSaves;
+    constexpr chrono::seconds::rep SGReplicatorStatsCollector::kMaxTrackedSaveAgeSec;
+    constexpr uint32_t SGReplicatorStatsCollector::kObserverBatchSize;
+
+    SGReplicatorStatsCollector::SGReplicatorStatsCollector(SGScheduler &scheduler) : scheduler_(scheduler) {
+        last_sample_time_ = Clock::now();
+        last_save_expiry_ = last_sample_time_;
+    }
+
+    SGReplicatorStatsCollector::~SGReplicatorStatsCollector() {
+        stopObserving();
+    }
+
+    void SGReplicatorStatsCollector::startObserving(C4Database *c4db, bool track_saves) {
+        lock_guard<mutex> lock(observer_lock_);
+        track_saves_ = track_saves;
+        if (!track_saves) {
+            lock_guard<mutex> stats_lock(stats_lock_);
+            pending_saves_.clear();
+        }
+        if (observer_ != nullptr || c4db == nullptr) {
+            return;
+        }
+        observer_ = c4dbobs_create(c4db, &SGReplicatorStatsCollector::onDatabaseChanged, this);
+        if (observer_ == nullptr) {
+            qC4Warning(logDomainSGReplicator, "Could not observe the local database, push latency won't be reported.");
+        }
+    }
+
+    void SGReplicatorStatsCollector::stopObserving() {
+        {
+            lock_guard<mutex> lock(observer_lock_);
+            if (observer_ != nullptr) {
+                c4dbobs_free(observer_);
+                observer_ = nullptr;
+            }
+        }
+        lock_guard<mutex> lock(stats_lock_);
+        pending_saves_.clear();
+    }
+
+    void SGReplicatorStatsCollector::onDatabaseChanged(C4DatabaseObserver *observer, void *context) {
+        // Only take the timestamp here, the changes are read on the scheduler thread.
+        SGReplicatorStatsCollector *ref = (SGReplicatorStatsCollector *) context;
+        lock_guard<mutex> lock(ref->drain_lock_);
+        if (ref->drain_scheduled_) {
+            return;
+        }
+        ref->drain_scheduled_ = true;
+        ref->first_unread_change_ = Clock::now();
+        ref->scheduler_.scheduleAfter(chrono::milliseconds::zero(), [ref]() {
+            ref->drainDatabaseChanges();
+        });
+    }
+
+    void SGReplicatorStatsCollector::drainDatabaseChanges() {
+        Clock::time_point changed_at;
+        {
+            lock_guard<mutex> lock(drain_lock_);
+            drain_scheduled_ = false;
+            changed_at = first_unread_change_;
+        }
+
+        lock_guard<mutex> observer_lock(observer_lock_);
+        if (observer_ == nullptr) {
+            return;
+        }
+
+        C4DatabaseChange changes[kObserverBatchSize];
+        bool external = false;
+        uint32_t count;
+        while ((count = c4dbobs_getChanges(observer_, changes, kObserverBatchSize, &external)) > 0) {
+            lock_guard<mutex> lock(stats_lock_);
+            for (uint32_t index = 0; index < count; ++index) {
+                if (external) {
+                    // Written by the replicator's own database connection, that is pulled data.
+                    stats_.pull.byte_count += changes[index].bodySize;
+                    continue;
+                }
+                if (!track_saves_ || pending_saves_.size() >= kMaxTrackedSaves) {
+                    continue;
+                }
+                // Keep the oldest unacknowledged save, latency is measured from the first change the server hasn't seen.
+                PendingSave save = {changed_at, changes[index].bodySize};
+                pair<unordered_map<string, PendingSave>::iterator, bool> inserted =
+                        pending_saves_.insert(make_pair(slice(changes[index].docID).asString(), save));
+                if (!inserted.second) {
+                    inserted.first->second.body_size = changes[index].bodySize;
+                }
+            }
+            c4dbobs_releaseChanges(changes, count);
+        }
+    }
+
+    void SGReplicatorStatsCollector::onStatusChanged(const C4ReplicatorStatus &status) {
+        lock_guard<mutex> lock(stats_lock_);
+        if (status.error.code != 0 && (status.level == kC4Stopped || status.level == kC4Offline)) {
+            countError(status.error);
+        }
+        if (status.level == kC4Idle && last_level_ == kC4Busy) {
+            has_checkpoint_ = true;
+            last_checkpoint_ = Clock::now();
+        }
+        last_level_ = status.level;
+    }
+
+    void SGReplicatorStatsCollector::onDocumentEnded(bool pushing, C4String doc_id, const C4Error &error) {
+        lock_guard<mutex> lock(stats_lock_);
+        if (error.code != 0) {
+            countError(error);
+            return;
+        }
+
+        if (!pushing) {
+            ++stats_.pull.document_count;
+            return;
+        }
+
+        ++stats_.push.document_count;
+        unordered_map<string, PendingSave>::iterator iter = pending_saves_.find(slice(doc_id).asString());
+        if (iter != pending_saves_.end()) {
+            chrono::microseconds latency = chrono::duration_cast<chrono::microseconds>(Clock::now() - iter->second.saved_at);
+            push_latency_us_.record(static_cast<uint64_t>(latency.count()));
+            stats_.push.byte_count += iter->second.body_size;
+            pending_saves_.erase(iter);
+        }
+    }
+
+    void SGReplicatorStatsCollector::onReconnect() {
+        lock_guard<mutex> lock(stats_lock_);
+        ++stats_.reconnect_count;
+    }
+
+    void SGReplicatorStatsCollector::countError(const C4Error &error) {
+        ++stats_.error_count_by_domain[error.domain];
+    }
+
+    void SGReplicatorStatsCollector::_expirePendingSaves(const Clock::time_point &now) {
+        Clock::time_point oldest = now - chrono::seconds(kMaxTrackedSaveAgeSec);
+        for (unordered_map<string, PendingSave>::iterator iter = pending_saves_.begin(); iter != pending_saves_.end();) {
+            if (iter->second.saved_at < oldest) {
+                iter = pending_saves_.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+        last_save_expiry_ = now;
+    }
+
+    void SGReplicatorStatsCollector::sample() {
+        lock_guard<mutex> lock(stats_lock_);
+        Clock::time_point now = Clock::now();
+        // A full pass over the saves, once in a while is enough
+        if (now - last_save_expiry_ >= chrono::seconds(kMaxTrackedSaveAgeSec) / 10) {
+            _expirePendingSaves(now);
+        }
+        double seconds = chrono::duration<double>(now - last_sample_time_).count();
+        if (seconds <= 0.0) {
+            return;
+        }
+
+        stats_.push.documents_per_second = (stats_.push.document_count - last_push_sample_.document_count) / seconds;
+        stats_.push.bytes_per_second = (stats_.push.byte_count - last_push_sample_.byte_count) / seconds;
+        stats_.pull.documents_per_second = (stats_.pull.document_count - last_pull_sample_.document_count) / seconds;
+        stats_.pull.bytes_per_second = (stats_.pull.byte_count - last_pull_sample_.byte_count) / seconds;
+
+        last_push_sample_ = stats_.push;
+        last_pull_sample_ = stats_.pull;
+        last_sample_time_ = now;
+    }
+
+    SGReplicatorStats SGReplicatorStatsCollector::snapshot() {
+        lock_guard<mutex> lock(stats_lock_);
+        SGReplicatorStats stats = stats_;
+        if (has_checkpoint_) {
+            stats.time_since_last_checkpoint_ms =
+                    chrono::duration_cast<chrono::milliseconds>(Clock::now() - last_checkpoint_).count();
+        }
+        stats.push_latency_us = push_latency_us_.snapshot();
+        return stats;
+    }
+}
@@ -0,0 +1,171 @@
+//
+//  SGRevisionPipeline.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <exception>
+
+#include "SGRevisionPipeline.h"
+#include "SGLoggingCategories.h"
+#include "SGMemoryTracker.h"
+#include "SGTrace.h"
+
+using namespace std;
+
+namespace Strata {
+    constexpr unsigned SGRevisionPipeline::kDefaultWorkerCount;
+    constexpr size_t SGRevisionPipeline::kDefaultCapacity;
+
+    SGRevisionPipeline::SGRevisionPipeline(unsigned worker_count, size_t capacity)
+            : worker_capacity_(max<size_t>(1, capacity / max(1u, worker_count))) {
+        worker_count = max(1u, worker_count);
+        for (unsigned i = 0; i < worker_count; ++i) {
+            workers_.emplace_back(new Worker());
+        }
+        // Started once workers_ doesn't move anymore
+        for (const unique_ptr<Worker> &worker : workers_) {
+            worker->thread = thread(&SGRevisionPipeline::run, this, ref(*worker));
+        }
+    }
+
+    SGRevisionPipeline::~SGRevisionPipeline() {
+        stop();
+    }
+
+    bool SGRevisionPipeline::submit(const std::string &doc_id, const std::function<void()> &handler, size_t byte_size) {
+        if (stopping_) {
+            refused_count_++;
+            return false;
+        }
+
+        // Same document, same worker: its revisions are handled in order
+        Worker &worker = *workers_[hash<string>()(doc_id) % workers_.size()];
+        unique_lock<mutex> lock(worker.lock);
+        if (worker.tasks.size() >= worker_capacity_) {
+            blocked_count_++;
+            worker.space_available.wait(lock, [this, &worker]() {
+                return worker.tasks.size() < worker_capacity_ || stopping_;
+            });
+        }
+        if (stopping_) {
+            refused_count_++;
+            return false;
+        }
+
+        Task task;
+        task.handler = handler;
+        task.queued_at = Clock::now();
+        task.byte_size = byte_size;
+        worker.tasks.push_back(task);
+        SGMemoryTracker::process().add(SGMemoryCategory::kRevisionPipeline, byte_size);
+        pending_count_++;
+        uint64_t queued_count = ++queued_count_;
+        uint64_t max_queued_count = max_queued_count_;
+        while (queued_count > max_queued_count && !max_queued_count_.compare_exchange_weak(max_queued_count, queued_count)) {}
+        lock.unlock();
+
+        worker.task_available.notify_one();
+        return true;
+    }
+
+    void SGRevisionPipeline::run(Worker &worker) {
+        unique_lock<mutex> lock(worker.lock);
+        while (true) {
+            worker.task_available.wait(lock, [this, &worker]() {
+                return !worker.tasks.empty() || stopping_;
+            });
+            if (worker.tasks.empty()) {
+                // Stopping, and everything queued ran
+                break;
+            }
+
+            Task task = worker.tasks.front();
+            worker.tasks.pop_front();
+            size_t byte_size = task.byte_size;
+            queued_count_--;
+            lock.unlock();
+            worker.space_available.notify_one();
+
+            Clock::time_point started_at = Clock::now();
+            queue_latency_us_.record(chrono::duration_cast<chrono::microseconds>(started_at - task.queued_at).count());
+            try {
+                SG_TRACE_SPAN("SGRevisionPipeline", "revision handler");
+                task.handler();
+            } catch (const exception &e) {
+                qC4Warning(logDomainSGReplicator, "Revision handler failed: %s", e.what());
+            }
+            handler_latency_us_.record(chrono::duration_cast<chrono::microseconds>(Clock::now() - started_at).count());
+            processed_count_++;
+            // Release what the handler captured before uncounting it
+            task = Task();
+            SGMemoryTracker::process().remove(SGMemoryCategory::kRevisionPipeline, byte_size);
+
+            if (--pending_count_ == 0) {
+                lock_guard<mutex> idle_lock(idle_lock_);
+                idle_.notify_all();
+            }
+            lock.lock();
+        }
+    }
+
+    bool SGRevisionPipeline::waitForIdle(const std::chrono::milliseconds &timeout) {
+        unique_lock<mutex> lock(idle_lock_);
+        return idle_.wait_for(lock, timeout, [this]() {
+            return pending_count_ == 0;
+        });
+    }
+
+    void SGRevisionPipeline::stop() {
+        lock_guard<mutex> lock(stop_lock_);
+        stopping_ = true;
+        for (const unique_ptr<Worker> &worker : workers_) {
+            {
+                // Taken so a worker or submitter about to wait can't miss the notification
+                lock_guard<mutex> worker_lock(worker->lock);
+            }
+            worker->task_available.notify_all();
+            worker->space_available.notify_all();
+        }
+        for (const unique_ptr<Worker> &worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+    }
+
+    unsigned SGRevisionPipeline::getWorkerCount() const {
+        return (unsigned) workers_.size();
+    }
+
+    SGRevisionPipelineStats SGRevisionPipeline::getStats() const {
+        SGRevisionPipelineStats stats;
+        stats.queued_count = queued_count_;
+        stats.max_queued_count = max_queued_count_;
+        stats.processed_count = processed_count_;
+        stats.blocked_count = blocked_count_;
+        stats.refused_count = refused_count_;
+        stats.queue_latency_us = queue_latency_us_.snapshot();
+        stats.handler_latency_us = handler_latency_us_.snapshot();
+        return stats;
+    }
+}
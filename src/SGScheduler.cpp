@@ -0,0 +1,122 @@
+//
+//  SGScheduler.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "SGScheduler.h"
+
+using namespace std;
+
+namespace Strata {
+    SGScheduler::SGScheduler() {}
+
+    SGScheduler::~SGScheduler() {
+        stop();
+    }
+
+    SGScheduler::TaskId SGScheduler::scheduleAfter(const chrono::milliseconds &delay, const function<void()> &task) {
+        return schedule(delay, chrono::milliseconds::zero(), task);
+    }
+
+    SGScheduler::TaskId SGScheduler::scheduleEvery(const chrono::milliseconds &interval, const function<void()> &task) {
+        return schedule(interval, interval, task);
+    }
+
+    SGScheduler::TaskId SGScheduler::schedule(const chrono::milliseconds &delay, const chrono::milliseconds &interval,
+                                              const function<void()> &task) {
+        lock_guard<mutex> lock(scheduler_lock_);
+        if (stopping_ || !task) {
+            return 0;
+        }
+
+        TaskId task_id = next_task_id_++;
+        Task &new_task = tasks_[task_id];
+        new_task.due = Clock::now() + delay;
+        new_task.interval = interval;
+        new_task.function = task;
+
+        // The thread is only started once something needs to run.
+        if (!thread_.joinable()) {
+            thread_ = thread(&SGScheduler::run, this);
+        }
+        scheduler_cv_.notify_one();
+        return task_id;
+    }
+
+    void SGScheduler::cancel(TaskId task_id) {
+        lock_guard<mutex> lock(scheduler_lock_);
+        tasks_.erase(task_id);
+    }
+
+    void SGScheduler::stop() {
+        {
+            lock_guard<mutex> lock(scheduler_lock_);
+            stopping_ = true;
+            tasks_.clear();
+        }
+        scheduler_cv_.notify_one();
+
+        if (thread_.joinable() && thread_.get_id() != this_thread::get_id()) {
+            thread_.join();
+        }
+    }
+
+    void SGScheduler::run() {
+        unique_lock<mutex> lock(scheduler_lock_);
+        while (!stopping_) {
+            if (tasks_.empty()) {
+                scheduler_cv_.wait(lock);
+                continue;
+            }
+
+            // Only a handful of tasks are expected, a linear scan is cheaper than keeping a heap in sync with cancel().
+            map<TaskId, Task>::iterator next = tasks_.begin();
+            for (map<TaskId, Task>::iterator iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+                if (iter->second.due < next->second.due) {
+                    next = iter;
+                }
+            }
+
+            if (Clock::now() < next->second.due) {
+                // A copy, cancel() or stop() may erase the task while the lock is released
+                Clock::time_point due = next->second.due;
+                scheduler_cv_.wait_until(lock, due);
+                continue;
+            }
+
+            function<void()> task = next->second.function;
+            if (next->second.interval > chrono::milliseconds::zero()) {
+                next->second.due += next->second.interval;
+                // Don't try to catch up on runs missed because a task was slow.
+                if (next->second.due < Clock::now()) {
+                    next->second.due = Clock::now() + next->second.interval;
+                }
+            } else {
+                tasks_.erase(next);
+            }
+
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+}
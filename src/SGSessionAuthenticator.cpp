@@ -0,0 +1,275 @@
+//
+//  SGSessionAuthenticator.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <cstdio>
+#include <ctime>
+
+#include <civetweb/civetweb.h>
+#include <litecore/c4Replicator.h>
+
+#include "SGAuthenticator.h"
+#include "SGUtility.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+using namespace fleece::impl;
+
+namespace Strata {
+    constexpr const char *SGSessionAuthenticator::kDefaultCookieName;
+    const unsigned SGSessionAuthenticator::kDefaultSessionTtlSec;
+    const unsigned SGSessionAuthenticator::kDefaultRenewalMarginSec;
+    const int SGSessionAuthenticator::kResponseTimeoutMs;
+    const unsigned SGSessionAuthenticator::kRetryIntervalSec;
+
+    // Largest _session response accepted.
+    static const size_t kMaxResponseSize = 64 * 1024;
+
+    /** parseTimestamp.
+    * @brief Parses an RFC 3339 timestamp as returned by Sync Gateway, i.e "2019-03-20T17:38:15.245957-07:00".
+    */
+    static bool parseTimestamp(const string &timestamp, chrono::system_clock::time_point &time_point) {
+        int year, month, day, hour, minute;
+        double second;
+        int length = 0;
+        if (sscanf(timestamp.c_str(), "%d-%d-%dT%d:%d:%lf%n", &year, &month, &day, &hour, &minute, &second, &length) < 6) {
+            return false;
+        }
+
+        tm time {};
+        time.tm_year = year - 1900;
+        time.tm_mon = month - 1;
+        time.tm_mday = day;
+        time.tm_hour = hour;
+        time.tm_min = minute;
+        time.tm_sec = (int) second;
+#ifdef _WIN32
+        time_t utc = _mkgmtime(&time);
+#else
+        time_t utc = timegm(&time);
+#endif
+        if (utc == (time_t) -1) {
+            return false;
+        }
+
+        // Time zone offset, nothing or "Z" for UTC
+        string zone = timestamp.substr(length);
+        int offset_hours = 0, offset_minutes = 0;
+        if (!zone.empty() && (zone[0] == '+' || zone[0] == '-') &&
+            sscanf(zone.c_str() + 1, "%d:%d", &offset_hours, &offset_minutes) == 2) {
+            int offset = offset_hours * 3600 + offset_minutes * 60;
+            utc -= zone[0] == '+' ? offset : -offset;
+        }
+        time_point = chrono::system_clock::from_time_t(utc);
+        return true;
+    }
+
+    SGSessionAuthenticator::SGSessionAuthenticator(const std::string &session_id,
+                                                   const std::chrono::system_clock::time_point &expires,
+                                                   const std::string &cookie_name)
+            : session_id_(session_id), cookie_name_(cookie_name), expires_(expires) {}
+
+    SGSessionAuthenticator::SGSessionAuthenticator(const SGURLEndpoint *url_endpoint, const std::string &username,
+                                                   const std::string &password)
+            : cookie_name_(kDefaultCookieName), username_(username), password_(password) {
+        if (url_endpoint != nullptr) {
+            scheme_ = url_endpoint->getSchema() == "wss" ? "https" : "http";
+            host_ = url_endpoint->getHost();
+            port_ = url_endpoint->getPort();
+            database_ = url_endpoint->getPath();
+        }
+    }
+
+    SGSessionAuthenticator::~SGSessionAuthenticator() {
+        // Waits for a running request
+        scheduler_.stop();
+    }
+
+    void SGSessionAuthenticator::authenticate(fleece::Retained<fleece::impl::MutableDict> options) {
+        lock_guard<mutex> lock(session_lock_);
+        bool expiring = session_id_.empty() || chrono::system_clock::now() + renewal_margin_ >= expires_;
+        // Unless a request is already running or due now
+        if (expiring && !host_.empty() && (request_task_ == 0 || request_due_ > chrono::steady_clock::now())) {
+            _scheduleRequest(chrono::milliseconds::zero());
+        }
+
+        if (!session_id_.empty() && chrono::system_clock::now() < expires_) {
+            string cookie = cookie_name_ + "=" + session_id_;
+            options->set(slice(kC4ReplicatorOptionCookies), slice(cookie));
+            options->remove(slice(kC4ReplicatorOptionAuthentication));
+            return;
+        }
+
+        options->remove(slice(kC4ReplicatorOptionCookies));
+        if (username_.empty()) {
+            qC4Warning(logDomainSGReplicator, "The Sync Gateway session expired, connecting without authentication");
+            options->remove(slice(kC4ReplicatorOptionAuthentication));
+            return;
+        }
+        qC4Warning(logDomainSGReplicator, "No Sync Gateway session, falling back to basic authentication");
+        SGBasicAuthenticator(username_, password_).authenticate(options);
+    }
+
+    void SGSessionAuthenticator::authenticationFailed() {
+        lock_guard<mutex> lock(session_lock_);
+        if (!host_.empty()) {
+            session_id_.clear();
+            _scheduleRequest(chrono::milliseconds::zero());
+        }
+    }
+
+    bool SGSessionAuthenticator::renewSession() {
+        return !host_.empty() && requestSession();
+    }
+
+    void SGSessionAuthenticator::setRenewalMargin(const std::chrono::seconds &renewal_margin) {
+        lock_guard<mutex> lock(session_lock_);
+        renewal_margin_ = renewal_margin;
+    }
+
+    void SGSessionAuthenticator::setCACertificateFile(const std::string &ca_file) {
+        lock_guard<mutex> lock(session_lock_);
+        ca_file_ = ca_file;
+    }
+
+    std::string SGSessionAuthenticator::getSessionId() const {
+        lock_guard<mutex> lock(session_lock_);
+        return session_id_;
+    }
+
+    std::chrono::system_clock::time_point SGSessionAuthenticator::getSessionExpiry() const {
+        lock_guard<mutex> lock(session_lock_);
+        return expires_;
+    }
+
+    void SGSessionAuthenticator::runScheduledRequest() {
+        bool created = requestSession();
+
+        lock_guard<mutex> lock(session_lock_);
+        chrono::milliseconds delay = chrono::seconds(kRetryIntervalSec);
+        if (created) {
+            chrono::system_clock::time_point renew_at = expires_ - renewal_margin_;
+            delay = max(chrono::duration_cast<chrono::milliseconds>(renew_at - chrono::system_clock::now()),
+                        chrono::milliseconds(chrono::seconds(kRetryIntervalSec)));
+        }
+        _scheduleRequest(delay);
+    }
+
+    void SGSessionAuthenticator::_scheduleRequest(const std::chrono::milliseconds &delay) {
+        if (request_task_ != 0) {
+            scheduler_.cancel(request_task_);
+        }
+        request_due_ = chrono::steady_clock::now() + delay;
+        request_task_ = scheduler_.scheduleAfter(delay, [this]() {
+            runScheduledRequest();
+        });
+    }
+
+    bool SGSessionAuthenticator::requestSession() {
+        lock_guard<mutex> request_lock(request_lock_);
+        string ca_file;
+        {
+            lock_guard<mutex> lock(session_lock_);
+            ca_file = ca_file_;
+        }
+
+        char error_buffer[256] = {0};
+        mg_connection *connection = nullptr;
+        if (scheme_ == "https") {
+            if (ca_file.empty()) {
+                qC4Warning(logDomainSGReplicator, "No CA certificate file to verify %s with, no session requested", host_.c_str());
+                return false;
+            }
+            mg_client_options client_options {};
+            client_options.host = host_.c_str();
+            client_options.port = port_;
+            client_options.server_cert = ca_file.c_str();
+            connection = mg_connect_client_secure(&client_options, error_buffer, sizeof(error_buffer));
+        } else {
+            connection = mg_connect_client(host_.c_str(), port_, 0, error_buffer, sizeof(error_buffer));
+        }
+        if (connection == nullptr) {
+            qC4Warning(logDomainSGReplicator, "Could not connect to %s:%u for a session: %s", host_.c_str(), port_, error_buffer);
+            return false;
+        }
+
+        // HTTP/1.0 so the response comes whole, without chunked encoding, and the server closes the connection
+        string body = "{}";
+        string request = "POST /" + database_ + "/_session HTTP/1.0\r\n";
+        request += "Host: " + host_ + ":" + to_string(port_) + "\r\n";
+        request += "Authorization: Basic " + Base64Encode(username_ + ":" + password_) + "\r\n";
+        request += "Content-Type: application/json\r\n";
+        request += "Content-Length: " + to_string(body.size()) + "\r\n\r\n";
+        request += body;
+
+        int status = 0;
+        string response;
+        if (mg_write(connection, request.data(), request.size()) == (int) request.size() &&
+            mg_get_response(connection, error_buffer, sizeof(error_buffer), kResponseTimeoutMs) >= 0) {
+            status = mg_get_response_info(connection)->status_code;
+            char buffer[4096];
+            int read_count;
+            while ((read_count = mg_read(connection, buffer, sizeof(buffer))) > 0 && response.size() < kMaxResponseSize) {
+                response.append(buffer, read_count);
+            }
+        }
+        mg_close_connection(connection);
+
+        if (status != 200) {
+            qC4Warning(logDomainSGReplicator, "Sync Gateway refused the session for %s: HTTP %d %s", username_.c_str(), status, error_buffer);
+            return false;
+        }
+
+        // {"session_id":"...","expires":"2019-03-20T17:38:15.245957-07:00","cookie_name":"SyncGatewaySession"}
+        alloc_slice session_fleece;
+        try {
+            session_fleece = JSONConverter::convertJSON(slice(response));
+        } catch (const FleeceException &e) {
+            qC4Warning(logDomainSGReplicator, "Invalid session response: %s", e.what());
+            return false;
+        }
+        const Value *root = Value::fromData(session_fleece);
+        const Dict *session = root ? root->asDict() : nullptr;
+        const Value *session_id = session ? session->get(slice("session_id")) : nullptr;
+        if (session_id == nullptr || !session_id->asString()) {
+            qC4Warning(logDomainSGReplicator, "Invalid session response, no session_id");
+            return false;
+        }
+        chrono::system_clock::time_point expires_at;
+        const Value *expires = session->get(slice("expires"));
+        if (expires == nullptr || !parseTimestamp(expires->asString().asString(), expires_at)) {
+            expires_at = chrono::system_clock::now() + chrono::seconds(kDefaultSessionTtlSec);
+        }
+
+        lock_guard<mutex> lock(session_lock_);
+        session_id_ = session_id->asString().asString();
+        const Value *cookie_name = session->get(slice("cookie_name"));
+        if (cookie_name != nullptr && cookie_name->asString()) {
+            cookie_name_ = cookie_name->asString().asString();
+        }
+        expires_ = expires_at;
+        qC4Info(logDomainSGReplicator, "Created a Sync Gateway session for %s", username_.c_str());
+        return true;
+    }
+}
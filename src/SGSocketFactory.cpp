@@ -0,0 +1,322 @@
+//
+//  SGSocketFactory.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cctype>
+#include <random>
+
+#include <fleece/FleeceImpl.hh>
+#include <litecore/c4Replicator.h>
+
+#include "SGSocketFactory.h"
+#include "SGUtility.h"
+#include "SGLoggingCategories.h"
+
+using namespace std;
+using namespace fleece;
+using namespace fleece::impl;
+
+namespace Strata {
+    static string toLower(string value) {
+        transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char) tolower(c); });
+        return value;
+    }
+
+    constexpr const char *SGSocketFactory::kOptionIdleTimeout;
+    constexpr const char *SGSocketFactory::kOptionConnectTimeout;
+    constexpr const char *SGSocketFactory::kOptionBandwidthLimiter;
+
+    SGSocketFactory::SGSocketFactory(C4SocketFraming framing) {
+        c4socket_factory_.framing = framing;
+        c4socket_factory_.context = this;
+        c4socket_factory_.open = &SGSocketFactory::openCallback;
+        c4socket_factory_.write = &SGSocketFactory::writeCallback;
+        c4socket_factory_.completedReceive = &SGSocketFactory::completedReceiveCallback;
+        c4socket_factory_.close = &SGSocketFactory::closeCallback;
+        c4socket_factory_.requestClose = &SGSocketFactory::requestCloseCallback;
+        c4socket_factory_.dispose = &SGSocketFactory::disposeCallback;
+    }
+
+    SGSocketFactory::~SGSocketFactory() {}
+
+    const C4SocketFactory *SGSocketFactory::getC4SocketFactory() const {
+        return &c4socket_factory_;
+    }
+
+    SGSocketFactoryStats SGSocketFactory::getStats() const {
+        SGSocketFactoryStats stats;
+        stats.bytes_written = bytes_written_.load();
+        stats.bytes_received = bytes_received_.load();
+        stats.connection_count = connection_count_.load();
+        stats.open_connection_count = open_connection_count_.load();
+        stats.wire_bytes_written = wire_bytes_written_.load();
+        stats.wire_bytes_received = wire_bytes_received_.load();
+        stats.compression_time_us = compression_time_ns_.load() / 1000;
+        stats.throttle_time_us = throttle_time_ns_.load() / 1000;
+        return stats;
+    }
+
+    void SGSocketFactory::close(C4Socket *socket) {
+        closed(socket, {});
+    }
+
+    void SGSocketFactory::requestClose(C4Socket *socket, int status, C4String message) {
+        C4Error error {};
+        if (status != kWebSocketCloseNormal) {
+            error = c4error_make(WebSocketDomain, status, message);
+        }
+        closed(socket, error);
+    }
+
+    void SGSocketFactory::dispose(C4Socket *socket) {
+        delete (SGSocketHandle *) socket->nativeHandle;
+        socket->nativeHandle = nullptr;
+    }
+
+    void SGSocketFactory::received(C4Socket *socket, C4Slice data) {
+        bytes_received_ += data.size;
+        c4socket_received(socket, data);
+    }
+
+    void SGSocketFactory::opened(C4Socket *socket) {
+        SGSocketHandle *handle = (SGSocketHandle *) socket->nativeHandle;
+        if (handle != nullptr && !handle->is_open) {
+            handle->is_open = true;
+            connection_count_++;
+            open_connection_count_++;
+        }
+        c4socket_opened(socket);
+    }
+
+    void SGSocketFactory::closed(C4Socket *socket, C4Error error) {
+        SGSocketHandle *handle = (SGSocketHandle *) socket->nativeHandle;
+        if (handle != nullptr && handle->is_open) {
+            handle->is_open = false;
+            open_connection_count_--;
+        }
+        c4socket_closed(socket, error);
+    }
+
+    void SGSocketFactory::countWireBytes(size_t bytes_written, size_t bytes_received) {
+        wire_bytes_written_ += bytes_written;
+        wire_bytes_received_ += bytes_received;
+    }
+
+    void SGSocketFactory::countCompressionTime(uint64_t compression_time_ns) {
+        compression_time_ns_ += compression_time_ns;
+    }
+
+    std::string SGSocketFactory::makeUpgradeRequest(const std::string &host, uint16_t port, const std::string &path,
+                                                    C4Slice options_data, const std::string &extensions,
+                                                    std::string &websocket_key) {
+        random_device random;
+        string key;
+        for (int index = 0; index < 16; ++index) {
+            key += (char) (random() & 0xFF);
+        }
+
+        string request = "GET " + path + " HTTP/1.1\r\n";
+        request += "Host: " + host + ":" + to_string(port) + "\r\n";
+        request += "Upgrade: websocket\r\n";
+        request += "Connection: Upgrade\r\n";
+        request += "Sec-WebSocket-Version: 13\r\n";
+        websocket_key = Base64Encode(key);
+        request += "Sec-WebSocket-Key: " + websocket_key + "\r\n";
+        if (!extensions.empty()) {
+            request += "Sec-WebSocket-Extensions: " + extensions + "\r\n";
+        }
+
+        // Replicator options LiteCore expects the transport to turn into headers
+        const Value *root = Value::fromData(options_data);
+        const Dict *options = root ? root->asDict() : nullptr;
+        if (options != nullptr) {
+            const Value *protocols = options->get(slice(kC4SocketOptionWSProtocols));
+            if (protocols && protocols->asString()) {
+                request += "Sec-WebSocket-Protocol: " + protocols->asString().asString() + "\r\n";
+            }
+            const Value *auth_value = options->get(slice(kC4ReplicatorOptionAuthentication));
+            const Dict *auth = auth_value ? auth_value->asDict() : nullptr;
+            if (auth != nullptr) {
+                const Value *type = auth->get(slice(kC4ReplicatorAuthType));
+                const Value *username = auth->get(slice(kC4ReplicatorAuthUserName));
+                const Value *password = auth->get(slice(kC4ReplicatorAuthPassword));
+                if (type && type->asString() == slice(kC4AuthTypeBasic) && username && password) {
+                    string credentials = username->asString().asString() + ":" + password->asString().asString();
+                    request += "Authorization: Basic " + Base64Encode(credentials) + "\r\n";
+                }
+            }
+            const Value *cookies = options->get(slice(kC4ReplicatorOptionCookies));
+            if (cookies && cookies->asString()) {
+                request += "Cookie: " + cookies->asString().asString() + "\r\n";
+            }
+            const Value *headers_value = options->get(slice(kC4ReplicatorOptionExtraHeaders));
+            const Dict *headers = headers_value ? headers_value->asDict() : nullptr;
+            if (headers != nullptr) {
+                for (Dict::iterator iter(headers); iter; ++iter) {
+                    request += iter.keyString().asString() + ": " + iter.value()->asString().asString() + "\r\n";
+                }
+            }
+        }
+        request += "\r\n";
+        return request;
+    }
+
+    int SGSocketFactory::parseUpgradeResponse(C4Socket *socket, const std::string &response, std::string &reason,
+                                              std::map<std::string, std::string> &headers) {
+        // Status line, i.e "HTTP/1.1 101 Switching Protocols"
+        size_t line_end = response.find("\r\n");
+        string status_line = response.substr(0, line_end);
+        size_t status_start = status_line.find(' ');
+        int status = status_start == string::npos ? 0 : atoi(status_line.c_str() + status_start + 1);
+        reason = status_start == string::npos ? string() : status_line.substr(min(status_line.size(), status_start + 5));
+
+        Encoder encoder;
+        encoder.beginDictionary();
+        size_t line_start = line_end == string::npos ? response.size() : line_end + 2;
+        while (line_start < response.size()) {
+            line_end = response.find("\r\n", line_start);
+            if (line_end == string::npos) {
+                line_end = response.size();
+            }
+            string line = response.substr(line_start, line_end - line_start);
+            size_t colon = line.find(':');
+            if (colon != string::npos) {
+                string name = line.substr(0, colon);
+                size_t value_start = line.find_first_not_of(' ', colon + 1);
+                string value = value_start == string::npos ? string() : line.substr(value_start);
+                headers[toLower(name)] = value;
+                encoder.writeKey(slice(name));
+                encoder.writeString(slice(value));
+            }
+            line_start = line_end + 2;
+        }
+        encoder.endDictionary();
+        alloc_slice headers_fleece = encoder.finish();
+        c4socket_gotHTTPResponse(socket, status, headers_fleece);
+
+        return status;
+    }
+
+    unsigned SGSocketFactory::getSecondsOption(C4Slice options_data, const char *key) {
+        const Value *root = Value::fromData(options_data);
+        const Dict *options = root ? root->asDict() : nullptr;
+        const Value *value = options ? options->get(slice(key)) : nullptr;
+        if (value == nullptr || value->type() != kNumber || value->asInt() <= 0) {
+            return 0;
+        }
+        return (unsigned) value->asUnsigned();
+    }
+
+    std::shared_ptr<SGBandwidthLimiter> SGSocketFactory::getBandwidthLimiter(C4Slice options_data) {
+        const Value *root = Value::fromData(options_data);
+        const Dict *options = root ? root->asDict() : nullptr;
+        const Value *value = options ? options->get(slice(kOptionBandwidthLimiter)) : nullptr;
+        if (value == nullptr || value->type() != kNumber) {
+            return nullptr;
+        }
+        return SGBandwidthLimiter::find(value->asUnsigned());
+    }
+
+    std::chrono::nanoseconds SGSocketFactory::throttle(SGBandwidthLimiter *limiter,
+                                                       SGBandwidthLimiter::Direction direction, size_t byte_count,
+                                                       std::chrono::steady_clock::time_point &throttled_until) {
+        chrono::nanoseconds delay = SGBandwidthLimiter::process().reserve(direction, byte_count);
+        if (limiter != nullptr) {
+            delay = max(delay, limiter->reserve(direction, byte_count));
+        }
+        if (delay.count() <= 0) {
+            return chrono::nanoseconds::zero();
+        }
+
+        // Waits overlap when the connection moves data while already held back, only count the extra time
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        chrono::steady_clock::time_point until = now + delay;
+        if (until > throttled_until) {
+            chrono::nanoseconds throttle_time = until - max(now, throttled_until);
+            throttled_until = until;
+            throttle_time_ns_ += throttle_time.count();
+            SGBandwidthLimiter::process().addThrottleTime(direction, throttle_time);
+            if (limiter != nullptr) {
+                limiter->addThrottleTime(direction, throttle_time);
+            }
+        }
+        return delay;
+    }
+
+    SGSocketFactory *SGSocketFactory::factoryOf(C4Socket *socket) {
+        SGSocketHandle *handle = (SGSocketHandle *) socket->nativeHandle;
+        if (handle == nullptr) {
+            qC4Critical(logDomainSGReplicator, "Socket callback without a SGSocketHandle");
+            return nullptr;
+        }
+        return handle->factory;
+    }
+
+    void SGSocketFactory::openCallback(C4Socket *socket, const C4Address *address, C4Slice options, void *context) {
+        // Passive sockets created with c4socket_fromNative() already carry their handle.
+        SGSocketFactory *factory = (SGSocketFactory *) context;
+        if (socket->nativeHandle != nullptr) {
+            factory = factoryOf(socket);
+        }
+        factory->open(socket, address, options);
+    }
+
+    void SGSocketFactory::writeCallback(C4Socket *socket, C4SliceResult data) {
+        SGSocketFactory *factory = factoryOf(socket);
+        if (factory == nullptr) {
+            c4slice_free(data);
+            return;
+        }
+        factory->bytes_written_ += data.size;
+        factory->write(socket, data);
+    }
+
+    void SGSocketFactory::completedReceiveCallback(C4Socket *socket, size_t byte_count) {
+        SGSocketFactory *factory = factoryOf(socket);
+        if (factory != nullptr) {
+            factory->completedReceive(socket, byte_count);
+        }
+    }
+
+    void SGSocketFactory::closeCallback(C4Socket *socket) {
+        SGSocketFactory *factory = factoryOf(socket);
+        if (factory != nullptr) {
+            factory->close(socket);
+        }
+    }
+
+    void SGSocketFactory::requestCloseCallback(C4Socket *socket, int status, C4String message) {
+        SGSocketFactory *factory = factoryOf(socket);
+        if (factory != nullptr) {
+            factory->requestClose(socket, status, message);
+        }
+    }
+
+    void SGSocketFactory::disposeCallback(C4Socket *socket) {
+        if (socket->nativeHandle == nullptr) {
+            return;
+        }
+        factoryOf(socket)->dispose(socket);
+    }
+}
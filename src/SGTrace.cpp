@@ -0,0 +1,169 @@
+//
+//  SGTrace.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "SGTrace.h"
+
+using namespace std;
+
+namespace Strata {
+    const size_t SGTrace::kMaxEventsPerThread;
+
+    atomic<bool> SGTrace::enabled_ {false};
+
+    namespace {
+        struct TraceEvent {
+            const char *category;
+            const char *name;
+            int64_t start_ns;
+            int64_t end_ns;
+        };
+
+        // The owning thread appends, the lock is only contended while exporting
+        struct ThreadBuffer {
+            mutex lock;
+            vector<TraceEvent> events;
+            uint64_t dropped_count {0};
+            unsigned thread_id {0};
+        };
+
+        // Buffers outlive their thread so its spans can still be exported
+        mutex buffers_lock;
+        vector<shared_ptr<ThreadBuffer>> buffers;
+        unsigned next_thread_id = 1;
+
+        thread_local shared_ptr<ThreadBuffer> thread_buffer;
+
+        ThreadBuffer &currentThreadBuffer() {
+            if(thread_buffer == nullptr) {
+                thread_buffer = make_shared<ThreadBuffer>();
+                lock_guard<mutex> lock(buffers_lock);
+                thread_buffer->thread_id = next_thread_id++;
+                buffers.push_back(thread_buffer);
+            }
+            return *thread_buffer;
+        }
+
+        // Timestamps are exported relative to this, in microseconds
+        const chrono::steady_clock::time_point trace_epoch = chrono::steady_clock::now();
+
+        void appendJsonString(string &json, const char *value) {
+            json += '"';
+            for(const char *c = value; *c != '\0'; ++c) {
+                if(*c == '"' || *c == '\\') {
+                    json += '\\';
+                    json += *c;
+                } else if((unsigned char) *c < 0x20) {
+                    json += ' ';
+                } else {
+                    json += *c;
+                }
+            }
+            json += '"';
+        }
+    }
+
+    void SGTrace::setEnabled(bool enabled) {
+        enabled_.store(enabled, memory_order_relaxed);
+    }
+
+    void SGTrace::clear() {
+        lock_guard<mutex> lock(buffers_lock);
+        for(auto it = buffers.begin(); it != buffers.end();) {
+            // Only the list still holds the buffer of a thread that exited
+            if(it->use_count() == 1) {
+                it = buffers.erase(it);
+                continue;
+            }
+            lock_guard<mutex> buffer_lock((*it)->lock);
+            (*it)->events.clear();
+            (*it)->dropped_count = 0;
+            ++it;
+        }
+    }
+
+    std::string SGTrace::toJson() {
+        string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        char numbers[96];
+        int64_t epoch_ns = chrono::duration_cast<chrono::nanoseconds>(trace_epoch.time_since_epoch()).count();
+
+        lock_guard<mutex> lock(buffers_lock);
+        for(const shared_ptr<ThreadBuffer> &buffer : buffers) {
+            lock_guard<mutex> buffer_lock(buffer->lock);
+            for(const TraceEvent &event : buffer->events) {
+                json += first ? "\n" : ",\n";
+                first = false;
+                json += "{\"name\":";
+                appendJsonString(json, event.name);
+                json += ",\"cat\":";
+                appendJsonString(json, event.category);
+                snprintf(numbers, sizeof(numbers), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                         (event.start_ns - epoch_ns) / 1000.0, (event.end_ns - event.start_ns) / 1000.0,
+                         buffer->thread_id);
+                json += numbers;
+            }
+        }
+        json += "\n]}\n";
+        return json;
+    }
+
+    bool SGTrace::dump(const std::string &file_path) {
+        string json = toJson();
+        FILE *file = fopen(file_path.c_str(), "wb");
+        if(file == nullptr) {
+            return false;
+        }
+        bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+        return fclose(file) == 0 && written;
+    }
+
+    uint64_t SGTrace::getDroppedCount() {
+        uint64_t dropped_count = 0;
+        lock_guard<mutex> lock(buffers_lock);
+        for(const shared_ptr<ThreadBuffer> &buffer : buffers) {
+            lock_guard<mutex> buffer_lock(buffer->lock);
+            dropped_count += buffer->dropped_count;
+        }
+        return dropped_count;
+    }
+
+    int64_t SGTrace::now() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void SGTrace::record(const char *category, const char *name, int64_t start_ns, int64_t end_ns) {
+        ThreadBuffer &buffer = currentThreadBuffer();
+        lock_guard<mutex> lock(buffer.lock);
+        if(buffer.events.size() >= kMaxEventsPerThread) {
+            ++buffer.dropped_count;
+            return;
+        }
+        buffer.events.push_back(TraceEvent {category, name, start_ns, end_ns});
+    }
+}
@@ -32,4 +32,25 @@ namespace Strata {
         fleece::alloc_slice error_message = c4error_getDescription(err);
         return error_message.asString();
     }
+
+    std::string Base64Encode(const std::string &data)
+    {
+        static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string encoded;
+        encoded.reserve((data.size() + 2) / 3 * 4);
+        for (size_t index = 0; index < data.size(); index += 3) {
+            uint32_t chunk = (uint8_t) data[index] << 16;
+            if (index + 1 < data.size()) {
+                chunk |= (uint8_t) data[index + 1] << 8;
+            }
+            if (index + 2 < data.size()) {
+                chunk |= (uint8_t) data[index + 2];
+            }
+            encoded += kAlphabet[(chunk >> 18) & 0x3F];
+            encoded += kAlphabet[(chunk >> 12) & 0x3F];
+            encoded += index + 1 < data.size() ? kAlphabet[(chunk >> 6) & 0x3F] : '=';
+            encoded += index + 2 < data.size() ? kAlphabet[chunk & 0x3F] : '=';
+        }
+        return encoded;
+    }
 }
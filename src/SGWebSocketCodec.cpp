@@ -0,0 +1,491 @@
+//
+//  SGWebSocketCodec.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#include "SGWebSocketCodec.h"
+#include "SGLoggingCategories.h"
+#include "SGUtility.h"
+
+using namespace std;
+
+namespace Strata {
+    const int SGWebSocketCodec::kOpcodeContinuation;
+    const int SGWebSocketCodec::kOpcodeText;
+    const int SGWebSocketCodec::kOpcodeBinary;
+    const int SGWebSocketCodec::kOpcodeClose;
+    const int SGWebSocketCodec::kOpcodePing;
+    const int SGWebSocketCodec::kOpcodePong;
+    const int SGWebSocketCodec::kCompressionDisabled;
+    const int SGWebSocketCodec::kDefaultCompressionLevel;
+    const size_t SGWebSocketCodec::kMinCompressedMessageSize;
+    const size_t SGWebSocketCodec::kMaxMessageSize;
+    const int SGWebSocketCodec::kCloseInternalError;
+
+    // Frame header bits
+    static const uint8_t kFinalFrame = 0x80;
+    static const uint8_t kRsv1 = 0x40;
+    static const uint8_t kRsv2Rsv3 = 0x30;
+    static const uint8_t kOpcodeMask = 0x0F;
+    static const uint8_t kMaskedPayload = 0x80;
+    static const uint8_t kPayloadLengthMask = 0x7F;
+
+    // Close status codes
+    static const int kCloseProtocolError = 1002;
+    static const int kCloseInvalidPayload = 1007;
+    static const int kCloseMessageTooBig = 1009;
+
+    // A deflate sync flush always ends with these 4 bytes, permessage-deflate leaves them out of the frame.
+    static const char kDeflateTail[] = {0x00, 0x00, (char) 0xFF, (char) 0xFF};
+
+    static const size_t kZlibChunkSize = 16 * 1024;
+
+    // Appended to the Sec-WebSocket-Key before hashing, RFC 6455 section 1.3
+    static const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    static uint32_t rotateLeft(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    // SHA-1 (RFC 3174), only used for the handshake's Sec-WebSocket-Accept
+    static string sha1(const string &data) {
+        uint32_t hash[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        string message = data;
+        uint64_t bit_length = (uint64_t) data.size() * 8;
+        message += (char) 0x80;
+        while (message.size() % 64 != 56) {
+            message += (char) 0x00;
+        }
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            message += (char) ((bit_length >> shift) & 0xFF);
+        }
+
+        for (size_t block = 0; block < message.size(); block += 64) {
+            uint32_t words[80];
+            for (int index = 0; index < 16; ++index) {
+                const uint8_t *bytes = (const uint8_t *) message.data() + block + index * 4;
+                words[index] = ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) |
+                               ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+            }
+            for (int index = 16; index < 80; ++index) {
+                words[index] = rotateLeft(words[index - 3] ^ words[index - 8] ^ words[index - 14] ^ words[index - 16], 1);
+            }
+            uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4];
+            for (int index = 0; index < 80; ++index) {
+                uint32_t f, k;
+                if (index < 20) {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                } else if (index < 40) {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                } else if (index < 60) {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                } else {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t temp = rotateLeft(a, 5) + f + e + k + words[index];
+                e = d;
+                d = c;
+                c = rotateLeft(b, 30);
+                b = a;
+                a = temp;
+            }
+            hash[0] += a;
+            hash[1] += b;
+            hash[2] += c;
+            hash[3] += d;
+            hash[4] += e;
+        }
+
+        string digest;
+        for (uint32_t word : hash) {
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                digest += (char) ((word >> shift) & 0xFF);
+            }
+        }
+        return digest;
+    }
+
+    static string trim(const string &value) {
+        size_t first = value.find_first_not_of(" \t");
+        if (first == string::npos) {
+            return string();
+        }
+        size_t last = value.find_last_not_of(" \t");
+        return value.substr(first, last - first + 1);
+    }
+
+    SGWebSocketCodec::SGWebSocketCodec(Role role) : role_(role), mask_generator_(random_device()()) {
+        memset(&deflate_stream_, 0, sizeof(deflate_stream_));
+        memset(&inflate_stream_, 0, sizeof(inflate_stream_));
+    }
+
+    SGWebSocketCodec::~SGWebSocketCodec() {
+        releaseStreams();
+    }
+
+    std::string SGWebSocketCodec::extensionOffer() {
+        return "permessage-deflate; client_max_window_bits";
+    }
+
+    std::string SGWebSocketCodec::acceptKey(const std::string &websocket_key) {
+        return Base64Encode(sha1(websocket_key + kWebSocketGuid));
+    }
+
+    bool SGWebSocketCodec::acceptExtension(const std::string &extensions_header, int compression_level) {
+        if (compression_level == kCompressionDisabled || extensions_header.empty()) {
+            return false;
+        }
+
+        // i.e "permessage-deflate; server_no_context_takeover; client_max_window_bits=12"
+        stringstream parameters(extensions_header);
+        string parameter;
+        bool accepted = false;
+        bool client_no_context_takeover = false;
+        bool server_no_context_takeover = false;
+        int client_max_window_bits = 15;
+        while (getline(parameters, parameter, ';')) {
+            parameter = trim(parameter);
+            if (parameter == "permessage-deflate") {
+                accepted = true;
+            } else if (parameter == "client_no_context_takeover") {
+                client_no_context_takeover = true;
+            } else if (parameter == "server_no_context_takeover") {
+                server_no_context_takeover = true;
+            } else if (parameter.compare(0, 22, "client_max_window_bits") == 0) {
+                size_t equal = parameter.find('=');
+                if (equal != string::npos) {
+                    client_max_window_bits = atoi(parameter.c_str() + equal + 1);
+                }
+            }
+        }
+        if (!accepted) {
+            return false;
+        }
+
+        // zlib can't produce an 8 bit window for raw deflate and a bigger one breaks the server's inflate:
+        // enableDeflate() then only decompresses.
+        if (client_max_window_bits < 8 || client_max_window_bits > 15) {
+            qC4Warning(logDomainSGReplicator, "Invalid client_max_window_bits %d, permessage-deflate declined", client_max_window_bits);
+            return false;
+        }
+
+        if (role_ == Role::kClient) {
+            enableDeflate(compression_level, client_no_context_takeover, server_no_context_takeover,
+                          client_max_window_bits);
+        } else {
+            enableDeflate(compression_level, server_no_context_takeover, client_no_context_takeover);
+        }
+        return deflate_enabled_;
+    }
+
+    void SGWebSocketCodec::enableDeflate(int compression_level, bool compress_no_context_takeover,
+                                         bool decompress_no_context_takeover, int compress_window_bits) {
+        releaseStreams();
+        if (compression_level == kCompressionDisabled) {
+            return;
+        }
+
+        if (compress_window_bits < 9) {
+            qC4Info(logDomainSGReplicator, "Compression window of %d bits not supported, outgoing messages are sent uncompressed", compress_window_bits);
+        } else if (deflateInit2(&deflate_stream_, compression_level, Z_DEFLATED, -compress_window_bits, 8,
+                                Z_DEFAULT_STRATEGY) != Z_OK) {
+            qC4Critical(logDomainSGReplicator, "deflateInit2 failed, compression disabled");
+            return;
+        } else {
+            deflate_initialized_ = true;
+        }
+        if (inflateInit2(&inflate_stream_, -15) != Z_OK) {
+            qC4Critical(logDomainSGReplicator, "inflateInit2 failed, compression disabled");
+            releaseStreams();
+            return;
+        }
+        inflate_initialized_ = true;
+
+        compress_no_context_takeover_ = compress_no_context_takeover;
+        decompress_no_context_takeover_ = decompress_no_context_takeover;
+        deflate_enabled_ = true;
+    }
+
+    bool SGWebSocketCodec::isDeflateEnabled() const {
+        return deflate_enabled_;
+    }
+
+    bool SGWebSocketCodec::encode(int opcode, const void *data, size_t size, std::string &frame) {
+        const char *payload = (const char *) data;
+        string compressed_payload;
+        bool compressed = false;
+        if (deflate_failed_ && opcode < kOpcodeClose) {
+            return false;
+        }
+        // Once data went through the compressor it must be sent compressed, the peer's window depends on it.
+        if (deflate_initialized_ && opcode < kOpcodeClose && size >= kMinCompressedMessageSize) {
+            if (!deflate(payload, size, compressed_payload)) {
+                deflate_failed_ = true;
+                return false;
+            }
+            payload = compressed_payload.data();
+            size = compressed_payload.size();
+            compressed = true;
+        }
+
+        frame += (char) (kFinalFrame | (compressed ? kRsv1 : 0) | (opcode & kOpcodeMask));
+        uint8_t mask_bit = role_ == Role::kClient ? kMaskedPayload : 0;
+        if (size < 126) {
+            frame += (char) (mask_bit | size);
+        } else if (size <= 0xFFFF) {
+            frame += (char) (mask_bit | 126);
+            frame += (char) ((size >> 8) & 0xFF);
+            frame += (char) (size & 0xFF);
+        } else {
+            frame += (char) (mask_bit | 127);
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                frame += (char) (((uint64_t) size >> shift) & 0xFF);
+            }
+        }
+
+        if (role_ != Role::kClient) {
+            frame.append(payload, size);
+            return true;
+        }
+
+        uint32_t mask_key = mask_generator_();
+        char mask[4] = {(char) (mask_key >> 24), (char) (mask_key >> 16), (char) (mask_key >> 8), (char) mask_key};
+        frame.append(mask, 4);
+        size_t payload_start = frame.size();
+        frame.append(payload, size);
+        for (size_t index = 0; index < size; ++index) {
+            frame[payload_start + index] ^= mask[index & 3];
+        }
+        return true;
+    }
+
+    bool SGWebSocketCodec::decode(const void *data, size_t size,
+                                  const std::function<void(int opcode, const std::string &payload)> &on_message) {
+        if (close_status_ != 0) {
+            return false;
+        }
+        input_.append((const char *) data, size);
+
+        while (true) {
+            size_t available = input_.size() - input_offset_;
+            const uint8_t *header = (const uint8_t *) input_.data() + input_offset_;
+            if (available < 2) {
+                break;
+            }
+
+            bool final_frame = (header[0] & kFinalFrame) != 0;
+            bool rsv1 = (header[0] & kRsv1) != 0;
+            if ((header[0] & kRsv2Rsv3) != 0) {
+                close_status_ = kCloseProtocolError;
+                return false;
+            }
+            int opcode = header[0] & kOpcodeMask;
+            bool masked = (header[1] & kMaskedPayload) != 0;
+            uint64_t payload_length = header[1] & kPayloadLengthMask;
+            size_t header_length = 2;
+            if (payload_length == 126) {
+                header_length += 2;
+            } else if (payload_length == 127) {
+                header_length += 8;
+            }
+            if (masked) {
+                header_length += 4;
+            }
+            if (available < header_length) {
+                break;
+            }
+            if (payload_length == 126) {
+                payload_length = ((uint64_t) header[2] << 8) | header[3];
+            } else if (payload_length == 127) {
+                payload_length = 0;
+                for (int index = 2; index < 10; ++index) {
+                    payload_length = (payload_length << 8) | header[index];
+                }
+            }
+            if (payload_length > kMaxMessageSize || message_.size() + payload_length > kMaxMessageSize) {
+                close_status_ = kCloseMessageTooBig;
+                return false;
+            }
+            if (available < header_length + payload_length) {
+                break;
+            }
+
+            string payload((const char *) header + header_length, (size_t) payload_length);
+            if (masked) {
+                const uint8_t *mask = header + header_length - 4;
+                for (size_t index = 0; index < payload.size(); ++index) {
+                    payload[index] ^= mask[index & 3];
+                }
+            }
+            input_offset_ += header_length + (size_t) payload_length;
+
+            if (opcode >= kOpcodeClose) {
+                // Control frames can't be fragmented, and can come in the middle of a fragmented message
+                if (!final_frame || rsv1 || payload.size() > 125) {
+                    close_status_ = kCloseProtocolError;
+                    return false;
+                }
+                on_message(opcode, payload);
+                continue;
+            }
+
+            if (opcode != kOpcodeContinuation) {
+                if (in_message_) {
+                    close_status_ = kCloseProtocolError;
+                    return false;
+                }
+                in_message_ = true;
+                message_opcode_ = opcode;
+                message_compressed_ = rsv1;
+                message_.clear();
+            } else if (!in_message_ || rsv1) {
+                // RFC 7692 section 6.1: only the first frame of a message carries RSV1
+                close_status_ = kCloseProtocolError;
+                return false;
+            }
+            if (rsv1 && !deflate_enabled_) {
+                close_status_ = kCloseProtocolError;
+                return false;
+            }
+            message_ += payload;
+            if (!final_frame) {
+                continue;
+            }
+
+            in_message_ = false;
+            if (message_compressed_) {
+                string decompressed;
+                if (!inflate(message_, decompressed)) {
+                    close_status_ = kCloseInvalidPayload;
+                    return false;
+                }
+                message_.swap(decompressed);
+            }
+            on_message(message_opcode_, message_);
+            message_.clear();
+        }
+
+        // Drop consumed bytes once in a while instead of after every frame
+        if (input_offset_ == input_.size()) {
+            input_.clear();
+            input_offset_ = 0;
+        } else if (input_offset_ > kZlibChunkSize) {
+            input_.erase(0, input_offset_);
+            input_offset_ = 0;
+        }
+        return true;
+    }
+
+    int SGWebSocketCodec::getCloseStatus() const {
+        return close_status_;
+    }
+
+    uint64_t SGWebSocketCodec::getCompressionTimeNs() const {
+        return deflate_time_ns_ + inflate_time_ns_;
+    }
+
+    uint64_t SGWebSocketCodec::getDeflateTimeNs() const {
+        return deflate_time_ns_;
+    }
+
+    uint64_t SGWebSocketCodec::getInflateTimeNs() const {
+        return inflate_time_ns_;
+    }
+
+    bool SGWebSocketCodec::deflate(const char *data, size_t size, std::string &output) {
+        auto started_at = chrono::steady_clock::now();
+        deflate_stream_.next_in = (Bytef *) data;
+        deflate_stream_.avail_in = (uInt) size;
+        char chunk[kZlibChunkSize];
+        int result;
+        do {
+            deflate_stream_.next_out = (Bytef *) chunk;
+            deflate_stream_.avail_out = sizeof(chunk);
+            result = ::deflate(&deflate_stream_, Z_SYNC_FLUSH);
+            if (result != Z_OK && result != Z_BUF_ERROR) {
+                qC4Critical(logDomainSGReplicator, "deflate failed: %d", result);
+                return false;
+            }
+            output.append(chunk, sizeof(chunk) - deflate_stream_.avail_out);
+        } while (deflate_stream_.avail_out == 0);
+
+        if (output.size() >= 4 && memcmp(output.data() + output.size() - 4, kDeflateTail, 4) == 0) {
+            output.resize(output.size() - 4);
+        }
+        if (compress_no_context_takeover_) {
+            deflateReset(&deflate_stream_);
+        }
+        deflate_time_ns_ += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started_at).count();
+        return true;
+    }
+
+    bool SGWebSocketCodec::inflate(const std::string &input, std::string &output) {
+        auto started_at = chrono::steady_clock::now();
+        string compressed = input;
+        compressed.append(kDeflateTail, 4);
+        inflate_stream_.next_in = (Bytef *) compressed.data();
+        inflate_stream_.avail_in = (uInt) compressed.size();
+        char chunk[kZlibChunkSize];
+        do {
+            inflate_stream_.next_out = (Bytef *) chunk;
+            inflate_stream_.avail_out = sizeof(chunk);
+            int result = ::inflate(&inflate_stream_, Z_SYNC_FLUSH);
+            if (result != Z_OK && result != Z_BUF_ERROR && result != Z_STREAM_END) {
+                qC4Critical(logDomainSGReplicator, "inflate failed: %d", result);
+                return false;
+            }
+            output.append(chunk, sizeof(chunk) - inflate_stream_.avail_out);
+            if (output.size() > kMaxMessageSize) {
+                return false;
+            }
+        } while (inflate_stream_.avail_out == 0);
+
+        if (decompress_no_context_takeover_) {
+            inflateReset(&inflate_stream_);
+        }
+        inflate_time_ns_ += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started_at).count();
+        return true;
+    }
+
+    void SGWebSocketCodec::releaseStreams() {
+        if (deflate_initialized_) {
+            deflateEnd(&deflate_stream_);
+            deflate_initialized_ = false;
+        }
+        if (inflate_initialized_) {
+            inflateEnd(&inflate_stream_);
+            inflate_initialized_ = false;
+        }
+        memset(&deflate_stream_, 0, sizeof(deflate_stream_));
+        memset(&inflate_stream_, 0, sizeof(inflate_stream_));
+        deflate_enabled_ = false;
+        deflate_failed_ = false;
+    }
+}
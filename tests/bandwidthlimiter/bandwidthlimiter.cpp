@@ -0,0 +1,145 @@
+//
+//  bandwidthlimiter.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// SGWebSocketCodec tests: framing and permessage-deflate round trips, the RFC 7692 section 7.2.3 examples, protocol
+// SGBandwidthLimiter tests: the limiter registry, unlimited and limited directions, bursts, debt and refill, limit
+// changes and the throttle time. Exits with the number of failed checks.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+#include "SGBandwidthLimiter.h"
+
+using namespace std;
+using namespace Strata;
+
+static int failure_count = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failure_count++; \
+        } \
+    } while (0)
+
+typedef SGBandwidthLimiter::Direction Direction;
+
+static int64_t waitMs(const chrono::nanoseconds &wait) {
+    return chrono::duration_cast<chrono::milliseconds>(wait).count();
+}
+
+static void testRegistry() {
+    shared_ptr<SGBandwidthLimiter> first = SGBandwidthLimiter::create();
+    shared_ptr<SGBandwidthLimiter> second = SGBandwidthLimiter::create();
+    CHECK(first->getId() != 0);
+    CHECK(first->getId() != second->getId());
+    CHECK(SGBandwidthLimiter::process().getId() == 0);
+    CHECK(SGBandwidthLimiter::find(first->getId()) == first);
+    CHECK(SGBandwidthLimiter::find(second->getId()) == second);
+
+    // The registry doesn't keep limiters alive
+    uint64_t first_id = first->getId();
+    first.reset();
+    CHECK(SGBandwidthLimiter::find(first_id) == nullptr);
+    CHECK(SGBandwidthLimiter::find(second->getId()) == second);
+}
+
+static void testUnlimited() {
+    shared_ptr<SGBandwidthLimiter> limiter = SGBandwidthLimiter::create();
+    CHECK(limiter->getLimit(Direction::kUpload) == 0);
+    CHECK(limiter->getLimit(Direction::kDownload) == 0);
+    CHECK(limiter->reserve(Direction::kUpload, 1 << 30) == chrono::nanoseconds::zero());
+    CHECK(limiter->reserve(Direction::kDownload, 1 << 30) == chrono::nanoseconds::zero());
+
+    // Back to unlimited
+    limiter->setLimits(1000, 1000);
+    limiter->setLimits(0, 0);
+    CHECK(limiter->reserve(Direction::kUpload, 1 << 30) == chrono::nanoseconds::zero());
+}
+
+static void testBurstAndDebt() {
+    shared_ptr<SGBandwidthLimiter> limiter = SGBandwidthLimiter::create();
+    limiter->setLimits(1000, 0, 500);
+    CHECK(limiter->getLimit(Direction::kUpload) == 1000);
+    CHECK(limiter->getLimit(Direction::kDownload) == 0);
+
+    // A new limit starts with a full bucket of burst_bytes
+    CHECK(limiter->reserve(Direction::kUpload, 500) == chrono::nanoseconds::zero());
+    // 100 bytes of debt at 1000 bytes/s
+    int64_t wait_ms = waitMs(limiter->reserve(Direction::kUpload, 100));
+    CHECK(wait_ms > 50 && wait_ms <= 100);
+    // The debt adds up
+    wait_ms = waitMs(limiter->reserve(Direction::kUpload, 100));
+    CHECK(wait_ms > 150 && wait_ms <= 200);
+    CHECK(limiter->reserve(Direction::kDownload, 1 << 30) == chrono::nanoseconds::zero());
+
+    // Changing a limit keeps the debt
+    limiter->setLimits(1000, 0, 500);
+    CHECK(limiter->reserve(Direction::kUpload, 0) > chrono::nanoseconds::zero());
+}
+
+static void testDefaultBurstAndRefill() {
+    shared_ptr<SGBandwidthLimiter> limiter = SGBandwidthLimiter::create();
+    // Without burst_bytes, one second worth of traffic
+    limiter->setLimits(0, 2000);
+    CHECK(limiter->reserve(Direction::kDownload, 2000) == chrono::nanoseconds::zero());
+    int64_t wait_ms = waitMs(limiter->reserve(Direction::kDownload, 100));
+    CHECK(wait_ms > 0 && wait_ms <= 50);
+
+    // Waiting pays the debt back
+    this_thread::sleep_for(chrono::milliseconds(wait_ms + 20));
+    CHECK(limiter->reserve(Direction::kDownload, 0) == chrono::nanoseconds::zero());
+
+    // The bucket doesn't fill past its capacity while idle
+    limiter->setLimits(0, 100000, 1000);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    CHECK(limiter->reserve(Direction::kDownload, 1000) == chrono::nanoseconds::zero());
+    CHECK(limiter->reserve(Direction::kDownload, 500) > chrono::nanoseconds::zero());
+}
+
+static void testThrottleTime() {
+    shared_ptr<SGBandwidthLimiter> limiter = SGBandwidthLimiter::create();
+    CHECK(limiter->getThrottleTimeMs(Direction::kUpload) == 0);
+    limiter->addThrottleTime(Direction::kUpload, chrono::milliseconds(1500));
+    limiter->addThrottleTime(Direction::kUpload, chrono::microseconds(500));
+    CHECK(limiter->getThrottleTimeMs(Direction::kUpload) == 1500);
+    CHECK(limiter->getThrottleTimeMs(Direction::kDownload) == 0);
+}
+
+int main(int argc, const char *argv[]) {
+    testRegistry();
+    testUnlimited();
+    testBurstAndDebt();
+    testDefaultBurstAndRefill();
+    testThrottleTime();
+
+    if (failure_count > 0) {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+    } else {
+        printf("All SGBandwidthLimiter tests passed\n");
+    }
+    return failure_count;
+}
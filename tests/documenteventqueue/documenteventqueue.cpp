@@ -0,0 +1,253 @@
+//
+//  documenteventqueue.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// SGWebSocketCodec tests: framing and permessage-deflate round trips, the RFC 7692 section 7.2.3 examples, protocol
+// SGDocumentEventQueue tests: the kBlock, kDropOldest and kCoalesce overflow policies, long doc ids, close() and
+// waitForEvents(). Exits with the number of failed checks.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SGDocumentEventQueue.h"
+
+using namespace std;
+using namespace Strata;
+
+static int failure_count = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failure_count++; \
+        } \
+    } while (0)
+
+static void push(SGDocumentEventQueue &queue, const string &doc_id, bool pushing = true, int32_t error_code = 0) {
+    C4Error error {};
+    if (error_code != 0) {
+        error.domain = LiteCoreDomain;
+        error.code = error_code;
+    }
+    queue.push(pushing, c4str(doc_id.c_str()), error, false);
+}
+
+static vector<string> drainDocIds(SGDocumentEventQueue &queue) {
+    vector<SGDocumentEndedEvent> events;
+    queue.drain(events);
+    vector<string> doc_ids;
+    for (const SGDocumentEndedEvent &event : events) {
+        doc_ids.push_back(event.getDocId());
+    }
+    return doc_ids;
+}
+
+static void testEvent() {
+    SGDocumentEventQueue queue(8);
+    string long_doc_id(SGDocumentEndedEvent::kInlineDocIdLength + 10, 'x');
+    push(queue, "short", true);
+    push(queue, long_doc_id, false, kC4ErrorNotFound);
+
+    vector<SGDocumentEndedEvent> events;
+    CHECK(queue.drain(events) == 2);
+    CHECK(events.size() == 2);
+    if (events.size() == 2) {
+        CHECK(events[0].getDocId() == "short");
+        CHECK(events[0].isPushing());
+        CHECK(!events[0].isError());
+        CHECK(events[0].getErrorMessage().empty());
+        CHECK(events[1].getDocId() == long_doc_id);
+        CHECK(!events[1].isPushing());
+        CHECK(events[1].isError());
+        CHECK(events[1].getError().code == kC4ErrorNotFound);
+    }
+}
+
+static void testBlock() {
+    const int kEventCount = 200;
+    SGDocumentEventQueue queue(4, SGDocumentEventQueue::OverflowPolicy::kBlock);
+    thread producer([&queue, kEventCount]() {
+        for (int index = 0; index < kEventCount; ++index) {
+            push(queue, "doc" + to_string(index));
+        }
+    });
+
+    // A slow consumer: the producer waits for room, nothing is lost or reordered
+    vector<string> doc_ids;
+    while (doc_ids.size() < (size_t) kEventCount) {
+        if (!queue.waitForEvents(chrono::milliseconds(1000))) {
+            break;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+        vector<string> drained = drainDocIds(queue);
+        doc_ids.insert(doc_ids.end(), drained.begin(), drained.end());
+    }
+    producer.join();
+
+    CHECK(doc_ids.size() == (size_t) kEventCount);
+    for (size_t index = 0; index < doc_ids.size(); ++index) {
+        CHECK(doc_ids[index] == "doc" + to_string(index));
+    }
+    SGDocumentEventQueueStats stats = queue.getStats();
+    CHECK(stats.enqueued_count == (uint64_t) kEventCount);
+    CHECK(stats.delivered_count == (uint64_t) kEventCount);
+    CHECK(stats.dropped_count == 0);
+    CHECK(stats.blocked_count > 0);
+}
+
+static void testBlockReleasedByClose() {
+    SGDocumentEventQueue queue(2, SGDocumentEventQueue::OverflowPolicy::kBlock);
+    push(queue, "doc0");
+    push(queue, "doc1");
+    thread producer([&queue]() {
+        push(queue, "doc2");
+    });
+    this_thread::sleep_for(chrono::milliseconds(50));
+    queue.close();
+    producer.join();
+
+    CHECK(queue.isClosed());
+    push(queue, "doc3");
+    SGDocumentEventQueueStats stats = queue.getStats();
+    CHECK(stats.enqueued_count == 2);
+    CHECK(stats.dropped_count == 2);
+    CHECK(stats.blocked_count == 1);
+}
+
+static void testDropOldest() {
+    SGDocumentEventQueue queue(4, SGDocumentEventQueue::OverflowPolicy::kDropOldest);
+    for (int index = 0; index < 10; ++index) {
+        push(queue, "doc" + to_string(index));
+    }
+
+    vector<string> doc_ids = drainDocIds(queue);
+    CHECK((doc_ids == vector<string> {"doc6", "doc7", "doc8", "doc9"}));
+    SGDocumentEventQueueStats stats = queue.getStats();
+    CHECK(stats.enqueued_count == 10);
+    CHECK(stats.dropped_count == 6);
+    CHECK(stats.delivered_count == 4);
+}
+
+static void testCoalesce() {
+    SGDocumentEventQueue queue(4, SGDocumentEventQueue::OverflowPolicy::kCoalesce);
+    for (int index = 0; index < 4; ++index) {
+        push(queue, "ring" + to_string(index));
+    }
+    // The ring buffer is full from here on
+    push(queue, "doc0", true, kC4ErrorNotFound);
+    push(queue, "doc1");
+    push(queue, "doc0");
+    push(queue, "doc0");
+    // A pull of the same document is a different event
+    push(queue, "doc0", false);
+
+    vector<SGDocumentEndedEvent> events;
+    CHECK(queue.drain(events) == 7);
+    CHECK(events.size() == 7);
+    if (events.size() == 7) {
+        for (int index = 0; index < 4; ++index) {
+            CHECK(events[index].getDocId() == "ring" + to_string(index));
+        }
+        // The latest event, in the place of the first one
+        CHECK(events[4].getDocId() == "doc0");
+        CHECK(events[4].isPushing());
+        CHECK(!events[4].isError());
+        CHECK(events[4].getCoalescedCount() == 2);
+        CHECK(events[5].getDocId() == "doc1");
+        CHECK(events[5].getCoalescedCount() == 0);
+        CHECK(events[6].getDocId() == "doc0");
+        CHECK(!events[6].isPushing());
+    }
+    SGDocumentEventQueueStats stats = queue.getStats();
+    CHECK(stats.coalesced_count == 2);
+    CHECK(stats.dropped_count == 0);
+    CHECK(stats.delivered_count == 7);
+
+    // Drained, events go to the ring buffer again
+    push(queue, "doc2");
+    CHECK((drainDocIds(queue) == vector<string> {"doc2"}));
+}
+
+static void testCoalesceOverflowBound() {
+    SGDocumentEventQueue queue(2, SGDocumentEventQueue::OverflowPolicy::kCoalesce);
+    for (int index = 0; index < 6; ++index) {
+        push(queue, "doc" + to_string(index));
+    }
+
+    // Two events in the ring buffer, two in the overflow, which is bounded by the capacity too
+    vector<string> doc_ids = drainDocIds(queue);
+    CHECK((doc_ids == vector<string> {"doc0", "doc1", "doc2", "doc3"}));
+    CHECK(queue.getStats().dropped_count == 2);
+}
+
+static void testPartialDrain() {
+    SGDocumentEventQueue queue(2, SGDocumentEventQueue::OverflowPolicy::kCoalesce);
+    for (int index = 0; index < 4; ++index) {
+        push(queue, "doc" + to_string(index));
+    }
+
+    vector<SGDocumentEndedEvent> events;
+    CHECK(queue.drain(events, 3) == 3);
+    // The overflow index follows the events left, doc3 still coalesces
+    push(queue, "doc3");
+    events.clear();
+    CHECK(queue.drain(events) == 1);
+    CHECK(events.size() == 1 && events[0].getDocId() == "doc3" && events[0].getCoalescedCount() == 1);
+}
+
+static void testWaitForEvents() {
+    SGDocumentEventQueue queue(4);
+    CHECK(!queue.waitForEvents(chrono::milliseconds(10)));
+
+    thread producer([&queue]() {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        push(queue, "doc0");
+    });
+    CHECK(queue.waitForEvents(chrono::milliseconds(5000)));
+    producer.join();
+    CHECK(drainDocIds(queue).size() == 1);
+
+    queue.close();
+    CHECK(!queue.waitForEvents(chrono::milliseconds(10)));
+}
+
+int main(int argc, const char *argv[]) {
+    testEvent();
+    testBlock();
+    testBlockReleasedByClose();
+    testDropOldest();
+    testCoalesce();
+    testCoalesceOverflowBound();
+    testPartialDrain();
+    testWaitForEvents();
+
+    if (failure_count > 0) {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+    } else {
+        printf("All SGDocumentEventQueue tests passed\n");
+    }
+    return failure_count;
+}
@@ -0,0 +1,168 @@
+//
+//  histogram.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// SGWebSocketCodec tests: framing and permessage-deflate round trips, the RFC 7692 section 7.2.3 examples, protocol
+// SGHistogram tests: bucket bounds over the whole 64 bit range, snapshots, percentiles and reset. Exits with the
+// number of failed checks.
+
+#include <cstdio>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "SGHistogram.h"
+
+using namespace std;
+using namespace Strata;
+
+static int failure_count = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failure_count++; \
+        } \
+    } while (0)
+
+// The bucket a single recorded value lands in, or kBucketCount if none
+static size_t bucketOf(uint64_t value) {
+    SGHistogram histogram;
+    histogram.record(value);
+    SGHistogramSnapshot snapshot = histogram.snapshot();
+    for (size_t index = 0; index < snapshot.bucket_counts.size(); ++index) {
+        if (snapshot.bucket_counts[index] > 0) {
+            return index;
+        }
+    }
+    return SGHistogram::kBucketCount;
+}
+
+static void testBucketBounds() {
+    // Exact buckets below kSubBucketCount
+    for (uint64_t value = 0; value < SGHistogram::kSubBucketCount; ++value) {
+        CHECK(SGHistogram::bucketUpperBound((size_t) value) == value);
+        CHECK(bucketOf(value) == value);
+    }
+
+    // Every bucket starts right after the previous one and holds both of its bounds
+    for (size_t index = SGHistogram::kSubBucketCount; index < SGHistogram::kBucketCount; ++index) {
+        uint64_t lower_bound = SGHistogram::bucketUpperBound(index - 1) + 1;
+        uint64_t upper_bound = SGHistogram::bucketUpperBound(index);
+        if (upper_bound < lower_bound) {
+            fprintf(stderr, "bucket %zu: upper bound %llu below lower bound %llu\n", index,
+                    (unsigned long long) upper_bound, (unsigned long long) lower_bound);
+            failure_count++;
+            break;
+        }
+        CHECK(bucketOf(lower_bound) == index);
+        CHECK(bucketOf(upper_bound) == index);
+        // Relative error under 1 / kSubBucketCount
+        CHECK(upper_bound - lower_bound < lower_bound / SGHistogram::kSubBucketCount);
+    }
+
+    CHECK(SGHistogram::bucketUpperBound(SGHistogram::kBucketCount - 1) == numeric_limits<uint64_t>::max());
+    CHECK(bucketOf(numeric_limits<uint64_t>::max()) == SGHistogram::kBucketCount - 1);
+}
+
+static void testSnapshot() {
+    SGHistogram histogram;
+    SGHistogramSnapshot empty = histogram.snapshot();
+    CHECK(empty.count == 0);
+    CHECK(empty.min == 0);
+    CHECK(empty.max == 0);
+    CHECK(empty.mean() == 0.0);
+    CHECK(empty.percentile(50) == 0);
+    CHECK(empty.bucket_counts.size() == SGHistogram::kBucketCount);
+
+    for (uint64_t value = 1; value <= 100; ++value) {
+        histogram.record(value);
+    }
+    SGHistogramSnapshot snapshot = histogram.snapshot();
+    CHECK(snapshot.count == 100);
+    CHECK(snapshot.min == 1);
+    CHECK(snapshot.max == 100);
+    CHECK(snapshot.sum == 5050);
+    CHECK(snapshot.mean() == 50.5);
+
+    // The upper bound of the matching bucket, within the bucket width of the exact value
+    uint64_t median = snapshot.percentile(50);
+    CHECK(median >= 50 && median <= 50 + 50 / SGHistogram::kSubBucketCount);
+    uint64_t p99 = snapshot.percentile(99);
+    CHECK(p99 >= 99 && p99 <= 100);
+    // Capped at the largest recorded value
+    CHECK(snapshot.percentile(100) == 100);
+    CHECK(snapshot.percentile(150) == 100);
+    CHECK(snapshot.percentile(0) == 1);
+    CHECK(snapshot.percentile(-10) == 1);
+
+    histogram.reset();
+    SGHistogramSnapshot reset = histogram.snapshot();
+    CHECK(reset.count == 0);
+    CHECK(reset.min == 0);
+    CHECK(reset.max == 0);
+    CHECK(reset.sum == 0);
+    // The snapshot taken before the reset is unchanged
+    CHECK(snapshot.count == 100);
+}
+
+static void testConcurrentRecord() {
+    const int kThreadCount = 4;
+    const uint64_t kValuesPerThread = 10000;
+    SGHistogram histogram;
+    vector<thread> threads;
+    for (int thread_index = 0; thread_index < kThreadCount; ++thread_index) {
+        threads.emplace_back([&histogram, kValuesPerThread]() {
+            for (uint64_t value = 1; value <= kValuesPerThread; ++value) {
+                histogram.record(value);
+            }
+        });
+    }
+    for (thread &worker : threads) {
+        worker.join();
+    }
+
+    SGHistogramSnapshot snapshot = histogram.snapshot();
+    uint64_t bucket_total = 0;
+    for (uint64_t bucket_count : snapshot.bucket_counts) {
+        bucket_total += bucket_count;
+    }
+    CHECK(snapshot.count == kThreadCount * kValuesPerThread);
+    CHECK(bucket_total == snapshot.count);
+    CHECK(snapshot.sum == kThreadCount * kValuesPerThread * (kValuesPerThread + 1) / 2);
+    CHECK(snapshot.min == 1);
+    CHECK(snapshot.max == kValuesPerThread);
+}
+
+int main(int argc, const char *argv[]) {
+    testBucketBounds();
+    testSnapshot();
+    testConcurrentRecord();
+
+    if (failure_count > 0) {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+    } else {
+        printf("All SGHistogram tests passed\n");
+    }
+    return failure_count;
+}
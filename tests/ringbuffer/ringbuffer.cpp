@@ -0,0 +1,174 @@
+//
+//  ringbuffer.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// SGWebSocketCodec tests: framing and permessage-deflate round trips, the RFC 7692 section 7.2.3 examples, protocol
+// SGRingBuffer tests: capacity rounding, FIFO order, full and empty queues, wrap around and concurrent producers and
+// consumers. Exits with the number of failed checks.
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SGRingBuffer.h"
+
+using namespace std;
+using namespace Strata;
+
+static int failure_count = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failure_count++; \
+        } \
+    } while (0)
+
+static void testCapacity() {
+    CHECK(SGRingBuffer<int>(0).capacity() == 2);
+    CHECK(SGRingBuffer<int>(1).capacity() == 2);
+    CHECK(SGRingBuffer<int>(5).capacity() == 8);
+    CHECK(SGRingBuffer<int>(16).capacity() == 16);
+    CHECK(SGRingBuffer<int>(17).capacity() == 32);
+}
+
+static void testFullAndEmpty() {
+    SGRingBuffer<string> ring_buffer(4);
+    string item;
+    CHECK(!ring_buffer.tryPop(item));
+    CHECK(ring_buffer.sizeApprox() == 0);
+
+    for (int index = 0; index < 4; ++index) {
+        string value = to_string(index);
+        CHECK(ring_buffer.tryPush(move(value)));
+    }
+    CHECK(ring_buffer.sizeApprox() == 4);
+
+    // A refused item is left untouched
+    string refused = "refused";
+    CHECK(!ring_buffer.tryPush(move(refused)));
+    CHECK(refused == "refused");
+
+    for (int index = 0; index < 4; ++index) {
+        CHECK(ring_buffer.tryPop(item));
+        CHECK(item == to_string(index));
+    }
+    CHECK(!ring_buffer.tryPop(item));
+    CHECK(ring_buffer.sizeApprox() == 0);
+}
+
+static void testWrapAround() {
+    SGRingBuffer<int> ring_buffer(4);
+    int next_pushed = 0;
+    int next_popped = 0;
+    // Positions go around the slots many times, with the queue at every fill level
+    for (int round = 0; round < 1000; ++round) {
+        int push_count = 1 + round % 4;
+        for (int index = 0; index < push_count; ++index) {
+            int value = next_pushed;
+            if (ring_buffer.tryPush(move(value))) {
+                next_pushed++;
+            }
+        }
+        int pop_count = 1 + (round * 7) % 4;
+        int item;
+        for (int index = 0; index < pop_count && ring_buffer.tryPop(item); ++index) {
+            CHECK(item == next_popped);
+            next_popped++;
+        }
+    }
+    int item;
+    while (ring_buffer.tryPop(item)) {
+        CHECK(item == next_popped);
+        next_popped++;
+    }
+    CHECK(next_popped == next_pushed);
+    CHECK(next_pushed > 1000);
+}
+
+static void testConcurrentProducersAndConsumers() {
+    const int kThreadCount = 4;
+    const int kItemsPerProducer = 20000;
+    SGRingBuffer<int> ring_buffer(64);
+    atomic<int> popped_count {0};
+    atomic<long long> popped_sum {0};
+    vector<vector<int>> last_seen(kThreadCount, vector<int>(kThreadCount, -1));
+    atomic<int> out_of_order_count {0};
+
+    vector<thread> threads;
+    for (int producer = 0; producer < kThreadCount; ++producer) {
+        threads.emplace_back([&ring_buffer, producer, kItemsPerProducer]() {
+            for (int index = 0; index < kItemsPerProducer; ++index) {
+                // The producer in the high bits, its sequence in the low ones
+                int item = producer * kItemsPerProducer + index;
+                while (!ring_buffer.tryPush(move(item))) {
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int consumer = 0; consumer < kThreadCount; ++consumer) {
+        threads.emplace_back([&, consumer]() {
+            int item;
+            while (popped_count.load() < kThreadCount * kItemsPerProducer) {
+                if (!ring_buffer.tryPop(item)) {
+                    this_thread::yield();
+                    continue;
+                }
+                popped_count++;
+                popped_sum += item;
+                // Each consumer sees the items of a producer in the order they were pushed
+                int producer = item / kItemsPerProducer;
+                if (item <= last_seen[consumer][producer]) {
+                    out_of_order_count++;
+                }
+                last_seen[consumer][producer] = item;
+            }
+        });
+    }
+    for (thread &worker : threads) {
+        worker.join();
+    }
+
+    long long item_count = (long long) kThreadCount * kItemsPerProducer;
+    CHECK(popped_count.load() == item_count);
+    CHECK(popped_sum.load() == item_count * (item_count - 1) / 2);
+    CHECK(out_of_order_count.load() == 0);
+    CHECK(ring_buffer.sizeApprox() == 0);
+}
+
+int main(int argc, const char *argv[]) {
+    testCapacity();
+    testFullAndEmpty();
+    testWrapAround();
+    testConcurrentProducersAndConsumers();
+
+    if (failure_count > 0) {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+    } else {
+        printf("All SGRingBuffer tests passed\n");
+    }
+    return failure_count;
+}
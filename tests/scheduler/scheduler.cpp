@@ -0,0 +1,191 @@
+//
+//  scheduler.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// SGWebSocketCodec tests: framing and permessage-deflate round trips, the RFC 7692 section 7.2.3 examples, protocol
+// SGScheduler tests: delays, run order, periodic tasks, cancel(), stop() and tasks scheduled from a task. Exits with
+// the number of failed checks.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SGScheduler.h"
+
+using namespace std;
+using namespace Strata;
+
+static int failure_count = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failure_count++; \
+        } \
+    } while (0)
+
+typedef chrono::steady_clock Clock;
+
+static bool waitFor(const function<bool()> &condition, const chrono::milliseconds &timeout = chrono::milliseconds(5000)) {
+    Clock::time_point deadline = Clock::now() + timeout;
+    while (!condition()) {
+        if (Clock::now() > deadline) {
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void testDelay() {
+    SGScheduler scheduler;
+    atomic<bool> ran {false};
+    Clock::time_point scheduled_at = Clock::now();
+    Clock::time_point ran_at;
+    SGScheduler::TaskId task_id = scheduler.scheduleAfter(chrono::milliseconds(50), [&ran, &ran_at]() {
+        ran_at = Clock::now();
+        ran = true;
+    });
+    CHECK(task_id != 0);
+    CHECK(waitFor([&ran]() { return ran.load(); }));
+    CHECK(ran_at - scheduled_at >= chrono::milliseconds(50));
+
+    // Nothing to run without a task
+    CHECK(scheduler.scheduleAfter(chrono::milliseconds(0), function<void()>()) == 0);
+}
+
+static void testOrder() {
+    SGScheduler scheduler;
+    mutex order_lock;
+    vector<int> order;
+    auto record = [&order_lock, &order](int value) {
+        return [&order_lock, &order, value]() {
+            lock_guard<mutex> lock(order_lock);
+            order.push_back(value);
+        };
+    };
+
+    // Zero delays run in scheduling order, later deadlines after them whatever the scheduling order
+    scheduler.scheduleAfter(chrono::milliseconds(60), record(5));
+    scheduler.scheduleAfter(chrono::milliseconds(30), record(4));
+    for (int value = 1; value <= 3; ++value) {
+        scheduler.scheduleAfter(chrono::milliseconds(0), record(value));
+    }
+    CHECK(waitFor([&order_lock, &order]() {
+        lock_guard<mutex> lock(order_lock);
+        return order.size() == 5;
+    }));
+    lock_guard<mutex> lock(order_lock);
+    CHECK((order == vector<int> {1, 2, 3, 4, 5}));
+}
+
+static void testEveryAndCancel() {
+    SGScheduler scheduler;
+    atomic<int> run_count {0};
+    SGScheduler::TaskId task_id = scheduler.scheduleEvery(chrono::milliseconds(10), [&run_count]() {
+        run_count++;
+    });
+    CHECK(waitFor([&run_count]() { return run_count.load() >= 3; }));
+
+    scheduler.cancel(task_id);
+    // A run already in progress may still finish
+    this_thread::sleep_for(chrono::milliseconds(20));
+    int cancelled_count = run_count.load();
+    this_thread::sleep_for(chrono::milliseconds(50));
+    CHECK(run_count.load() == cancelled_count);
+
+    // A pending task never runs once cancelled
+    atomic<bool> ran {false};
+    task_id = scheduler.scheduleAfter(chrono::milliseconds(30), [&ran]() {
+        ran = true;
+    });
+    scheduler.cancel(task_id);
+    this_thread::sleep_for(chrono::milliseconds(60));
+    CHECK(!ran.load());
+}
+
+static void testBlockingTask() {
+    SGScheduler scheduler;
+    atomic<bool> ran {false};
+    Clock::time_point scheduled_at = Clock::now();
+    Clock::time_point ran_at;
+    // One thread: a blocking task holds up the tasks due after it
+    scheduler.scheduleAfter(chrono::milliseconds(0), []() {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    });
+    scheduler.scheduleAfter(chrono::milliseconds(10), [&ran, &ran_at]() {
+        ran_at = Clock::now();
+        ran = true;
+    });
+    CHECK(waitFor([&ran]() { return ran.load(); }));
+    CHECK(ran_at - scheduled_at >= chrono::milliseconds(100));
+}
+
+static void testScheduleFromTask() {
+    SGScheduler scheduler;
+    atomic<int> run_count {0};
+    scheduler.scheduleAfter(chrono::milliseconds(0), [&scheduler, &run_count]() {
+        run_count++;
+        scheduler.scheduleAfter(chrono::milliseconds(10), [&run_count]() {
+            run_count++;
+        });
+    });
+    CHECK(waitFor([&run_count]() { return run_count.load() == 2; }));
+}
+
+static void testStop() {
+    SGScheduler scheduler;
+    atomic<bool> ran {false};
+    scheduler.scheduleAfter(chrono::milliseconds(50), [&ran]() {
+        ran = true;
+    });
+    // Drops the pending task and refuses new ones
+    scheduler.stop();
+    CHECK(scheduler.scheduleAfter(chrono::milliseconds(0), [&ran]() { ran = true; }) == 0);
+    this_thread::sleep_for(chrono::milliseconds(80));
+    CHECK(!ran.load());
+    // Stopping twice, and a scheduler that never ran a task, are fine
+    scheduler.stop();
+    SGScheduler unused_scheduler;
+    unused_scheduler.stop();
+}
+
+int main(int argc, const char *argv[]) {
+    testDelay();
+    testOrder();
+    testEveryAndCancel();
+    testBlockingTask();
+    testScheduleFromTask();
+    testStop();
+
+    if (failure_count > 0) {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+    } else {
+        printf("All SGScheduler tests passed\n");
+    }
+    return failure_count;
+}
@@ -0,0 +1,309 @@
+//
+//  websocketcodec.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// SGWebSocketCodec tests: framing and permessage-deflate round trips, the RFC 7692 section 7.2.3 examples, protocol
+// errors and the handshake's Sec-WebSocket-Accept. Exits with the number of failed checks.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SGWebSocketCodec.h"
+
+using namespace std;
+using namespace Strata;
+
+static int failure_count = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failure_count++; \
+        } \
+    } while (0)
+
+struct Message {
+    int opcode;
+    string payload;
+};
+
+static string bytes(const vector<int> &values) {
+    string result;
+    for (int value : values) {
+        result += (char) value;
+    }
+    return result;
+}
+
+static bool decodeAll(SGWebSocketCodec &codec, const string &data, vector<Message> &messages) {
+    return codec.decode(data.data(), data.size(), [&messages](int opcode, const string &payload) {
+        messages.push_back({opcode, payload});
+    });
+}
+
+static string makePayload(size_t size, bool compressible) {
+    string payload;
+    uint32_t seed = 12345;
+    for (size_t index = 0; index < size; ++index) {
+        seed = seed * 1103515245 + 12345;
+        payload += compressible ? (char) ('a' + (index / 7) % 5) : (char) (seed >> 16);
+    }
+    return payload;
+}
+
+static void testRoundTrip(bool deflate) {
+    SGWebSocketCodec client(SGWebSocketCodec::Role::kClient);
+    SGWebSocketCodec server(SGWebSocketCodec::Role::kServer);
+    if (deflate) {
+        client.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        server.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+    }
+
+    // Every payload length encoding, compressible and not, the compressors keep their window between messages
+    vector<size_t> sizes = {0, 1, 63, 64, 125, 126, 127, 65535, 65536, 300000};
+    for (int compressible = 0; compressible < 2; ++compressible) {
+        for (size_t size : sizes) {
+            string payload = makePayload(size, compressible != 0);
+
+            string frame;
+            CHECK(client.encode(SGWebSocketCodec::kOpcodeBinary, payload.data(), payload.size(), frame));
+            CHECK(((uint8_t) frame[1] & 0x80) != 0);
+            bool compressed = ((uint8_t) frame[0] & 0x40) != 0;
+            CHECK(compressed == (deflate && size >= SGWebSocketCodec::kMinCompressedMessageSize));
+            vector<Message> messages;
+            CHECK(decodeAll(server, frame, messages));
+            CHECK(messages.size() == 1 && messages[0].opcode == SGWebSocketCodec::kOpcodeBinary &&
+                  messages[0].payload == payload);
+
+            frame.clear();
+            CHECK(server.encode(SGWebSocketCodec::kOpcodeText, payload.data(), payload.size(), frame));
+            CHECK(((uint8_t) frame[1] & 0x80) == 0);
+            // Fed one byte at a time, decode() has to wait for whole frames
+            messages.clear();
+            for (char byte : frame) {
+                CHECK(client.decode(&byte, 1, [&messages](int opcode, const string &data) {
+                    messages.push_back({opcode, data});
+                }));
+            }
+            CHECK(messages.size() == 1 && messages[0].opcode == SGWebSocketCodec::kOpcodeText &&
+                  messages[0].payload == payload);
+        }
+    }
+
+    // Control frames are never compressed
+    string frame;
+    CHECK(client.encode(SGWebSocketCodec::kOpcodePing, "ping", 4, frame));
+    CHECK(((uint8_t) frame[0] & 0x40) == 0);
+    vector<Message> messages;
+    CHECK(decodeAll(server, frame, messages));
+    CHECK(messages.size() == 1 && messages[0].opcode == SGWebSocketCodec::kOpcodePing && messages[0].payload == "ping");
+}
+
+static void testNoContextTakeover() {
+    SGWebSocketCodec client(SGWebSocketCodec::Role::kClient);
+    SGWebSocketCodec server(SGWebSocketCodec::Role::kServer);
+    CHECK(client.acceptExtension("permessage-deflate; client_no_context_takeover; server_no_context_takeover",
+                                 SGWebSocketCodec::kDefaultCompressionLevel));
+    server.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel, true, true);
+
+    string payload = makePayload(4096, true);
+    string first_frame;
+    string second_frame;
+    CHECK(client.encode(SGWebSocketCodec::kOpcodeBinary, payload.data(), payload.size(), first_frame));
+    CHECK(client.encode(SGWebSocketCodec::kOpcodeBinary, payload.data(), payload.size(), second_frame));
+    // Without context takeover the same message compresses to the same bytes, masks aside
+    CHECK(first_frame.size() == second_frame.size());
+
+    vector<Message> messages;
+    CHECK(decodeAll(server, first_frame + second_frame, messages));
+    CHECK(messages.size() == 2 && messages[0].payload == payload && messages[1].payload == payload);
+}
+
+static void testRfc7692Examples() {
+    // Section 7.2.3.1, a message compressed on its own
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(decodeAll(codec, bytes({0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00}), messages));
+        CHECK(messages.size() == 1 && messages[0].opcode == SGWebSocketCodec::kOpcodeText &&
+              messages[0].payload == "Hello");
+    }
+
+    // Section 7.2.3.1, the same message fragmented
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(decodeAll(codec, bytes({0x41, 0x03, 0xf2, 0x48, 0xcd}), messages));
+        CHECK(messages.empty());
+        CHECK(decodeAll(codec, bytes({0x80, 0x04, 0xc9, 0xc9, 0x07, 0x00}), messages));
+        CHECK(messages.size() == 1 && messages[0].payload == "Hello");
+    }
+
+    // Section 7.2.3.2, the second message uses the first one's LZ77 window
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(decodeAll(codec, bytes({0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00}), messages));
+        CHECK(decodeAll(codec, bytes({0xc1, 0x05, 0xf2, 0x00, 0x11, 0x00, 0x00}), messages));
+        CHECK(messages.size() == 2 && messages[0].payload == "Hello" && messages[1].payload == "Hello");
+    }
+
+    // Section 7.2.3.3, a stored (uncompressed) DEFLATE block
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(decodeAll(codec, bytes({0xc1, 0x0b, 0x00, 0x05, 0x00, 0xfa, 0xff, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x00}),
+                        messages));
+        CHECK(messages.size() == 1 && messages[0].payload == "Hello");
+    }
+
+    // Section 7.2.3.5, two DEFLATE blocks in one message
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(decodeAll(codec, bytes({0xc1, 0x0d, 0xf2, 0x48, 0x05, 0x00, 0x00, 0x00, 0xff, 0xff, 0xca, 0xc9, 0xc9,
+                                      0x07, 0x00}), messages));
+        CHECK(messages.size() == 1 && messages[0].payload == "Hello");
+    }
+}
+
+static void testProtocolErrors() {
+    // RSV1 without permessage-deflate
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        vector<Message> messages;
+        CHECK(!decodeAll(codec, bytes({0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00}), messages));
+        CHECK(codec.getCloseStatus() == 1002);
+    }
+
+    // RSV1 on a continuation frame, RFC 7692 section 6.1
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(decodeAll(codec, bytes({0x41, 0x03, 0xf2, 0x48, 0xcd}), messages));
+        CHECK(!decodeAll(codec, bytes({0xc0, 0x04, 0xc9, 0xc9, 0x07, 0x00}), messages));
+        CHECK(codec.getCloseStatus() == 1002);
+        CHECK(messages.empty());
+    }
+
+    // RSV1 on a control frame
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(!decodeAll(codec, bytes({0xc9, 0x00}), messages));
+        CHECK(codec.getCloseStatus() == 1002);
+    }
+
+    // RSV2 and RSV3 aren't negotiated
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        vector<Message> messages;
+        CHECK(!decodeAll(codec, bytes({0xa1, 0x00}), messages));
+        CHECK(codec.getCloseStatus() == 1002);
+    }
+
+    // Continuation without a message
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        vector<Message> messages;
+        CHECK(!decodeAll(codec, bytes({0x80, 0x01, 0x41}), messages));
+        CHECK(codec.getCloseStatus() == 1002);
+    }
+
+    // Compressed data that doesn't inflate
+    {
+        SGWebSocketCodec codec(SGWebSocketCodec::Role::kClient);
+        codec.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+        vector<Message> messages;
+        CHECK(!decodeAll(codec, bytes({0xc1, 0x02, 0xff, 0xff}), messages));
+        CHECK(codec.getCloseStatus() == 1007);
+    }
+}
+
+static void testWindowBitsNegotiation() {
+    // zlib can't compress with an 8 bit window: messages are inflated but sent uncompressed
+    SGWebSocketCodec client(SGWebSocketCodec::Role::kClient);
+    CHECK(client.acceptExtension("permessage-deflate; client_max_window_bits=8",
+                                 SGWebSocketCodec::kDefaultCompressionLevel));
+    CHECK(client.isDeflateEnabled());
+    string payload = makePayload(4096, true);
+    string frame;
+    CHECK(client.encode(SGWebSocketCodec::kOpcodeBinary, payload.data(), payload.size(), frame));
+    CHECK(((uint8_t) frame[0] & 0x40) == 0);
+
+    vector<Message> messages;
+    CHECK(decodeAll(client, bytes({0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00}), messages));
+    CHECK(messages.size() == 1 && messages[0].payload == "Hello");
+
+    // A window the server can inflate is used as is
+    SGWebSocketCodec small_window_client(SGWebSocketCodec::Role::kClient);
+    SGWebSocketCodec server(SGWebSocketCodec::Role::kServer);
+    CHECK(small_window_client.acceptExtension("permessage-deflate; client_max_window_bits=9",
+                                              SGWebSocketCodec::kDefaultCompressionLevel));
+    server.enableDeflate(SGWebSocketCodec::kDefaultCompressionLevel);
+    frame.clear();
+    CHECK(small_window_client.encode(SGWebSocketCodec::kOpcodeBinary, payload.data(), payload.size(), frame));
+    CHECK(((uint8_t) frame[0] & 0x40) != 0);
+    messages.clear();
+    CHECK(decodeAll(server, frame, messages));
+    CHECK(messages.size() == 1 && messages[0].payload == payload);
+
+    // Out of range values and a missing extension decline compression
+    SGWebSocketCodec invalid_client(SGWebSocketCodec::Role::kClient);
+    CHECK(!invalid_client.acceptExtension("permessage-deflate; client_max_window_bits=16",
+                                          SGWebSocketCodec::kDefaultCompressionLevel));
+    CHECK(!invalid_client.isDeflateEnabled());
+    SGWebSocketCodec plain_client(SGWebSocketCodec::Role::kClient);
+    CHECK(!plain_client.acceptExtension("", SGWebSocketCodec::kDefaultCompressionLevel));
+    CHECK(!plain_client.acceptExtension("permessage-deflate", SGWebSocketCodec::kCompressionDisabled));
+}
+
+static void testAcceptKey() {
+    // RFC 6455 section 1.3
+    CHECK(SGWebSocketCodec::acceptKey("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+int main(int argc, const char *argv[]) {
+    testRoundTrip(false);
+    testRoundTrip(true);
+    testNoContextTakeover();
+    testRfc7692Examples();
+    testProtocolErrors();
+    testWindowBitsNegotiation();
+    testAcceptKey();
+
+    if (failure_count > 0) {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+    } else {
+        printf("All SGWebSocketCodec tests passed\n");
+    }
+    return failure_count;
+}
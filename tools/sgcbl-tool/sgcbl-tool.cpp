@@ -0,0 +1,376 @@
+//
+//  sgcbl-tool.cpp
+//
+//  Copyright 2014 ON Semiconductor.
+//  All rights reserved. This software and/or documentation is licensed by ON Semiconductor under
+//  limited terms and conditions. The terms and conditions pertaining to the software and/or documentation are available at
+//  http://www.onsemi.com/site/pdf/ONSEMI_T&C.pdf (“ON Semiconductor Standard Terms and Conditions of Sale, Section 8 Software”).
+//  Do not use this software and/or documentation unless you have carefully read and you agree to the limited terms and conditions.
+//  By using this software and/or documentation, you agree to the limited terms and conditions.
+//
+//  Copyright 2019 ON Semiconductor
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Inspects a database file without writing code against SGDatabase, for operations and capacity planning.
+//   stats    prints the document count, file and WAL sizes, indexes, body sizes, revision tree depths, conflicts and
+//            the free space left in the file
+//   export   writes the live documents as NDJSON, one {"_id", "_rev", ...body} object per line
+//   compact  compacts the file offline, stop the applications using the database first
+// stats and export open the database read-only and read it one document at a time, they can run next to the live
+// process on files of any size.
+//
+// usage: sgcbl-tool stats <database directory>
+//        sgcbl-tool export <database directory> [output file]
+//        sgcbl-tool compact <database directory>
+// The database directory is the one SGDatabase opens, i.e db/<db_name>. export writes to stdout without an output file.
+// Exits with 1 on error.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "SGCouchBaseLite.h"
+#include "SGUtility.h"
+
+using namespace std;
+using namespace fleece;
+using namespace Strata;
+
+// Files of the database directory
+static const char *kDatabaseFileName = "db.sqlite3";
+static const char *kWALFileName = "db.sqlite3-wal";
+
+// Documents between two progress lines on stderr
+static const uint64_t kProgressInterval = 100000;
+
+// SQLite file header, see https://www.sqlite.org/fileformat.html
+static const size_t kSQLiteHeaderSize = 100;
+
+struct FileSpace {
+    uint64_t page_size {0};
+    uint64_t page_count {0};
+    uint64_t free_page_count {0};   // Pages left by deleted data, reused before the file grows
+};
+
+struct DocumentStats {
+    uint64_t document_count {0};
+    uint64_t deleted_count {0};
+    uint64_t conflicted_count {0};
+    uint64_t body_bytes {0};
+    uint64_t max_body_bytes {0};
+    string max_body_doc_id;
+    map<unsigned, uint64_t> depth_counts;   // Revisions stored on the current branch -> documents
+};
+
+string joinPath(const string &directory, const char *file_name) {
+    if (!directory.empty() && (directory.back() == '/' || directory.back() == '\\')) {
+        return directory + file_name;
+    }
+    return directory + "/" + file_name;
+}
+
+uint64_t fileSize(const string &path) {
+    ifstream file(path, ios::binary | ios::ate);
+    return file ? (uint64_t) file.tellg() : 0;
+}
+
+uint32_t readBigEndian(const unsigned char *bytes, size_t size) {
+    uint32_t value = 0;
+    for (size_t index = 0; index < size; ++index) {
+        value = (value << 8) | bytes[index];
+    }
+    return value;
+}
+
+// Reads the page counts from the SQLite header, they are as of the last WAL checkpoint
+bool readFileSpace(const string &path, FileSpace &space) {
+    unsigned char header[kSQLiteHeaderSize];
+    ifstream file(path, ios::binary);
+    if (!file.read((char *) header, sizeof(header)) || memcmp(header, "SQLite format 3", 16) != 0) {
+        return false;
+    }
+    space.page_size = readBigEndian(header + 16, 2);
+    if (space.page_size == 1) {
+        space.page_size = 65536;
+    }
+    // The page count is only valid if the file was last written by a SQLite version that maintains it
+    bool page_count_valid = readBigEndian(header + 24, 4) == readBigEndian(header + 92, 4);
+    space.page_count = page_count_valid ? readBigEndian(header + 28, 4) : fileSize(path) / space.page_size;
+    space.free_page_count = readBigEndian(header + 36, 4);
+    return true;
+}
+
+string jsonString(slice value) {
+    string json = "\"";
+    for (size_t index = 0; index < value.size; ++index) {
+        char character = ((const char *) value.buf)[index];
+        switch (character) {
+            case '"':
+                json += "\\\"";
+                break;
+            case '\\':
+                json += "\\\\";
+                break;
+            case '\n':
+                json += "\\n";
+                break;
+            case '\r':
+                json += "\\r";
+                break;
+            case '\t':
+                json += "\\t";
+                break;
+            default:
+                if ((unsigned char) character < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned) character);
+                    json += escaped;
+                } else {
+                    json += character;
+                }
+        }
+    }
+    return json + "\"";
+}
+
+C4Database *openDatabase(const string &directory, bool read_only) {
+    // SGDatabase's configuration, without creating the database
+    C4DatabaseConfig config {};
+    config.flags = read_only ? kC4DB_ReadOnly : 0;
+    config.storageEngine = kC4SQLiteStorageEngine;
+    config.versioning = kC4RevisionTrees;
+    config.encryptionKey.algorithm = kC4EncryptionNone;
+
+    C4Error c4error {};
+    C4Database *c4db = c4db_open(slice(directory), &config, &c4error);
+    if (c4db == nullptr) {
+        fprintf(stderr, "Can't open %s: %s\n", directory.c_str(), C4ErrorToString(c4error).c_str());
+    }
+    return c4db;
+}
+
+void closeDatabase(C4Database *c4db) {
+    C4Error c4error {};
+    if (!c4db_close(c4db, &c4error)) {
+        fprintf(stderr, "Can't close the database: %s\n", C4ErrorToString(c4error).c_str());
+    }
+    c4db_free(c4db);
+}
+
+// Calls on_document for every document, one at a time. Returns false on error.
+template<typename Callback>
+bool forEachDocument(C4Database *c4db, C4EnumeratorFlags flags, Callback on_document) {
+    C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;
+    options.flags = flags;
+    C4Error c4error {};
+    C4DocEnumerator *enumerator = c4db_enumerateAllDocs(c4db, &options, &c4error);
+    if (enumerator == nullptr) {
+        fprintf(stderr, "Can't enumerate the documents: %s\n", C4ErrorToString(c4error).c_str());
+        return false;
+    }
+
+    uint64_t document_count = 0;
+    bool succeeded = true;
+    while (c4enum_next(enumerator, &c4error)) {
+        C4Document *c4doc = c4enum_getDocument(enumerator, &c4error);
+        if (c4doc == nullptr) {
+            break;
+        }
+        succeeded = on_document(c4doc);
+        c4doc_free(c4doc);
+        if (!succeeded) {
+            break;
+        }
+        if (++document_count % kProgressInterval == 0) {
+            fprintf(stderr, "%llu documents\n", (unsigned long long) document_count);
+        }
+    }
+    c4enum_free(enumerator);
+
+    if (c4error.code != 0) {
+        fprintf(stderr, "Enumerating the documents failed: %s\n", C4ErrorToString(c4error).c_str());
+        return false;
+    }
+    return succeeded;
+}
+
+bool printStats(const string &directory) {
+    C4Database *c4db = openDatabase(directory, true);
+    if (c4db == nullptr) {
+        return false;
+    }
+
+    string database_path = joinPath(directory, kDatabaseFileName);
+    printf("Database:           %s\n", directory.c_str());
+    printf("File size:          %llu bytes\n", (unsigned long long) fileSize(database_path));
+    printf("WAL size:           %llu bytes\n", (unsigned long long) fileSize(joinPath(directory, kWALFileName)));
+    FileSpace space;
+    if (readFileSpace(database_path, space) && space.page_count > 0) {
+        printf("Free pages:         %llu of %llu pages of %llu bytes, %.1f%% fragmentation\n",
+               (unsigned long long) space.free_page_count, (unsigned long long) space.page_count,
+               (unsigned long long) space.page_size, 100.0 * space.free_page_count / space.page_count);
+    }
+    printf("Last sequence:      %llu\n", (unsigned long long) c4db_getLastSequence(c4db));
+
+    C4Error c4error {};
+    C4SliceResult indexes = c4db_getIndexes(c4db, &c4error);
+    if (indexes.buf != nullptr) {
+        const impl::Value *index_names = impl::Value::fromData(slice(indexes.buf, indexes.size));
+        printf("Indexes:            %s\n", index_names != nullptr ? index_names->toJSONString().c_str() : "[]");
+        c4slice_free(indexes);
+    } else {
+        fprintf(stderr, "Can't list the indexes: %s\n", C4ErrorToString(c4error).c_str());
+    }
+
+    DocumentStats stats;
+    bool succeeded = forEachDocument(c4db, kC4IncludeNonConflicted | kC4IncludeBodies | kC4IncludeDeleted,
+                                     [&stats](C4Document *c4doc) {
+        if (c4doc->flags & kDocDeleted) {
+            stats.deleted_count++;
+            return true;
+        }
+        stats.document_count++;
+        if (c4doc->flags & kDocConflicted) {
+            stats.conflicted_count++;
+        }
+        uint64_t body_bytes = c4doc->selectedRev.body.size;
+        stats.body_bytes += body_bytes;
+        if (body_bytes > stats.max_body_bytes) {
+            stats.max_body_bytes = body_bytes;
+            stats.max_body_doc_id = slice(c4doc->docID).asString();
+        }
+        unsigned depth = 1;
+        while (c4doc_selectParentRevision(c4doc)) {
+            depth++;
+        }
+        stats.depth_counts[depth]++;
+        return true;
+    });
+    closeDatabase(c4db);
+    if (!succeeded) {
+        return false;
+    }
+
+    printf("Documents:          %llu, %llu deleted, %llu conflicted\n", (unsigned long long) stats.document_count,
+           (unsigned long long) stats.deleted_count, (unsigned long long) stats.conflicted_count);
+    printf("Body size:          %.1f bytes average, %llu bytes max (%s)\n",
+           stats.document_count > 0 ? (double) stats.body_bytes / stats.document_count : 0.0,
+           (unsigned long long) stats.max_body_bytes, stats.max_body_doc_id.c_str());
+    printf("Revision depth:     documents\n");
+    for (const pair<const unsigned, uint64_t> &depth_count : stats.depth_counts) {
+        printf("  %-17u %llu\n", depth_count.first, (unsigned long long) depth_count.second);
+    }
+    return true;
+}
+
+bool exportDocuments(const string &directory, const char *output_path) {
+    ofstream output_file;
+    if (output_path != nullptr) {
+        output_file.open(output_path, ios::binary | ios::trunc);
+        if (!output_file) {
+            fprintf(stderr, "Can't write %s\n", output_path);
+            return false;
+        }
+    }
+    ostream &output = output_path != nullptr ? output_file : cout;
+
+    C4Database *c4db = openDatabase(directory, true);
+    if (c4db == nullptr) {
+        return false;
+    }
+
+    uint64_t document_count = 0;
+    bool succeeded = forEachDocument(c4db, kC4IncludeNonConflicted | kC4IncludeBodies,
+                                     [&output, &document_count](C4Document *c4doc) {
+        C4Error c4error {};
+        C4SliceResult body = c4doc_bodyAsJSON(c4doc, false, &c4error);
+        if (body.buf == nullptr) {
+            fprintf(stderr, "Can't convert %.*s to JSON: %s\n", (int) c4doc->docID.size, (const char *) c4doc->docID.buf,
+                    C4ErrorToString(c4error).c_str());
+            return false;
+        }
+        output << "{\"_id\":" << jsonString(c4doc->docID) << ",\"_rev\":" << jsonString(c4doc->revID);
+        // Appends the body's properties, past its opening brace
+        if (body.size > 2) {
+            output << ",";
+            output.write((const char *) body.buf + 1, body.size - 1);
+        } else {
+            output << "}";
+        }
+        output << "\n";
+        c4slice_free(body);
+        document_count++;
+        return (bool) output;
+    });
+    closeDatabase(c4db);
+
+    output.flush();
+    if (!output) {
+        fprintf(stderr, "Writing the documents failed\n");
+        return false;
+    }
+    fprintf(stderr, "Exported %llu documents\n", (unsigned long long) document_count);
+    return succeeded;
+}
+
+bool compactDatabase(const string &directory) {
+    uint64_t size_before = fileSize(joinPath(directory, kDatabaseFileName)) + fileSize(joinPath(directory, kWALFileName));
+
+    C4Database *c4db = openDatabase(directory, false);
+    if (c4db == nullptr) {
+        return false;
+    }
+    C4Error c4error {};
+    bool compacted = c4db_compact(c4db, &c4error);
+    if (!compacted) {
+        fprintf(stderr, "Compaction failed: %s\n", C4ErrorToString(c4error).c_str());
+    }
+    closeDatabase(c4db);
+    if (!compacted) {
+        return false;
+    }
+
+    uint64_t size_after = fileSize(joinPath(directory, kDatabaseFileName)) + fileSize(joinPath(directory, kWALFileName));
+    printf("Compacted %s: %llu -> %llu bytes\n", directory.c_str(), (unsigned long long) size_before,
+           (unsigned long long) size_after);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    string command = argc > 1 ? argv[1] : "";
+    if (argc < 3 || (command != "stats" && command != "export" && command != "compact")) {
+        fprintf(stderr, "usage: sgcbl-tool stats <database directory>\n"
+                        "       sgcbl-tool export <database directory> [output file]\n"
+                        "       sgcbl-tool compact <database directory>\n");
+        return 1;
+    }
+
+    // Only problems, stdout may be the export
+    setLogLevel(kC4LogWarning);
+
+    string directory = argv[2];
+    bool succeeded;
+    if (command == "stats") {
+        succeeded = printStats(directory);
+    } else if (command == "export") {
+        succeeded = exportDocuments(directory, argc > 3 ? argv[3] : nullptr);
+    } else {
+        succeeded = compactDatabase(directory);
+    }
+    return succeeded ? 0 : 1;
+}